@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "boards.hpp"
+#include "movegen.hpp"
+#include "perft.hpp"
+
+// Compare sliding attack backends. The backend is chosen when the engine is
+// built, so run this from a build with PEXT on and one with it off.
+
+// The number of random lookups in each pass.
+#define LOOKUPS (1 << 16)
+// The number of passes over the lookups.
+#define PASSES 200
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ns(Clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+    .count();
+}
+
+int main() {
+  movegen_initialize_attack_boards();
+  std::cout << "Attack backend: " << movegen_attack_backend() << std::endl;
+
+  // Occupancies with about a quarter of the squares filled, like a middle
+  // game position.
+  std::vector<int> squares(LOOKUPS);
+  std::vector<uint64_t> occupancies(LOOKUPS);
+  uint64_t state = 0x9e3779b97f4a7c15ull;
+  auto next = [&state]() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  };
+  for (unsigned i = 0; i < LOOKUPS; i++) {
+    squares[i] = next() % 64;
+    occupancies[i] = next() & next();
+  }
+
+  // Independent lookups measure throughput.
+  uint64_t checksum = 0;
+  auto start = Clock::now();
+  for (unsigned p = 0; p < PASSES; p++) {
+    for (unsigned i = 0; i < LOOKUPS; i++) {
+      checksum ^= rook_attacks(squares[i], occupancies[i]);
+      checksum ^= bishop_attacks(squares[i], occupancies[i]);
+    }
+  }
+  double ns = elapsed_ns(start) / (2.0 * PASSES * LOOKUPS);
+  std::cout << "Independent lookups: " << ns << " ns each" << std::endl;
+
+  // Making each lookup depend on the last measures latency.
+  uint64_t chain = 0;
+  start = Clock::now();
+  for (unsigned p = 0; p < PASSES; p++) {
+    for (unsigned i = 0; i < LOOKUPS; i++) {
+      chain = rook_attacks(squares[i], occupancies[i] ^ chain);
+      chain = bishop_attacks(squares[i], occupancies[i] ^ chain);
+    }
+  }
+  ns = elapsed_ns(start) / (2.0 * PASSES * LOOKUPS);
+  std::cout << "Dependent lookups: " << ns << " ns each" << std::endl;
+
+  // Move generation is where the lookups matter in practice.
+  GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+  start = Clock::now();
+  uint64_t nodes = perft(gs, 4);
+  double ms = elapsed_ns(start) / 1e6;
+  std::cout << "Perft 4 of Kiwipete: " << nodes << " nodes in " << ms <<
+    " ms (" << (uint64_t) (nodes / ms * 1000) << " nodes/second)" <<
+    std::endl;
+
+  // Print the checksums so the work can't be optimized away.
+  std::cout << "Checksum: " << (checksum ^ chain) << std::endl;
+}
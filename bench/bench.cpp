@@ -0,0 +1,129 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "boards.hpp"
+#include "evaluation.hpp"
+#include "movegen.hpp"
+
+// Time the engine's hot paths over the bench positions. The results are only
+// meaningful from an optimized build, for example with
+// -DCMAKE_BUILD_TYPE=Release.
+//
+// Usage: bench [filter] [depth]. Only benchmarks whose name contains the
+// filter are run, and the searches go to the given depth.
+
+// Each benchmark repeats its passes until at least this many ms have passed.
+#define MIN_TIME 250
+// The depth of the benchmark searches when none is given.
+#define SEARCH_DEPTH 6
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ns(Clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+    .count();
+}
+
+// Anything the benchmarks compute is folded into this and printed at the end
+// so that the work can't be optimized away.
+static uint64_t checksum = 0;
+
+// Run a pass repeatedly and print the time per operation. The pass returns
+// the number of operations it performed.
+static void measure(const std::string& name, const std::string& filter,
+    const std::function<uint64_t()>& pass) {
+  if (name.find(filter) == std::string::npos) {
+    return;
+  }
+  // One untimed pass warms up the caches and branch predictors.
+  pass();
+  uint64_t ops = 0;
+  auto start = Clock::now();
+  do {
+    ops += pass();
+  } while (elapsed_ns(start) < MIN_TIME * 1e6);
+  double ns = elapsed_ns(start) / ops;
+  std::cout << name << ": " << ns << " ns/op (" <<
+    (uint64_t) (1e9 / ns) << " ops/second)" << std::endl;
+}
+
+static void measure_search(const std::string& name, const std::string& filter,
+    const Evaluator& eval, unsigned depth, bool pvs) {
+  if (name.find(filter) == std::string::npos) {
+    return;
+  }
+  BenchResult result = run_bench(eval, SearchParams(), depth, pvs);
+  std::cout << name << " depth " << depth << ": " << result.nodes <<
+    " nodes in " << result.time << " ms (" << result.nps() <<
+    " nodes/second)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  movegen_initialize_attack_boards();
+  std::string filter = argc > 1 ? argv[1] : "";
+  unsigned depth = argc > 2 ? std::stoi(argv[2]) : SEARCH_DEPTH;
+
+  std::vector<GameState> states;
+  std::vector<MoveList> moves;
+  for (const std::string& fen : bench_positions()) {
+    states.emplace_back(fen);
+    moves.emplace_back();
+    generate_moves(states.back(), moves.back());
+  }
+
+  measure("generate_moves", filter, [&]() {
+      MoveList ml;
+      for (GameState& gs : states) {
+        ml.clear();
+        generate_moves(gs, ml);
+        checksum += ml.size();
+      }
+      return states.size();
+    });
+
+  // A move and its undo count as one operation.
+  measure("make_move/undo_move", filter, [&]() {
+      uint64_t ops = 0;
+      for (unsigned i = 0; i < states.size(); i++) {
+        for (const Move& m : moves[i]) {
+          states[i].make_move(m);
+          checksum += states[i].hash();
+          states[i].undo_move();
+        }
+        ops += moves[i].size();
+      }
+      return ops;
+    });
+
+  measure("Position::get_piece", filter, [&]() {
+      for (const GameState& gs : states) {
+        for (int sq = 0; sq < 64; sq++) {
+          checksum += gs.pos().get_piece(sq);
+        }
+      }
+      return 64 * states.size();
+    });
+
+  BasicEvaluator basic;
+  measure("BasicEvaluator::evaluate_position", filter, [&]() {
+      double total = 0;
+      for (GameState& gs : states) {
+        total += basic.evaluate_position(gs);
+      }
+      checksum += (uint64_t) total;
+      return states.size();
+    });
+
+  measure_search("BasicAlphaBetaSearcher::search", filter, basic, depth,
+      false);
+  measure_search("PVSSearcher::search", filter, IncrementalEvaluator(), depth,
+      true);
+
+  std::cout << "Checksum: " << checksum << std::endl;
+}
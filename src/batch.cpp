@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "batch.hpp"
+#include "movegen.hpp"
+
+// Split a line into whitespace-separated words. Quoted strings are kept as a
+// single word without the quotes, and a semicolon outside quotes is a word of
+// its own, which is how EPD operations are separated.
+static std::vector<std::string> epd_words(const std::string& line) {
+  std::vector<std::string> words;
+  std::string cur;
+  bool quoted = false;
+  bool started = false;
+  auto finish = [&]() {
+    if (started) {
+      words.push_back(cur);
+    }
+    cur = "";
+    started = false;
+  };
+  for (char c : line) {
+    if (quoted) {
+      if (c == '"') {
+        quoted = false;
+      } else {
+        cur.push_back(c);
+      }
+    } else if (c == '"') {
+      quoted = true;
+      started = true;
+    } else if (c == ';') {
+      finish();
+      words.push_back(";");
+    } else if (isspace(static_cast<unsigned char>(c))) {
+      finish();
+    } else {
+      cur.push_back(c);
+      started = true;
+    }
+  }
+  if (quoted) {
+    throw std::runtime_error("Unterminated string in EPD line");
+  }
+  finish();
+  return words;
+}
+
+static bool is_number(const std::string& s) {
+  return !s.empty() && s.size() < 10 && std::all_of(s.begin(), s.end(),
+      [](char c) { return isdigit(static_cast<unsigned char>(c)); });
+}
+
+// The FEN parser trusts its input, so we check the first four fields here
+// rather than let a malformed line crash a worker.
+static void check_fields(const std::vector<std::string>& words) {
+  int rank = 0;
+  int file = 0;
+  int white_kings = 0;
+  int black_kings = 0;
+  for (char c : words[0]) {
+    if (c == '/') {
+      if (file != 8) {
+        throw std::runtime_error("Wrong number of files in FEN rank");
+      }
+      rank++;
+      file = 0;
+    } else if ('1' <= c && c <= '8') {
+      file += c - '0';
+    } else if (std::string("PNBRQKpnbrqk").find(c) != std::string::npos) {
+      white_kings += c == 'K';
+      black_kings += c == 'k';
+      file++;
+    } else {
+      throw std::runtime_error("Unexpected character in FEN board");
+    }
+    if (file > 8) {
+      throw std::runtime_error("Wrong number of files in FEN rank");
+    }
+  }
+  if (rank != 7 || file != 8) {
+    throw std::runtime_error("Wrong number of ranks in FEN board");
+  }
+  if (white_kings != 1 || black_kings != 1) {
+    throw std::runtime_error("Each side needs exactly one king");
+  }
+  if (words[1] != "w" && words[1] != "b") {
+    throw std::runtime_error("Unexpected side to move in FEN");
+  }
+  if (words[2] != "-" && (words[2].empty() || words[2].size() > 4 ||
+        words[2].find_first_not_of("KQkq") != std::string::npos)) {
+    throw std::runtime_error("Unexpected castling rights in FEN");
+  }
+  const std::string& ep = words[3];
+  if (ep != "-" && (ep.size() != 2 || ep[0] < 'a' || ep[0] > 'h' ||
+        (ep[1] != '3' && ep[1] != '6'))) {
+    throw std::runtime_error("Unexpected en passant square in FEN");
+  }
+}
+
+std::optional<BatchPosition> parse_batch_line(const std::string& line,
+    uint64_t index) {
+  size_t start = line.find_first_not_of(" \t\r\n");
+  if (start == std::string::npos || line[start] == '#') {
+    return std::nullopt;
+  }
+  std::vector<std::string> words = epd_words(line);
+  if (words.size() < 4) {
+    throw std::runtime_error("Expected at least four fields in EPD line");
+  }
+  check_fields(words);
+  BatchPosition bp;
+  bp.index = index;
+  std::string half_moves = "0";
+  std::string move_number = "1";
+  unsigned ops = 4;
+  if (words.size() >= 6 && is_number(words[4]) && is_number(words[5])) {
+    half_moves = words[4];
+    move_number = words[5];
+    ops = 6;
+  }
+  // Anything left is EPD operations, each an opcode followed by operands and
+  // a semicolon.
+  for (unsigned i = ops; i < words.size();) {
+    const std::string& opcode = words[i];
+    std::vector<std::string> operands;
+    for (i++; i < words.size() && words[i] != ";"; i++) {
+      operands.push_back(words[i]);
+    }
+    i++;
+    if (operands.empty()) {
+      continue;
+    }
+    if (opcode == "id") {
+      bp.id = operands[0];
+    } else if (opcode == "hmvc" && is_number(operands[0])) {
+      half_moves = operands[0];
+    } else if (opcode == "fmvn" && is_number(operands[0])) {
+      move_number = operands[0];
+    }
+  }
+  bp.fen = words[0] + " " + words[1] + " " + words[2] + " " + words[3] + " " +
+    half_moves + " " + move_number;
+  // The search assumes the side which just moved isn't left in check and
+  // that pawns can always move, so positions breaking the rules are rejected
+  // here too.
+  GameState gs(bp.fen);
+  if (in_check(!gs.whites_move(), gs.pos())) {
+    throw std::runtime_error("The side not to move is in check");
+  }
+  uint64_t back_ranks = 0xff000000000000ffULL;
+  if ((gs.pos().get_board(Position::W_PAWN) |
+        gs.pos().get_board(Position::B_PAWN)) & back_ranks) {
+    throw std::runtime_error("Pawns can't be on the first or last rank");
+  }
+  return bp;
+}
+
+static std::string json_string(const std::string& s) {
+  std::ostringstream out;
+  out << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      static const char* hex = "0123456789abcdef";
+      out << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+  return out.str();
+}
+
+static std::string csv_field(const std::string& s) {
+  if (s.find_first_of(",\"\r\n") == std::string::npos) {
+    return s;
+  }
+  std::string ret = "\"";
+  for (char c : s) {
+    if (c == '"') {
+      ret += "\"\"";
+    } else {
+      ret.push_back(c);
+    }
+  }
+  return ret + "\"";
+}
+
+static std::string move_string(const Move& m) {
+  // UCI writes a null move as "0000".
+  if (m.is_null()) {
+    return "0000";
+  }
+  std::ostringstream out;
+  out << m;
+  return out.str();
+}
+
+std::string batch_csv_header() {
+  return "index,id,fen,bestmove,score,depth,nodes,time,pv,error";
+}
+
+std::string format_batch_result(const BatchResult& r,
+    BatchOptions::Format format) {
+  std::string pv;
+  for (const Move& m : r.pv) {
+    if (!pv.empty()) {
+      pv += " ";
+    }
+    pv += move_string(m);
+  }
+  // Scores are written in centipawns, as in UCI info lines. A search which
+  // was stopped before it scored any move leaves the lowest double, which
+  // doesn't fit in an int, so the score is kept within a mate.
+  int cp = static_cast<int>(std::clamp(r.score, -BATCH_MATE_SCORE,
+        BATCH_MATE_SCORE) * 100);
+  std::ostringstream out;
+  if (format == BatchOptions::Format::CSV) {
+    out << r.index << "," << csv_field(r.id) << "," << csv_field(r.fen) << ",";
+    if (r.error.empty()) {
+      out << move_string(r.best) << "," << cp << "," << r.depth << "," <<
+        r.nodes << "," << r.time << "," << pv << ",";
+    } else {
+      out << ",,,,,," << csv_field(r.error);
+    }
+    return out.str();
+  }
+  out << "{\"index\":" << r.index;
+  if (!r.id.empty()) {
+    out << ",\"id\":" << json_string(r.id);
+  }
+  out << ",\"fen\":" << json_string(r.fen);
+  if (r.error.empty()) {
+    out << ",\"bestmove\":\"" << move_string(r.best) << "\",\"score\":" << cp <<
+      ",\"depth\":" << r.depth << ",\"nodes\":" << r.nodes << ",\"time\":" <<
+      r.time << ",\"pv\":\"" << pv << "\"";
+  } else {
+    out << ",\"error\":" << json_string(r.error);
+  }
+  out << "}";
+  return out.str();
+}
+
+namespace {
+
+/**
+ * \brief The state shared by the reader and the workers of a batch.
+ */
+struct BatchQueue {
+  std::mutex lock;
+  /** Notified when a position is added or the input ends. */
+  std::condition_variable not_empty;
+  /** Notified when a position is taken. */
+  std::condition_variable not_full;
+  std::deque<BatchPosition> positions;
+  /** Set once the whole input has been read. */
+  bool finished = false;
+  /** Held while writing a result, so that lines are not interleaved. */
+  std::mutex out_lock;
+};
+
+}
+
+// Write one result and flush it, so that a consumer reading the output as a
+// stream sees each result as soon as it is found.
+static void write_result(BatchQueue& queue, std::ostream& out,
+    const BatchResult& result, BatchOptions::Format format) {
+  std::string line = format_batch_result(result, format);
+  std::lock_guard<std::mutex> guard(queue.out_lock);
+  out << line << std::endl;
+}
+
+static void batch_worker(BatchQueue& queue, std::ostream& out,
+    const Evaluator& eval, const BatchOptions& options) {
+  std::shared_ptr<TranspositionTable> tt =
+    std::make_shared<TranspositionTable>(options.hash);
+  std::atomic<bool> stop_signal{false};
+  while (true) {
+    BatchPosition bp;
+    {
+      std::unique_lock<std::mutex> guard(queue.lock);
+      queue.not_empty.wait(guard, [&queue]() {
+          return !queue.positions.empty() || queue.finished;
+        });
+      if (queue.positions.empty()) {
+        return;
+      }
+      bp = std::move(queue.positions.front());
+      queue.positions.pop_front();
+    }
+    queue.not_full.notify_one();
+
+    // A fresh searcher and an empty table make the result independent of
+    // whatever this worker searched before.
+    tt->clear();
+    PVSSearcher searcher(eval.clone(), tt);
+    searcher.set_params(options.params);
+    GameState gs(bp.fen);
+    BatchResult result{};
+    result.index = bp.index;
+    result.id = bp.id;
+    result.fen = bp.fen;
+    MoveList ml;
+    generate_moves(gs, ml);
+    if (ml.empty()) {
+      // There is nothing to search, and the game is already over.
+      result.score = in_check(gs.whites_move(), gs.pos()) ?
+        -BATCH_MATE_SCORE : 0.0;
+      write_result(queue, out, result, options.format);
+      continue;
+    }
+    SearchInfo info;
+    auto start = std::chrono::steady_clock::now();
+    auto [score, best] = searcher.search(gs, options.limits, info,
+        stop_signal);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    result.best = best;
+    // The searcher scores from white's point of view.
+    result.score = gs.whites_move() ? score : -score;
+    result.depth = info.depth;
+    result.nodes = info.nodes;
+    result.time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        elapsed).count();
+    {
+      std::lock_guard<std::mutex> guard(info.pv_lock);
+      result.pv = info.pv;
+    }
+    write_result(queue, out, result, options.format);
+  }
+}
+
+uint64_t run_batch(std::istream& in, std::ostream& out, const Evaluator& eval,
+    const BatchOptions& options) {
+  if (options.format == BatchOptions::Format::CSV) {
+    out << batch_csv_header() << std::endl;
+  }
+  unsigned threads = std::max(1u, options.threads);
+  size_t capacity = BATCH_QUEUE_PER_WORKER * threads;
+  BatchQueue queue;
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < threads; i++) {
+    workers.emplace_back(batch_worker, std::ref(queue), std::ref(out),
+        std::cref(eval), std::cref(options));
+  }
+
+  uint64_t count = 0;
+  uint64_t index = 0;
+  for (std::string line; std::getline(in, line); index++) {
+    std::optional<BatchPosition> bp;
+    try {
+      bp = parse_batch_line(line, index);
+    } catch (const std::exception& e) {
+      BatchResult result{};
+      result.index = index;
+      result.fen = line;
+      result.error = e.what();
+      write_result(queue, out, result, options.format);
+      continue;
+    }
+    if (!bp) {
+      continue;
+    }
+    {
+      std::unique_lock<std::mutex> guard(queue.lock);
+      queue.not_full.wait(guard, [&]() {
+          return queue.positions.size() < capacity;
+        });
+      queue.positions.push_back(std::move(*bp));
+    }
+    queue.not_empty.notify_one();
+    count++;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    queue.finished = true;
+  }
+  queue.not_empty.notify_all();
+  for (std::thread& t : workers) {
+    t.join();
+  }
+  return count;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+
+#include "boards.hpp"
+#include "evaluation.hpp"
+#include "search.hpp"
+#include "transposition.hpp"
+
+// The number of positions waiting to be searched per batch worker. The reader
+// stops reading the input while the queue is full.
+#define BATCH_QUEUE_PER_WORKER 4
+
+// The score in pawns of a side which is checkmated, as the search scores it.
+#define BATCH_MATE_SCORE 1000.0
+
+/**
+ * \brief A position read from an EPD or FEN file.
+ */
+struct BatchPosition {
+  /** The number of the line the position was read from, starting at 0. */
+  uint64_t index;
+  /** The position as a full FEN string. */
+  std::string fen;
+  /** The EPD "id" operation, or empty if there is none. */
+  std::string id;
+};
+
+/**
+ * \brief The result of analyzing one position of a batch.
+ */
+struct BatchResult {
+  uint64_t index;
+  std::string id;
+  std::string fen;
+  /** The best move found, or a null move if there are no legal moves. */
+  Move best;
+  /** The score of the position in pawns for the side to move, which is
+   * -BATCH_MATE_SCORE if it is checkmated and 0 if it is stalemated. */
+  double score;
+  /** The depth of the last completed iteration. */
+  unsigned depth;
+  uint64_t nodes;
+  /** The time spent searching in milliseconds. */
+  unsigned time;
+  MoveList pv;
+  /** Why the position couldn't be analyzed, or empty if it was. */
+  std::string error;
+};
+
+/**
+ * \brief Options for analyzing a batch of positions.
+ */
+struct BatchOptions {
+  enum class Format { JSON, CSV };
+
+  /** The limits of each search, normally a depth or a node count. */
+  SearchLimits limits;
+  /** The number of worker threads, each searching one position at a time. */
+  unsigned threads = 1;
+  /** The size of each worker's transposition table in megabytes. */
+  size_t hash = DEFAULT_HASH_SIZE;
+  /** The parameters of the selective search. */
+  SearchParams params;
+  /** The output format. */
+  Format format = Format::JSON;
+};
+
+/**
+ * \brief Parse one line of an EPD or FEN file.
+ *
+ * A FEN line has six fields. An EPD line has only the first four, followed
+ * by operations such as `bm e4; id "test 1";`, and is given a halfmove clock
+ * of 0 and move number 1 unless it has `hmvc` and `fmvn` operations.
+ *
+ * \param line The line to parse.
+ * \param index The number of the line.
+ * \return The position, or nothing if the line is blank or a comment
+ * starting with `#`. A std::runtime_error is thrown if the line is neither
+ * FEN nor EPD, or if the position is illegal: the side not to move is in
+ * check or a pawn is on the first or last rank.
+ */
+std::optional<BatchPosition> parse_batch_line(const std::string& line,
+    uint64_t index);
+
+/**
+ * \brief Get the CSV header line, without a line break.
+ */
+std::string batch_csv_header();
+
+/**
+ * \brief Format a result as a JSON object or a CSV row, without a line break.
+ */
+std::string format_batch_result(const BatchResult& result,
+    BatchOptions::Format format);
+
+/**
+ * \brief Analyze every position in a stream.
+ *
+ * The input is read one line at a time as the workers need more positions,
+ * so it may be arbitrarily large. Each worker has its own searcher,
+ * evaluator and transposition table, and writes each result to the output as
+ * soon as it has been found, so results appear in the order they finish
+ * rather than the order of the input. The `index` of a result is the number
+ * of the line it came from.
+ *
+ * Before each position the worker's transposition table is cleared and its
+ * searcher replaced, so every result depends only on its position and not on
+ * the positions searched before it or on the number of threads.
+ *
+ * Lines which can't be parsed or hold illegal positions give a result with an
+ * error rather than ending the batch.
+ *
+ * \param in The EPD or FEN input.
+ * \param out Where to write the results, in the format given by `options`.
+ * \param eval The evaluator. Each worker uses its own clone of it.
+ * \param options How to search the positions.
+ * \return The number of positions analyzed.
+ */
+uint64_t run_batch(std::istream& in, std::ostream& out, const Evaluator& eval,
+    const BatchOptions& options);
@@ -0,0 +1,57 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+#include "bench.hpp"
+#include "transposition.hpp"
+
+const std::vector<std::string>& bench_positions() {
+  static const std::vector<std::string> positions = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+    "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+    "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+    "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+  };
+  return positions;
+}
+
+BenchResult run_bench(const Evaluator& eval, const SearchParams& params,
+    unsigned depth, bool pvs) {
+  std::shared_ptr<TranspositionTable> tt =
+    std::make_shared<TranspositionTable>(DEFAULT_HASH_SIZE);
+  std::unique_ptr<BasicAlphaBetaSearcher> searcher;
+  if (pvs) {
+    searcher = std::make_unique<PVSSearcher>(eval.clone(), tt);
+  } else {
+    searcher = std::make_unique<BasicAlphaBetaSearcher>(eval.clone(), tt);
+  }
+  searcher->set_params(params);
+  SearchLimits limits;
+  limits.depth_limit = depth;
+  std::atomic<bool> stop_signal{false};
+  BenchResult result{0, 0};
+  auto start = std::chrono::steady_clock::now();
+  for (const std::string& fen : bench_positions()) {
+    // Each position starts a new game with an empty table of a fixed size,
+    // so the node count doesn't depend on the Hash option or on the other
+    // positions.
+    searcher->new_game();
+    GameState gs(fen);
+    SearchInfo info;
+    searcher->search(gs, limits, info, stop_signal);
+    result.nodes += info.nodes;
+  }
+  result.time = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  return result;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "evaluation.hpp"
+#include "search.hpp"
+
+// The depth searched by the bench command when none is given.
+#define BENCH_DEPTH 9
+
+/**
+ * \brief Get the positions used for benchmarking.
+ *
+ * These are a mix of openings, middle games and endings, including the
+ * usual perft test positions, as FEN strings.
+ */
+const std::vector<std::string>& bench_positions();
+
+/**
+ * \brief The totals of a benchmark search.
+ */
+struct BenchResult {
+  /** The number of nodes searched over all positions. */
+  uint64_t nodes;
+  /** The time taken in milliseconds. */
+  uint64_t time;
+
+  /**
+   * \brief Get the number of nodes searched per second.
+   */
+  inline uint64_t nps() const {
+    return nodes * 1000 / std::max<uint64_t>(time, 1);
+  }
+};
+
+/**
+ * \brief Search every bench position to a fixed depth.
+ *
+ * The search is single-threaded and starts from a new searcher and an empty
+ * transposition table, so the node count depends only on the search and
+ * evaluation code and the parameters. Any change to the node count means the
+ * search itself changed, while the time measures the speed of the machine
+ * and the build.
+ *
+ * \param eval The evaluator, which is cloned for the search.
+ * \param params The parameters of the selective search.
+ * \param depth The depth to search each position to.
+ * \param pvs If true use a PVSSearcher, otherwise a BasicAlphaBetaSearcher.
+ */
+BenchResult run_bench(const Evaluator& eval, const SearchParams& params,
+    unsigned depth, bool pvs = true);
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+
+// Pick the fastest way to count and find bits that the compiler offers. C++20
+// has portable versions in <bit>. Otherwise GCC and Clang have builtins which
+// become single instructions when the target has them (for example with the
+// Native CMake option), and MSVC has intrinsics. Anything else gets portable
+// code which is still branch free.
+#if __cplusplus >= 202002L && __has_include(<bit>)
+#include <bit>
+#define BITS_STD
+#elif defined(__GNUC__) || defined(__clang__)
+#define BITS_BUILTIN
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#define BITS_MSVC
+#endif
+
+/**
+ * \brief Count the number of 1 bits in a number without special instructions.
+ */
+inline int portable_popcount(uint64_t x) {
+  // Add up bits within fields of two, then four, then eight bits, and let the
+  // multiply sum the bytes into the top byte.
+  x = x - ((x >> 1) & 0x5555555555555555ull);
+  x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+  return (int) ((x * 0x0101010101010101ull) >> 56);
+}
+
+/**
+ * \brief Get the index of the least significant 1 bit in a nonzero number
+ * without special instructions.
+ */
+inline int portable_lsb(uint64_t x) {
+  // Isolating the lowest bit and multiplying by a De Bruijn sequence puts a
+  // unique pattern in the top six bits for each bit position.
+  static const int positions[64] = {
+     0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+    62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+    63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+    46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6
+  };
+  return positions[((x & (0 - x)) * 0x03f79d71b4cb0a89ull) >> 58];
+}
+
+/**
+ * \brief Count the number of 1 bits in a number.
+ */
+inline int popcount(uint64_t x) {
+#if defined(BITS_STD)
+  return std::popcount(x);
+#elif defined(BITS_BUILTIN)
+  return __builtin_popcountll(x);
+#elif defined(BITS_MSVC) && defined(__AVX__)
+  // The popcnt instruction is only guaranteed where AVX is available.
+  return (int) __popcnt64(x);
+#else
+  return portable_popcount(x);
+#endif
+}
+
+/**
+ * \brief Get the index of the least significant 1 bit in a nonzero number.
+ */
+inline int lsb(uint64_t x) {
+#if defined(BITS_STD)
+  return std::countr_zero(x);
+#elif defined(BITS_BUILTIN)
+  return __builtin_ctzll(x);
+#elif defined(BITS_MSVC)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return (int) index;
+#else
+  return portable_lsb(x);
+#endif
+}
+
+/**
+ * \brief Remove the least significant 1 bit from a nonzero number and return
+ * its index.
+ */
+inline int pop_lsb(uint64_t& x) {
+  int index = lsb(x);
+  x &= x - 1;
+  return index;
+}
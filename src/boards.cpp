@@ -1,15 +1,145 @@
+#include <algorithm>
 #include <string>
+#include <type_traits>
 
 #include "boards.hpp"
 #include "utils.hpp"
 
-Position::Position() {
+// Generate the next value of a splitmix64 sequence. This is a small, fast
+// generator which is good enough for Zobrist keys and can run at compile time.
+constexpr uint64_t splitmix64(uint64_t& state) {
+  state += 0x9e3779b97f4a7c15ull;
+  uint64_t z = state;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+constexpr ZobristKeys generate_zobrist_keys() {
+  ZobristKeys keys{};
+  uint64_t state = 0x5eed5eed5eed5eedull;
+  for (int i = 0; i < NUM_BOARDS; i++) {
+    bool combined = i == Position::W_ALL || i == Position::B_ALL ||
+      i == Position::BOTH_ALL;
+    for (int j = 0; j < 64; j++) {
+      keys.pieces[i][j] = combined ? 0 : splitmix64(state);
+    }
+  }
+  keys.white_to_move = splitmix64(state);
+  for (int i = 0; i < 4; i++) {
+    keys.castling[i] = splitmix64(state);
+  }
+  for (int i = 0; i < 8; i++) {
+    keys.en_passant[i] = splitmix64(state);
+  }
+  return keys;
+}
+
+constexpr ZobristKeys zobrist_keys = generate_zobrist_keys();
+
+// Piece-square bonuses in centipawns for white pieces. The tables are laid
+// out as the board is usually drawn, with a8 first and h1 last.
+constexpr int16_t pawn_squares[64] = {
+   0,  0,  0,  0,  0,  0,  0,  0,
+  50, 50, 50, 50, 50, 50, 50, 50,
+  10, 10, 20, 30, 30, 20, 10, 10,
+   5,  5, 10, 25, 25, 10,  5,  5,
+   0,  0,  0, 20, 20,  0,  0,  0,
+   5, -5,-10,  0,  0,-10, -5,  5,
+   5, 10, 10,-20,-20, 10, 10,  5,
+   0,  0,  0,  0,  0,  0,  0,  0
+};
+
+constexpr int16_t knight_squares[64] = {
+  -50,-40,-30,-30,-30,-30,-40,-50,
+  -40,-20,  0,  0,  0,  0,-20,-40,
+  -30,  0, 10, 15, 15, 10,  0,-30,
+  -30,  5, 15, 20, 20, 15,  5,-30,
+  -30,  0, 15, 20, 20, 15,  0,-30,
+  -30,  5, 10, 15, 15, 10,  5,-30,
+  -40,-20,  0,  5,  5,  0,-20,-40,
+  -50,-40,-30,-30,-30,-30,-40,-50
+};
+
+constexpr int16_t bishop_squares[64] = {
+  -20,-10,-10,-10,-10,-10,-10,-20,
+  -10,  0,  0,  0,  0,  0,  0,-10,
+  -10,  0,  5, 10, 10,  5,  0,-10,
+  -10,  5,  5, 10, 10,  5,  5,-10,
+  -10,  0, 10, 10, 10, 10,  0,-10,
+  -10, 10, 10, 10, 10, 10, 10,-10,
+  -10,  5,  0,  0,  0,  0,  5,-10,
+  -20,-10,-10,-10,-10,-10,-10,-20
+};
+
+constexpr int16_t rook_squares[64] = {
+   0,  0,  0,  0,  0,  0,  0,  0,
+   5, 10, 10, 10, 10, 10, 10,  5,
+  -5,  0,  0,  0,  0,  0,  0, -5,
+  -5,  0,  0,  0,  0,  0,  0, -5,
+  -5,  0,  0,  0,  0,  0,  0, -5,
+  -5,  0,  0,  0,  0,  0,  0, -5,
+  -5,  0,  0,  0,  0,  0,  0, -5,
+   0,  0,  0,  5,  5,  0,  0,  0
+};
+
+constexpr int16_t queen_squares[64] = {
+  -20,-10,-10, -5, -5,-10,-10,-20,
+  -10,  0,  0,  0,  0,  0,  0,-10,
+  -10,  0,  5,  5,  5,  5,  0,-10,
+   -5,  0,  5,  5,  5,  5,  0, -5,
+    0,  0,  5,  5,  5,  5,  0, -5,
+  -10,  5,  5,  5,  5,  5,  0,-10,
+  -10,  0,  5,  0,  0,  0,  0,-10,
+  -20,-10,-10, -5, -5,-10,-10,-20
+};
+
+constexpr int16_t king_squares[64] = {
+  -30,-40,-40,-50,-50,-40,-40,-30,
+  -30,-40,-40,-50,-50,-40,-40,-30,
+  -30,-40,-40,-50,-50,-40,-40,-30,
+  -30,-40,-40,-50,-50,-40,-40,-30,
+  -20,-30,-30,-40,-40,-30,-30,-20,
+  -10,-20,-20,-20,-20,-20,-20,-10,
+   20, 20,  0,  0,  0,  0, 20, 20,
+   20, 30, 10,  0,  0, 10, 30, 20
+};
+
+constexpr PieceSquareValues generate_piece_square_values() {
+  PieceSquareValues values{};
+  const int16_t material[6] = {100, 300, 300, 500, 900, 0};
+  const int16_t* squares[6] = {pawn_squares, knight_squares, bishop_squares,
+    rook_squares, queen_squares, king_squares};
+  for (int piece = Position::PAWN; piece <= Position::KING; piece++) {
+    int white = piece;
+    int black = piece + Position::B_PAWN;
+    values.material[white] = material[piece];
+    values.material[black] = -material[piece];
+    for (int sq = 0; sq < 64; sq++) {
+      // Flip the rank to go from board order to the drawn layout. Black's
+      // tables are white's reflected top to bottom.
+      int drawn = (7 - sq / 8) * 8 + sq % 8;
+      values.squares[white][sq] = squares[piece][drawn];
+      values.squares[black][sq] = -squares[piece][sq];
+    }
+  }
+  return values;
+}
+
+constexpr PieceSquareValues piece_square_values =
+  generate_piece_square_values();
+
+static_assert(std::is_trivially_copyable<Position>::value,
+    "Positions should be cheap to copy");
+
+Position::Position(): hash{0}, pawn_hash{0}, material{0}, placement{0} {
   for (int i = 0; i < NUM_BOARDS; i++) {
     boards[i] = 0;
   }
 }
 
-Position::Position(std::string fen) {
+Position::Position(std::string fen): hash{0}, pawn_hash{0},
+  material{0}, placement{0} {
   for (int i = 0; i < NUM_BOARDS; i++) {
     boards[i] = 0;
   }
@@ -76,14 +206,15 @@ Position::Position(std::string fen) {
   }
 }
 
-void Position::make_move(const Move& m) {
-  if (m.piece() == -1) {
+int Position::make_move(const Move& m) {
+  if (m.is_null()) {
     // This is a null move, the position doesn't change
-    return;
+    return -1;
   }
   int from_square = m.from_square();
   int to_square = m.to_square();
-  int piece = m.piece();
+  int piece = get_piece(from_square);
+  int captured = -1;
   if (m.capture()) {
     // Determine which square the captured piece was on. This is just the "to"
     // square unless the capture was en passant.
@@ -95,10 +226,9 @@ void Position::make_move(const Move& m) {
         captured_square += 8;
       }
     }
-    // Clear the captured square on each board
-    for (int i = 0; i < NUM_BOARDS; i++) {
-      remove_piece(captured_square, i);
-    }
+    // Remove the captured piece from the board
+    captured = get_piece(captured_square);
+    remove_piece(captured_square, captured);
   }
   // Remove the relevant piece from the "from" square
   remove_piece(from_square, piece);
@@ -151,6 +281,56 @@ void Position::make_move(const Move& m) {
       place_piece(61, B_ROOK);
     }
   }
+
+  return captured;
+}
+
+void Position::undo_move(const Move& m, int captured) {
+  if (m.is_null()) {
+    return;
+  }
+  int from_square = m.from_square();
+  int to_square = m.to_square();
+  int piece = get_piece(to_square);
+  bool white = piece_is_white(piece);
+
+  // Take the piece off the "to" square and put it back where it started. If
+  // the move was a promotion, the piece that started there was a pawn.
+  remove_piece(to_square, piece);
+  if (m.promote_knight() || m.promote_bishop() || m.promote_rook() ||
+      m.promote_queen()) {
+    place_piece(from_square, color_piece(PAWN, white));
+  } else {
+    place_piece(from_square, piece);
+  }
+
+  // Put the rook back if this was a castle
+  if (m.castle_queenside()) {
+    if (white) {
+      remove_piece(3, W_ROOK);
+      place_piece(0, W_ROOK);
+    } else {
+      remove_piece(59, B_ROOK);
+      place_piece(56, B_ROOK);
+    }
+  } else if (m.castle_kingside()) {
+    if (white) {
+      remove_piece(5, W_ROOK);
+      place_piece(7, W_ROOK);
+    } else {
+      remove_piece(61, B_ROOK);
+      place_piece(63, B_ROOK);
+    }
+  }
+
+  // Restore the captured piece
+  if (captured != -1) {
+    int captured_square = to_square;
+    if (m.capture_ep()) {
+      captured_square += white ? -8 : 8;
+    }
+    place_piece(captured_square, captured);
+  }
 }
 
 std::string Position::fen_board() const {
@@ -208,29 +388,36 @@ std::string Position::fen_board() const {
   return ret;
 }
 
-bool Position::operator<(const Position& other) const {
-  for (int i = 0; i < NUM_BOARDS; i++) {
-    if (boards[i] < other.boards[i]) {
-      return true;
-    }
-  }
-  return false;
-}
-
 Node::Node():
   position("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR"),
   white_to_move{true}, w_castle_k{true}, w_castle_q{true}, b_castle_k{true},
   b_castle_q{true}, en_passant_square{0x0000000000000000ull},
-  en_passant_possible{false}, half_moves_since_reset{0}, moves{1} {}
+  en_passant_possible{false}, half_moves_since_reset{0}, plies_since_null{0},
+  moves{1} {
+  hash = compute_hash();
+}
 
 Node::Node(Position pos, bool wtm, bool wck, bool wcq, bool bck, bool bcq,
     int eps, bool epp, int msr, int ms):
   position{pos}, white_to_move{wtm}, w_castle_k{wck}, w_castle_q{wcq},
   b_castle_k{bck}, b_castle_q{bcq}, en_passant_square{eps},
-  en_passant_possible{epp}, half_moves_since_reset{msr}, moves{ms} {}
+  en_passant_possible{epp}, half_moves_since_reset{msr}, plies_since_null{0},
+  moves{ms} {
+  hash = compute_hash();
+}
+
+uint64_t Node::compute_hash() const {
+  uint64_t h = position.get_hash() ^ castling_hash() ^ en_passant_hash();
+  if (white_to_move) {
+    h ^= zobrist_keys.white_to_move;
+  }
+  return h;
+}
 
 GameState::GameState():
-  node(), repeats(), history() {}
+  node(), history() {
+  history.reserve(HISTORY_RESERVE);
+}
 
 GameState::GameState(std::string fen) {
   std::vector<std::string> words = split(fen, ' ');
@@ -257,34 +444,53 @@ GameState::GameState(std::string fen) {
   int moves = std::stoi(move_number);
   node = Node(position, white_to_move, w_castle_k, w_castle_q, b_castle_k, b_castle_q,
       en_passant_square, en_passant_possible, half_moves_since_reset, moves);
-  repeats = std::map<Position, int>();
-  history = std::deque<Node>();
+  history.reserve(HISTORY_RESERVE);
 }
 
 GameState::GameState(Position pos, bool wtm, bool wck, bool wcq, bool bck,
-    bool bcq, uint64_t eps, bool epp, int msr, int ms,
-    std::map<Position, int> rs, std::deque<Node> hist) :
-  node(pos, wtm, wck, wcq, bck, bcq, eps, epp, msr, ms),
-  repeats(rs), history(hist) {}
+    bool bcq, uint64_t eps, bool epp, int msr, int ms) :
+  node(pos, wtm, wck, wcq, bck, bcq, eps, epp, msr, ms), history() {
+  history.reserve(HISTORY_RESERVE);
+}
 
 void GameState::make_move(const Move& m) {
-  history.push_back(Node(this->node));
-  // Change the current board state
-  node.position.make_move(m);
+  // Record everything we can't recover from the move itself.
+  UndoInfo undo;
+  undo.hash = node.hash;
+  undo.move = m;
+  undo.castling = (node.w_castle_k ? 1 : 0) | (node.w_castle_q ? 2 : 0) |
+    (node.b_castle_k ? 4 : 0) | (node.b_castle_q ? 8 : 0);
+  undo.en_passant_square = node.en_passant_square;
+  undo.en_passant_possible = node.en_passant_possible;
+  undo.half_moves_since_reset = node.half_moves_since_reset;
+  undo.plies_since_null = node.plies_since_null;
+  // Moves don't record which piece moved, so we need to find it before the
+  // board changes.
+  int piece = m.is_null() ? -1 : node.position.get_piece(m.from_square());
+  // Change the current board state. The position maintains the piece part of
+  // the hash itself, so we just swap the old piece hash for the new one.
+  uint64_t old_board_hash = node.position.get_hash();
+  undo.captured = node.position.make_move(m);
+  node.hash ^= old_board_hash ^ node.position.get_hash();
+  history.push_back(undo);
   // Update castling possiblities
   // Since both players often castle early in the game we wrap this in a check
   // to see if the current player can castle in order to skip it in most runs
   if (( node.white_to_move && (node.w_castle_q || node.w_castle_k)) ||
       (!node.white_to_move && (node.b_castle_q || node.b_castle_k))) {
 
+    // Take the old castling rights out of the hash. They are put back in once
+    // they have been updated.
+    node.hash ^= node.castling_hash();
+
     // If the king or rook moved, update castling possibilities
     int from_square = m.from_square();
 
     if (node.white_to_move) {
-      if (m.piece() == Position::W_KING) {
+      if (piece == Position::W_KING) {
         node.w_castle_q = false;
         node.w_castle_k = false;
-      } else if (m.piece() == Position::W_ROOK) {
+      } else if (piece == Position::W_ROOK) {
         if (from_square == 0) {
           // This is white's queenside rook
           node.w_castle_q = false;
@@ -293,10 +499,10 @@ void GameState::make_move(const Move& m) {
         }
       }
     } else {
-      if (m.piece() == Position::B_KING) {
+      if (piece == Position::B_KING) {
         node.b_castle_q = false;
         node.b_castle_k = false;
-      } else if (m.piece() == Position::B_ROOK) {
+      } else if (piece == Position::B_ROOK) {
         if (from_square == 56) {
           // This is black's queenside rook
           node.b_castle_q = false;
@@ -305,9 +511,12 @@ void GameState::make_move(const Move& m) {
         }
       }
     }
+
+    node.hash ^= node.castling_hash();
   }
 
   // Update en passant possibilities
+  node.hash ^= node.en_passant_hash();
   if (m.double_pawn_push()) {
     node.en_passant_possible = true;
     if (node.white_to_move) {
@@ -319,40 +528,59 @@ void GameState::make_move(const Move& m) {
   } else {
     node.en_passant_possible = false;
   }
+  node.hash ^= node.en_passant_hash();
   // Update the 50-move counter
   if (m.double_pawn_push() || m.capture() ||
-      m.piece() == Position::W_PAWN || m.piece() == Position::B_PAWN) {
+      piece == Position::W_PAWN || piece == Position::B_PAWN) {
     node.half_moves_since_reset = 0;
   } else {
     node.half_moves_since_reset++;
   }
+  // Repetition detection never looks back past a null move, since a line
+  // containing one is not a real game.
+  node.plies_since_null = m.is_null() ? 0 : node.plies_since_null + 1;
   // Update the move counter
   if (!node.white_to_move) {
     node.moves++;
   }
-  // Update repeated positions
-  if (repeats.find(node.position) == repeats.end()) {
-    repeats[node.position] = 1;
-  } else {
-    repeats[node.position]++;
-  }
   // It's now the next player's turn
   node.white_to_move = !node.white_to_move;
+  node.hash ^= zobrist_keys.white_to_move;
 }
 
 void GameState::undo_move() {
-  // Remove one instance of this position from the repetitions table
-  if (repeats[node.position] == 1) {
-    repeats.erase(node.position);
-  } else {
-    repeats[node.position]--;
+  const UndoInfo& undo = history.back();
+  node.position.undo_move(undo.move, undo.captured);
+  node.white_to_move = !node.white_to_move;
+  if (!node.white_to_move) {
+    node.moves--;
   }
-
-  // Now we can just take the previous node
-  node = history.back();
+  node.w_castle_k = (undo.castling & 1) != 0;
+  node.w_castle_q = (undo.castling & 2) != 0;
+  node.b_castle_k = (undo.castling & 4) != 0;
+  node.b_castle_q = (undo.castling & 8) != 0;
+  node.en_passant_square = undo.en_passant_square;
+  node.en_passant_possible = undo.en_passant_possible;
+  node.half_moves_since_reset = undo.half_moves_since_reset;
+  node.plies_since_null = undo.plies_since_null;
+  node.hash = undo.hash;
   history.pop_back();
 }
 
+int GameState::repetitions() const {
+  // The same position can only come up with the same player to move, so we
+  // only need to look at every other node.
+  int count = 0;
+  int limit = std::min<int>({node.half_moves_since_reset,
+      node.plies_since_null, (int) history.size()});
+  for (int i = 2; i <= limit; i += 2) {
+    if (history[history.size() - i].hash == node.hash) {
+      count++;
+    }
+  }
+  return count;
+}
+
 Move GameState::convert_move(const std::string& str) const {
   std::string from = str.substr(0, 2);
   std::string to = str.substr(2, 2);
@@ -427,7 +655,7 @@ Move GameState::convert_move(const std::string& str) const {
     flags = Move::QUEEN_CASTLE;
   }
 
-  return Move(start, end, piece, flags);
+  return Move(start, end, flags);
 }
 
 // Convert a GameState to a FEN string
@@ -472,7 +700,9 @@ std::ostream& operator<<(std::ostream& os, const GameState& gs) {
   return os;
 }
 
-Move::Move(): from_sq{0}, to_sq{0}, piece_moved{-1}, flags{0} {}
+Move::Move(): data{0} {}
+
+Move::Move(int from, int to, uint16_t fl) :
+  data((uint16_t) (from | (to << 6) | (fl << 12))) {}
 
-Move::Move(int from, int to, int p, uint16_t fl) :
-  from_sq(from), to_sq(to), piece_moved(p), flags(fl) {}
+static_assert(sizeof(Move) == 2, "Moves should be packed into 16 bits");
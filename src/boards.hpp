@@ -1,10 +1,10 @@
 #pragma once
 
-#include <map>
-#include <set>
+#include <cstdint>
 #include <iostream>
-#include <deque>
+#include <vector>
 
+#include "bits.hpp"
 #include "utils.hpp"
 
 // There are 12 bitboards for the indivitual pieces plus 2 representing all of
@@ -12,12 +12,120 @@
 // sides.
 #define NUM_BOARDS 15
 
+/**
+ * \brief Random keys used to build Zobrist hashes of game states.
+ *
+ * The hash of a game state is the exclusive or of the key for each piece on
+ * each square along with keys for the side to move, the castling rights and
+ * the file of the en passant square. Because exclusive or is its own inverse,
+ * the hash can be updated incrementally as pieces move around the board. The
+ * keys are generated at compile time from a fixed seed so that hashes are
+ * reproducible between runs.
+ */
+struct ZobristKeys {
+  /** One key per piece and square. The entries for the combined boards are
+   * zero since they never have pieces placed on them directly. */
+  uint64_t pieces[NUM_BOARDS][64];
+  /** Included in the hash when it is white's turn to move. */
+  uint64_t white_to_move;
+  /** Castling rights, in the order K, Q, k, q. */
+  uint64_t castling[4];
+  /** En passant targets, indexed by file. */
+  uint64_t en_passant[8];
+};
+
+/** The keys used for all Zobrist hashing. */
+extern const ZobristKeys zobrist_keys;
+
+/**
+ * \brief Material and piece-square values for incremental evaluation.
+ *
+ * Values are in centipawns from white's point of view, so black pieces have
+ * negative values. A position keeps the sum of these values for the pieces on
+ * the board up to date as pieces are placed and removed, in the same way as
+ * its hash, so evaluators can read them without looking at every piece.
+ */
+struct PieceSquareValues {
+  /** The material value of each piece. Zero for the combined boards. */
+  int16_t material[NUM_BOARDS];
+  /** The positional bonus for each piece on each square, not including its
+   * material value. Zero for the combined boards. */
+  int16_t squares[NUM_BOARDS][64];
+};
+
+/** The values used for all incremental evaluation. */
+extern const PieceSquareValues piece_square_values;
+
+/**
+ * \brief The set of squares in a bitboard.
+ *
+ * This allows the squares of a bitboard to be used in a range-based for loop,
+ * from a1 up to h8. Iterating is equivalent to repeatedly popping the lowest
+ * bit off the bitboard, so it does not allocate any memory.
+ */
+class SquareSet {
+  private:
+    uint64_t bits;
+
+  public:
+    /**
+     * \brief An iterator over the squares of a bitboard.
+     */
+    class iterator {
+      private:
+        uint64_t bits;
+
+      public:
+        iterator(uint64_t b): bits{b} {}
+
+        inline int operator*() const {
+          return lsb(bits);
+        }
+
+        inline iterator& operator++() {
+          bits &= bits - 1;
+          return *this;
+        }
+
+        friend bool operator==(const iterator& l, const iterator& r) {
+          return l.bits == r.bits;
+        }
+
+        friend bool operator!=(const iterator& l, const iterator& r) {
+          return l.bits != r.bits;
+        }
+    };
+
+    SquareSet(uint64_t b): bits{b} {}
+
+    inline iterator begin() const {
+      return iterator(bits);
+    }
+
+    inline iterator end() const {
+      return iterator(0);
+    }
+
+    /**
+     * \brief Get the number of squares in the set.
+     */
+    inline int size() const {
+      return popcount(bits);
+    }
+
+    /**
+     * \brief Determine whether the set has no squares.
+     */
+    inline bool empty() const {
+      return bits == 0;
+    }
+};
+
 /**
  * \brief A single move.
  *
- * A move consists of a starting and ending square along with the piece that
- * moved and some flags indicating what kind of move it was. Specifically, a
- * move may be:
+ * A move consists of a starting and ending square along with some flags
+ * indicating what kind of move it was. Specifically, a move may be:
  * - a capture (the captured piece needs to be removed),
  * - a double pawn push (en passant possibilities should be updated),
  * - a king or queenside castle (the associated rook needs to be moved),
@@ -25,13 +133,15 @@
  * - promotion (the pawn needs to be replaced with the specified piece),
  * - promotion with a capture, or
  * - quite (none of the above applies).
+ *
+ * A move is packed into 16 bits: the starting square in the low six bits,
+ * the ending square in the next six and the flags in the top four. The piece
+ * which moved is not stored, since it can always be found on the starting
+ * square of the board the move is made on.
  */
 class Move {
   private:
-    int from_sq;      /**< The starting square of the move. */
-    int to_sq;        /**< The ending square of the move. */
-    int piece_moved;  /**< The piece which was moved. */
-    uint16_t flags;   /**< Other information about the move. */
+    uint16_t data;    /**< The packed squares and flags. */
 
   public:
     static const uint16_t QUIET = 0;
@@ -59,10 +169,9 @@ class Move {
      *
      * \param from The starting square.
      * \param to The ending square.
-     * \param p The piece which moved.
      * \param fl The move type flag.
      */
-    Move(int from, int to, int p, uint16_t fl);
+    Move(int from, int to, uint16_t fl);
 
     /** \name Flag Tests
      * These functions test the move type flag.
@@ -73,35 +182,35 @@ class Move {
      * \brief True if this move is a kingside castle.
      */
     inline bool castle_kingside() const {
-      return flags == KING_CASTLE;
+      return get_flags() == KING_CASTLE;
     }
 
     /**
      * \brief True if this move is a queenside castle.
      */
     inline bool castle_queenside() const {
-      return flags == QUEEN_CASTLE;
+      return get_flags() == QUEEN_CASTLE;
     }
 
     /**
      * \brief True if this move is a double pawn push.
      */
     inline bool double_pawn_push() const {
-      return flags == PAWN_DOUBLE;
+      return get_flags() == PAWN_DOUBLE;
     }
 
     /**
      * \brief True if this move results in a capture.
      */
     inline bool capture() const {
-      return (flags & 0x4) != 0;
+      return (get_flags() & 0x4) != 0;
     }
 
     /**
      * \brief True if this move is an en passant capture.
      */
     inline bool capture_ep() const {
-      return flags == CAPTURE_EP;
+      return get_flags() == CAPTURE_EP;
     }
 
     /**
@@ -111,7 +220,7 @@ class Move {
      * with capture.
      */
     inline bool promote_knight() const {
-      return flags == PROMOTE_KNIGHT || flags == PROMOTE_KNIGHT_CAPTURE;
+      return get_flags() == PROMOTE_KNIGHT || get_flags() == PROMOTE_KNIGHT_CAPTURE;
     }
 
     /**
@@ -121,7 +230,7 @@ class Move {
      * with capture.
      */
     inline bool promote_bishop() const {
-      return flags == PROMOTE_BISHOP || flags == PROMOTE_BISHOP_CAPTURE;
+      return get_flags() == PROMOTE_BISHOP || get_flags() == PROMOTE_BISHOP_CAPTURE;
     }
 
     /**
@@ -131,7 +240,7 @@ class Move {
      * with capture.
      */
     inline bool promote_rook() const {
-      return flags == PROMOTE_ROOK || flags == PROMOTE_ROOK_CAPTURE;
+      return get_flags() == PROMOTE_ROOK || get_flags() == PROMOTE_ROOK_CAPTURE;
     }
 
     /**
@@ -141,30 +250,37 @@ class Move {
      * with capture.
      */
     inline bool promote_queen() const {
-      return flags == PROMOTE_QUEEN || flags == PROMOTE_QUEEN_CAPTURE;
+      return get_flags() == PROMOTE_QUEEN || get_flags() == PROMOTE_QUEEN_CAPTURE;
+    }
+
+    /**
+     * \brief True if this move ends in promotion to any piece.
+     */
+    inline bool promotion() const {
+      return (get_flags() & 0x8) != 0;
     }
 
     ///@}
 
     /**
-     * \brief Get the starting square of this move.
+     * \brief Determine whether this is the null move.
      */
-    inline int from_square() const {
-      return from_sq;
+    inline bool is_null() const {
+      return data == 0;
     }
 
     /**
-     * \brief Get the ending square of this move.
+     * \brief Get the starting square of this move.
      */
-    inline int to_square() const {
-      return to_sq;
+    inline int from_square() const {
+      return data & 0x3f;
     }
 
     /**
-     * \brief Get the moved piece.
+     * \brief Get the ending square of this move.
      */
-    inline int piece() const {
-      return piece_moved;
+    inline int to_square() const {
+      return (data >> 6) & 0x3f;
     }
 
     /**
@@ -174,15 +290,14 @@ class Move {
      * using the flags to compare this move to another.
      */
     inline uint16_t get_flags() const {
-      return flags;
+      return data >> 12;
     }
 
     /**
      * \brief Determine whether two moves are equal.
      */
     friend bool operator==(const Move& l, const Move& r) {
-      return l.flags == r.flags && l.piece_moved == r.piece_moved &&
-        l.from_sq == r.from_sq && l.to_sq == r.to_sq;
+      return l.data == r.data;
     }
 
     friend bool operator!=(const Move& l, const Move& r) {
@@ -196,7 +311,7 @@ class Move {
      * a possible appended character for promotion.
      */
     friend std::ostream& operator<<(std::ostream& out, const Move& m) {
-      out << int_to_algebraic(m.from_sq) << int_to_algebraic(m.to_sq);
+      out << int_to_algebraic(m.from_square()) << int_to_algebraic(m.to_square());
       if (m.promote_rook()) {
         out << "r";
       } else if (m.promote_bishop()) {
@@ -216,14 +331,21 @@ class Move {
  * The layout of pieces on a board is represented by a set of bitboards in
  * rank-major order where the most-significant bit is h8 and the least
  * significant bit is a1. The squares are numbered accordingly so that a1 is 0
- * and h8 is 63.
+ * and h8 is 63. A position is trivially copyable, so copying one is just a
+ * copy of its bitboards, hash and incremental scores.
  */
 class Position {
   private:
     /** The bitboards representing the position. */
     uint64_t boards[NUM_BOARDS];
-    /** A cache of the locations of each piece type for fast access. */
-    std::set<int> piece_sets[NUM_BOARDS];
+    /** The Zobrist hash of the pieces on the board. */
+    uint64_t hash;
+    /** The Zobrist hash of the pawns on the board. */
+    uint64_t pawn_hash;
+    /** The sum of piece_square_values.material over the pieces on the board. */
+    int32_t material;
+    /** The sum of piece_square_values.squares over the pieces on the board. */
+    int32_t placement;
 
   public:
     /**
@@ -316,7 +438,12 @@ class Position {
       } else {
         boards[B_ALL] |= mask;
       }
-      piece_sets[piece].insert(pos);
+      hash ^= zobrist_keys.pieces[piece][pos];
+      if (piece == W_PAWN || piece == B_PAWN) {
+        pawn_hash ^= zobrist_keys.pieces[piece][pos];
+      }
+      material += piece_square_values.material[piece];
+      placement += piece_square_values.squares[piece][pos];
     }
 
     // Remove a piece from the board
@@ -331,18 +458,35 @@ class Position {
      * \param piece The piece to remove.
      */
     inline void remove_piece(int pos, int piece) {
+      if (boards[piece] & (1ull << pos)) {
+        hash ^= zobrist_keys.pieces[piece][pos];
+        if (piece == W_PAWN || piece == B_PAWN) {
+          pawn_hash ^= zobrist_keys.pieces[piece][pos];
+        }
+        material -= piece_square_values.material[piece];
+        placement -= piece_square_values.squares[piece][pos];
+      }
       uint64_t mask = ~(1ull << pos);
       boards[piece] &= mask;
       boards[W_ALL] &= mask;
       boards[B_ALL] &= mask;
       boards[BOTH_ALL] &= mask;
-      piece_sets[piece].erase(pos);
     }
 
     /**
      * \brief Update the position by making a move.
+     *
+     * \return The piece which was captured, or -1 if there was no capture.
      */
-    void make_move(const Move& m);
+    int make_move(const Move& m);
+
+    /**
+     * \brief Reverse a move made with make_move.
+     *
+     * \param m The move to undo. This must be the last move made.
+     * \param captured The piece returned by make_move.
+     */
+    void undo_move(const Move& m, int captured);
 
     /**
      * \brief Determine whether the given piece is at the given square.
@@ -354,8 +498,8 @@ class Position {
     /**
      * \brief Get the positions of all pieces of a given type.
      */
-    inline const std::set<int>& find_piece(int piece) const {
-      return piece_sets[piece];
+    inline SquareSet find_piece(int piece) const {
+      return SquareSet(boards[piece]);
     }
 
     /**
@@ -400,25 +544,56 @@ class Position {
     }
 
     /**
-     * \brief Generate a FEN string for this board.
+     * \brief Get the Zobrist hash of the piece placement.
+     *
+     * This only covers the pieces on the board. See Node::hash for a hash
+     * that includes the rest of the game state.
      */
-    std::string fen_board() const;
+    inline uint64_t get_hash() const {
+      return hash;
+    }
 
     /**
-     * \brief Impose an arbitrary ordering on positions.
+     * \brief Get the Zobrist hash of the pawns alone.
      *
-     * This ordering is only provided to allow positions to be used as the key
-     * of a map.
+     * Pawn structure changes much less often than the rest of the position,
+     * so this is used to cache evaluation terms which only depend on pawns.
+     * A position with no pawns has a pawn hash of zero.
      */
-    bool operator<(const Position& other) const;
+    inline uint64_t get_pawn_hash() const {
+      return pawn_hash;
+    }
+
+    /**
+     * \brief Get the material balance in centipawns.
+     *
+     * This is positive when white has more material.
+     */
+    inline int32_t material_score() const {
+      return material;
+    }
+
+    /**
+     * \brief Get the piece-square balance in centipawns.
+     *
+     * This is the positional part of the piece-square tables only, and is
+     * positive when white's pieces are better placed.
+     */
+    inline int32_t placement_score() const {
+      return placement;
+    }
+
+    /**
+     * \brief Generate a FEN string for this board.
+     */
+    std::string fen_board() const;
 };
 
 /**
  * \brief A part of the game state.
  *
- * A node holds the space-efficient parts of the game state. The point here is
- * to allow fast making and undoing of moves by copying the small parts of the
- * game state to reduce the computation required to undo a move.
+ * A node holds everything about the game state needed to generate and make
+ * moves, but none of the history of the game.
  */
 class Node {
   public:
@@ -431,7 +606,9 @@ class Node {
     int en_passant_square;   /**< The square where en passant can occur. */
     bool en_passant_possible;     /**< True if an en passant move is legal. */
     int half_moves_since_reset;   /**< Number of moves since pawn move or capture. */
+    int plies_since_null;   /**< Number of moves since a null move. */
     int moves;    /**< Current move number (1 in the initial position). */
+    uint64_t hash;    /**< Zobrist hash of the whole node. */
 
     /**
      * \brief Construct a node representing the starting position.
@@ -454,8 +631,74 @@ class Node {
      */
     Node(Position pos, bool wtm, bool wck, bool wcq, bool bck, bool bcq,
         int eps, bool epp, int msr, int ms);
+
+    /**
+     * \brief Get the part of the hash describing castling rights.
+     */
+    inline uint64_t castling_hash() const {
+      uint64_t h = 0;
+      if (w_castle_k) {
+        h ^= zobrist_keys.castling[0];
+      }
+      if (w_castle_q) {
+        h ^= zobrist_keys.castling[1];
+      }
+      if (b_castle_k) {
+        h ^= zobrist_keys.castling[2];
+      }
+      if (b_castle_q) {
+        h ^= zobrist_keys.castling[3];
+      }
+      return h;
+    }
+
+    /**
+     * \brief Get the part of the hash describing en passant possibilities.
+     */
+    inline uint64_t en_passant_hash() const {
+      if (en_passant_possible) {
+        return zobrist_keys.en_passant[en_passant_square % 8];
+      }
+      return 0;
+    }
+
+    /**
+     * \brief Compute the hash of this node from scratch.
+     *
+     * This is used when a node is constructed. After that, the hash is kept
+     * up to date incrementally by GameState::make_move.
+     */
+    uint64_t compute_hash() const;
+};
+
+/**
+ * \brief The information needed to undo a move.
+ *
+ * This holds the parts of a node which can't be recovered from the move
+ * itself, so undoing a move doesn't require a copy of the whole node.
+ */
+struct UndoInfo {
+  /** The hash of the node before the move was made. */
+  uint64_t hash;
+  /** The move which was made. */
+  Move move;
+  /** The piece which was captured, or -1. */
+  int8_t captured;
+  /** The castling rights before the move, one bit each for K, Q, k and q. */
+  uint8_t castling;
+  /** The en passant square before the move. */
+  uint8_t en_passant_square;
+  /** True if en passant was possible before the move. */
+  bool en_passant_possible;
+  /** The half-move counter before the move. */
+  uint16_t half_moves_since_reset;
+  /** The number of moves since a null move before the move. */
+  uint16_t plies_since_null;
 };
 
+// The number of moves the history has space for before it needs to allocate.
+#define HISTORY_RESERVE 512
+
 /**
  * \brief The state of a chess game.
  */
@@ -463,11 +706,9 @@ class GameState {
   private:
     /// Most features of the current position.
     Node node;
-    /** A count of the number of time each position has been reached. This is
-     * used for determining when the game is drawn by repetition. */
-    std::map<Position, int> repeats;
-    /// A history of nodes, used for quickly undoing moves.
-    std::deque<Node> history;
+    /// A stack of undo records, used for quickly undoing moves and for
+    /// detecting repetitions.
+    std::vector<UndoInfo> history;
 
   public:
     /**
@@ -484,8 +725,7 @@ class GameState {
      * \brief Construct a game state from its constituent pieces.
      */
     GameState(Position pos, bool wtm, bool wck, bool wcq, bool bck, bool bcq,
-        uint64_t eps, bool epp, int msr, int ms, std::map<Position, int> rs,
-        std::deque<Node> history);
+        uint64_t eps, bool epp, int msr, int ms);
 
     /**
      * \brief Determine whether it is white's turn to move.
@@ -501,6 +741,22 @@ class GameState {
       return node.position;
     }
 
+    /**
+     * \brief Get the Zobrist hash of the current game state.
+     */
+    inline uint64_t hash() const {
+      return node.hash;
+    }
+
+    /**
+     * \brief Count how many times the current position occurred before.
+     *
+     * Only positions since the last pawn move or capture are considered,
+     * since no earlier position can be repeated, and none before a null
+     * move.
+     */
+    int repetitions() const;
+
     /**
      * \brief Determine whether en passant is possible.
      */
@@ -515,6 +771,29 @@ class GameState {
       return node.en_passant_square;
     }
 
+    /**
+     * \brief Determine whether either side can still castle.
+     */
+    inline bool can_castle() const {
+      return node.w_castle_k || node.w_castle_q || node.b_castle_k ||
+        node.b_castle_q;
+    }
+
+    /**
+     * \brief Get the castling rights, one bit each for K, Q, k and q.
+     */
+    inline uint8_t castling_rights() const {
+      return (node.w_castle_k ? 1 : 0) | (node.w_castle_q ? 2 : 0) |
+        (node.b_castle_k ? 4 : 0) | (node.b_castle_q ? 8 : 0);
+    }
+
+    /**
+     * \brief Get the number of half moves since the last pawn move or capture.
+     */
+    inline int half_move_clock() const {
+      return node.half_moves_since_reset;
+    }
+
     /**
      * \brief Return a bitboard of square the king moves through to castle kingside.
      *
@@ -547,6 +826,10 @@ class GameState {
 
     /**
      * \brief Make a move.
+     *
+     * The null move passes the turn to the other player. It is not a legal
+     * chess move, but the search uses it to test whether a position is good
+     * even without a move.
      */
     void make_move(const Move& m);
 
@@ -555,6 +838,13 @@ class GameState {
      */
     void undo_move();
 
+    /**
+     * \brief Get the number of moves which can be undone.
+     */
+    inline unsigned history_size() const {
+      return history.size();
+    }
+
     /**
      * \brief Convert a move in long algebraic notation to the internal format.
      */
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boards.hpp"
+#include "mapped_file.hpp"
+
+/**
+ * \brief One entry of an opening book, as stored in the file.
+ */
+struct BookEntry {
+  /** The key of the position, see OpeningBook::key. */
+  uint64_t key;
+  /** The move in Polyglot's encoding, see OpeningBook::encode_move. */
+  uint16_t move;
+  /** How often the move should be chosen, relative to the other moves in
+   * the position. */
+  uint16_t weight;
+  /** Unused, kept for compatibility with Polyglot tools. */
+  uint32_t learn;
+};
+
+/**
+ * \brief An opening book read from a memory-mapped file.
+ *
+ * The file has the layout of a Polyglot .bin book: 16-byte big-endian
+ * entries of a 64-bit key, a 16-bit move, a 16-bit weight and a 32-bit learn
+ * value, sorted by key.
+ *
+ * The file is mapped read-only and shared, and searched in place, so opening
+ * a book costs nothing however large it is. Only the pages a lookup touches
+ * are read, and every process using the same book shares them through the
+ * page cache.
+ *
+ * Positions are keyed by Polyglot's Zobrist hash, so books made by other
+ * Polyglot tools work unchanged, and books written with OpeningBook::write,
+ * for example by the makebook command, work with other engines.
+ */
+class OpeningBook {
+  private:
+    /** The mapped file. A binary search jumps around it, so the kernel
+     * is told not to read ahead. */
+    MappedFile file;
+
+    /**
+     * \brief Decode the entry at the given index.
+     */
+    BookEntry entry(size_t index) const;
+
+  public:
+    /** The size of an entry in the file. */
+    static const size_t ENTRY_SIZE = 16;
+
+    /**
+     * \brief Map a book file.
+     *
+     * A std::runtime_error is thrown if the file can't be mapped or its size
+     * is not a multiple of the entry size.
+     */
+    OpeningBook(const std::string& path);
+
+    /**
+     * \brief Get the number of entries in the book.
+     */
+    inline size_t size() const {
+      return file.size() / ENTRY_SIZE;
+    }
+
+    /**
+     * \brief Get the book moves for a game state.
+     *
+     * \return Each legal move in the book for the game state with its weight,
+     * in the order they appear in the file.
+     */
+    std::vector<std::pair<Move, uint16_t>> moves(const GameState& gs) const;
+
+    /**
+     * \brief Choose a book move for a game state.
+     *
+     * Moves are chosen at random in proportion to their weights.
+     *
+     * \return The move, or nothing if the game state is not in the book or
+     * all of its moves have zero weight.
+     */
+    std::optional<Move> probe(const GameState& gs, std::mt19937_64& rng) const;
+
+    /**
+     * \brief Get the Polyglot key of a game state.
+     *
+     * As in Polyglot, the en passant file is only part of the key when a pawn
+     * of the side to move could capture en passant.
+     */
+    static uint64_t key(const GameState& gs);
+
+    /**
+     * \brief Encode a move as Polyglot does.
+     *
+     * The to square takes the low six bits and the from square the next six,
+     * each as file then rank, with the promotion piece from 1 (knight) to 4
+     * (queen) above them. Castling is written as the king capturing its own
+     * rook.
+     */
+    static uint16_t encode_move(const Move& m);
+
+    /**
+     * \brief Find the legal move with the given encoding.
+     *
+     * \return The move, or a null move if no legal move has this encoding.
+     */
+    static Move decode_move(const GameState& gs, uint16_t move);
+
+    /**
+     * \brief Write a book file.
+     *
+     * The entries are sorted by key before writing. A std::runtime_error is
+     * thrown if the file can't be written.
+     */
+    static void write(const std::string& path, std::vector<BookEntry> entries);
+};
@@ -1,4 +1,5 @@
 #include "evaluation.hpp"
+#include "bits.hpp"
 #include "movegen.hpp"
 
 double BasicEvaluator::evaluate_position(GameState& gs) {
@@ -35,8 +36,8 @@ double BasicEvaluator::evaluate_position(GameState& gs) {
   double bishop_pair_score = 0.5 * (white_bishop_pair - black_bishop_pair);
 
   // Pawn structure considerations -- doubled, isolated pawns.
-  const std::set<int>& w_pawns = gs.pos().find_piece(Position::W_PAWN);
-  const std::set<int>& b_pawns = gs.pos().find_piece(Position::B_PAWN);
+  SquareSet w_pawns = gs.pos().find_piece(Position::W_PAWN);
+  SquareSet b_pawns = gs.pos().find_piece(Position::B_PAWN);
 
   int w_pawn_files[8];
   int b_pawn_files[8];
@@ -73,3 +74,183 @@ double BasicEvaluator::evaluate_position(GameState& gs) {
 
   return material_score + mobility_score + bishop_pair_score + structure_score;
 }
+
+// The squares on the a-file. Other files are found by shifting this.
+static const uint64_t FILE_A = 0x0101010101010101ull;
+
+// Get the squares attacked by a set of pawns of the given color.
+static inline uint64_t pawn_attacks(uint64_t pawns, bool white) {
+  if (white) {
+    return ((pawns & ~FILE_A) << 7) | ((pawns & ~(FILE_A << 7)) << 9);
+  } else {
+    return ((pawns & ~FILE_A) >> 9) | ((pawns & ~(FILE_A << 7)) >> 7);
+  }
+}
+
+int IncrementalEvaluator::mobility(const Position& p, bool white) {
+  uint64_t occupancy = p.get_board(Position::BOTH_ALL);
+  uint64_t own = p.get_board(white ? Position::W_ALL : Position::B_ALL);
+
+  // Squares defended by enemy pawns are not useful places to move to, so they
+  // are left out of the count.
+  uint64_t enemy_pawns = p.get_board(white ? Position::B_PAWN :
+      Position::W_PAWN);
+  uint64_t available = ~own & ~pawn_attacks(enemy_pawns, !white);
+
+  int score = 0;
+  for (int sq : p.find_piece(Position::color_piece(Position::KNIGHT, white))) {
+    score += MOBILITY_WEIGHTS[Position::KNIGHT] *
+      popcount(knight_attacks(sq) & available);
+  }
+  for (int sq : p.find_piece(Position::color_piece(Position::BISHOP, white))) {
+    score += MOBILITY_WEIGHTS[Position::BISHOP] *
+      popcount(bishop_attacks(sq, occupancy) & available);
+  }
+  for (int sq : p.find_piece(Position::color_piece(Position::ROOK, white))) {
+    score += MOBILITY_WEIGHTS[Position::ROOK] *
+      popcount(rook_attacks(sq, occupancy) & available);
+  }
+  for (int sq : p.find_piece(Position::color_piece(Position::QUEEN, white))) {
+    uint64_t attacks = rook_attacks(sq, occupancy) |
+      bishop_attacks(sq, occupancy);
+    score += MOBILITY_WEIGHTS[Position::QUEEN] * popcount(attacks & available);
+  }
+  return score;
+}
+
+// Bitboard masks used to evaluate pawns, indexed by color (white is 1) and
+// square.
+struct PawnMasks {
+  /** The squares on the same file and the adjacent files in front of a pawn.
+   * A pawn with no enemy pawns here is passed. */
+  uint64_t passed[2][64];
+  /** The squares on the same file in front of a pawn. */
+  uint64_t front[2][64];
+  /** The squares on the adjacent files on the same rank as a pawn or behind
+   * it. A pawn with no friendly pawns here can not be defended by one. */
+  uint64_t support[2][64];
+};
+
+constexpr PawnMasks generate_pawn_masks() {
+  PawnMasks masks{};
+  for (int c = 0; c < 2; c++) {
+    bool white = c == 1;
+    for (int sq = 0; sq < 64; sq++) {
+      int rank = sq / 8;
+      int file = sq % 8;
+      for (int s = 0; s < 64; s++) {
+        int r = s / 8;
+        int f = s % 8;
+        bool ahead = white ? r > rank : r < rank;
+        bool adjacent = f == file - 1 || f == file + 1;
+        if (ahead && f == file) {
+          masks.front[c][sq] |= 1ull << s;
+        }
+        if (ahead && (adjacent || f == file)) {
+          masks.passed[c][sq] |= 1ull << s;
+        }
+        if (!ahead && adjacent) {
+          masks.support[c][sq] |= 1ull << s;
+        }
+      }
+    }
+  }
+  return masks;
+}
+
+static constexpr PawnMasks pawn_masks = generate_pawn_masks();
+
+int IncrementalEvaluator::pawn_structure(const Position& p, bool white) {
+  uint64_t pawns = p.get_board(white ? Position::W_PAWN : Position::B_PAWN);
+  uint64_t enemy = p.get_board(white ? Position::B_PAWN : Position::W_PAWN);
+  uint64_t defended = pawn_attacks(pawns, white);
+  uint64_t enemy_attacks = pawn_attacks(enemy, !white);
+  int score = 0;
+
+  // Doubled and isolated pawns are counted once per file.
+  for (int f = 0; f < 8; f++) {
+    uint64_t on_file = pawns & (FILE_A << f);
+    if (on_file == 0) {
+      continue;
+    }
+    if ((on_file & (on_file - 1)) != 0) {
+      score -= DOUBLED_PAWN;
+    }
+    uint64_t neighbors = (f > 0 ? FILE_A << (f - 1) : 0) |
+      (f < 7 ? FILE_A << (f + 1) : 0);
+    if ((pawns & neighbors) == 0) {
+      score -= ISOLATED_PAWN;
+    }
+  }
+
+  for (int sq : SquareSet(pawns)) {
+    uint64_t bit = 1ull << sq;
+    int rank = white ? sq / 8 : 7 - sq / 8;
+    uint64_t beside = ((bit & ~FILE_A) >> 1) | ((bit & ~(FILE_A << 7)) << 1);
+
+    if ((defended & bit) || (pawns & beside)) {
+      score += CONNECTED_PAWN;
+    }
+
+    // Only the front pawn of a doubled pair can be passed.
+    if ((enemy & pawn_masks.passed[white][sq]) == 0 &&
+        (pawns & pawn_masks.front[white][sq]) == 0) {
+      score += PASSED_PAWN[rank];
+      continue;
+    }
+
+    // A pawn is backward if no pawn on a neighboring file can come up to
+    // defend it and an enemy pawn stops it from advancing. Isolated pawns
+    // have already been penalized.
+    uint64_t stop = white ? bit << 8 : bit >> 8;
+    uint64_t neighbors = pawn_masks.support[white][sq] |
+      (pawn_masks.passed[white][sq] & ~pawn_masks.front[white][sq]);
+    if ((pawns & neighbors) != 0 &&
+        (pawns & pawn_masks.support[white][sq]) == 0 &&
+        (enemy_attacks & stop) != 0) {
+      score -= BACKWARD_PAWN;
+    }
+  }
+  return score;
+}
+
+void IncrementalEvaluator::initialize(GameState& gs) {
+  if (pawn_table.empty()) {
+    // A zeroed entry is correct for the position with no pawns, whose pawn
+    // hash is zero, so the table needs no separate notion of empty entries.
+    pawn_table = std::vector<PawnEntry>(PAWN_TABLE_SIZE, PawnEntry{0, 0});
+  }
+}
+
+int IncrementalEvaluator::pawn_score(const Position& p) {
+  if (pawn_table.empty()) {
+    return pawn_structure(p, true) - pawn_structure(p, false);
+  }
+  uint64_t key = p.get_pawn_hash();
+  PawnEntry& e = pawn_table[key & (PAWN_TABLE_SIZE - 1)];
+  if (e.key != key) {
+    e.key = key;
+    e.score = pawn_structure(p, true) - pawn_structure(p, false);
+  }
+  return e.score;
+}
+
+double IncrementalEvaluator::evaluate_position(GameState& gs) {
+  const Position& p = gs.pos();
+  int score = p.material_score() + p.placement_score();
+
+  score += mobility(p, true) - mobility(p, false);
+
+  uint64_t w_bishops = p.get_board(Position::W_BISHOP);
+  uint64_t b_bishops = p.get_board(Position::B_BISHOP);
+  if (w_bishops & (w_bishops - 1)) {
+    score += BISHOP_PAIR;
+  }
+  if (b_bishops & (b_bishops - 1)) {
+    score -= BISHOP_PAIR;
+  }
+
+  score += pawn_score(p);
+
+  return score / 100.0;
+}
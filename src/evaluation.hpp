@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <vector>
+
 #include "boards.hpp"
 
 /**
@@ -29,6 +33,14 @@ class Evaluator {
      * equal, the score would be -3.
      */
     virtual double evaluate_position(GameState& gs) = 0;
+
+    /**
+     * \brief Create a copy of this evaluator.
+     *
+     * Evaluators may keep state between calls, so each search thread needs
+     * its own.
+     */
+    virtual std::unique_ptr<Evaluator> clone() const = 0;
 };
 
 /**
@@ -41,4 +53,99 @@ class Evaluator {
 class BasicEvaluator: public Evaluator {
   public:
     double evaluate_position(GameState& gs) override;
+
+    std::unique_ptr<Evaluator> clone() const override {
+      return std::make_unique<BasicEvaluator>(*this);
+    }
+};
+
+// The number of entries in each evaluator's pawn table. This must be a power
+// of two.
+#define PAWN_TABLE_SIZE (1 << 14)
+
+/**
+ * \brief A cached pawn structure score.
+ */
+struct PawnEntry {
+  /** The pawn hash of the position the score belongs to. */
+  uint64_t key;
+  /** The pawn structure score in centipawns, positive when white's pawns are
+   * better. */
+  int32_t score;
+};
+
+/**
+ * \brief An evaluation function which does not generate any moves.
+ *
+ * Material and piece-square sums are read from the position, which keeps them
+ * up to date as pieces move. Mobility is the number of squares each piece
+ * attacks rather than the number of legal moves, so it only needs a few
+ * attack board lookups.
+ *
+ * Pawn structure terms only depend on where the pawns are, and sibling nodes
+ * almost always share a pawn structure, so their total is cached in a
+ * direct-mapped table indexed by the pawn hash. The table is allocated by
+ * initialize, which the searcher calls on the thread that will use it. Each
+ * clone gets its own table. Until initialize is called, pawn structure is
+ * computed from scratch for each position. Evaluating a position never
+ * allocates memory and never changes the game state.
+ */
+class IncrementalEvaluator: public Evaluator {
+  private:
+    /** The value of each attacked square for each piece type, in centipawns.
+     * Pawns and kings don't count towards mobility. */
+    static constexpr int MOBILITY_WEIGHTS[6] = {0, 4, 5, 3, 2, 0};
+    /** The value of having both bishops, in centipawns. */
+    static constexpr int BISHOP_PAIR = 50;
+    /** The penalty for each file with more than one pawn, in centipawns. */
+    static constexpr int DOUBLED_PAWN = 50;
+    /** The penalty for each file with an isolated pawn, in centipawns. */
+    static constexpr int ISOLATED_PAWN = 50;
+    /** The penalty for a pawn which can't be supported by other pawns and
+     * can't safely advance, in centipawns. */
+    static constexpr int BACKWARD_PAWN = 15;
+    /** The bonus for a pawn defended by or beside another pawn, in
+     * centipawns. */
+    static constexpr int CONNECTED_PAWN = 10;
+    /** The bonus for a passed pawn by rank from its owner's side, in
+     * centipawns. */
+    static constexpr int PASSED_PAWN[8] = {0, 10, 15, 25, 40, 65, 100, 0};
+
+    /** Cached pawn structure scores. Empty until initialize is called. */
+    std::vector<PawnEntry> pawn_table;
+
+    /**
+     * \brief Compute the mobility of one side in centipawns.
+     */
+    static int mobility(const Position& p, bool white);
+
+    /**
+     * \brief Compute the pawn structure score of one side in centipawns.
+     *
+     * Higher scores are better for that side.
+     */
+    static int pawn_structure(const Position& p, bool white);
+
+  public:
+    /**
+     * \brief Allocate the pawn table if it has not been allocated yet.
+     *
+     * Cached scores are kept between searches since they don't depend on
+     * anything but the pawns.
+     */
+    void initialize(GameState& gs) override;
+
+    double evaluate_position(GameState& gs) override;
+
+    /**
+     * \brief Get the pawn structure score of a position in centipawns.
+     *
+     * This is positive when white's pawns are better. The cached score is
+     * used if there is one.
+     */
+    int pawn_score(const Position& p);
+
+    std::unique_ptr<Evaluator> clone() const override {
+      return std::make_unique<IncrementalEvaluator>(*this);
+    }
 };
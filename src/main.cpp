@@ -3,75 +3,212 @@
 #include <vector>
 #include <cctype>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <optional>
 #include <chrono>
 #include <functional>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <random>
+#include <iomanip>
+#include <sstream>
 
+#include "batch.hpp"
+#include "bench.hpp"
+#include "book.hpp"
 #include "movegen.hpp"
 #include "search.hpp"
 #include "evaluation.hpp"
+#include "nnue.hpp"
+#include "perft.hpp"
+#include "selfplay.hpp"
+#include "training.hpp"
 
 #define DEFAULT_WRITE_PERIOD 500
+// The number of plies of each line makebook adds to a book by default.
+#define DEFAULT_BOOK_PLY 20
 
 using namespace std::chrono_literals;
 
 /**
- * \brief Track resource limits and provide status updates for a search.
- *
- * This function is responsible for keeping track of time limits in a search
- * and for providing search info to the interface.
- *
- * \param limits The resource limits on the current search.
- * \param info Information about the curren search.
- * \param stop_signal Indicates that the search is out of resources.
- * \param write_period The frequence to write data to the interface.
+ * \brief The state shared by a search and the thread reporting on it.
  */
-void report(const SearchLimits& limits, SearchInfo& info,
-    bool& stop_signal, unsigned write_period) {
-  auto start = std::chrono::system_clock::now();
-  auto last_write = start;
-  while (true) {
-    // Wait a short time between iterations
-    std::this_thread::sleep_for(10ms);
+struct ReportChannel {
+  std::mutex lock;
+  /** Notified when the search is over. */
+  std::condition_variable done_cv;
+  /** Set once the search is over. */
+  bool done = false;
+};
 
-    // Update info
-    auto current = std::chrono::system_clock::now();
-    unsigned elapsed = (current - start) / 1ms;
-    info.time = elapsed;
+/**
+ * \brief Get a count as a percentage of a total, or 0 if the total is 0.
+ */
+double percent(uint64_t count, uint64_t total) {
+  return total ? 100.0 * count / total : 0.0;
+}
 
-    // Stop if the timeout has passed
-    bool stop = limits.timeout && elapsed > *limits.timeout;
-    // We use ||= here in case another thread has signaled a stop
-    stop_signal = stop_signal || stop;
+/**
+ * \brief Write the statistics of iterations which have not been written yet.
+ *
+ * \param info Information about the current search.
+ * \param written The number of iterations already written. This is updated.
+ */
+void report_iterations(SearchInfo& info, size_t& written) {
+  std::lock_guard<std::mutex> guard(info.pv_lock);
+  for (; written < info.iterations.size(); written++) {
+    const IterationStats& it = info.iterations[written];
+    const SearchStats& s = it.stats;
+    // Rates are written with two decimals without changing the format of
+    // everything else written to std::cout.
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(2);
+    line << "info string depth " << it.depth << " time " << it.time <<
+      " nodes " << s.nodes << " nps " <<
+      s.nodes * 1000 / std::max(it.duration, 1u);
+    // The effective branching factor is how many times more nodes this
+    // iteration needed than the one before.
+    if (written > 0 && info.iterations[written - 1].stats.nodes > 0) {
+      line << " ebf " <<
+        (double) s.nodes / info.iterations[written - 1].stats.nodes;
+    }
+    line << " fmc " << percent(s.first_move_cutoffs, s.cutoffs) <<
+      "% qnodes " << percent(s.qnodes, s.nodes) << "% evals " << s.evals <<
+      " ttprobes " << s.tt_probes << " tthits " <<
+      percent(s.tt_hits, s.tt_probes) << "%";
+    if (!it.complete) {
+      line << " incomplete";
+    }
+    std::cout << line.str() << std::endl;
+  }
+}
 
-    // Limit writes to every `write_period` ms in order to avoid overwhelming
-    // the GUI
-    if ((current - last_write) / 1ms >= write_period) {
-      // Write out info
-      std::cout << "info score cp " << (int) (info.score * 100) << " depth " <<
-        info.depth << " nodes " << info.nodes << " time " << info.time <<
+/**
+ * \brief Write the progress of a search to the interface.
+ *
+ * A MultiPV search writes one line of info for each of its lines.
+ */
+void write_info(SearchInfo& info) {
+  info.pv_lock.lock();
+  if (info.lines.empty()) {
+    std::cout << "info score cp " << (int) (info.score * 100) <<
+      " depth " << info.depth << " nodes " << info.nodes << " tbhits " <<
+      info.tbhits << " time " << info.time << " pv ";
+    for (const Move& m : info.pv) {
+      std::cout << m << " ";
+    }
+    std::cout << std::endl;
+  } else {
+    for (size_t i = 0; i < info.lines.size(); i++) {
+      const PVLine& line = info.lines[i];
+      std::cout << "info multipv " << i + 1 << " score cp " <<
+        (int) (line.score * 100) << " depth " << line.depth << " nodes " <<
+        info.nodes << " tbhits " << info.tbhits << " time " << info.time <<
         " pv ";
-      info.pv_lock.lock();
-      for (const Move& m : info.pv) {
+      for (const Move& m : line.pv) {
         std::cout << m << " ";
       }
-      info.pv_lock.unlock();
       std::cout << std::endl;
-      last_write = current;
     }
+  }
+  info.pv_lock.unlock();
+}
 
-    if (stop_signal) {
-      return;
+/**
+ * \brief Provide status updates for a search.
+ *
+ * Time limits are enforced by the search itself, so this only writes search
+ * info to the interface every `write_period` ms until the search is over,
+ * and once more with the final result. It sleeps on a condition variable in
+ * between, so it wakes up as soon as the search finishes rather than at the
+ * next write.
+ *
+ * \param info Information about the curren search.
+ * \param channel Tells the reporter when the search is over.
+ * \param write_period The frequence to write data to the interface.
+ * \param debug If true, also write the statistics of each iteration.
+ */
+void report(SearchInfo& info, ReportChannel& channel, unsigned write_period,
+    bool debug) {
+  size_t written = 0;
+  auto start = std::chrono::steady_clock::now();
+  auto next_write = start + write_period * 1ms;
+  std::unique_lock<std::mutex> guard(channel.lock);
+  while (!channel.done_cv.wait_until(guard, next_write,
+        [&channel]() { return channel.done; })) {
+    auto current = std::chrono::steady_clock::now();
+    info.time = (current - start) / 1ms;
+    write_info(info);
+    if (debug) {
+      report_iterations(info, written);
     }
+    next_write = current + write_period * 1ms;
+  }
+  // The final result, which a short search may not have written yet.
+  info.time = (std::chrono::steady_clock::now() - start) / 1ms;
+  write_info(info);
+  if (debug) {
+    report_iterations(info, written);
   }
 }
 
 /**
- * \brief A wrapper to help the searcher work with threads.
+ * \brief Wakes a search which finished while pondering once the GUI sends
+ * ponderhit or stop.
+ */
+struct PonderChannel {
+  std::mutex lock;
+  /** Notified when pondering ends or the search is stopped. */
+  std::condition_variable cv;
+};
+
+/**
+ * \brief Run a search, reporting on it from another thread.
+ *
+ * Once the search is over, whether it ran out of resources or was told to
+ * stop, the reporting thread is stopped and the best move is written to the
+ * interface. The move the search expects in reply is suggested for
+ * pondering.
+ *
+ * While pondering the GUI doesn't expect a move, so a search which ends on
+ * its own first waits for ponderhit or stop.
+ *
+ * \param debug If true, search statistics are written too.
  */
 void search_helper(Searcher& searcher, GameState& gs, const SearchLimits& limits,
-    SearchInfo& info, bool& stop_signal) {
-  searcher.search(gs, limits, info, stop_signal);
+    SearchInfo& info, std::atomic<bool>& stop_signal, PonderChannel& ponder,
+    bool debug) {
+  ReportChannel channel;
+  std::thread reporter(report, std::ref(info), std::ref(channel),
+      DEFAULT_WRITE_PERIOD, debug);
+  Move best = searcher.search(gs, limits, info, stop_signal).second;
+  {
+    std::lock_guard<std::mutex> guard(channel.lock);
+    channel.done = true;
+  }
+  channel.done_cv.notify_one();
+  reporter.join();
+  {
+    std::unique_lock<std::mutex> guard(ponder.lock);
+    ponder.cv.wait(guard, [&info, &stop_signal]() {
+        return !info.pondering || stop_signal;
+      });
+  }
+  // UCI writes a null move as "0000".
+  if (best.is_null()) {
+    std::cout << "bestmove 0000" << std::endl;
+    return;
+  }
+  std::cout << "bestmove " << best;
+  info.pv_lock.lock();
+  if (info.pv.size() > 1 && info.pv[0] == best) {
+    std::cout << " ponder " << info.pv[1];
+  }
+  info.pv_lock.unlock();
+  std::cout << std::endl;
 }
 
 /**
@@ -84,57 +221,212 @@ class Engine {
   private:
     /** The search algorithm to use for this engine. */
     std::unique_ptr<Searcher> searcher;
-    /** The thread responsible for the game search. */
+    /** The thread responsible for the game search. It starts its own thread
+     * to report progress. */
     std::optional<std::thread> work_thread;
-    /** The thread responsible for monitoring time limits. */
-    std::optional<std::thread> timer_thread;
-    /** A signal variable for telling the work/timer threads to halt. */
-    bool stop_signal;
-    /** The best available move, to be set by the work thread. */
-    std::optional<Move> best_move;
+    /** Set to tell the search to halt. The search reads it at every node. */
+    std::atomic<bool> stop_signal;
     SearchInfo info;
+    /** The limits of the current search. The work thread refers to these, so
+     * they must outlive the search. */
+    SearchLimits limits;
+    /** The position being searched. This is a copy so that the interface can
+     * change the game while the search runs. */
+    GameState state;
+    /** Wakes the work thread when pondering ends. */
+    PonderChannel ponder;
+    /** If true, searches write their statistics as well. */
+    bool debug;
+
+    /**
+     * \brief Wake the work thread if it is waiting for pondering to end.
+     */
+    void notify_ponder() {
+      // Taking the lock means the work thread is either not waiting yet, and
+      // will see the change, or already waiting and will be woken.
+      { std::lock_guard<std::mutex> guard(ponder.lock); }
+      ponder.cv.notify_one();
+    }
 
   public:
     Engine(std::unique_ptr<Searcher>&& s): searcher{std::move(s)},
-      work_thread{}, timer_thread{}, stop_signal{false}, best_move{},
-      info{} {}
+      work_thread{}, stop_signal{false}, info{}, limits{}, state{}, ponder{},
+      debug{false} {}
+
+    /**
+     * \brief Turn debugging output on or off.
+     *
+     * This takes effect from the next search.
+     */
+    void set_debug(bool d) {
+      debug = d;
+    }
 
     /**
      * \brief Start searching with the speficied limits.
      *
-     * \param limits Limitations which can be placed on search time.
+     * The best move is written to the interface when the search ends. Any
+     * previous search is stopped first.
+     *
+     * \param l Limitations which can be placed on search time.
+     * \param pondering If true, the search ignores the clock and the best
+     * move is not written until ponderhit or stop.
      */
-    void start(SearchLimits limits, GameState& gs) {
-      searcher->initialize(gs);
-      timer_thread = std::thread(report, std::cref(limits), std::ref(info),
-          std::ref(stop_signal), DEFAULT_WRITE_PERIOD);
+    void start(SearchLimits l, const GameState& gs, bool pondering) {
+      stop();
+      limits = l;
+      state = gs;
+      info.pondering = pondering;
       work_thread = std::thread(search_helper, std::ref(*searcher),
-          std::ref(gs), std::cref(limits), std::ref(info),
-          std::ref(stop_signal));
+          std::ref(state), std::cref(limits), std::ref(info),
+          std::ref(stop_signal), std::ref(ponder), debug);
+    }
+
+    /**
+     * \brief Start a new game.
+     *
+     * Until then the searcher keeps its tables from one move to the next.
+     * Any search is stopped first.
+     */
+    void new_game() {
+      stop();
+      searcher->new_game();
+    }
+
+    /**
+     * \brief Tell a pondering search that the opponent played the expected
+     * move.
+     *
+     * The search carries on where it is, but from now on it is limited by
+     * the clock given when it started. This does nothing if the engine isn't
+     * pondering.
+     */
+    void ponderhit() {
+      if (work_thread && info.pondering) {
+        info.pondering = false;
+        notify_ponder();
+      }
     }
 
     /**
-     * \brief Stop the current search and return the best move.
+     * \brief Stop the current search and wait for it to finish.
      *
-     * \return The best move found by the searcher.
+     * This does nothing if there is no search running.
      */
-    Move stop() {
+    void stop() {
       if (work_thread) {
-        // NOTE: The two threads should always be started together
         stop_signal = true;
+        notify_ponder();
         work_thread->join();
-        timer_thread->join();
         stop_signal = false;
+        info.pondering = false;
       }
       work_thread = {};
-      timer_thread = {};
+    }
+};
+
+/**
+ * \brief Run a perft test and write the results to the interface.
+ *
+ * \param gs The position to start from.
+ * \param depth The number of plies to search.
+ * \param threads The number of threads to split the root moves across.
+ * \param per_move If true, also write the node count below each root move.
+ */
+void run_perft(const GameState& gs, unsigned depth, unsigned threads,
+    bool per_move) {
+  auto start = std::chrono::steady_clock::now();
+  uint64_t nodes = 0;
+  if (depth == 0) {
+    nodes = 1;
+  }
+  for (const auto& [m, n] : divide(gs, depth, threads)) {
+    if (per_move) {
+      std::cout << m << ": " << n << std::endl;
+    }
+    nodes += n;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  uint64_t ms = elapsed / 1ms;
+  uint64_t nps = nodes * 1000 / std::max<uint64_t>(ms, 1);
+  if (per_move) {
+    std::cout << std::endl;
+  }
+  std::cout << "Nodes searched: " << nodes << std::endl;
+  std::cout << "Time: " << ms << " ms" << std::endl;
+  std::cout << "Nodes/second: " << nps << std::endl;
+}
+
+/**
+ * \brief Parse the arguments of a perft or divide command.
+ *
+ * The arguments are `<depth> [threads <n>]`, starting at the given index.
+ */
+std::pair<unsigned, unsigned> parse_perft_args(
+    const std::vector<std::string>& tokens, unsigned index) {
+  if (index >= tokens.size()) {
+    throw std::runtime_error("Expected a depth for perft");
+  }
+  unsigned depth = std::stoi(tokens[index]);
+  unsigned threads = 1;
+  if (index + 2 < tokens.size() && tokens[index + 1] == "threads") {
+    threads = std::stoi(tokens[index + 2]);
+  }
+  return std::make_pair(depth, threads);
+}
 
-      if (info.pv.empty()) {
-        throw std::runtime_error("Stopped before finding any moves!");
+/**
+ * \brief Parse the arguments of a position command.
+ *
+ * The arguments are `[startpos | fen <fen>] [moves <move>...]`, starting at
+ * the given index. Without a starting position the moves are played from the
+ * current game state.
+ *
+ * \param gs The game state to set.
+ * \param on_move If given, this is called with each move and the game state
+ * before it is played.
+ */
+void parse_position(const std::vector<std::string>& tokens, unsigned index,
+    GameState& gs,
+    const std::function<void(const GameState&, const Move&)>& on_move = {}) {
+  if (index >= tokens.size()) {
+    throw std::runtime_error("Expected a position");
+  }
+  unsigned start = index;
+  if (tokens[start] == "fen") {
+    if (tokens.size() < start + 2) {
+      throw std::runtime_error("Expected FEN string after position fen");
+    }
+    index = start + 1;
+    std::string fen;
+    while (index < tokens.size() && tokens[index] != "moves") {
+      if (index > start + 1) {
+        fen += " ";
       }
-      return info.pv.front();
+      fen += tokens[index];
+      index++;
     }
-};
+    gs = GameState(fen);
+  } else if (tokens[start] == "startpos") {
+    gs = GameState();
+    index = start + 1;
+  } else if (tokens[start] != "moves") {
+    throw std::runtime_error("Unrecognized argument in position");
+  }
+  if (tokens.size() > index) {
+    if (tokens[index] == "moves") {
+      for (unsigned i = index + 1; i < tokens.size(); i++) {
+        Move m = gs.convert_move(tokens[i]);
+        if (on_move) {
+          on_move(gs, m);
+        }
+        gs.make_move(m);
+      }
+    } else {
+      throw std::runtime_error("Unrecognized arguments to command position");
+    }
+  }
+}
 
 std::vector<std::string> split(const std::string& inp) {
   std::vector<std::string> ret;
@@ -161,15 +453,212 @@ bool is_move(const std::string& move) {
     move[2] <= 'h' && '1' <= move[3] && move[3] <= '8';
 }
 
+/**
+ * \brief Analyze a file of positions without the UCI loop.
+ *
+ * The arguments are `<file> [depth <n>] [nodes <n>] [threads <n>]
+ * [hash <mb>] [format json|csv] [evalfile <path>]`, where a file of "-" is
+ * standard input. At least one of depth and nodes must be given, so that
+ * every position gets the same search regardless of the machine.
+ */
+int run_batch_command(const std::vector<std::string>& args) {
+  if (args.empty()) {
+    throw std::runtime_error("Expected an input file for batch");
+  }
+  BatchOptions options;
+  std::unique_ptr<Evaluator> eval = std::make_unique<IncrementalEvaluator>();
+  for (unsigned i = 1; i < args.size(); i += 2) {
+    if (i + 1 >= args.size()) {
+      throw std::runtime_error("Expected a value for batch argument " +
+          args[i]);
+    }
+    const std::string& value = args[i + 1];
+    if (args[i] == "depth") {
+      options.limits.depth_limit = std::stoi(value);
+    } else if (args[i] == "nodes") {
+      options.limits.node_limit = std::stoull(value);
+    } else if (args[i] == "threads") {
+      options.threads = std::clamp(std::stoi(value), 1, MAX_THREADS);
+    } else if (args[i] == "hash") {
+      options.hash = std::clamp(std::stoi(value), 1, MAX_HASH_SIZE);
+    } else if (args[i] == "format") {
+      if (value == "json") {
+        options.format = BatchOptions::Format::JSON;
+      } else if (value == "csv") {
+        options.format = BatchOptions::Format::CSV;
+      } else {
+        throw std::runtime_error("Unrecognized batch format " + value);
+      }
+    } else if (args[i] == "evalfile") {
+      eval = std::make_unique<NNUEEvaluator>(NNUENetwork::load(value));
+    } else {
+      throw std::runtime_error("Unrecognized batch argument " + args[i]);
+    }
+  }
+  if (!options.limits.depth_limit && !options.limits.node_limit) {
+    throw std::runtime_error("Expected a depth or node limit for batch");
+  }
+  // Results are written whenever they are ready, so output is only flushed
+  // per line rather than synchronized with C stdio.
+  std::ios::sync_with_stdio(false);
+  if (args[0] == "-") {
+    run_batch(std::cin, std::cout, *eval, options);
+  } else {
+    std::ifstream in(args[0]);
+    if (!in) {
+      throw std::runtime_error("Could not open " + args[0]);
+    }
+    run_batch(in, std::cout, *eval, options);
+  }
+  return 0;
+}
+
+/**
+ * \brief Build an opening book from a file of lines.
+ *
+ * The arguments are `<input> <output> [maxply <n>]`. Each input line has the
+ * arguments of a position command, such as `startpos moves e2e4 e7e5`. Every
+ * move played in the first `maxply` plies of a line is added to the book,
+ * weighted by the number of lines playing it.
+ */
+int run_makebook_command(const std::vector<std::string>& args) {
+  if (args.size() < 2) {
+    throw std::runtime_error("Expected input and output files for makebook");
+  }
+  unsigned max_ply = DEFAULT_BOOK_PLY;
+  if (args.size() == 4 && args[2] == "maxply") {
+    max_ply = std::stoi(args[3]);
+  } else if (args.size() != 2) {
+    throw std::runtime_error("Unrecognized arguments to makebook");
+  }
+  std::ifstream in(args[0]);
+  if (!in) {
+    throw std::runtime_error("Could not open " + args[0]);
+  }
+  // The weight of each move in each position, keyed by the book key and the
+  // encoded move.
+  std::map<std::pair<uint64_t, uint16_t>, uint32_t> counts;
+  unsigned lines = 0;
+  for (std::string line; std::getline(in, line);) {
+    std::vector<std::string> tokens = split(line);
+    if (tokens.empty() || tokens[0][0] == '#') {
+      continue;
+    }
+    GameState gs;
+    unsigned ply = 0;
+    parse_position(tokens, 0, gs, [&](const GameState& g, const Move& m) {
+        if (ply++ < max_ply) {
+          counts[{OpeningBook::key(g), OpeningBook::encode_move(m)}]++;
+        }
+      });
+    lines++;
+  }
+  std::vector<BookEntry> entries;
+  for (const auto& [k, n] : counts) {
+    uint16_t weight = std::min<uint32_t>(n, UINT16_MAX);
+    entries.push_back({k.first, k.second, weight, 0});
+  }
+  OpeningBook::write(args[1], entries);
+  std::cout << "Wrote " << entries.size() << " entries from " << lines <<
+    " lines" << std::endl;
+  return 0;
+}
+
+/**
+ * \brief Generate training data by playing the engine against itself.
+ *
+ * The arguments are `<output> [games <n>] [depth <n>] [nodes <n>]
+ * [threads <n>] [hash <mb>] [randomply <n>] [maxply <n>] [seed <n>]
+ * [append true|false] [evalfile <path>]`. At least one of depth and nodes
+ * must be given. The output is a file of packed training records, see
+ * pack_record.
+ */
+int run_selfplay_command(const std::vector<std::string>& args) {
+  if (args.empty()) {
+    throw std::runtime_error("Expected an output file for selfplay");
+  }
+  SelfPlayOptions options;
+  bool append = false;
+  std::unique_ptr<Evaluator> eval = std::make_unique<IncrementalEvaluator>();
+  for (unsigned i = 1; i < args.size(); i += 2) {
+    if (i + 1 >= args.size()) {
+      throw std::runtime_error("Expected a value for selfplay argument " +
+          args[i]);
+    }
+    const std::string& value = args[i + 1];
+    if (args[i] == "games") {
+      options.games = std::stoul(value);
+    } else if (args[i] == "depth") {
+      options.limits.depth_limit = std::stoi(value);
+    } else if (args[i] == "nodes") {
+      options.limits.node_limit = std::stoull(value);
+    } else if (args[i] == "threads") {
+      options.threads = std::clamp(std::stoi(value), 1, MAX_THREADS);
+    } else if (args[i] == "hash") {
+      options.hash = std::clamp(std::stoi(value), 1, MAX_HASH_SIZE);
+    } else if (args[i] == "randomply") {
+      options.random_plies = std::stoul(value);
+    } else if (args[i] == "maxply") {
+      options.max_plies = std::stoul(value);
+    } else if (args[i] == "seed") {
+      options.seed = std::stoull(value);
+    } else if (args[i] == "append") {
+      append = value == "true";
+    } else if (args[i] == "evalfile") {
+      eval = std::make_unique<NNUEEvaluator>(NNUENetwork::load(value));
+    } else {
+      throw std::runtime_error("Unrecognized selfplay argument " + args[i]);
+    }
+  }
+  if (!options.limits.depth_limit && !options.limits.node_limit) {
+    throw std::runtime_error("Expected a depth or node limit for selfplay");
+  }
+  TrainingWriter out(args[0], append);
+  uint64_t positions = run_selfplay(out, *eval, options);
+  std::cout << "Wrote " << positions << " positions from " << options.games <<
+    " games" << std::endl;
+  return 0;
+}
+
 int main(int argc, char** argv) {
-  bool boards_initialized = false;
+  movegen_initialize_attack_boards();
+
+  // Non-standard: "engine batch <file> ..." analyzes a file of positions and
+  // exits.
+  if (argc > 1 && std::string(argv[1]) == "batch") {
+    return run_batch_command(std::vector<std::string>(argv + 2, argv + argc));
+  }
+  // Non-standard: "engine makebook <input> <output>" writes an opening book.
+  if (argc > 1 && std::string(argv[1]) == "makebook") {
+    return run_makebook_command(
+        std::vector<std::string>(argv + 2, argv + argc));
+  }
+  // Non-standard: "engine selfplay <output> ..." writes training data from
+  // self-play games.
+  if (argc > 1 && std::string(argv[1]) == "selfplay") {
+    return run_selfplay_command(
+        std::vector<std::string>(argv + 2, argv + argc));
+  }
 
   GameState gs;
-  std::optional<Move> ponder_move;
 
-  std::unique_ptr<Evaluator> eval = std::make_unique<BasicEvaluator>();
-  std::unique_ptr<Searcher> search = std::make_unique<BasicAlphaBetaSearcher>(std::move(eval));
+  std::shared_ptr<TranspositionTable> tt =
+    std::make_shared<TranspositionTable>(DEFAULT_HASH_SIZE);
+  // The searcher gets a clone of the evaluator, and we keep the original for
+  // the bench command.
+  std::unique_ptr<Evaluator> eval = std::make_unique<IncrementalEvaluator>();
+  std::unique_ptr<LazySMPSearcher> search =
+    std::make_unique<LazySMPSearcher>(eval->clone(), tt, 1, true);
+  // The engine owns the searcher, but we keep a pointer to change options.
+  LazySMPSearcher* smp = search.get();
+  SearchParams params;
   Engine engine(std::move(search));
+  // The opening book, if a file has been given, and whether to use it.
+  std::unique_ptr<OpeningBook> book;
+  bool own_book = false;
+  std::mt19937_64 book_rng(std::random_device{}());
+  // The number of lines each search finds.
+  unsigned multipv = 1;
 
   // Handle UCI commands
   for (std::string line; std::getline(std::cin, line);) {
@@ -180,102 +669,193 @@ int main(int argc, char** argv) {
       }
       std::cout << "id name Test" << std::endl;
       std::cout << "id author Greg Anderson" << std::endl;
-      // We should send option information here once it exists.
+      std::cout << "option name Hash type spin default " << DEFAULT_HASH_SIZE
+        << " min 1 max " << MAX_HASH_SIZE << std::endl;
+      std::cout << "option name Threads type spin default 1 min 1 max "
+        << MAX_THREADS << std::endl;
+      std::cout << "option name EvalFile type string default <empty>"
+        << std::endl;
+      std::cout << "option name Ponder type check default false" <<
+        std::endl;
+      std::cout << "option name MultiPV type spin default 1 min 1 max " <<
+        MAX_MULTIPV << std::endl;
+      std::cout << "option name OwnBook type check default false" <<
+        std::endl;
+      std::cout << "option name BookFile type string default <empty>" <<
+        std::endl;
+      std::cout << "option name SyzygyPath type string default <empty>" <<
+        std::endl;
+      for (const SearchParams::Option& opt : SearchParams::options()) {
+        std::cout << "option name " << opt.name << " type spin default " <<
+          params.*opt.value << " min " << opt.min << " max " << opt.max <<
+          std::endl;
+      }
       std::cout << "uciok" << std::endl;
     } else if (tokens[0] == "debug") {
       if (tokens.size() != 2) {
         throw std::runtime_error("Wrong number of arguments to command debug");
       }
       if (tokens[1] == "on") {
-        // We don't do any debugging right now
+        engine.set_debug(true);
+        if (!SEARCH_STATS_ENABLED) {
+          std::cout << "info string search statistics are not compiled in" <<
+            std::endl;
+        }
       } else if (tokens[1] == "off") {
-        // We don't do any debugging right now
+        engine.set_debug(false);
       } else {
         throw std::runtime_error("Unexpected argument to command debug");
       }
     } else if (tokens[0] == "isready") {
-      movegen_initialize_attack_boards();
-      boards_initialized = true;
       std::cout << "readyok" << std::endl;
     } else if (tokens[0] == "setoption") {
-      // There are currently no options that can be set.
-      throw std::runtime_error("Unrecognized option in setoption");
+      // The format is "setoption name <id> [value <x>]", where the name may
+      // contain spaces.
+      if (tokens.size() < 3 || tokens[1] != "name") {
+        throw std::runtime_error("Expected option name after setoption");
+      }
+      unsigned index = 2;
+      std::string name;
+      while (index < tokens.size() && tokens[index] != "value") {
+        if (index > 2) {
+          name += " ";
+        }
+        name += tokens[index];
+        index++;
+      }
+      // Values may contain spaces too, for example in file names.
+      std::optional<std::string> value;
+      for (index++; index < tokens.size(); index++) {
+        value = value ? *value + " " + tokens[index] : tokens[index];
+      }
+      if (name == "Hash") {
+        if (!value) {
+          throw std::runtime_error("Expected a value for option Hash");
+        }
+        tt->resize(std::clamp(std::stoi(*value), 1, MAX_HASH_SIZE));
+      } else if (name == "Threads") {
+        if (!value) {
+          throw std::runtime_error("Expected a value for option Threads");
+        }
+        smp->set_threads(std::stoi(*value));
+      } else if (name == "EvalFile") {
+        // Without a network we fall back to the hand-written evaluation.
+        if (!value || *value == "<empty>") {
+          eval = std::make_unique<IncrementalEvaluator>();
+        } else {
+          eval = std::make_unique<NNUEEvaluator>(NNUENetwork::load(*value));
+        }
+        smp->set_evaluator(eval->clone());
+      } else if (name == "MultiPV") {
+        if (!value) {
+          throw std::runtime_error("Expected a value for option MultiPV");
+        }
+        multipv = std::clamp(std::stoi(*value), 1, MAX_MULTIPV);
+      } else if (name == "Ponder") {
+        // This only tells us the GUI may send go ponder, which we always
+        // handle.
+      } else if (name == "OwnBook") {
+        own_book = value && *value == "true";
+      } else if (name == "BookFile") {
+        // The old book is unmapped before the new one is mapped.
+        book = nullptr;
+        if (value && *value != "<empty>") {
+          book = std::make_unique<OpeningBook>(*value);
+        }
+      } else if (name == "SyzygyPath") {
+        std::shared_ptr<SyzygyTablebase> tb;
+        if (value && *value != "<empty>") {
+          tb = std::make_shared<SyzygyTablebase>(*value);
+          std::cout << "info string found " << tb->wdl_tables() <<
+            " WDL and " << tb->dtz_tables() << " DTZ tables with up to " <<
+            tb->max_pieces() << " pieces" << std::endl;
+        }
+        smp->set_tablebase(tb);
+      } else {
+        // Search parameters, which exist mostly for tuning.
+        const std::vector<SearchParams::Option>& options =
+          SearchParams::options();
+        auto opt = std::find_if(options.begin(), options.end(),
+            [&name](const SearchParams::Option& o) { return name == o.name; });
+        if (opt == options.end()) {
+          throw std::runtime_error("Unrecognized option in setoption");
+        }
+        if (!value) {
+          throw std::runtime_error("Expected a value for option " + name);
+        }
+        params.*opt->value = std::clamp(std::stoi(*value), opt->min, opt->max);
+        smp->set_params(params);
+      }
     } else if (tokens[0] == "register") {
       // There is no required registration
     } else if (tokens[0] == "ucinewgame") {
-      // We currently don't have anything advanced enough to care about this.
+      // Results from the previous game are unlikely to be useful
+      engine.new_game();
     } else if (tokens[0] == "position") {
       if (tokens.size() < 2) {
         throw std::runtime_error("Not enough arguments to command position");
       }
-      unsigned index = 0;
-      if (tokens[1] == "fen") {
-        if (tokens.size() < 3) {
-          throw std::runtime_error("Expected FEN string after position fen");
-        }
-        index = 2;
-        std::string fen;
-        while (index < tokens.size() && tokens[index] != "moves") {
-          if (index > 2) {
-            fen += " ";
-          }
-          fen += tokens[index];
-          index++;
-        }
-        gs = GameState(fen);
-      } else if (tokens[1] == "startpos") {
-        gs = GameState();
-        index = 2;
-      } else if (tokens[1] == "moves") {
-        index = 1;
-      } else {
-        throw std::runtime_error("Unrecognized argument in position");
-      }
-      if (tokens.size() > index) {
-        if (tokens[index] == "moves") {
-          for (unsigned i = index + 1; i < tokens.size(); i++) {
-            Move m = gs.convert_move(tokens[i]);
-            gs.make_move(m);
-          }
-        } else {
-          throw std::runtime_error("Unrecognized arguments to command position");
-        }
+      parse_position(tokens, 1, gs);
+    } else if (tokens[0] == "go" && tokens.size() > 1 && tokens[1] == "perft") {
+      // Non-standard: "go perft <depth> [threads <n>]" counts leaf nodes.
+      auto [depth, threads] = parse_perft_args(tokens, 2);
+      run_perft(gs, depth, threads, false);
+    } else if (tokens[0] == "bench") {
+      // Non-standard: "bench [depth]" searches a fixed set of positions and
+      // writes the total node count, which only changes when the search
+      // does, and the speed.
+      engine.stop();
+      unsigned depth = BENCH_DEPTH;
+      if (tokens.size() > 1) {
+        depth = std::stoi(tokens[1]);
       }
+      BenchResult result = run_bench(*eval, params, depth);
+      std::cout << "Nodes searched: " << result.nodes << std::endl;
+      std::cout << "Time: " << result.time << " ms" << std::endl;
+      std::cout << "Nodes/second: " << result.nps() << std::endl;
+    } else if (tokens[0] == "divide") {
+      // Non-standard: "divide <depth> [threads <n>]" is perft broken down by
+      // root move.
+      auto [depth, threads] = parse_perft_args(tokens, 1);
+      run_perft(gs, depth, threads, true);
     } else if (tokens[0] == "go") {
       SearchLimits limits;
+      bool ponder = false;
       unsigned ind = 1;
       while (ind < tokens.size()) {
         if (tokens[ind] == "searchmoves") {
           ind++;
           limits.moves = MoveList();
-          while (is_move(tokens[ind])) {
-            Move m = gs.convert_move(tokens[ind]);
-            ponder_move = m;
-            limits.moves->push_back(m);
+          while (ind < tokens.size() && is_move(tokens[ind])) {
+            limits.moves->push_back(gs.convert_move(tokens[ind]));
             ind++;
           }
           ind--;
         } else if (tokens[ind] == "ponder") {
-          if (ponder_move) {
-            gs.undo_move();
-            limits.moves = {*ponder_move};
-          }
+          // The position already includes the move we expect the opponent
+          // to play, so we search it as usual, just without the clock.
+          ponder = true;
         } else if (tokens[ind] == "wtime") {
-          // White time left, currently unused
+          ind++;
+          limits.wtime = std::stoi(tokens[ind]);
         } else if (tokens[ind] == "btime") {
-          // Black time left, currently unused
+          ind++;
+          limits.btime = std::stoi(tokens[ind]);
         } else if (tokens[ind] == "winc") {
-          // White increment, currently unused
+          ind++;
+          limits.winc = std::stoi(tokens[ind]);
         } else if (tokens[ind] == "binc") {
-          // Black increment, currently unused
+          ind++;
+          limits.binc = std::stoi(tokens[ind]);
         } else if (tokens[ind] == "movestogo") {
-          // Moves to the time control, currently unused
+          ind++;
+          limits.movestogo = std::stoi(tokens[ind]);
         } else if (tokens[ind] == "depth") {
           ind++;
           limits.depth_limit = std::stoi(tokens[ind]);
         } else if (tokens[ind] == "nodes") {
           ind++;
-          limits.node_limit = std::stoi(tokens[ind]);
+          limits.node_limit = std::stoull(tokens[ind]);
         } else if (tokens[ind] == "mate") {
           ind++;
           limits.mate_in = std::stoi(tokens[ind]);
@@ -287,24 +867,33 @@ int main(int argc, char** argv) {
         }
         ind++;
       }
-      engine.start(limits, gs);
+      if (multipv > 1) {
+        limits.multipv = multipv;
+      }
+      // A book move is played without searching. While pondering, limited
+      // to some moves or analyzing several lines, we search as usual.
+      if (own_book && book && !ponder && !limits.moves && multipv == 1) {
+        std::optional<Move> m = book->probe(gs, book_rng);
+        if (m) {
+          engine.stop();
+          std::cout << "info string book move" << std::endl;
+          std::cout << "bestmove " << *m << std::endl;
+          continue;
+        }
+      }
+      engine.start(limits, gs, ponder);
     } else if (tokens[0] == "stop") {
-      Move best = engine.stop();
-      std::cout << "bestmove " << best << std::endl;
-    } else if (tokens[0] == "ponderhit") {
       engine.stop();
-      gs.make_move(*ponder_move);
-      ponder_move = {};
-      SearchLimits limits;
-      engine.start(limits, gs);
+    } else if (tokens[0] == "ponderhit") {
+      // The opponent played the move we pondered on, so the search we
+      // started keeps its tables, principle variation and depth. After a
+      // miss the GUI sends stop instead, which ends the search at once.
+      engine.ponderhit();
     } else if (tokens[0] == "quit") {
+      engine.stop();
       break;
     } else {
       throw std::runtime_error("Unrecognzized command");
     }
   }
-
-  if (boards_initialized) {
-    movegen_free_magics();
-  }
 }
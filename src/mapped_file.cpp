@@ -0,0 +1,42 @@
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+
+MappedFile::MappedFile(const std::string& path, bool random):
+  bytes{nullptr}, length{0} {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open " + path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("Could not read " + path);
+  }
+  length = st.st_size;
+  // An empty file can't be mapped, but it is still a valid file.
+  if (length > 0) {
+    void* p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Could not map " + path);
+    }
+    if (random) {
+      madvise(p, length, MADV_RANDOM);
+    }
+    bytes = static_cast<const unsigned char*>(p);
+  }
+  // The mapping stays valid after the file is closed.
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (bytes) {
+    munmap(const_cast<unsigned char*>(bytes), length);
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * \brief A file mapped read-only into memory.
+ *
+ * The mapping is shared, so every process mapping the same file uses the
+ * same pages of the page cache, and only the pages which are touched are
+ * read from disk.
+ */
+class MappedFile {
+  private:
+    /** The start of the mapping, or null for an empty file. */
+    const unsigned char* bytes;
+    /** The size of the file in bytes. */
+    size_t length;
+
+  public:
+    /**
+     * \brief Map a file.
+     *
+     * A std::runtime_error is thrown if the file can't be opened or mapped.
+     *
+     * \param random True if the file will be read in no particular order, so
+     * that the kernel doesn't read ahead.
+     */
+    MappedFile(const std::string& path, bool random = true);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * \brief Get the contents of the file.
+     */
+    inline const unsigned char* data() const {
+      return bytes;
+    }
+
+    /**
+     * \brief Get the size of the file in bytes.
+     */
+    inline size_t size() const {
+      return length;
+    }
+};
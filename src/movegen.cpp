@@ -1,9 +1,14 @@
 #include "movegen.hpp"
+#include "bits.hpp"
 #include "utils.hpp"
 
-#include <cstdlib>
-#include <set>
-#include <random>
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+
+#ifdef USE_PEXT
+#include <immintrin.h>
+#endif
 
 // A brief explanation of magic bitboards: When we need to figure out where
 // sliding pieces move, we need to consider many possible configurations of
@@ -19,32 +24,146 @@
 // index bits to store all of the relevant moves, rather than 64.
 // Given a Magic object m and a piece occupancy bitboard occ for the whole
 // board, we compute the possible attacks as
-// attack_table[((occ & m.mask) * magic) >> (64 - shift)]
+// m.attacks[((occ & m.mask) * m.magic) >> (64 - m.shift)]
+//
+// The magic numbers below were found once by a seeded random search and are
+// fixed, so start up only has to fill in the attack tables. Each square uses
+// exactly as many index bits as its mask has, and the tables for all squares
+// share one contiguous array.
+//
+// On CPUs with BMI2, the PEXT instruction extracts the bits of the occupancy
+// under the mask directly, which gives a perfect index without the multiply.
+// When built with USE_PEXT the tables are filled in that order instead and
+// the magic numbers go unused.
 
 /**
  * \brief A magic bitboard.
  */
 typedef struct {
-  /// The generated magic number.
+  /// The magic number.
   uint64_t magic;
   /// The occlusion mask.
   uint64_t mask;
-  /// An array of attack boards.
-  uint64_t* attack_table;
-  /// The shift to apply.
+  /// The attack boards for this square, part of attack_table.
+  uint64_t* attacks;
+  /// The number of index bits.
   int shift;
 } Magic;
 
+/// The magic numbers for rooks on each square.
+static const uint64_t ROOK_MAGICS[64] = {
+  0x6a80028040001063ull, 0x3040004020001000ull, 0x4100084020001102ull,
+  0x0600102040860008ull, 0x8100110004020800ull, 0x0900040008010022ull,
+  0x0200042091282200ull, 0x0100008a0a264100ull, 0x2802802480004000ull,
+  0x0002401000200040ull, 0x0220801000802004ull, 0x9001000820100500ull,
+  0x4203000500124800ull, 0x040a001042000804ull, 0x8041000401000200ull,
+  0x0021800480106100ull, 0x2080004000402004ull, 0x000082802002c000ull,
+  0x00228080100a2000ull, 0x1010808010000800ull, 0x0020808008000400ull,
+  0x009c008080040200ull, 0x1942004080010040ull, 0x0100020010490884ull,
+  0x8080004040002002ull, 0x0580400240201000ull, 0x0500804200120020ull,
+  0x0000082100100100ull, 0x0006001200040920ull, 0x0042000200041008ull,
+  0x8408020080800100ull, 0x014b098200106704ull, 0x0120004000808000ull,
+  0x8020804000802000ull, 0x0010002001010040ull, 0x0589001001002008ull,
+  0x0000080080800402ull, 0x4002000402001008ull, 0x1800429904000810ull,
+  0x4000011082000044ull, 0x0038400480008020ull, 0x0010004020004008ull,
+  0x4008804600120020ull, 0x0010010080080800ull, 0x4000100801010004ull,
+  0x0001000400030018ull, 0x8008021801840050ull, 0x0420104108a20004ull,
+  0x4049400080012880ull, 0x0000400020100840ull, 0x4022841000200480ull,
+  0x3001002010000900ull, 0x2115012800e41100ull, 0x0412000805900200ull,
+  0x8006002724580600ull, 0x00c0808124004200ull, 0x48401100208001cbull,
+  0x0004120020408902ull, 0x0041044020000811ull, 0x0410010420089101ull,
+  0x0058000500154811ull, 0x2002008821102402ull, 0x04b400a108023004ull,
+  0x0080004400209102ull
+};
+
+/// The magic numbers for bishops on each square.
+static const uint64_t BISHOP_MAGICS[64] = {
+  0x0004203404208010ull, 0x4021024200410001ull, 0x0090040060401608ull,
+  0x900c24008081a001ull, 0x0004042000824020ull, 0x1b1c901009001480ull,
+  0x42840a0105600401ull, 0x0018160090045000ull, 0x440010c248110401ull,
+  0x4400249108030300ull, 0xa401042806005280ull, 0x0010044400820000ull,
+  0x0840040420000008ull, 0x0400020804060050ull, 0x02030d008824c000ull,
+  0x0000802401041000ull, 0x1204412020042108ull, 0x008200104c016400ull,
+  0x4a41060808002880ull, 0x1241000820460040ull, 0x000880d400a02000ull,
+  0x02160041004d2c22ull, 0x2000400084042050ull, 0x8100900200940120ull,
+  0x4010400010840100ull, 0x0201880404102404ull, 0xc308140022082200ull,
+  0x0009480009820040ull, 0x000f001081004001ull, 0x5048002002020101ull,
+  0x0004048005082140ull, 0x0002042020808800ull, 0x3002823124602020ull,
+  0x00a8040400100114ull, 0x1004040208010200ull, 0x0920220080080480ull,
+  0x10040100108c0041ull, 0x005850010008a080ull, 0x800c08028a085c09ull,
+  0xc085024200031108ull, 0x1804010590004000ull, 0x2000480804000800ull,
+  0x0010082090040800ull, 0x2000004010409a00ull, 0x043040450a040300ull,
+  0x0002200224800408ull, 0x0802020811080200ull, 0x2208222400400024ull,
+  0x0000a20110410100ull, 0x0202084108082410ull, 0x2112021142280022ull,
+  0x550c00082a080000ull, 0x0120842004240588ull, 0x020421020202000eull,
+  0x0008080108021281ull, 0x08e0042082004820ull, 0x20020504048c4440ull,
+  0x00081100a2104210ull, 0x001100004c022100ull, 0x000020000020a800ull,
+  0x0010001090020210ull, 0x8020006260020220ull, 0x220004a088810100ull,
+  0x0840018210850102ull
+};
+
+// The total size of the rook and bishop attack tables, the sum of two to the
+// number of mask bits over every square.
+#define ROOK_TABLE_SIZE 102400
+#define BISHOP_TABLE_SIZE 5248
+
+/// The attack boards of every rook and bishop magic.
+alignas(64) uint64_t attack_table[ROOK_TABLE_SIZE + BISHOP_TABLE_SIZE];
+
 /// A set of masks showing where the knight can move to from each square.
 uint64_t knight_moves[64];
 /// A set of masks showing where the king can move to from each square.
 uint64_t king_moves[64];
 
+/// For each pair of squares on a common rank, file or diagonal, the squares
+/// strictly between them. Zero for squares which are not aligned.
+uint64_t between_squares[64][64];
+/// For each pair of aligned squares, the whole line through both of them,
+/// from edge to edge. Zero for squares which are not aligned.
+uint64_t line_through[64][64];
+
 /// A set of magic bitboards describing rook moves form each square.
 Magic rook_magics[64];
 /// A set of magic bitboards describing bishop moves form each square.
 Magic bishop_magics[64];
 
+uint64_t knight_attacks(int square) {
+  return knight_moves[square];
+}
+
+uint64_t king_attacks(int square) {
+  return king_moves[square];
+}
+
+// Find the index of an occupancy in a magic's attack table.
+inline uint64_t magic_index(const Magic& m, uint64_t occupancy) {
+#ifdef USE_PEXT
+  return _pext_u64(occupancy, m.mask);
+#else
+  return ((occupancy & m.mask) * m.magic) >> (64 - m.shift);
+#endif
+}
+
+// Look up the squares attacked by a rook on the given square.
+uint64_t rook_attacks(int square, uint64_t occupancy) {
+  const Magic& rm = rook_magics[square];
+  return rm.attacks[magic_index(rm, occupancy)];
+}
+
+// Look up the squares attacked by a bishop on the given square.
+uint64_t bishop_attacks(int square, uint64_t occupancy) {
+  const Magic& bm = bishop_magics[square];
+  return bm.attacks[magic_index(bm, occupancy)];
+}
+
+const char* movegen_attack_backend() {
+#ifdef USE_PEXT
+  return "pext";
+#else
+  return "magic";
+#endif
+}
+
 // Get a board representing all of the pieces which can move to the given
 // target. Note that this move only considers moves which end with a piece
 // on the target square. In particular, if there is a pawn on the target
@@ -62,12 +181,8 @@ uint64_t get_attacks_to(const Position& p, int target, bool white_to_move,
   uint64_t rook_board = p.get_board(opp_rook);
   uint64_t queen_board = p.get_board(opp_queen);
   uint64_t king_board = p.get_board(opp_king);
-  Magic bm = bishop_magics[target];
-  uint64_t bishop_attack = bm.attack_table[((occupancy & bm.mask) * bm.magic)
-    >> (64 - bm.shift)];
-  Magic rm = rook_magics[target];
-  uint64_t rook_attack = rm.attack_table[((occupancy & rm.mask) * rm.magic)
-    >> (64 - rm.shift)];
+  uint64_t bishop_attack = bishop_attacks(target, occupancy);
+  uint64_t rook_attack = rook_attacks(target, occupancy);
   uint64_t check_board = knight_moves[target] & knight_board;
   check_board |= king_moves[target] & king_board;
   check_board |= bishop_attack & (bishop_board | queen_board);
@@ -77,8 +192,8 @@ uint64_t get_attacks_to(const Position& p, int target, bool white_to_move,
   int krank = target / 8;
   int kfile = target % 8;
   if (kfile < 7) {
-    if (white_to_move && krank < 7) {
-      if (p.piece_at(target + 9, opp_pawn)) {
+    if (white_to_move) {
+      if (krank < 7 && p.piece_at(target + 9, opp_pawn)) {
         check_board |= 1ull << (target + 9);
       }
     } else if (krank > 0) {
@@ -88,8 +203,8 @@ uint64_t get_attacks_to(const Position& p, int target, bool white_to_move,
     }
   }
   if (kfile > 0) {
-    if (white_to_move && krank < 7) {
-      if (p.piece_at(target + 7, opp_pawn)) {
+    if (white_to_move) {
+      if (krank < 7 && p.piece_at(target + 7, opp_pawn)) {
         check_board |= 1ull << (target + 7);
       }
     } else if (krank > 0) {
@@ -113,56 +228,239 @@ bool in_check(bool white_to_move, const Position& p) {
   return !(get_check_board(white_to_move, p) == 0);
 }
 
-// Count the number of 1 bits in a number
-int popcount(uint64_t x) {
-  int count = 0;
-  while (x != 0) {
-    count++;
-    x = x & (x - 1);
+int piece_score(int piece) {
+  switch (piece) {
+    case Position::W_PAWN:
+    case Position::B_PAWN:
+      return 1;
+    case Position::W_KNIGHT:
+    case Position::B_KNIGHT:
+    case Position::W_BISHOP:
+    case Position::B_BISHOP:
+      return 3;
+    case Position::W_ROOK:
+    case Position::B_ROOK:
+      return 5;
+    case Position::W_QUEEN:
+    case Position::B_QUEEN:
+      return 9;
+    case Position::W_KING:
+    case Position::B_KING:
+      return 100;
+    default:
+      throw std::runtime_error("Illegal capture: " + std::to_string(piece));
   }
-  return count;
 }
 
-#ifdef __GNUC__
-inline int lsb(uint64_t x) {
-  return __builtin_ctzll(x);
+// Get every piece of either color which attacks the target square, treating
+// only the squares in occupancy as occupied. Pieces which are not in the
+// occupancy are never included, so this can be used to play out a sequence of
+// captures without changing the position.
+uint64_t get_all_attacks_to(const Position& p, int target,
+    uint64_t occupancy) {
+  const uint64_t file_a = 0x0101010101010101ull;
+  const uint64_t file_h = file_a << 7;
+  uint64_t t = 1ull << target;
+  uint64_t queens = p.get_board(Position::W_QUEEN) |
+    p.get_board(Position::B_QUEEN);
+  uint64_t rooks = p.get_board(Position::W_ROOK) |
+    p.get_board(Position::B_ROOK) | queens;
+  uint64_t bishops = p.get_board(Position::W_BISHOP) |
+    p.get_board(Position::B_BISHOP) | queens;
+  uint64_t knights = p.get_board(Position::W_KNIGHT) |
+    p.get_board(Position::B_KNIGHT);
+  uint64_t kings = p.get_board(Position::W_KING) |
+    p.get_board(Position::B_KING);
+  // White pawns attack up the board and black pawns attack down it.
+  uint64_t white_pawns = (((t >> 7) & ~file_a) | ((t >> 9) & ~file_h)) &
+    p.get_board(Position::W_PAWN);
+  uint64_t black_pawns = (((t << 7) & ~file_h) | ((t << 9) & ~file_a)) &
+    p.get_board(Position::B_PAWN);
+  uint64_t attackers = white_pawns | black_pawns;
+  attackers |= knight_moves[target] & knights;
+  attackers |= king_moves[target] & kings;
+  attackers |= rook_attacks(target, occupancy) & rooks;
+  attackers |= bishop_attacks(target, occupancy) & bishops;
+  return attackers & occupancy;
 }
-#else
-inline int lsb(uint64_t x) {
-  uint64_t y = x - 1;
-  x = (x | y) ^ y;
-  return std::log2(x);
+
+int see(const Position& p, const Move& m) {
+  int from = m.from_square();
+  int to = m.to_square();
+  int attacker = p.get_piece(from);
+  bool white = attacker < Position::W_ALL;
+  uint64_t occupancy = p.get_board(Position::BOTH_ALL) & ~(1ull << from);
+  // gain[d] is the material won by the side making the d'th capture, assuming
+  // the exchange stops right after it.
+  int gain[32];
+  int d = 0;
+  if (m.capture_ep()) {
+    gain[0] = 1;
+    occupancy &= ~(1ull << (white ? to - 8 : to + 8));
+  } else {
+    int victim = p.get_piece(to);
+    gain[0] = victim >= 0 ? piece_score(victim) : 0;
+  }
+  // The value of the piece now standing on the target square.
+  int on_square = piece_score(attacker);
+  uint64_t attackers = get_all_attacks_to(p, to, occupancy);
+  while (true) {
+    white = !white;
+    // Find the least valuable piece of the side to move which can recapture.
+    int lva = -1;
+    uint64_t lva_board = 0;
+    for (int piece = Position::PAWN; piece <= Position::KING; piece++) {
+      lva_board = attackers & p.get_board(Position::color_piece(piece, white));
+      if (lva_board != 0) {
+        lva = Position::color_piece(piece, white);
+        break;
+      }
+    }
+    if (lva < 0) {
+      break;
+    }
+    d++;
+    gain[d] = on_square - gain[d - 1];
+    // If neither continuing nor stopping here helps the side to move, the
+    // rest of the exchange can't change the result.
+    if (std::max(-gain[d - 1], gain[d]) < 0) {
+      break;
+    }
+    on_square = piece_score(lva);
+    occupancy &= ~(lva_board & -lva_board);
+    // Removing a piece may uncover a slider behind it.
+    attackers = get_all_attacks_to(p, to, occupancy);
+  }
+  // Each side only continues the exchange if doing so is better for it than
+  // stopping.
+  for (; d > 0; d--) {
+    gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+  }
+  return gain[0];
 }
-#endif
 
-// Append all of the moves for a given piece type starting from some square.
+/**
+ * \brief The restrictions check and pins place on the side to move.
+ *
+ * These are computed once per node, after which each move can be checked for
+ * legality with a couple of mask operations instead of making it.
+ */
+struct MoveConstraints {
+  /// The square of the king of the side to move.
+  int king_square;
+  /// The opposing pieces giving check.
+  uint64_t checkers;
+  /// The squares a piece other than the king may move to. This is every
+  /// square when not in check, the checker and the squares between it and the
+  /// king in single check, and nothing in double check.
+  uint64_t check_mask;
+  /// Our pieces which are pinned to our king.
+  uint64_t pinned;
+  /// The kinds of moves being generated.
+  GenMode mode;
+  /// The squares pieces other than pawns may move to under the generation
+  /// mode: opposing pieces for captures, empty squares for quiet moves.
+  uint64_t mode_mask;
+  /// The squares of the pieces we are generating moves for.
+  uint64_t from_mask;
+};
+
+MoveConstraints compute_constraints(const GameState& gs, GenMode mode,
+    uint64_t from_mask) {
+  const Position& p = gs.pos();
+  bool white_to_move = gs.whites_move();
+  MoveConstraints c;
+  c.mode = mode;
+  c.from_mask = from_mask;
+  uint64_t opp_all = p.get_board(
+      Position::color_piece(Position::ALL, !white_to_move));
+  if (mode == GenMode::CAPTURES) {
+    c.mode_mask = opp_all;
+  } else if (mode == GenMode::QUIETS) {
+    c.mode_mask = ~opp_all;
+  } else {
+    c.mode_mask = ~0ull;
+  }
+  int our_king = Position::color_piece(Position::KING, white_to_move);
+  c.king_square = *p.find_piece(our_king).begin();
+  uint64_t occupancy = p.get_board(Position::BOTH_ALL);
+  c.checkers = get_attacks_to(p, c.king_square, white_to_move, occupancy);
+  if (c.checkers == 0) {
+    c.check_mask = ~0ull;
+  } else if ((c.checkers & (c.checkers - 1)) == 0) {
+    int checker = lsb(c.checkers);
+    c.check_mask = c.checkers | between_squares[c.king_square][checker];
+  } else {
+    c.check_mask = 0;
+  }
+
+  // Any opposing slider which would attack our king on an empty board pins
+  // one of our pieces if exactly one piece stands between them and that
+  // piece is ours.
+  uint64_t our_pieces = p.get_board(
+      Position::color_piece(Position::ALL, white_to_move));
+  uint64_t opp_queens = p.get_board(
+      Position::color_piece(Position::QUEEN, !white_to_move));
+  uint64_t opp_rooks = p.get_board(
+      Position::color_piece(Position::ROOK, !white_to_move));
+  uint64_t opp_bishops = p.get_board(
+      Position::color_piece(Position::BISHOP, !white_to_move));
+  uint64_t snipers = (rook_attacks(c.king_square, 0) & (opp_rooks | opp_queens))
+    | (bishop_attacks(c.king_square, 0) & (opp_bishops | opp_queens));
+  c.pinned = 0;
+  while (snipers != 0) {
+    int sq = pop_lsb(snipers);
+    uint64_t blockers = between_squares[c.king_square][sq] & occupancy;
+    if (blockers != 0 && (blockers & (blockers - 1)) == 0) {
+      c.pinned |= blockers & our_pieces;
+    }
+  }
+  return c;
+}
+
+// Get the squares a piece other than the king on the given square may move to
+// without leaving the king in check.
+inline uint64_t legal_targets(const MoveConstraints& c, int from) {
+  if (c.pinned & (1ull << from)) {
+    return c.check_mask & line_through[c.king_square][from];
+  }
+  return c.check_mask;
+}
+
+// Append all of the moves for a piece starting from some square.
 void append_moves_from(int from_square, uint64_t to_squares,
-    int piece, uint64_t opp_pieces, MoveList& l) {
+    uint64_t opp_pieces, MoveList& l) {
   while (to_squares != 0) {
-    int tsq = lsb(to_squares);
-    to_squares &= to_squares - 1;
+    int tsq = pop_lsb(to_squares);
     if (opp_pieces & (1ull << tsq)) {
-      l.push_back(Move(from_square, tsq, piece, Move::CAPTURE));
+      l.push_back(Move(from_square, tsq, Move::CAPTURE));
     } else {
-      l.push_back(Move(from_square, tsq, piece, Move::QUIET));
+      l.push_back(Move(from_square, tsq, Move::QUIET));
     }
   }
 }
 
-// Generate pseudolegal king moves
-MoveList generate_king_moves(const GameState& gs) {
+// Append legal king moves, not including castling.
+void append_king_moves(const GameState& gs, const MoveConstraints& c,
+    MoveList& l) {
   const Position& p = gs.pos();
   bool white_to_move = gs.whites_move();
-  int our_king = Position::color_piece(Position::KING, white_to_move);
   int our_pieces = Position::color_piece(Position::ALL, white_to_move);
-  int king_square = *p.find_piece(our_king).begin();
-  uint64_t king_move_board = king_moves[king_square];
+  uint64_t king_move_board = king_moves[c.king_square] & c.mode_mask;
   king_move_board &= ~p.get_board(our_pieces);
+  // The king is removed from the occupancy so that a slider giving check also
+  // attacks the squares behind the king.
+  uint64_t occupancy = p.get_board(Position::BOTH_ALL) & ~(1ull << c.king_square);
+  uint64_t targets = 0;
+  while (king_move_board != 0) {
+    int sq = pop_lsb(king_move_board);
+    if (get_attacks_to(p, sq, white_to_move, occupancy) == 0) {
+      targets |= 1ull << sq;
+    }
+  }
   int opp_pieces = Position::color_piece(Position::ALL, !white_to_move);
   uint64_t opp_all_board = p.get_board(opp_pieces);
-  MoveList ret;
-  append_moves_from(king_square, king_move_board, our_king, opp_all_board, ret);
-  return ret;
+  append_moves_from(c.king_square, targets, opp_all_board, l);
 }
 
 void append_castling_moves(const GameState& gs, MoveList& l) {
@@ -175,8 +473,7 @@ void append_castling_moves(const GameState& gs, MoveList& l) {
   if (squares_to_check != 0) {
     bool can_castle = true;
     while (squares_to_check != 0) {
-      int sq = lsb(squares_to_check);
-      squares_to_check &= squares_to_check - 1;
+      int sq = pop_lsb(squares_to_check);
       uint64_t attacks = get_attacks_to(p, sq, white_to_move, occupancy);
       if (attacks != 0 || ((occupancy & (1ull << sq)) && !(king_board & (1ull << sq)))) {
         can_castle = false;
@@ -186,10 +483,10 @@ void append_castling_moves(const GameState& gs, MoveList& l) {
     if (can_castle) {
       if (white_to_move && p.piece_at(4, Position::W_KING) &&
           p.piece_at(7, Position::W_ROOK)) {
-        l.push_back(Move(4, 6, Position::W_KING, Move::KING_CASTLE));
+        l.push_back(Move(4, 6, Move::KING_CASTLE));
       } else if (!white_to_move && p.piece_at(60, Position::B_KING) &&
           p.piece_at(63, Position::B_ROOK)) {
-        l.push_back(Move(60, 62, Position::B_KING, Move::KING_CASTLE));
+        l.push_back(Move(60, 62, Move::KING_CASTLE));
       }
     }
   }
@@ -197,8 +494,7 @@ void append_castling_moves(const GameState& gs, MoveList& l) {
   if (squares_to_check != 0) {
     bool can_castle = true;
     while (squares_to_check != 0) {
-      int sq = lsb(squares_to_check);
-      squares_to_check &= squares_to_check - 1;
+      int sq = pop_lsb(squares_to_check);
       uint64_t attacks = get_attacks_to(p, sq, white_to_move, occupancy);
       if (attacks != 0 || ((occupancy & (1ull << sq)) && !(king_board & (1ull << sq)))) {
         can_castle = false;
@@ -208,174 +504,211 @@ void append_castling_moves(const GameState& gs, MoveList& l) {
     if (can_castle) {
       if (white_to_move && p.piece_at(4, Position::W_KING) &&
           p.piece_at(0, Position::W_ROOK) && (occupancy & (1ull << 1)) == 0) {
-        l.push_back(Move(4, 2, Position::W_KING, Move::QUEEN_CASTLE));
+        l.push_back(Move(4, 2, Move::QUEEN_CASTLE));
       } else if (!white_to_move && p.piece_at(60, Position::B_KING) &&
           p.piece_at(56, Position::B_ROOK) && (occupancy & (1ull << 57)) == 0) {
-        l.push_back(Move(60, 58, Position::B_KING, Move::QUEEN_CASTLE));
+        l.push_back(Move(60, 58, Move::QUEEN_CASTLE));
       }
     }
   }
 }
 
-void append_en_passant(const GameState& gs, MoveList& l) {
-  if (!gs.en_passant()) {
+// Check whether a given pseudolegal move leaves our king in check by making it.
+bool is_legal(const Move& m, const GameState& gs) {
+  Position p(gs.pos());
+  p.make_move(m);
+  return get_check_board(gs.whites_move(), p) == 0;
+}
+
+// En passant captures remove a piece from a square other than the target, and
+// can expose the king along the rank both pawns stood on. They are rare enough
+// that we simply make each one and test it.
+void append_en_passant(const GameState& gs, const MoveConstraints& c,
+    MoveList& l) {
+  if (!gs.en_passant() || c.mode == GenMode::QUIETS) {
     return;
   }
   int square = gs.en_passant_target();
   bool white_to_move = gs.whites_move();
   const Position& p = gs.pos();
   int our_pawn = Position::color_piece(Position::PAWN, white_to_move);
+  int from[2] = {-1, -1};
   if (white_to_move) {
     if (p.piece_at(square - 9, our_pawn) && square % 8 > 0) {
-      l.push_back(Move(square - 9, square, our_pawn, Move::CAPTURE_EP));
+      from[0] = square - 9;
     }
     if (p.piece_at(square - 7, our_pawn) && square % 8 < 7) {
-      l.push_back(Move(square - 7, square, our_pawn, Move::CAPTURE_EP));
+      from[1] = square - 7;
     }
   } else {
     if (p.piece_at(square + 9, our_pawn) && square % 8 < 7) {
-      l.push_back(Move(square + 9, square, our_pawn, Move::CAPTURE_EP));
+      from[0] = square + 9;
     }
     if (p.piece_at(square + 7, our_pawn) && square % 8 > 0) {
-      l.push_back(Move(square + 7, square, our_pawn, Move::CAPTURE_EP));
+      from[1] = square + 7;
+    }
+  }
+  for (int f : from) {
+    if (f >= 0 && (c.from_mask & (1ull << f))) {
+      Move m(f, square, Move::CAPTURE_EP);
+      if (is_legal(m, gs)) {
+        l.push_back(m);
+      }
     }
   }
 }
 
-void append_pawn_moves(const GameState& gs, MoveList& l) {
+// Append a pawn move to the given square, expanding it into each promotion if
+// the pawn reaches the last rank.
+inline void append_pawn_move(int from, int to, bool capture, MoveList& l) {
+  if (to / 8 == 0 || to / 8 == 7) {
+    if (capture) {
+      l.push_back(Move(from, to, Move::PROMOTE_KNIGHT_CAPTURE));
+      l.push_back(Move(from, to, Move::PROMOTE_BISHOP_CAPTURE));
+      l.push_back(Move(from, to, Move::PROMOTE_ROOK_CAPTURE));
+      l.push_back(Move(from, to, Move::PROMOTE_QUEEN_CAPTURE));
+    } else {
+      l.push_back(Move(from, to, Move::PROMOTE_KNIGHT));
+      l.push_back(Move(from, to, Move::PROMOTE_BISHOP));
+      l.push_back(Move(from, to, Move::PROMOTE_ROOK));
+      l.push_back(Move(from, to, Move::PROMOTE_QUEEN));
+    }
+  } else {
+    l.push_back(Move(from, to, capture ? Move::CAPTURE : Move::QUIET));
+  }
+}
+
+void append_pawn_moves(const GameState& gs, const MoveConstraints& c,
+    MoveList& l) {
   bool white_to_move = gs.whites_move();
   int our_pawn = Position::color_piece(Position::PAWN, white_to_move);
   const Position& p = gs.pos();
-  const std::set<int>& pawns = p.find_piece(our_pawn);
+  SquareSet pawns(p.get_board(our_pawn) & c.from_mask);
   int opp_all = Position::color_piece(Position::ALL, !white_to_move);
   uint64_t opp_pieces = p.get_board(opp_all);
   uint64_t all_pieces = p.get_board(Position::BOTH_ALL);
+  // Captures and promotions belong to GenMode::CAPTURES, and other pushes to
+  // GenMode::QUIETS.
+  bool noisy = c.mode != GenMode::QUIETS;
+  bool quiet = c.mode != GenMode::CAPTURES;
+  if (!noisy) {
+    opp_pieces = 0;
+  }
   for (int p : pawns) {
+    uint64_t allowed = legal_targets(c, p);
     int target = white_to_move ? p + 8 : p - 8;
-    if ((all_pieces & (1ull << target)) == 0) {
-      if (target / 8 == 0 || target / 8 == 7) {
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_KNIGHT));
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_BISHOP));
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_ROOK));
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_QUEEN));
-      } else {
-        l.push_back(Move(p, target, our_pawn, Move::QUIET));
-      }
+    bool push_open = (all_pieces & (1ull << target)) == 0;
+    bool promotion = target / 8 == 0 || target / 8 == 7;
+    if (push_open && (allowed & (1ull << target)) &&
+        (promotion ? noisy : quiet)) {
+      append_pawn_move(p, target, false, l);
     }
     target--;   // pawn + 7 for white, pawn - 9 for black
-    if (p % 8 > 0 && ((opp_pieces & (1ull << target)) != 0)) {
-      if (target / 8 == 0 || target / 8 == 7) {
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_KNIGHT_CAPTURE));
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_BISHOP_CAPTURE));
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_ROOK_CAPTURE));
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_QUEEN_CAPTURE));
-      } else {
-        l.push_back(Move(p, target, our_pawn, Move::CAPTURE));
-      }
+    if (p % 8 > 0 && ((opp_pieces & allowed & (1ull << target)) != 0)) {
+      append_pawn_move(p, target, true, l);
     }
     target += 2;
-    if (p % 8 < 7 && ((opp_pieces & (1ull << target)) != 0)) {
-      if (target / 8 == 0 || target / 8 == 7) {
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_KNIGHT_CAPTURE));
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_BISHOP_CAPTURE));
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_ROOK_CAPTURE));
-        l.push_back(Move(p, target, our_pawn, Move::PROMOTE_QUEEN_CAPTURE));
-      } else {
-        l.push_back(Move(p, target, our_pawn, Move::CAPTURE));
-      }
+    if (p % 8 < 7 && ((opp_pieces & allowed & (1ull << target)) != 0)) {
+      append_pawn_move(p, target, true, l);
     }
-    if (white_to_move ? p / 8 == 1 : p / 8 == 6) {
+    if (quiet && push_open && (white_to_move ? p / 8 == 1 : p / 8 == 6)) {
       target = white_to_move ? p + 16 : p - 16;
-      int sq = white_to_move ? p + 8 : p - 8;
-      if ((all_pieces & ((1ull << target) | (1ull << sq))) == 0) {
-        l.push_back(Move(p, target, our_pawn, Move::PAWN_DOUBLE));
+      if ((all_pieces & (1ull << target)) == 0 && (allowed & (1ull << target))) {
+        l.push_back(Move(p, target, Move::PAWN_DOUBLE));
       }
     }
   }
 }
 
-void append_knight_moves(const GameState& gs, MoveList& l) {
+void append_knight_moves(const GameState& gs, const MoveConstraints& c,
+    MoveList& l) {
   bool white_to_move = gs.whites_move();
   int our_knight = Position::color_piece(Position::KNIGHT, white_to_move);
   const Position& p = gs.pos();
-  const std::set<int>& knights = p.find_piece(our_knight);
+  // A pinned knight can never move along the pin, so it has no legal moves.
+  uint64_t knights = p.get_board(our_knight) & ~c.pinned & c.from_mask;
   int our_all = Position::color_piece(Position::ALL, white_to_move);
   int opp_all = Position::color_piece(Position::ALL, !white_to_move);
   uint64_t occupancy = p.get_board(our_all);
   uint64_t opp_pieces = p.get_board(opp_all);
-  for (int k : knights) {
-    uint64_t moves_to = knight_moves[k] & ~occupancy;
-    append_moves_from(k, moves_to, our_knight, opp_pieces, l);
+  for (int k : SquareSet(knights)) {
+    uint64_t moves_to = knight_moves[k] & ~occupancy & c.check_mask &
+      c.mode_mask;
+    append_moves_from(k, moves_to, opp_pieces, l);
   }
 }
 
-void append_sliding_moves(const GameState& gs, MoveList& l) {
+void append_sliding_moves(const GameState& gs, const MoveConstraints& c,
+    MoveList& l) {
   bool white_to_move = gs.whites_move();
   const Position& p = gs.pos();
   uint64_t occupancy = p.get_board(Position::BOTH_ALL);
   int our_all = Position::color_piece(Position::ALL, white_to_move);
-  uint64_t our_pieces = p.get_board(our_all);
+  // Masking out our own pieces and applying the generation mode are folded
+  // into one mask.
+  uint64_t allowed = ~p.get_board(our_all) & c.mode_mask;
   int opp_all = Position::color_piece(Position::ALL, !white_to_move);
   uint64_t opp_pieces = p.get_board(opp_all);
   int our_rook = Position::color_piece(Position::ROOK, white_to_move);
-  const std::set<int>& rooks = p.find_piece(our_rook);
+  SquareSet rooks(p.get_board(our_rook) & c.from_mask);
   for (int r : rooks) {
-    Magic rm = rook_magics[r];
-    uint64_t r_att = rm.attack_table[((occupancy & rm.mask) * rm.magic) >> (64 - rm.shift)];
-    uint64_t targets = r_att & ~our_pieces;
-    append_moves_from(r, targets, our_rook, opp_pieces, l);
+    uint64_t targets = rook_attacks(r, occupancy) & allowed;
+    append_moves_from(r, targets & legal_targets(c, r), opp_pieces, l);
   }
   int our_bishop = Position::color_piece(Position::BISHOP, white_to_move);
-  const std::set<int>& bishops = p.find_piece(our_bishop);
+  SquareSet bishops(p.get_board(our_bishop) & c.from_mask);
   for (int b : bishops) {
-    Magic bm = bishop_magics[b];
-    uint64_t b_att = bm.attack_table[((occupancy & bm.mask) * bm.magic) >> (64 - bm.shift)];
-    uint64_t targets = b_att & ~our_pieces;
-    append_moves_from(b, targets, our_bishop, opp_pieces, l);
+    uint64_t targets = bishop_attacks(b, occupancy) & allowed;
+    append_moves_from(b, targets & legal_targets(c, b), opp_pieces, l);
   }
   int our_queen = Position::color_piece(Position::QUEEN, white_to_move);
-  const std::set<int>& queens = p.find_piece(our_queen);
+  SquareSet queens(p.get_board(our_queen) & c.from_mask);
   for (int q : queens) {
-    Magic rm = rook_magics[q];
-    Magic bm = bishop_magics[q];
-    uint64_t r_att = rm.attack_table[((occupancy & rm.mask) * rm.magic) >> (64 - rm.shift)];
-    uint64_t b_att = bm.attack_table[((occupancy & bm.mask) * bm.magic) >> (64 - bm.shift)];
-    uint64_t targets = (r_att | b_att) & ~our_pieces;
-    append_moves_from(q, targets, our_queen, opp_pieces, l);
+    uint64_t targets = (rook_attacks(q, occupancy) |
+        bishop_attacks(q, occupancy)) & allowed;
+    append_moves_from(q, targets & legal_targets(c, q), opp_pieces, l);
   }
 }
 
-// Generate the pseudo-legal moves in this position. We will need to filter out
-// moves that result in check later.
-MoveList generate_pseudolegal_moves(const GameState& gs) {
-  MoveList ret = generate_king_moves(gs);
-  append_castling_moves(gs, ret);
-  append_en_passant(gs, ret);
-  append_pawn_moves(gs, ret);
-  append_knight_moves(gs, ret);
-  append_sliding_moves(gs, ret);
+// Add the legal moves of the given kinds for the pieces on the given squares.
+void generate_moves_from(const GameState& gs, MoveList& l, GenMode mode,
+    uint64_t from_mask) {
+  MoveConstraints c = compute_constraints(gs, mode, from_mask);
+  if (from_mask & (1ull << c.king_square)) {
+    append_king_moves(gs, c, l);
+    if (c.checkers == 0 && mode != GenMode::CAPTURES) {
+      append_castling_moves(gs, l);
+    }
+  }
+  if (c.check_mask == 0) {
+    // In double check only the king can move.
+    return;
+  }
+  append_en_passant(gs, c, l);
+  append_pawn_moves(gs, c, l);
+  append_knight_moves(gs, c, l);
+  append_sliding_moves(gs, c, l);
+}
 
-  return ret;
+void generate_moves(const GameState& gs, MoveList& l, GenMode mode) {
+  generate_moves_from(gs, l, mode, ~0ull);
 }
 
-// Check whether a given pseudolegal move results in check
-bool is_legal(const Move& m, const GameState& gs) {
-  Position p(gs.pos());
-  p.make_move(m);
-  return get_check_board(gs.whites_move(), p) == 0;
+bool is_legal_move(const GameState& gs, const Move& m) {
+  if (m.is_null()) {
+    return false;
+  }
+  // Only generate moves for the piece on the from square. This can't produce
+  // more than 27 moves, so the search is quick.
+  MoveList l;
+  generate_moves_from(gs, l, GenMode::ALL, 1ull << m.from_square());
+  return std::find(l.begin(), l.end(), m) != l.end();
 }
 
 MoveList generate_moves(const GameState& gs) {
-  MoveList pseudo = generate_pseudolegal_moves(gs);
-  MoveList::iterator it = pseudo.begin();
-  while (it != pseudo.end()) {
-    if (is_legal(*it, gs)) {
-      it++;
-    } else {
-      it = pseudo.erase(it);
-    }
-  }
-  return pseudo;
+  MoveList l;
+  generate_moves(gs, l);
+  return l;
 }
 
 uint64_t generate_occupancy_mask(int s, bool is_rook) {
@@ -447,23 +780,6 @@ uint64_t generate_occupancy_mask(int s, bool is_rook) {
   return occupancy;
 }
 
-std::vector<uint64_t> generate_possible_occupancies(int sq,
-    uint64_t occupancy, uint64_t partial, int ind) {
-  if (ind >= 64) {
-    return std::vector<uint64_t>{partial};
-  }
-
-  std::vector<uint64_t> zero = generate_possible_occupancies(sq, occupancy,
-      partial, ind + 1);
-
-  if ((occupancy & (1ull << ind))) {
-    std::vector<uint64_t> one = generate_possible_occupancies(sq, occupancy,
-        partial | (1ull << ind), ind + 1);
-    zero.insert(zero.end(), one.begin(), one.end());
-  }
-  return zero;
-}
-
 // Generate the possible moves of a sliding piece given an occupancy mask. Note
 // that the generated attack will include the first occupied square in each
 // direction.
@@ -560,84 +876,33 @@ uint64_t generate_attack(int sq, uint64_t occupancy, bool is_rook) {
   return attack;
 }
 
-// Generate a magic number for some square
-Magic generate_magic(int square, int shift, bool is_rook) {
-  uint64_t occupancy = generate_occupancy_mask(square, is_rook);
-  std::vector<uint64_t> occupancies = generate_possible_occupancies(square,
-      occupancy, 0, 0);
-  std::vector<uint64_t> attacks;
-  for (unsigned i = 0; i < occupancies.size(); i++) {
-    attacks.push_back(generate_attack(square, occupancies[i], is_rook));
-  }
-
-  // table will be the attack table of the generated Magic object
-  uint64_t* table = (uint64_t*) malloc((1 << shift) * sizeof(uint64_t));
-
-  std::random_device rd;
-  std::mt19937_64 gen(rd());
-  std::uniform_int_distribution<uint64_t> dis;
-  while (true) {
-    for (int i = 0; i < 1 << shift; i++) {
-      // We initialize each attack in the table to all ones to check for collisions
-      table[i] = ~0ull;
-    }
-
-    // Generate a random candidate magic number
-    // In general we want to have a small number of 1 bits, so we'll & together
-    // a few random numbers to bias the generator toward good numbers.
-    uint64_t m = dis(gen) & dis(gen) & dis(gen);
-
-    bool collision = false;
-    // For each possible occupancy
-    for (unsigned i = 0; i < occupancies.size(); i++) {
-      // Calculate an offset into a small number of bits
-      unsigned offset = (occupancies[i] * m) >> (64 - shift);
-      if (table[offset] == ~0ull || table[offset] == attacks[i]) {
-        // If the offset hasn't been filled already, fill it
-        table[offset] = attacks[i];
-      } else {
-        // Otherwise there is a collision, so this is not a good magic number
-        collision = true;
-        break;
-      }
-    }
-
-    if (!collision) {
-      // This is a good magic number
-      Magic mag;
-      mag.magic = m;
-      mag.mask = occupancy;
-      mag.attack_table = table;
-      mag.shift = shift;
-      return mag;
-    }
-  }
+// Set up the magic for a square, taking the next entries of attack_table.
+void initialize_magic(Magic& m, int square, uint64_t magic, bool is_rook,
+    uint64_t*& next) {
+  m.magic = magic;
+  m.mask = generate_occupancy_mask(square, is_rook);
+  m.shift = popcount(m.mask);
+  m.attacks = next;
+  next += 1ull << m.shift;
+  // Visit every subset of the mask, using the fact that subtracting the mask
+  // carries through exactly the bits outside of it.
+  uint64_t occupancy = 0;
+  do {
+    m.attacks[magic_index(m, occupancy)] = generate_attack(square, occupancy,
+        is_rook);
+    occupancy = (occupancy - m.mask) & m.mask;
+  } while (occupancy != 0);
 }
 
-void movegen_initialize_attack_boards() {
-  // rook_shifts and bishop_shifts give the number of bits in the occupancy
-  // relevance mask which are one. This is used for finding an efficient magic
-  // number.
-  int rook_shifts[64] = {
-    12, 11, 11, 11, 11, 11, 11, 12,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    12, 11, 11, 11, 11, 11, 11, 12
-  };
-  int bishop_shifts[64] = {
-    6, 5, 5, 5, 5, 5, 5, 6,
-    5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 7, 7, 7, 7, 5, 5,
-    5, 5, 7, 9, 9, 7, 5, 5,
-    5, 5, 7, 9, 9, 7, 5, 5,
-    5, 5, 7, 7, 7, 7, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5,
-    6, 5, 5, 5, 5, 5, 5, 6,
-  };
+void initialize_attack_boards() {
+#if defined(USE_PEXT) && defined(__GNUC__)
+  // Fail clearly rather than with an illegal instruction.
+  if (!__builtin_cpu_supports("bmi2")) {
+    throw std::runtime_error("This build uses PEXT, but the CPU does not "
+        "support BMI2");
+  }
+#endif
+  uint64_t* next = attack_table;
   for (int i = 0; i < 64; i++) {
     knight_moves[i] = 0;
     king_moves[i] = 0;
@@ -684,14 +949,36 @@ void movegen_initialize_attack_boards() {
       }
     }
 
-    rook_magics[i] = generate_magic(i, rook_shifts[i], true);
-    bishop_magics[i] = generate_magic(i, bishop_shifts[i], false);
+    initialize_magic(rook_magics[i], i, ROOK_MAGICS[i], true, next);
   }
-}
-
-void movegen_free_magics() {
   for (int i = 0; i < 64; i++) {
-    free(rook_magics[i].attack_table);
-    free(bishop_magics[i].attack_table);
+    initialize_magic(bishop_magics[i], i, BISHOP_MAGICS[i], false, next);
+  }
+
+  // Squares are aligned if one is on the other's empty-board rook or bishop
+  // rays. The squares between them are then the intersection of the rays from
+  // each square with the other square blocking.
+  for (int a = 0; a < 64; a++) {
+    for (int b = 0; b < 64; b++) {
+      between_squares[a][b] = 0;
+      line_through[a][b] = 0;
+      if (a == b) {
+        continue;
+      }
+      for (bool is_rook : {true, false}) {
+        uint64_t from_a = generate_attack(a, 0, is_rook);
+        if (from_a & (1ull << b)) {
+          uint64_t from_b = generate_attack(b, 0, is_rook);
+          between_squares[a][b] = generate_attack(a, 1ull << b, is_rook) &
+            generate_attack(b, 1ull << a, is_rook);
+          line_through[a][b] = (from_a & from_b) | (1ull << a) | (1ull << b);
+        }
+      }
+    }
   }
 }
+
+void movegen_initialize_attack_boards() {
+  static std::once_flag initialized;
+  std::call_once(initialized, initialize_attack_boards);
+}
@@ -1,12 +1,167 @@
 #pragma once
 
-#include <deque>
+#include <initializer_list>
+#include <new>
 
 #include "boards.hpp"
 
-// For now a move list is just a queue, but this may change later in order
-// to support better move ordering.
-typedef std::deque<Move> MoveList;
+// No legal chess position has more than 218 legal moves, so this leaves
+// plenty of space.
+#define MAX_MOVES 256
+
+/**
+ * \brief A fixed-capacity list of moves.
+ *
+ * The moves are stored inline, so a move list can live on the stack and
+ * building one never allocates. The storage is left uninitialized until moves
+ * are added, so creating an empty list is free.
+ */
+class MoveList {
+  private:
+    /** Storage for up to MAX_MOVES moves. */
+    alignas(Move) unsigned char storage[MAX_MOVES * sizeof(Move)];
+    /** The number of moves in the list. */
+    unsigned count;
+
+    inline Move* data() {
+      return reinterpret_cast<Move*>(storage);
+    }
+
+    inline const Move* data() const {
+      return reinterpret_cast<const Move*>(storage);
+    }
+
+  public:
+    typedef Move* iterator;
+    typedef const Move* const_iterator;
+
+    MoveList(): count{0} {}
+
+    MoveList(std::initializer_list<Move> ms): count{0} {
+      for (const Move& m : ms) {
+        push_back(m);
+      }
+    }
+
+    MoveList(const MoveList& other): count{0} {
+      *this = other;
+    }
+
+    MoveList& operator=(const MoveList& other) {
+      if (this != &other) {
+        count = 0;
+        for (const Move& m : other) {
+          push_back(m);
+        }
+      }
+      return *this;
+    }
+
+    /**
+     * \brief Add a move to the end of the list.
+     */
+    inline void push_back(const Move& m) {
+      new (&data()[count]) Move(m);
+      count++;
+    }
+
+    /**
+     * \brief Remove the last move in the list.
+     */
+    inline void pop_back() {
+      count--;
+    }
+
+    /**
+     * \brief Remove all moves from the list.
+     */
+    inline void clear() {
+      count = 0;
+    }
+
+    /**
+     * \brief Remove the moves from the given iterator to the end of the list.
+     */
+    inline void truncate(const_iterator it) {
+      count = it - data();
+    }
+
+    inline unsigned size() const {
+      return count;
+    }
+
+    inline bool empty() const {
+      return count == 0;
+    }
+
+    inline Move& operator[](unsigned i) {
+      return data()[i];
+    }
+
+    inline const Move& operator[](unsigned i) const {
+      return data()[i];
+    }
+
+    inline const Move& front() const {
+      return data()[0];
+    }
+
+    inline const Move& back() const {
+      return data()[count - 1];
+    }
+
+    inline iterator begin() {
+      return data();
+    }
+
+    inline iterator end() {
+      return data() + count;
+    }
+
+    inline const_iterator begin() const {
+      return data();
+    }
+
+    inline const_iterator end() const {
+      return data() + count;
+    }
+
+    inline const_iterator cbegin() const {
+      return data();
+    }
+
+    inline const_iterator cend() const {
+      return data() + count;
+    }
+};
+
+/**
+ * \brief The kinds of moves to generate.
+ *
+ * CAPTURES and QUIETS split the legal moves between them, so generating both
+ * gives the same moves as ALL.
+ */
+enum class GenMode {
+  /** Every legal move. */
+  ALL,
+  /** Captures (including en passant) and promotions. */
+  CAPTURES,
+  /** Every other move, including castling. */
+  QUIETS
+};
+
+/**
+ * \brief Add legal moves to a list.
+ *
+ * This is the preferred way to generate moves in performance-sensitive code
+ * since the caller controls where the list lives.
+ *
+ * \param gs The current game state.
+ * \param l The list to add the legal moves to.
+ * \param mode Which kinds of moves to add.
+ */
+void generate_moves(const GameState& gs, MoveList& l,
+    GenMode mode = GenMode::ALL);
 
 /**
  * \brief Generate a list of legal moves.
@@ -18,21 +173,69 @@ MoveList generate_moves(const GameState& gs);
  */
 bool in_check(bool white_to_move, const Position& p);
 
+/**
+ * \brief Determine whether a move is legal in the given game state.
+ *
+ * This is used to check moves from other sources, such as the transposition
+ * table, before playing them. It is much cheaper than generating every move.
+ */
+bool is_legal_move(const GameState& gs, const Move& m);
+
+/**
+ * \brief Get the point value of a piece.
+ *
+ * We also return a value for kings because this is used for move ordering
+ * by examining the difference between the captured and capturing piece.
+ */
+int piece_score(int piece);
+
+/**
+ * \brief Estimate the material won by a capture with static exchange
+ * evaluation.
+ *
+ * This plays out the sequence of captures on the target square, with each
+ * side always recapturing with its least valuable piece and stopping when
+ * continuing would lose material.
+ *
+ * \param p The position before the move.
+ * \param m A capture in the position.
+ * \return The expected material gain in the units of `piece_score`.
+ */
+int see(const Position& p, const Move& m);
+
+/**
+ * \name Attack Boards
+ *
+ * These look up the squares a piece on the given square attacks, including
+ * squares occupied by pieces of either color. Sliding pieces stop at the
+ * first occupied square in each direction. They may only be used after
+ * movegen_initialize_attack_boards has been called.
+ */
+///@{
+uint64_t knight_attacks(int square);
+uint64_t king_attacks(int square);
+uint64_t rook_attacks(int square, uint64_t occupancy);
+uint64_t bishop_attacks(int square, uint64_t occupancy);
+///@}
+
+/**
+ * \brief Get the name of the method used to index sliding attacks.
+ *
+ * This is "pext" when built with the PEXT option and "magic" otherwise.
+ */
+const char* movegen_attack_backend();
+
 /**
  * \brief Precompute some data to speed up move generation.
  *
  * This function generates bitboards which can be used to quickly generate
  * moves for certain kinds of pieces. This includes attack boards for the
  * knight and king, along with magic bitboards for the rooks and bishops.
- * See movegen.cpp for a brief explanation of magic bitboards. This function
- * should be called once when the engine starts up.
+ * See movegen.cpp for a brief explanation of magic bitboards. The magic
+ * numbers are fixed, so this only fills in tables and takes a few
+ * milliseconds. It must be called before generating moves. Only the first
+ * call does any work, so it is safe to call more than once, even from
+ * several threads. The tables are static and never need to be freed.
  */
 void movegen_initialize_attack_boards();
 
-/**
- * \brief Free the precomputed data.
- *
- * This function should be called once when the engine shuts down.
- */
-void movegen_free_magics();
-
@@ -0,0 +1,180 @@
+#include <algorithm>
+
+#include "movepicker.hpp"
+
+void HistoryTable::clear() {
+  std::fill(&scores[0][0][0], &scores[0][0][0] + 2 * 64 * 64, 0);
+}
+
+void HistoryTable::age() {
+  for (int32_t* s = &scores[0][0][0]; s != &scores[0][0][0] + 2 * 64 * 64;
+      s++) {
+    *s /= 8;
+  }
+}
+
+void HistoryTable::update(bool white, const Move& m, unsigned depth) {
+  int32_t& s = scores[white][m.from_square()][m.to_square()];
+  s += depth * depth;
+  if (s >= MAX_SCORE) {
+    // Halve everything so that the relative order is kept without overflow.
+    for (int32_t* t = &scores[0][0][0]; t != &scores[0][0][0] + 2 * 64 * 64;
+        t++) {
+      *t /= 2;
+    }
+  }
+}
+
+MovePicker::MovePicker(const GameState& g, std::optional<Move> hm,
+    const Move* ks, const HistoryTable* h, bool co):
+  gs{g}, hash_move{hm}, killers{}, history{h}, captures_only{co},
+  stage{HASH_MOVE}, moves{}, current{0}, bad_end{0}, killer_index{0} {
+  if (ks != nullptr) {
+    killers[0] = ks[0];
+    killers[1] = ks[1];
+  }
+}
+
+int32_t MovePicker::capture_score(const Position& p, const Move& m) {
+  int32_t victim = 0;
+  if (m.capture_ep()) {
+    victim = 1;
+  } else if (m.capture()) {
+    victim = piece_score(p.get_piece(m.to_square()));
+  }
+  if (m.promote_queen()) {
+    victim += 8;
+  }
+  // Victims are worth more than any attacker so that the victim decides the
+  // order first.
+  return 128 * victim - piece_score(p.get_piece(m.from_square()));
+}
+
+bool MovePicker::losing_capture(const Position& p, const Move& m) {
+  if (m.promotion()) {
+    return !m.promote_queen();
+  }
+  if (m.capture_ep()) {
+    return false;
+  }
+  // A capture can only lose material if the capturing piece is worth more
+  // than the captured one.
+  if (piece_score(p.get_piece(m.from_square())) <=
+      piece_score(p.get_piece(m.to_square()))) {
+    return false;
+  }
+  return see(p, m) < 0;
+}
+
+void MovePicker::select_best() {
+  unsigned best = current;
+  for (unsigned i = current + 1; i < moves.size(); i++) {
+    if (scores[i] > scores[best]) {
+      best = i;
+    }
+  }
+  std::swap(moves[current], moves[best]);
+  std::swap(scores[current], scores[best]);
+}
+
+bool MovePicker::already_picked(const Move& m) const {
+  return (hash_move && m == *hash_move) || m == killers[0] || m == killers[1];
+}
+
+bool MovePicker::next(Move& m) {
+  switch (stage) {
+    case HASH_MOVE:
+      stage = GENERATE_CAPTURES;
+      if (hash_move && (!captures_only || hash_move->capture() ||
+            hash_move->promotion()) && is_legal_move(gs, *hash_move)) {
+        m = *hash_move;
+        return true;
+      }
+      // Otherwise fall through to the next stage
+      [[fallthrough]];
+
+    case GENERATE_CAPTURES:
+      generate_moves(gs, moves, GenMode::CAPTURES);
+      for (unsigned i = 0; i < moves.size(); i++) {
+        scores[i] = capture_score(gs.pos(), moves[i]);
+      }
+      current = 0;
+      bad_end = 0;
+      stage = GOOD_CAPTURES;
+      [[fallthrough]];
+
+    case GOOD_CAPTURES:
+      while (current < moves.size()) {
+        select_best();
+        Move c = moves[current++];
+        if (hash_move && c == *hash_move) {
+          continue;
+        }
+        if (!captures_only) {
+          // Underpromotions and captures which lose material are saved for
+          // after the quiet moves.
+          if (losing_capture(gs.pos(), c)) {
+            std::swap(moves[bad_end], moves[current - 1]);
+            std::swap(scores[bad_end], scores[current - 1]);
+            bad_end++;
+            continue;
+          }
+        }
+        m = c;
+        return true;
+      }
+      if (captures_only) {
+        stage = DONE;
+        return false;
+      }
+      stage = KILLERS;
+      killer_index = 0;
+      [[fallthrough]];
+
+    case KILLERS:
+      while (killer_index < 2) {
+        const Move& k = killers[killer_index++];
+        if (!k.is_null() && !(hash_move && k == *hash_move) &&
+            !k.capture() && !k.promotion() && is_legal_move(gs, k)) {
+          m = k;
+          return true;
+        }
+      }
+      stage = GENERATE_QUIETS;
+      [[fallthrough]];
+
+    case GENERATE_QUIETS:
+      current = moves.size();
+      generate_moves(gs, moves, GenMode::QUIETS);
+      for (unsigned i = current; i < moves.size(); i++) {
+        scores[i] = history ? history->get(gs.whites_move(), moves[i]) : 0;
+      }
+      stage = QUIETS;
+      [[fallthrough]];
+
+    case QUIETS:
+      while (current < moves.size()) {
+        select_best();
+        Move q = moves[current++];
+        if (already_picked(q)) {
+          continue;
+        }
+        m = q;
+        return true;
+      }
+      stage = BAD_CAPTURES;
+      current = 0;
+      [[fallthrough]];
+
+    case BAD_CAPTURES:
+      if (current < bad_end) {
+        m = moves[current++];
+        return true;
+      }
+      stage = DONE;
+      [[fallthrough]];
+
+    default:
+      return false;
+  }
+}
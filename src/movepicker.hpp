@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "boards.hpp"
+#include "movegen.hpp"
+
+/**
+ * \brief Scores for quiet moves based on how often they caused a cutoff.
+ *
+ * Scores are indexed by the side to move and the from and to squares of the
+ * move. A quiet move which refutes one position is often good in similar
+ * positions elsewhere in the tree.
+ */
+class HistoryTable {
+  private:
+    /** The score of each move. */
+    int32_t scores[2][64][64];
+
+  public:
+    /** Scores are scaled down once any of them reaches this value. */
+    static const int32_t MAX_SCORE = 1 << 24;
+
+    HistoryTable() {
+      clear();
+    }
+
+    /**
+     * \brief Reset every score to zero.
+     */
+    void clear();
+
+    /**
+     * \brief Scale down every score.
+     *
+     * This is called between searches so that old results still help order
+     * moves but new results quickly outweigh them.
+     */
+    void age();
+
+    /**
+     * \brief Record that a quiet move caused a cutoff.
+     *
+     * \param white True if white made the move.
+     * \param m The move.
+     * \param depth The remaining depth at the node where the cutoff happened.
+     * Cutoffs near the root are rarer and more valuable.
+     */
+    void update(bool white, const Move& m, unsigned depth);
+
+    /**
+     * \brief Get the score of a move.
+     */
+    inline int32_t get(bool white, const Move& m) const {
+      return scores[white][m.from_square()][m.to_square()];
+    }
+};
+
+/**
+ * \brief Produce the legal moves of a position one at a time, most promising
+ * first.
+ *
+ * Most search nodes are cut off after one or two moves, so rather than
+ * generating and sorting every move up front, the picker works in stages:
+ *
+ * 1. The hash move, which is checked for legality but needs no generation.
+ * 2. Captures and promotions which don't lose material according to static
+ *    exchange evaluation, most valuable victim and least valuable attacker
+ *    first.
+ * 3. The killer moves for this ply.
+ * 4. The remaining quiet moves, ordered by the history heuristic. These are
+ *    not generated until this stage is reached.
+ * 5. Captures which lose material.
+ *
+ * Each move is produced exactly once.
+ */
+class MovePicker {
+  private:
+    static const int HASH_MOVE = 0;
+    static const int GENERATE_CAPTURES = 1;
+    static const int GOOD_CAPTURES = 2;
+    static const int KILLERS = 3;
+    static const int GENERATE_QUIETS = 4;
+    static const int QUIETS = 5;
+    static const int BAD_CAPTURES = 6;
+    static const int DONE = 7;
+
+    /** The game state to pick moves for. */
+    const GameState& gs;
+    /** The move to try first, if any. */
+    std::optional<Move> hash_move;
+    /** The killer moves for this ply, or null moves. */
+    Move killers[2];
+    /** Scores for quiet moves. */
+    const HistoryTable* history;
+    /** If true, only captures and promotions are produced. */
+    bool captures_only;
+    /** The current stage. */
+    int stage;
+    /** The generated moves. Captures come first, then quiet moves. */
+    MoveList moves;
+    /** The ordering score of each move in `moves`. */
+    int32_t scores[MAX_MOVES];
+    /** The index of the next move to consider in `moves`. */
+    unsigned current;
+    /** Losing captures are moved to the front of `moves`, up to this index. */
+    unsigned bad_end;
+    /** The index of the next killer to consider. */
+    unsigned killer_index;
+
+    /**
+     * \brief Move the highest scoring move in `moves` after `current` to
+     * `current`.
+     */
+    void select_best();
+
+    /**
+     * \brief Determine whether a move was already produced by an earlier
+     * stage.
+     */
+    bool already_picked(const Move& m) const;
+
+  public:
+    /**
+     * \brief Construct a move picker.
+     *
+     * \param gs The game state to pick moves for. It must not change while
+     * the picker is in use.
+     * \param hash_move A move to try first. It is skipped if it is not legal.
+     * \param killers The two killer moves for this ply, or null to use none.
+     * \param history Scores for quiet moves, or null to use none.
+     * \param captures_only If true, only produce captures and promotions, in
+     * order of MVV-LVA.
+     */
+    MovePicker(const GameState& gs, std::optional<Move> hash_move,
+        const Move* killers, const HistoryTable* history, bool captures_only);
+
+    /**
+     * \brief Get the next move.
+     *
+     * \param m Set to the next move.
+     * \return False if there are no more moves.
+     */
+    bool next(Move& m);
+
+    /**
+     * \brief Score a capture or promotion for ordering.
+     *
+     * Captures are ordered by most valuable victim, then by least valuable
+     * attacker. Promotions to a queen are ordered as captures of a queen less
+     * the pawn.
+     */
+    static int32_t capture_score(const Position& p, const Move& m);
+
+    /**
+     * \brief Determine whether a capture or promotion loses material.
+     *
+     * Captures are judged by static exchange evaluation, which is only
+     * needed when the capturing piece is worth more than the captured one.
+     * Promotions to anything but a queen are also counted as losing.
+     */
+    static bool losing_capture(const Position& p, const Move& m);
+};
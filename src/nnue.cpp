@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "nnue.hpp"
+#include "bits.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define NNUE_AVX2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define NNUE_NEON
+#endif
+
+// The portable kernels. The SIMD kernels below must give exactly the same
+// results. Accumulator lengths are multiples of 16 and dot product lengths
+// are multiples of 32.
+
+static void add_row_scalar(int16_t* acc, const int16_t* row, unsigned n) {
+  for (unsigned i = 0; i < n; i++) {
+    acc[i] += row[i];
+  }
+}
+
+// Only the incremental updates subtract rows, and they always use the fastest
+// kernels available.
+[[maybe_unused]]
+static void sub_row_scalar(int16_t* acc, const int16_t* row, unsigned n) {
+  for (unsigned i = 0; i < n; i++) {
+    acc[i] -= row[i];
+  }
+}
+
+// Clip accumulator values to [0, 127].
+static void clip_scalar(const int16_t* in, uint8_t* out, unsigned n) {
+  for (unsigned i = 0; i < n; i++) {
+    out[i] = std::clamp<int16_t>(in[i], 0, 127);
+  }
+}
+
+static int32_t dot_scalar(const uint8_t* x, const int8_t* w, unsigned n) {
+  int32_t sum = 0;
+  for (unsigned i = 0; i < n; i++) {
+    sum += x[i] * w[i];
+  }
+  return sum;
+}
+
+#if defined(NNUE_AVX2)
+
+static void add_row_simd(int16_t* acc, const int16_t* row, unsigned n) {
+  for (unsigned i = 0; i < n; i += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i*) (acc + i));
+    __m256i r = _mm256_loadu_si256((const __m256i*) (row + i));
+    _mm256_storeu_si256((__m256i*) (acc + i), _mm256_add_epi16(a, r));
+  }
+}
+
+static void sub_row_simd(int16_t* acc, const int16_t* row, unsigned n) {
+  for (unsigned i = 0; i < n; i += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i*) (acc + i));
+    __m256i r = _mm256_loadu_si256((const __m256i*) (row + i));
+    _mm256_storeu_si256((__m256i*) (acc + i), _mm256_sub_epi16(a, r));
+  }
+}
+
+static void clip_simd(const int16_t* in, uint8_t* out, unsigned n) {
+  const __m256i max = _mm256_set1_epi16(127);
+  for (unsigned i = 0; i < n; i += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (in + i));
+    v = _mm256_min_epi16(v, max);
+    // Packing with unsigned saturation takes care of the lower bound.
+    __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(v),
+        _mm256_extracti128_si256(v, 1));
+    _mm_storeu_si128((__m128i*) (out + i), packed);
+  }
+}
+
+static int32_t dot_simd(const uint8_t* x, const int8_t* w, unsigned n) {
+  // maddubs adds pairs of products into int16. Inputs are at most 127, so
+  // a pair is at most 2 * 127 * 128 in magnitude and can't saturate.
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i sum = _mm256_setzero_si256();
+  for (unsigned i = 0; i < n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i*) (x + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*) (w + i));
+    __m256i products = _mm256_maddubs_epi16(a, b);
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+  }
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum),
+      _mm256_extracti128_si256(sum, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+  return _mm_cvtsi128_si32(s);
+}
+
+#elif defined(NNUE_NEON)
+
+static void add_row_simd(int16_t* acc, const int16_t* row, unsigned n) {
+  for (unsigned i = 0; i < n; i += 8) {
+    vst1q_s16(acc + i, vaddq_s16(vld1q_s16(acc + i), vld1q_s16(row + i)));
+  }
+}
+
+static void sub_row_simd(int16_t* acc, const int16_t* row, unsigned n) {
+  for (unsigned i = 0; i < n; i += 8) {
+    vst1q_s16(acc + i, vsubq_s16(vld1q_s16(acc + i), vld1q_s16(row + i)));
+  }
+}
+
+static void clip_simd(const int16_t* in, uint8_t* out, unsigned n) {
+  const int16x8_t max = vdupq_n_s16(127);
+  for (unsigned i = 0; i < n; i += 8) {
+    int16x8_t v = vminq_s16(vld1q_s16(in + i), max);
+    // Narrowing with unsigned saturation takes care of the lower bound.
+    vst1_u8(out + i, vqmovun_s16(v));
+  }
+}
+
+static int32_t dot_simd(const uint8_t* x, const int8_t* w, unsigned n) {
+  // Inputs are at most 127, so they can be treated as signed, and a pair of
+  // products fits in int16.
+  int32x4_t sum = vdupq_n_s32(0);
+  for (unsigned i = 0; i < n; i += 16) {
+    int8x16_t a = vreinterpretq_s8_u8(vld1q_u8(x + i));
+    int8x16_t b = vld1q_s8(w + i);
+    int16x8_t products = vmull_s8(vget_low_s8(a), vget_low_s8(b));
+    products = vmlal_s8(products, vget_high_s8(a), vget_high_s8(b));
+    sum = vpadalq_s16(sum, products);
+  }
+  return vaddvq_s32(sum);
+}
+
+#else
+
+#define add_row_simd add_row_scalar
+#define sub_row_simd sub_row_scalar
+#define clip_simd clip_scalar
+#define dot_simd dot_scalar
+
+#endif
+
+const char* nnue_kernels() {
+#if defined(NNUE_AVX2)
+  return "avx2";
+#elif defined(NNUE_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+// Get the square of a king, or a1 if there is none. This is only used to pick
+// features, so a missing king just needs a consistent answer.
+static inline int king_square(const Position& p, bool white) {
+  uint64_t king = p.get_board(white ? Position::W_KING : Position::B_KING);
+  return king == 0 ? 0 : lsb(king);
+}
+
+// The pieces which are input features, in the order of their feature index
+// for white's view of the board.
+static const int FEATURE_PIECES[10] = {
+  Position::W_PAWN, Position::W_KNIGHT, Position::W_BISHOP, Position::W_ROOK,
+  Position::W_QUEEN, Position::B_PAWN, Position::B_KNIGHT, Position::B_BISHOP,
+  Position::B_ROOK, Position::B_QUEEN
+};
+
+NNUENetwork::NNUENetwork(unsigned h): hidden{h}, ft_bias(h, 0),
+  ft_weights((size_t) INPUTS * h, 0), l1_bias(L1, 0),
+  l1_weights(2 * L1 * h, 0), out_bias{0}, out_weights(L1, 0) {
+  if (h == 0 || h % 16 != 0 || h > MAX_HIDDEN) {
+    throw std::runtime_error("NNUE accumulator size must be a positive "
+        "multiple of 16 no larger than " + std::to_string(MAX_HIDDEN));
+  }
+}
+
+// Read an array of values from a network file.
+template <typename T>
+static void read_values(std::istream& in, T* data, size_t count) {
+  in.read(reinterpret_cast<char*>(data), count * sizeof(T));
+  if (!in) {
+    throw std::runtime_error("NNUE network file is truncated");
+  }
+}
+
+// Write an array of values to a network file.
+template <typename T>
+static void write_values(std::ostream& out, const T* data, size_t count) {
+  out.write(reinterpret_cast<const char*>(data), count * sizeof(T));
+}
+
+std::shared_ptr<NNUENetwork> NNUENetwork::load(const std::string& path) {
+  // The format is little-endian, which matches every platform the SIMD
+  // kernels target, so values are read directly into place.
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Could not open NNUE network file " + path);
+  }
+  uint32_t header[3];
+  read_values(in, header, 3);
+  if (header[0] != MAGIC) {
+    throw std::runtime_error(path + " is not an NNUE network file");
+  }
+  if (header[1] != VERSION) {
+    throw std::runtime_error("Unsupported NNUE network version " +
+        std::to_string(header[1]));
+  }
+  std::shared_ptr<NNUENetwork> net = std::make_shared<NNUENetwork>(header[2]);
+  read_values(in, net->ft_bias.data(), net->ft_bias.size());
+  read_values(in, net->ft_weights.data(), net->ft_weights.size());
+  read_values(in, net->l1_bias.data(), net->l1_bias.size());
+  read_values(in, net->l1_weights.data(), net->l1_weights.size());
+  read_values(in, &net->out_bias, 1);
+  read_values(in, net->out_weights.data(), net->out_weights.size());
+  if (in.peek() != std::char_traits<char>::eof()) {
+    throw std::runtime_error("NNUE network file " + path +
+        " has unexpected trailing data");
+  }
+  return net;
+}
+
+void NNUENetwork::save(const std::string& path) const {
+  std::ofstream out(path, std::ios::binary);
+  uint32_t header[3] = {MAGIC, VERSION, hidden};
+  write_values(out, header, 3);
+  write_values(out, ft_bias.data(), ft_bias.size());
+  write_values(out, ft_weights.data(), ft_weights.size());
+  write_values(out, l1_bias.data(), l1_bias.size());
+  write_values(out, l1_weights.data(), l1_weights.size());
+  write_values(out, &out_bias, 1);
+  write_values(out, out_weights.data(), out_weights.size());
+  if (!out) {
+    throw std::runtime_error("Could not write NNUE network file " + path);
+  }
+}
+
+std::shared_ptr<NNUENetwork> NNUENetwork::random(unsigned hidden,
+    uint64_t seed) {
+  std::shared_ptr<NNUENetwork> net = std::make_shared<NNUENetwork>(hidden);
+  // A small xorshift generator is plenty for test weights.
+  uint64_t state = seed | 1;
+  auto next = [&state](int lo, int hi) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return lo + (int) (state % (uint64_t) (hi - lo + 1));
+  };
+  // At most 30 features are active, so these weights keep every accumulator
+  // well within int16.
+  for (int16_t& b : net->ft_bias) {
+    b = next(0, 64);
+  }
+  for (int16_t& w : net->ft_weights) {
+    w = next(-16, 16);
+  }
+  for (int32_t& b : net->l1_bias) {
+    b = next(-4096, 4096);
+  }
+  for (int8_t& w : net->l1_weights) {
+    w = next(-64, 64);
+  }
+  net->out_bias = next(-1024, 1024);
+  for (int8_t& w : net->out_weights) {
+    w = next(-64, 64);
+  }
+  return net;
+}
+
+unsigned NNUENetwork::feature(bool white, int king, int piece, int square) {
+  bool own = Position::piece_is_white(piece) == white;
+  int type = piece % 7;
+  if (!white) {
+    king ^= 56;
+    square ^= 56;
+  }
+  return (king * 10 + type + (own ? 0 : 5)) * 64 + square;
+}
+
+void NNUENetwork::refresh(const Position& p, bool white, int16_t* acc,
+    bool scalar) const {
+  auto add_row = scalar ? add_row_scalar : add_row_simd;
+  std::copy(ft_bias.begin(), ft_bias.end(), acc);
+  int king = king_square(p, white);
+  for (int piece : FEATURE_PIECES) {
+    for (int sq : p.find_piece(piece)) {
+      add_row(acc,
+          &ft_weights[(size_t) feature(white, king, piece, sq) * hidden],
+          hidden);
+    }
+  }
+}
+
+int32_t NNUENetwork::propagate(const int16_t* us, const int16_t* them,
+    bool scalar) const {
+  alignas(32) uint8_t input[2 * MAX_HIDDEN];
+  alignas(32) uint8_t l1_out[L1];
+  auto clip = scalar ? clip_scalar : clip_simd;
+  auto dot = scalar ? dot_scalar : dot_simd;
+
+  clip(us, input, hidden);
+  clip(them, input + hidden, hidden);
+  for (unsigned o = 0; o < L1; o++) {
+    int32_t sum = l1_bias[o] + dot(input, &l1_weights[o * 2 * hidden],
+        2 * hidden);
+    l1_out[o] = std::clamp(sum >> WEIGHT_SHIFT, 0, 127);
+  }
+  return out_bias + dot(l1_out, out_weights.data(), L1);
+}
+
+int32_t NNUENetwork::evaluate(const Position& p, bool white_to_move,
+    bool scalar) const {
+  std::vector<int16_t> white(hidden);
+  std::vector<int16_t> black(hidden);
+  refresh(p, true, white.data(), scalar);
+  refresh(p, false, black.data(), scalar);
+  if (white_to_move) {
+    return propagate(white.data(), black.data(), scalar);
+  } else {
+    return propagate(black.data(), white.data(), scalar);
+  }
+}
+
+NNUEEvaluator::NNUEEvaluator(std::shared_ptr<const NNUENetwork> n): net{n},
+  positions(NNUE_STACK_SIZE), valid(NNUE_STACK_SIZE, 0),
+  values(2 * NNUE_STACK_SIZE * n->hidden), root{0} {}
+
+void NNUEEvaluator::initialize(GameState& gs) {
+  // Accumulators from an earlier search are still correct for the positions
+  // they were computed for, so they are kept as starting points.
+  root = gs.history_size();
+}
+
+void NNUEEvaluator::update(unsigned ply, unsigned source, const Position& p) {
+  const Position& old = positions[source];
+  for (bool white : {false, true}) {
+    int16_t* acc = accumulator(ply, white);
+    int king = king_square(p, white);
+    if (king != king_square(old, white)) {
+      net->refresh(p, white, acc);
+      continue;
+    }
+    if (source != ply) {
+      const int16_t* from = accumulator(source, white);
+      std::copy(from, from + net->hidden, acc);
+    }
+    for (int piece : FEATURE_PIECES) {
+      uint64_t before = old.get_board(piece);
+      uint64_t after = p.get_board(piece);
+      for (int sq : SquareSet(before & ~after)) {
+        sub_row_simd(acc, &net->ft_weights[(size_t) NNUENetwork::feature(
+              white, king, piece, sq) * net->hidden], net->hidden);
+      }
+      for (int sq : SquareSet(after & ~before)) {
+        add_row_simd(acc, &net->ft_weights[(size_t) NNUENetwork::feature(
+              white, king, piece, sq) * net->hidden], net->hidden);
+      }
+    }
+  }
+}
+
+double NNUEEvaluator::evaluate_position(GameState& gs) {
+  const Position& p = gs.pos();
+  unsigned size = gs.history_size();
+  unsigned ply = size > root ? std::min<unsigned>(size - root,
+      NNUE_STACK_SIZE - 1) : 0;
+
+  // Start from whichever of this ply's and the parent's accumulators is
+  // closest to the current position.
+  int source = -1;
+  int best = REFRESH_THRESHOLD + 1;
+  unsigned candidates[2] = {ply, ply - 1};
+  for (unsigned i = 0; i < (ply > 0 ? 2u : 1u); i++) {
+    unsigned s = candidates[i];
+    if (!valid[s]) {
+      continue;
+    }
+    int different = 0;
+    for (int piece : FEATURE_PIECES) {
+      different += popcount(positions[s].get_board(piece) ^
+          p.get_board(piece));
+    }
+    if (different < best) {
+      source = s;
+      best = different;
+    }
+  }
+
+  if (source < 0) {
+    net->refresh(p, true, accumulator(ply, true));
+    net->refresh(p, false, accumulator(ply, false));
+  } else {
+    update(ply, source, p);
+  }
+  positions[ply] = p;
+  valid[ply] = 1;
+
+  bool white = gs.whites_move();
+  int32_t out = net->propagate(accumulator(ply, white),
+      accumulator(ply, !white));
+  double score = out / NNUENetwork::OUTPUT_SCALE;
+  return white ? score : -score;
+}
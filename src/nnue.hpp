@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boards.hpp"
+#include "evaluation.hpp"
+
+// The number of accumulators kept by each NNUE evaluator, one per ply below
+// the root. Deeper positions share the last one.
+#define NNUE_STACK_SIZE 256
+
+/**
+ * \brief A quantized, efficiently updatable neural network.
+ *
+ * The network has a HalfKP feature transformer followed by two dense layers:
+ *
+ * 1. Each side has its own view of the board. An input feature is the
+ *    combination of that side's king square with the type, color and square
+ *    of one other piece (kings excluded), giving `INPUTS` features. The
+ *    active features' rows of `ft_weights` are summed with `ft_bias` into an
+ *    accumulator of `hidden` int16 values. Black's view is flipped vertically
+ *    so that both sides see themselves at the bottom of the board.
+ * 2. The side to move's accumulator, then the other side's, are clipped to
+ *    [0, 127] and fed through a dense layer with int8 weights into `L1`
+ *    values. These are shifted right by `WEIGHT_SHIFT` and clipped to
+ *    [0, 127] again.
+ * 3. A dense layer with int8 weights produces a single int32 output.
+ *
+ * Activations are scaled by 127 and weights by 64, so the output divided by
+ * `OUTPUT_SCALE` is the evaluation in pawns from the side to move's point of
+ * view.
+ *
+ * Networks are stored in a little-endian binary file: the magic number and
+ * version as uint32, `hidden` as uint32, then `ft_bias`, `ft_weights`,
+ * `l1_bias`, `l1_weights`, `out_bias` and `out_weights` in that order as laid
+ * out below.
+ */
+struct NNUENetwork {
+  /** The first four bytes of a network file, "CHNN". */
+  static const uint32_t MAGIC = 0x4e4e4843;
+  /** The version of the file format. */
+  static const uint32_t VERSION = 1;
+  /** The number of input features per side. */
+  static const unsigned INPUTS = 64 * 10 * 64;
+  /** The number of outputs of the first dense layer. */
+  static const unsigned L1 = 32;
+  /** The shift which removes the weight scale after a dense layer. */
+  static const int WEIGHT_SHIFT = 6;
+  /** The largest accumulator size which can be loaded. */
+  static const unsigned MAX_HIDDEN = 2048;
+  /** The output value of one pawn. */
+  static constexpr double OUTPUT_SCALE = 127.0 * 64.0;
+
+  /** The size of each side's accumulator. This is a multiple of 16. */
+  unsigned hidden;
+  /** The accumulator bias, `hidden` values. */
+  std::vector<int16_t> ft_bias;
+  /** The feature weights, `hidden` values per feature. */
+  std::vector<int16_t> ft_weights;
+  /** The first dense layer's bias, `L1` values. */
+  std::vector<int32_t> l1_bias;
+  /** The first dense layer's weights, `2 * hidden` values per output. */
+  std::vector<int8_t> l1_weights;
+  /** The output bias. */
+  int32_t out_bias;
+  /** The output weights, `L1` values. */
+  std::vector<int8_t> out_weights;
+
+  /**
+   * \brief Construct a network with all weights set to zero.
+   *
+   * \param hidden The accumulator size, which must be a positive multiple
+   * of 16 no larger than MAX_HIDDEN.
+   */
+  NNUENetwork(unsigned hidden);
+
+  /**
+   * \brief Read a network from a file.
+   *
+   * A std::runtime_error is thrown if the file can't be read or is not a
+   * valid network.
+   */
+  static std::shared_ptr<NNUENetwork> load(const std::string& path);
+
+  /**
+   * \brief Write this network to a file in the format read by load.
+   */
+  void save(const std::string& path) const;
+
+  /**
+   * \brief Construct a network with random weights.
+   *
+   * This is mostly useful for testing. The weights are small enough that no
+   * accumulator can overflow.
+   */
+  static std::shared_ptr<NNUENetwork> random(unsigned hidden, uint64_t seed);
+
+  /**
+   * \brief Get the index of an input feature.
+   *
+   * \param white True for white's view of the board.
+   * \param king The square of the viewing side's king.
+   * \param piece The piece, which must not be a king.
+   * \param square The square the piece is on.
+   */
+  static unsigned feature(bool white, int king, int piece, int square);
+
+  /**
+   * \brief Compute one side's accumulator from scratch.
+   *
+   * \param p The position.
+   * \param white True for white's view of the board.
+   * \param acc Set to the accumulator, `hidden` values.
+   * \param scalar If true, use the portable kernels even if SIMD kernels are
+   * available.
+   */
+  void refresh(const Position& p, bool white, int16_t* acc,
+      bool scalar = false) const;
+
+  /**
+   * \brief Run the dense layers.
+   *
+   * \param us The side to move's accumulator.
+   * \param them The other side's accumulator.
+   * \param scalar If true, use the portable kernels even if SIMD kernels are
+   * available. This is used to check the SIMD kernels.
+   * \return The output, in units of 1 / OUTPUT_SCALE pawns.
+   */
+  int32_t propagate(const int16_t* us, const int16_t* them,
+      bool scalar = false) const;
+
+  /**
+   * \brief Evaluate a position from scratch.
+   *
+   * \param p The position.
+   * \param white_to_move True if it is white's turn.
+   * \param scalar If true, use only the portable kernels.
+   * \return The output for the side to move.
+   */
+  int32_t evaluate(const Position& p, bool white_to_move,
+      bool scalar = false) const;
+};
+
+/**
+ * \brief Get the name of the SIMD instruction set used by the NNUE kernels.
+ *
+ * This is "scalar" if none is available.
+ */
+const char* nnue_kernels();
+
+/**
+ * \brief An evaluator backed by an NNUE network.
+ *
+ * The network is shared between clones, so each search thread only owns its
+ * accumulators. Each ply below the root has an accumulator along with the
+ * position it was computed for. When a position is evaluated its accumulator
+ * is found by taking the one for the same or the previous ply, whichever
+ * differs from the position in fewer squares, and adding and removing the
+ * features of the pieces which differ. A side's accumulator is only rebuilt
+ * from scratch when its king has moved, since then every feature changes.
+ * Working from the difference in bitboards means the accumulators never need
+ * to be told about moves, and every evaluation is exact no matter which
+ * positions were evaluated before it.
+ */
+class NNUEEvaluator: public Evaluator {
+  private:
+    /** If more pieces than this differ, the accumulators are rebuilt. */
+    static const int REFRESH_THRESHOLD = 16;
+
+    /** The network. */
+    std::shared_ptr<const NNUENetwork> net;
+    /** The position each accumulator was computed for. */
+    std::vector<Position> positions;
+    /** Whether each accumulator holds a value yet. */
+    std::vector<uint8_t> valid;
+    /** The accumulators, indexed by ply, then side (white is 1). */
+    std::vector<int16_t> values;
+    /** The history size of the root position. */
+    unsigned root;
+
+    inline int16_t* accumulator(unsigned ply, bool white) {
+      return values.data() + (2 * ply + white) * net->hidden;
+    }
+
+    /**
+     * \brief Bring the accumulators for a ply up to date with a position.
+     *
+     * \param ply The ply to update.
+     * \param source The ply whose accumulators to start from. They must be
+     * valid.
+     */
+    void update(unsigned ply, unsigned source, const Position& p);
+
+  public:
+    /**
+     * \brief Construct an evaluator using the given network.
+     */
+    NNUEEvaluator(std::shared_ptr<const NNUENetwork> n);
+
+    /**
+     * \brief Start a new search from the given root position.
+     */
+    void initialize(GameState& gs) override;
+
+    double evaluate_position(GameState& gs) override;
+
+    std::unique_ptr<Evaluator> clone() const override {
+      return std::make_unique<NNUEEvaluator>(*this);
+    }
+};
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "perft.hpp"
+#include "movegen.hpp"
+
+uint64_t perft(GameState& gs, unsigned depth) {
+  if (depth == 0) {
+    return 1;
+  }
+  MoveList ml;
+  generate_moves(gs, ml);
+  if (depth == 1) {
+    // Bulk counting: every legal move is exactly one leaf.
+    return ml.size();
+  }
+  uint64_t n = 0;
+  for (const Move& m : ml) {
+    gs.make_move(m);
+    n += perft(gs, depth - 1);
+    gs.undo_move();
+  }
+  return n;
+}
+
+std::vector<std::pair<Move, uint64_t>> divide(const GameState& gs,
+    unsigned depth, unsigned threads) {
+  std::vector<std::pair<Move, uint64_t>> results;
+  if (depth == 0) {
+    return results;
+  }
+  MoveList ml;
+  generate_moves(gs, ml);
+  for (const Move& m : ml) {
+    results.push_back(std::make_pair(m, 0));
+  }
+
+  // Each worker repeatedly claims the next unclaimed root move. The subtrees
+  // can differ in size by orders of magnitude, so this balances the load much
+  // better than handing each thread a fixed share up front.
+  std::atomic<unsigned> next{0};
+  auto worker = [&]() {
+    GameState local(gs);
+    for (unsigned i = next++; i < results.size(); i = next++) {
+      local.make_move(results[i].first);
+      results[i].second = perft(local, depth - 1);
+      local.undo_move();
+    }
+  };
+
+  threads = std::clamp<unsigned>(threads, 1, std::max<unsigned>(1, ml.size()));
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; i++) {
+    pool.push_back(std::thread(worker));
+  }
+  // The calling thread does its share of the work too.
+  worker();
+  for (std::thread& t : pool) {
+    t.join();
+  }
+  return results;
+}
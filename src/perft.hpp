@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "boards.hpp"
+
+/**
+ * \brief Count the leaves of the legal move tree to a given depth.
+ *
+ * This is used to check move generation against known results and to measure
+ * its speed. At depth one the legal moves are counted rather than made, which
+ * avoids making and undoing a move for every leaf.
+ *
+ * \param gs The game state to start from. It is restored before returning.
+ * \param depth The number of plies to search.
+ * \return The number of leaf nodes.
+ */
+uint64_t perft(GameState& gs, unsigned depth);
+
+/**
+ * \brief Count the leaves of the legal move tree below each root move.
+ *
+ * The root moves may be divided among several threads, each of which works
+ * on its own copy of the game state.
+ *
+ * \param gs The game state to start from.
+ * \param depth The number of plies to search, including the root move.
+ * \param threads The number of threads to use.
+ * \return Each legal root move with the number of leaves below it, in move
+ * generation order.
+ */
+std::vector<std::pair<Move, uint64_t>> divide(const GameState& gs,
+    unsigned depth, unsigned threads);
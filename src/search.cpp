@@ -1,300 +1,996 @@
+#include <algorithm>
+#include <cmath>
 #include <limits>
-#include <queue>
+#include <thread>
 
+#include "bits.hpp"
 #include "search.hpp"
 #include "movegen.hpp"
+#include "timeman.hpp"
 
 /**
- * \brief Get the point value of a piece
+ * \brief Perform an alpha-beta search and get the score.
  *
- * We also return a value for kings because this is used for move ordering
- * by examining the difference between the captured and capturing piece.
- */
-int piece_score(int piece) {
-  switch (piece) {
-    case Position::W_PAWN:
-    case Position::B_PAWN:
-      return 1;
-    case Position::W_KNIGHT:
-    case Position::B_KNIGHT:
-    case Position::W_BISHOP:
-    case Position::B_BISHOP:
-      return 3;
-    case Position::W_ROOK:
-    case Position::B_ROOK:
-      return 5;
-    case Position::W_QUEEN:
-    case Position::B_QUEEN:
-      return 9;
-    case Position::W_KING:
-    case Position::B_KING:
-      return 100;
-    default:
-      throw std::runtime_error("Illegal capture: " + std::to_string(piece));
-  }
-}
-
-/**
- * \brief An ordering for moves in a search.
+ * The principle variation found below this node is written to
+ * `pv_table[ply]`.
  *
- * Better move ordering can dramatically increase the amount of pruning that's
- * possible in the search. This class is designed to be used with a
- * std::priority_queue for move ordering. Note that this class is designed to
- * work for a specific game state, and should be reinitialized at each search
- * node.
+ * \param gs The current state of the game.
+ * \param depth The depth to search to.
+ * \param ply The distance from the root of the search.
+ * \param alpha The current best score for the alpha-player.
+ * \param beta The current best score for the beta-player.
+ * \param on_pv True if every move leading here was in the principle variation
+ * of the previous iteration.
+ * \param info An object to write search data into for passing to the GUI.
+ * \param stop_signal If true, return immediately.
+ * \param max_nodes The maximum number of nodes to search.
+ * \return The value of the current position.
  */
-class MoveOrdering {
-  private:
-    /** The current state of the game. */
-    const GameState& gs;
-    /** The move for this position in the principle variation. */
-    const std::optional<Move> pv_move;
-
-  public:
-    MoveOrdering(const GameState& g, const std::optional<Move> m):
-      gs{g}, pv_move{m} {}
-
-    /**
-     * \brief Compare two moves to determine their order in the queue.
-     *
-     * The semantics here are that this function should return true if
-     * r should be given higher priority than l.
-     */
-    bool operator()(const Move& l, const Move& r) {
-      // The move in the principle variation is always given highest priority.
-      if (pv_move && l == *pv_move) {
-        return false;
-      }
-      if (pv_move && r == *pv_move) {
-        return true;
-      }
-      // After that, we always search captures first
-      if (l.capture() && !r.capture()) {
-        return false;
+double BasicAlphaBetaSearcher::alpha_beta(GameState& gs, unsigned depth,
+    unsigned ply, double alpha, double beta, bool on_pv, SearchInfo& info,
+    std::atomic<bool>& stop_signal, uint64_t max_nodes) {
+  // If we reach the depth limit, switch to a quiescence search.
+  if (depth == 0) {
+    return quiescence(gs, ply, alpha, beta, info, stop_signal, max_nodes);
+  }
+  pv_length[ply] = 0;
+  // If we have been told to stop, return immediately.
+  if (stop_signal || out_of_time) {
+    return 0.0;
+  }
+  count_node(info, false);
+  if (over_node_limit(info, max_nodes)) {
+    return 0.0;
+  }
+  // A repeated position is a draw, since either side can repeat it again.
+  if (gs.repetitions() > 0) {
+    return 0.0;
+  }
+  // If the principle variation table is full we can't go any deeper.
+  if (ply >= MAX_PLY - 1) {
+    return evaluate(gs);
+  }
+  // See whether we have already searched this position deeply enough. Exact
+  // scores inside the window are not used for a cutoff because we would lose
+  // the principle variation below this node.
+  TTEntry entry;
+  std::optional<Move> hash_move;
+  if (probe(gs, ply, entry)) {
+    if (!entry.move.is_null()) {
+      hash_move = entry.move;
+    }
+    if (entry.depth >= (int) depth) {
+      if (entry.bound != TTEntry::UPPER && entry.score >= beta) {
+        return beta;
       }
-      if (!l.capture() && r.capture()) {
-        return true;
+      if (entry.bound != TTEntry::LOWER && entry.score <= alpha) {
+        return alpha;
       }
-      // If both moves are captures, we consider whichever one has the larger
-      // difference between the value of the capturing piece and the value of
-      // the captured piece.
-      if (l.capture()) {
-        int lscore = 0;
-        if (l.capture_ep()) {
-          lscore = 1;
-        } else {
-          lscore = piece_score(gs.pos().get_piece(l.to_square())) -
-              piece_score(l.piece());
-        }
-        int rscore = 0;
-        if (r.capture_ep()) {
-          rscore = 1;
-        } else {
-          rscore = piece_score(gs.pos().get_piece(r.to_square())) -
-              piece_score(r.piece());
+    }
+  }
+  double tb_score;
+  if (probe_tablebase(gs, ply, alpha, beta, info, tb_score)) {
+    return tb_score;
+  }
+  // Moves are produced lazily in order of how promising they are. The
+  // principle variation move is tried first, falling back to the best move
+  // from the hash table.
+  std::optional<Move> prev_pv_move;
+  if (on_pv && ply < this->principle_variation.size()) {
+    prev_pv_move = this->principle_variation[ply];
+  }
+  MovePicker picker(gs, prev_pv_move ? prev_pv_move : hash_move,
+      killers[ply], &history, false);
+  unsigned legal_moves = 0;
+  Move best_move;
+  Move m;
+  while (picker.next(m)) {
+    legal_moves++;
+    // We stay on the principle variation only by following it exactly.
+    bool child_on_pv = prev_pv_move && m == *prev_pv_move;
+    gs.make_move(m);
+    // The child's score has the opponent's perspective, so we flip it for the
+    // current frame.
+    double score = -alpha_beta(gs, depth - 1, ply + 1, -beta, -alpha,
+        child_on_pv, info, stop_signal, max_nodes);
+    gs.undo_move();
+    // Results from an interrupted search are meaningless, so we stop without
+    // caching anything.
+    if (interrupted(stop_signal, info, max_nodes)) {
+      return 0.0;
+    }
+    if (score >= beta) {
+      count_cutoff(legal_moves);
+      // Cutoff the search. This node will not be in the principle variation
+      // of its parent, so we don't need to record one. A quiet move which
+      // causes a cutoff is likely to be good in sibling positions too.
+      if (!m.capture() && !m.promotion()) {
+        if (!(killers[ply][0] == m)) {
+          killers[ply][1] = killers[ply][0];
+          killers[ply][0] = m;
         }
-        return lscore < rscore;
+        history.update(gs.whites_move(), m, depth);
       }
-      // If neither move is a capture, we use any arbitrary ordering.
-      return true;
+      store(gs, ply, m, beta, depth, TTEntry::LOWER);
+      return beta;
+    }
+    if (score > alpha) {
+      // New best score -- update alpha
+      alpha = score;
+      best_move = m;
+      update_pv(ply, m);
     }
-};
+  }
+  if (legal_moves == 0) {
+    if (in_check(gs.whites_move(), gs.pos())) {
+      // Checkmate
+      return -1000.0;
+    } else {
+      // Stalemate
+      return 0.0;
+    }
+  }
+  uint8_t bound = best_move.is_null() ? TTEntry::UPPER : TTEntry::EXACT;
+  store(gs, ply, best_move, alpha, depth, bound);
+  return alpha;
+}
 
 /**
- * \brief Perform an alpha-beta search and get the score.
+ * \brief Search captures until the position is quiet, then evaluate it.
+ *
+ * Stopping the search at a fixed depth would misjudge positions in the middle
+ * of an exchange, so at the horizon we keep searching captures. The side to
+ * move may also decline to capture and take the static evaluation instead
+ * (the "stand pat" score). In check there is no such option, so every
+ * evasion is searched.
  *
  * \param gs The current state of the game.
- * \param depth The depth to search to.
+ * \param ply The distance from the root of the search.
  * \param alpha The current best score for the alpha-player.
  * \param beta The current best score for the beta-player.
- * \param quiescence_search True if the search is in the quiescence phase.
  * \param info An object to write search data into for passing to the GUI.
  * \param stop_signal If true, return immediately.
- * \param pv_iter The next move in the principle variation.
+ * \param max_nodes The maximum number of nodes to search.
  * \return The value of the current position.
  */
-SearchResult BasicAlphaBetaSearcher::alpha_beta(GameState& gs,
-    unsigned depth, double alpha, double beta, bool quiescence_search,
-    SearchInfo& info, bool& stop_signal, MoveList::const_iterator pv_iter,
-    unsigned max_nodes) {
-  // If we have been told to stop, return immediately.
-  if (stop_signal) {
-    return SearchResult(0.0, MoveList());
+double BasicAlphaBetaSearcher::quiescence(GameState& gs, unsigned ply,
+    double alpha, double beta, SearchInfo& info,
+    std::atomic<bool>& stop_signal, uint64_t max_nodes) {
+  pv_length[ply] = 0;
+  if (stop_signal || out_of_time) {
+    return 0.0;
   }
-  info.nodes++;
-  if (info.nodes > max_nodes) {
-    return SearchResult(0.0, MoveList());
+  count_node(info, true);
+  if (over_node_limit(info, max_nodes)) {
+    return 0.0;
   }
-  MoveList::const_iterator next_pv_iter;
-  if (pv_iter == this->principle_variation.cend()) {
-    next_pv_iter = pv_iter;
-  } else {
-    next_pv_iter = pv_iter + 1;
-  }
-  // If we reach the depth limit, switch to a quiescence search
-  if (depth == 0 && !quiescence_search) {
-    // TODO: For now, we don't do any quiescence search
-    double v = eval->evaluate_position(gs);
-    if (gs.whites_move()) {
-      return SearchResult(v, MoveList());
-    } else {
-      return SearchResult(-v, MoveList());
-    }
+  // Captures reset the repetition count, so after one nothing can repeat.
+  // A repetition is still possible at the first node, or after the quiet
+  // evasions searched when in check.
+  if (gs.repetitions() > 0) {
+    return 0.0;
   }
-  // Generate and sort a list of possible moves
-  MoveList move_list = generate_moves(gs);
-  std::optional<Move> pv_move;
-  if (pv_iter != this->principle_variation.cend()) {
-    pv_move = *pv_iter;
+  bool check = in_check(gs.whites_move(), gs.pos());
+  double stand_pat = evaluate(gs);
+  if (ply >= MAX_PLY - 1) {
+    return stand_pat;
   }
-  MoveOrdering mo(gs, pv_move);
-  std::priority_queue<Move, std::vector<Move>, MoveOrdering>
-    ml(move_list.begin(), move_list.end(), mo);
-  if (ml.empty()) {
-    if (in_check(gs.whites_move(), gs.pos())) {
-      // Checkmate
-      return SearchResult(-1000.0, MoveList());
-    } else {
-      // Stalemate
-      return SearchResult(0.0, MoveList());
+  if (!check) {
+    if (stand_pat >= beta) {
+      return beta;
     }
-  }
-  bool q_finished = true;   // True when the quiescence search is finished
-  MoveList pv;
-  while (!ml.empty()) {
-    const Move& m = ml.top();
-    if (m != *next_pv_iter) {
-      // We are moving off the pv, so we should make sure not to use it for
-      // future move ordering
-      next_pv_iter = this->principle_variation.cend();
-    }
-    if (quiescence_search && !m.capture()) {
-      continue;
+    if (stand_pat > alpha) {
+      alpha = stand_pat;
     }
-    if (m.capture()) {
-      q_finished = false;
+  }
+
+  MovePicker picker(gs, std::nullopt, nullptr, nullptr, !check);
+  unsigned legal_moves = 0;
+  Move m;
+  while (picker.next(m)) {
+    legal_moves++;
+    if (!check) {
+      // Delta pruning: skip captures which can't raise alpha even if they
+      // win the captured piece for free.
+      double gain = m.capture_ep() ? 1.0 :
+        m.capture() ? piece_score(gs.pos().get_piece(m.to_square())) : 0.0;
+      if (m.promotion()) {
+        gain += 8.0;
+      }
+      if (stand_pat + gain + DELTA_MARGIN <= alpha) {
+        continue;
+      }
+      // Captures which lose material are very unlikely to help.
+      if (MovePicker::losing_capture(gs.pos(), m)) {
+        continue;
+      }
     }
     gs.make_move(m);
-    auto res = alpha_beta(gs, depth - 1, -beta, -alpha, quiescence_search,
-        info, stop_signal, next_pv_iter, max_nodes);
+    double score = -quiescence(gs, ply + 1, -beta, -alpha, info,
+        stop_signal, max_nodes);
     gs.undo_move();
-    // res.score has the opponent's perspective, so we flip it for the current
-    // frame.
-    double score = -res.score;
+    if (interrupted(stop_signal, info, max_nodes)) {
+      return 0.0;
+    }
     if (score >= beta) {
-      // Cutoff the search
-      // We can return an empty move list here because it will not be in the
-      // principle variation in the next call up the stack anyway
-      return SearchResult(beta, MoveList());
+      return beta;
     }
     if (score > alpha) {
-      // New best score -- update alpha
       alpha = score;
-      pv = res.pv;
-      pv.push_front(m);
+      update_pv(ply, m);
     }
-    ml.pop();
   }
-  // If the quiescence search had no more moves to consider, return the value
-  // of this position.
-  if (q_finished && quiescence_search) {
-    double score = eval->evaluate_position(gs);
-    if (gs.whites_move()) {
-      return SearchResult(score, MoveList());
-    } else {
-      return SearchResult(-score, MoveList());
-    }
+  if (check && legal_moves == 0) {
+    // Checkmate
+    return -1000.0;
   }
-  return SearchResult(alpha, pv);
+  return alpha;
+}
+
+double BasicAlphaBetaSearcher::evaluate(GameState& gs) {
+  SEARCH_STAT(stats.evals++);
+  double v = eval->evaluate_position(gs);
+  return gs.whites_move() ? v : -v;
+}
+
+bool BasicAlphaBetaSearcher::probe_tablebase(GameState& gs, unsigned ply,
+    double alpha, double beta, SearchInfo& info, double& score) {
+  // The tables assume the fifty-move counter is zero, so we only probe just
+  // after a capture or pawn move. Those are also the moves by which the
+  // search enters the tables in the first place.
+  if (tb_pieces == 0 || gs.half_move_clock() != 0 || gs.can_castle() ||
+      (unsigned) popcount(gs.pos().get_board(Position::BOTH_ALL)) >
+      tb_pieces) {
+    return false;
+  }
+  std::optional<WDL> wdl = tablebase->probe_wdl(gs);
+  if (!wdl) {
+    return false;
+  }
+  info.tbhits.fetch_add(1, std::memory_order_relaxed);
+  // The tablebase result is exact. A mate the search might find is worth
+  // more, but a tablebase win is just as certain. The table stores it
+  // without the ply, since the position may be reached again at another.
+  double value = tablebase_score(*wdl, ply);
+  store(gs, ply, Move(), value, MAX_PLY, TTEntry::EXACT);
+  score = std::clamp(value, alpha, beta);
+  return true;
+}
+
+void BasicAlphaBetaSearcher::update_pv(unsigned ply, const Move& m) {
+  pv_table[ply][0] = m;
+  for (unsigned i = 0; i < pv_length[ply + 1]; i++) {
+    pv_table[ply][i + 1] = pv_table[ply + 1][i];
+  }
+  pv_length[ply] = pv_length[ply + 1] + 1;
+}
+
+MoveList BasicAlphaBetaSearcher::root_pv(const Move& m) const {
+  MoveList pv;
+  pv.push_back(m);
+  for (unsigned i = 0; i < pv_length[1]; i++) {
+    pv.push_back(pv_table[1][i]);
+  }
+  return pv;
+}
+
+const std::vector<SearchParams::Option>& SearchParams::options() {
+  static const std::vector<Option> list = {
+    {"AspirationWindow", &SearchParams::aspiration_window, 1, 1000},
+    {"NullMoveDepth", &SearchParams::null_move_depth, 1, 100},
+    {"NullMoveReduction", &SearchParams::null_move_reduction, 1, 10},
+    {"LMRDepth", &SearchParams::lmr_depth, 2, 100},
+    {"LMRMoves", &SearchParams::lmr_moves, 1, 256},
+    {"LMRBase", &SearchParams::lmr_base, 0, 500},
+    {"LMRDivisor", &SearchParams::lmr_divisor, 50, 2000},
+    {"FutilityDepth", &SearchParams::futility_depth, 0, 10},
+    {"FutilityMargin", &SearchParams::futility_margin, 0, 2000},
+    {"ReverseFutilityDepth", &SearchParams::reverse_futility_depth, 0, 10},
+    {"ReverseFutilityMargin", &SearchParams::reverse_futility_margin, 0,
+      2000},
+    {"CheckExtension", &SearchParams::check_extension, 0, 1},
+  };
+  return list;
 }
 
 Searcher::Searcher(std::unique_ptr<Evaluator>&& e): eval{std::move(e)} {}
 
 BasicAlphaBetaSearcher::BasicAlphaBetaSearcher(std::unique_ptr<Evaluator>&& e):
-  Searcher(std::move(e)), principle_variation{} {}
+  BasicAlphaBetaSearcher(std::move(e),
+      std::make_shared<TranspositionTable>(DEFAULT_HASH_SIZE)) {}
+
+BasicAlphaBetaSearcher::BasicAlphaBetaSearcher(std::unique_ptr<Evaluator>&& e,
+    std::shared_ptr<TranspositionTable> t):
+  Searcher(std::move(e)), principle_variation{}, next_root{}, tt{t},
+  pv_table{}, pv_length{}, killers{}, history{}, pending_nodes{0},
+  pending_qnodes{0}, timer{nullptr}, out_of_time{false}, stats{},
+  tablebase{nullptr}, tb_pieces{0} {}
+
+void BasicAlphaBetaSearcher::clear_tables() {
+  principle_variation.clear();
+  next_root = std::nullopt;
+  history.clear();
+  for (unsigned i = 0; i < MAX_PLY; i++) {
+    killers[i][0] = Move();
+    killers[i][1] = Move();
+  }
+}
+
+void BasicAlphaBetaSearcher::new_game() {
+  tt->clear();
+  clear_tables();
+}
+
+void BasicAlphaBetaSearcher::start_search(const GameState& gs) {
+  if (next_root && gs.hash() == *next_root) {
+    MoveList pv;
+    for (unsigned i = 2; i < principle_variation.size(); i++) {
+      pv.push_back(principle_variation[i]);
+    }
+    principle_variation = pv;
+  } else {
+    principle_variation.clear();
+  }
+  next_root = std::nullopt;
+  for (unsigned i = 0; i < MAX_PLY; i++) {
+    for (unsigned j = 0; j < 2; j++) {
+      killers[i][j] = i + 2 < MAX_PLY ? killers[i + 2][j] : Move();
+    }
+  }
+  history.age();
+}
+
+void BasicAlphaBetaSearcher::finish_search(GameState& gs) {
+  next_root = std::nullopt;
+  if (principle_variation.size() > 2) {
+    gs.make_move(principle_variation[0]);
+    gs.make_move(principle_variation[1]);
+    next_root = gs.hash();
+    gs.undo_move();
+    gs.undo_move();
+  }
+}
+
+void BasicAlphaBetaSearcher::set_tablebase(
+    std::shared_ptr<const Tablebase> tb) {
+  tablebase = tb;
+}
+
+void BasicAlphaBetaSearcher::check_time() {
+  if (timer && timer->hard_limit_reached()) {
+    out_of_time = true;
+  }
+}
 
 std::pair<double, Move> BasicAlphaBetaSearcher::search(GameState& gs,
-    const SearchLimits& limits, SearchInfo& info, bool& stop_signal) {
+    const SearchLimits& limits, SearchInfo& info,
+    std::atomic<bool>& stop_signal) {
+  info.nodes = 0;
+  info.qnodes = 0;
+  info.tbhits = 0;
+  info.depth = 0;
+  tt->new_search();
+  TimeManager timer(limits, gs.whites_move(), &info.pondering);
+  return iterative_deepening(gs, limits, info, stop_signal, 0, true, &timer);
+}
+
+std::pair<double, Move> BasicAlphaBetaSearcher::iterative_deepening(
+    GameState& gs, const SearchLimits& limits, SearchInfo& info,
+    std::atomic<bool>& stop_signal, unsigned start_depth, bool report,
+    TimeManager* timer) {
   MoveList ml;
   if (limits.moves) {
     // In this case the GUI has told us to only search some moves.
     ml = *limits.moves;
   } else {
-    ml = generate_moves(gs);
+    generate_moves(gs, ml);
   }
-  info.nodes = 0;
-  info.depth = 0;
+  tb_pieces = tablebase ? tablebase->max_pieces() : 0;
+  // Once the root is in the tables the root moves are filtered instead.
+  // Probing below them would give every move kept the same score, leaving
+  // the search no way to tell which makes progress.
+  unsigned root_moves = ml.size();
+  if (tablebase && !limits.moves &&
+      tablebase_root_filter(*tablebase, gs, ml)) {
+    tb_pieces = 0;
+    if (report) {
+      info.tbhits.fetch_add(root_moves, std::memory_order_relaxed);
+    }
+  }
+  pending_nodes = 0;
+  pending_qnodes = 0;
+  this->timer = timer;
+  out_of_time = false;
+  // This runs on the thread doing the search, so any tables the evaluator
+  // allocates belong to that thread.
+  eval->initialize(gs);
+  start_search(gs);
+  if (report) {
+    std::lock_guard<std::mutex> guard(info.pv_lock);
+    info.iterations.clear();
+    info.lines.clear();
+  }
+  // Order the root moves once, captures and promotions first by MVV-LVA.
+  // After that the best move of each iteration is moved to the front.
+  auto root_score = [&gs](const Move& m) {
+    if (m.capture() || m.promotion()) {
+      return MovePicker::capture_score(gs.pos(), m);
+    }
+    return std::numeric_limits<int32_t>::min();
+  };
+  std::stable_sort(ml.begin(), ml.end(), [&](const Move& l, const Move& r) {
+      return root_score(l) > root_score(r);
+    });
   unsigned max_depth = limits.depth_limit.value_or(1000);
   if (limits.mate_in) {
     // mate_in is in moves, so we convert it to plies
     max_depth = 2 * (*limits.mate_in);
   }
-  unsigned max_nodes = limits.node_limit.value_or(
-      std::numeric_limits<unsigned>::max());
+  uint64_t max_nodes = limits.node_limit.value_or(
+      std::numeric_limits<uint64_t>::max());
   double outer_best_score = -std::numeric_limits<double>::max();
   Move outer_best_move;
+  // The score of the last completed iteration.
+  std::optional<double> last_score;
+  // The best move of the last completed iteration.
+  Move last_best_move;
+  // The number of lines to find, and the lines of the last completed
+  // iteration if there is more than one.
+  unsigned multipv = std::clamp<unsigned>(limits.multipv.value_or(1), 1,
+      MAX_MULTIPV);
+  std::vector<std::pair<double, MoveList>> last_lines;
   // Outer loop for iterative deepening
-  for (unsigned depth = 0; depth < max_depth; depth++) {
-    if (stop_signal) {
+  for (unsigned depth = start_depth; depth < max_depth; depth++) {
+    if (interrupted(stop_signal, info, max_nodes)) {
       break;
     }
-    double best_score = -std::numeric_limits<double>::max();
-    Move best_move = Move(0, 0, 0, 0);
-    MoveList best_pv;
-    // Get a pointer to the head of the principle variation
-    MoveList::const_iterator pv_iter = this->principle_variation.cbegin();
-    MoveList::const_iterator next_pv_iter;
-    if (pv_iter == this->principle_variation.cend()) {
-      next_pv_iter = pv_iter;
-    } else {
-      next_pv_iter = pv_iter + 1;
-    }
-    // Create an ordered set of moves to search
-    MoveOrdering mo(gs, *pv_iter);
-    std::priority_queue<Move, std::vector<Move>, MoveOrdering>
-      queue(ml.begin(), ml.end(), mo);
-    while (!queue.empty()) {
-      if (stop_signal) {
-        break;
-      }
-      Move m = queue.top();
-      queue.pop();
-      gs.make_move(m);
-      auto res = alpha_beta(gs, depth, -std::numeric_limits<double>::max(),
-          -best_score, false, info, stop_signal, next_pv_iter, max_nodes);
-      gs.undo_move();
-      // We invert the score here because we made a move before calling into
-      // alpha_beta
-      double score = -res.score;
-      if (score > best_score) {
-        best_score = score;
-        best_move = m;
-        best_pv = res.pv;
-        best_pv.push_front(m);
+    unsigned iteration_start = timer ? timer->elapsed() : 0;
+    // The best move from the previous iteration is searched first.
+    if (!this->principle_variation.empty()) {
+      MoveList::iterator it = std::find(ml.begin(), ml.end(),
+          this->principle_variation[0]);
+      if (it != ml.end()) {
+        std::rotate(ml.begin(), it, it + 1);
       }
-      if (best_score > outer_best_score) {
+    }
+    Move best_move;
+    MoveList best_pv;
+    stats = SearchStats();
+    double best_score = search_iteration(gs, ml, depth, last_score, best_move,
+        best_pv, info, stop_signal, max_nodes);
+    bool best_complete = !interrupted(stop_signal, info, max_nodes);
+    std::vector<std::pair<double, MoveList>> lines;
+    if (best_complete && multipv > 1) {
+      lines.emplace_back(best_score, best_pv);
+      search_lines(gs, ml, depth, multipv, last_lines, lines, info,
+          stop_signal, max_nodes);
+    }
+    if (report && SEARCH_STATS_ENABLED) {
+      unsigned now = timer ? timer->elapsed() : 0;
+      std::lock_guard<std::mutex> guard(info.pv_lock);
+      info.iterations.push_back({depth + 1, now, now - iteration_start,
+          !interrupted(stop_signal, info, max_nodes), stats});
+    }
+    if (!best_complete) {
+      // Part of an iteration is still useful if it found a move which is
+      // better than the best move of the last complete one.
+      if (!best_move.is_null() && best_score > outer_best_score) {
         outer_best_score = best_score;
         outer_best_move = best_move;
         this->principle_variation = best_pv;
-        info.pv_lock.lock();
-        info.pv = best_pv;
-        info.pv_lock.unlock();
-        info.score = gs.whites_move() ? best_score : -best_score;
+        if (report) {
+          info.pv_lock.lock();
+          info.pv = best_pv;
+          info.pv_lock.unlock();
+          info.score = gs.whites_move() ? best_score : -best_score;
+        }
       }
+      break;
     }
-    if (!stop_signal) {
-      outer_best_score = best_score;
-      outer_best_move = best_move;
-      this->principle_variation = best_pv;
+    outer_best_score = best_score;
+    outer_best_move = best_move;
+    this->principle_variation = best_pv;
+    if (report) {
       info.pv_lock.lock();
       info.pv = best_pv;
       info.pv_lock.unlock();
       info.depth = depth + 1;
       info.score = gs.whites_move() ? outer_best_score : -outer_best_score;
     }
+    if (report && multipv > 1) {
+      std::lock_guard<std::mutex> guard(info.pv_lock);
+      std::vector<PVLine> published;
+      for (const auto& [score, pv] : lines) {
+        published.push_back({gs.whites_move() ? score : -score, depth + 1,
+            pv});
+      }
+      // If the search was stopped before it found every line, the rest are
+      // kept from the last iteration.
+      for (const PVLine& old : info.lines) {
+        if (published.size() < multipv && std::none_of(published.begin(),
+              published.end(), [&old](const PVLine& l) {
+                return l.pv[0] == old.pv[0];
+              })) {
+          published.push_back(old);
+        }
+      }
+      info.lines = published;
+    }
+    // The best line is complete, but the search may have stopped while it
+    // was looking for the others.
+    if (interrupted(stop_signal, info, max_nodes)) {
+      break;
+    }
+    if (timer) {
+      timer->iteration_finished(depth > start_depth &&
+          best_move != last_best_move);
+      unsigned now = timer->elapsed();
+      if (!timer->start_iteration(now, now - iteration_start)) {
+        break;
+      }
+    }
+    last_best_move = best_move;
+    last_score = best_score;
+    last_lines = lines;
+  }
+  flush_nodes(info);
+  this->timer = nullptr;
+  finish_search(gs);
+  // If time ran out before the first root move was searched we still need
+  // a move to play. The root moves are ordered, so take the first.
+  if (outer_best_move.is_null() && !ml.empty()) {
+    outer_best_move = ml[0];
   }
   if (!gs.whites_move()) {
     outer_best_score = -outer_best_score;
   }
   return std::make_pair(outer_best_score, outer_best_move);
 }
+
+void BasicAlphaBetaSearcher::search_lines(GameState& gs, const MoveList& ml,
+    unsigned depth, unsigned count,
+    const std::vector<std::pair<double, MoveList>>& previous,
+    std::vector<std::pair<double, MoveList>>& lines, SearchInfo& info,
+    std::atomic<bool>& stop_signal, uint64_t max_nodes) {
+  // The search of each line follows the principle variation of the line of
+  // the same rank from the previous iteration.
+  MoveList saved_pv = this->principle_variation;
+  MoveList rest;
+  for (const Move& m : ml) {
+    if (std::none_of(lines.begin(), lines.end(),
+          [&m](const auto& l) { return l.second[0] == m; })) {
+      rest.push_back(m);
+    }
+  }
+  while (lines.size() < count && !rest.empty()) {
+    unsigned rank = lines.size();
+    std::optional<double> previous_score;
+    this->principle_variation.clear();
+    if (rank < previous.size()) {
+      previous_score = previous[rank].first;
+      this->principle_variation = previous[rank].second;
+      MoveList::iterator it = std::find(rest.begin(), rest.end(),
+          this->principle_variation[0]);
+      if (it != rest.end()) {
+        std::rotate(rest.begin(), it, it + 1);
+      }
+    }
+    Move move;
+    MoveList pv;
+    double score = search_iteration(gs, rest, depth, previous_score, move, pv,
+        info, stop_signal, max_nodes);
+    if (interrupted(stop_signal, info, max_nodes) || move.is_null()) {
+      break;
+    }
+    lines.emplace_back(score, pv);
+    rest.truncate(std::remove(rest.begin(), rest.end(), move));
+  }
+  this->principle_variation = saved_pv;
+}
+
+double BasicAlphaBetaSearcher::search_iteration(GameState& gs,
+    const MoveList& ml, unsigned depth, std::optional<double> previous_score,
+    Move& best_move, MoveList& best_pv, SearchInfo& info,
+    std::atomic<bool>& stop_signal, uint64_t max_nodes) {
+  double best_score = -std::numeric_limits<double>::max();
+  std::optional<Move> prev_pv_move;
+  if (!this->principle_variation.empty()) {
+    prev_pv_move = this->principle_variation[0];
+  }
+  for (const Move& m : ml) {
+    bool child_on_pv = prev_pv_move && m == *prev_pv_move;
+    gs.make_move(m);
+    // We invert the score here because we made a move before calling into
+    // alpha_beta
+    double score = -alpha_beta(gs, depth, 1,
+        -std::numeric_limits<double>::max(), -best_score, child_on_pv,
+        info, stop_signal, max_nodes);
+    gs.undo_move();
+    // The score of an interrupted search is meaningless.
+    if (interrupted(stop_signal, info, max_nodes)) {
+      break;
+    }
+    if (score > best_score) {
+      best_score = score;
+      best_move = m;
+      best_pv = root_pv(m);
+    }
+  }
+  return best_score;
+}
+
+/**
+ * \brief Determine whether a side has any pieces other than pawns and its
+ * king.
+ *
+ * Zugzwang is rare unless this is false.
+ */
+static bool has_pieces(const Position& p, bool white) {
+  return p.get_board(Position::color_piece(Position::KNIGHT, white)) |
+    p.get_board(Position::color_piece(Position::BISHOP, white)) |
+    p.get_board(Position::color_piece(Position::ROOK, white)) |
+    p.get_board(Position::color_piece(Position::QUEEN, white));
+}
+
+PVSSearcher::PVSSearcher(std::unique_ptr<Evaluator>&& e):
+  BasicAlphaBetaSearcher(std::move(e)), params{}, reductions{} {
+  set_params(params);
+}
+
+PVSSearcher::PVSSearcher(std::unique_ptr<Evaluator>&& e,
+    std::shared_ptr<TranspositionTable> t):
+  BasicAlphaBetaSearcher(std::move(e), t), params{}, reductions{} {
+  set_params(params);
+}
+
+double PVSSearcher::search_iteration(GameState& gs, const MoveList& ml,
+    unsigned depth, std::optional<double> previous_score, Move& best_move,
+    MoveList& best_pv, SearchInfo& info, std::atomic<bool>& stop_signal,
+    uint64_t max_nodes) {
+  double best_score = -std::numeric_limits<double>::max();
+  if (ml.empty()) {
+    return best_score;
+  }
+  double delta = params.aspiration_window / 100.0;
+  double alpha = -std::numeric_limits<double>::max();
+  double beta = std::numeric_limits<double>::max();
+  if (previous_score && depth >= ASPIRATION_DEPTH) {
+    alpha = *previous_score - delta;
+    beta = *previous_score + delta;
+  }
+  // The root moves are reordered when one fails high, so that it is searched
+  // first next time.
+  MoveList moves = ml;
+  while (true) {
+    Move move;
+    MoveList pv;
+    double score = search_root(gs, moves, depth, alpha, beta, move, pv, info,
+        stop_signal, max_nodes);
+    // Any move found scored above alpha, so it is at least as good as the
+    // score says even if the window turns out to be wrong.
+    if (!move.is_null()) {
+      best_score = score;
+      best_move = move;
+      best_pv = pv;
+    }
+    if (interrupted(stop_signal, info, max_nodes)) {
+      return best_score;
+    }
+    delta *= 2;
+    if (score <= alpha) {
+      alpha = delta > ASPIRATION_LIMIT ? -std::numeric_limits<double>::max() :
+        score - delta;
+    } else if (score >= beta) {
+      beta = delta > ASPIRATION_LIMIT ? std::numeric_limits<double>::max() :
+        score + delta;
+      MoveList::iterator it = std::find(moves.begin(), moves.end(), move);
+      std::rotate(moves.begin(), it, it + 1);
+    } else {
+      return best_score;
+    }
+  }
+}
+
+double PVSSearcher::search_root(GameState& gs, const MoveList& ml,
+    unsigned depth, double alpha, double beta, Move& best_move,
+    MoveList& best_pv, SearchInfo& info, std::atomic<bool>& stop_signal,
+    uint64_t max_nodes) {
+  std::optional<Move> prev_pv_move;
+  if (!this->principle_variation.empty()) {
+    prev_pv_move = this->principle_variation[0];
+  }
+  bool first = true;
+  for (const Move& m : ml) {
+    bool child_on_pv = prev_pv_move && m == *prev_pv_move;
+    gs.make_move(m);
+    double score;
+    if (first) {
+      score = -pvs(gs, depth, 1, -beta, -alpha, child_on_pv, true, info,
+          stop_signal, max_nodes);
+    } else {
+      score = -pvs(gs, depth, 1, -alpha - NULL_WINDOW, -alpha, child_on_pv,
+          true, info, stop_signal, max_nodes);
+      if (score > alpha && score < beta) {
+        score = -pvs(gs, depth, 1, -beta, -alpha, child_on_pv, true, info,
+            stop_signal, max_nodes);
+      }
+    }
+    gs.undo_move();
+    if (interrupted(stop_signal, info, max_nodes)) {
+      break;
+    }
+    first = false;
+    if (score > alpha) {
+      alpha = score;
+      best_move = m;
+      best_pv = root_pv(m);
+      if (score >= beta) {
+        break;
+      }
+    }
+  }
+  return alpha;
+}
+
+/**
+ * \brief Perform a principle variation search and get the score.
+ *
+ * This works like BasicAlphaBetaSearcher::alpha_beta, except that moves after
+ * the first are searched with a null window and the search is selective:
+ * see the description of PVSSearcher.
+ */
+double PVSSearcher::pvs(GameState& gs, unsigned depth, unsigned ply,
+    double alpha, double beta, bool on_pv, bool null_allowed, SearchInfo& info,
+    std::atomic<bool>& stop_signal, uint64_t max_nodes) {
+  bool check = in_check(gs.whites_move(), gs.pos());
+  if (check && params.check_extension) {
+    depth++;
+  }
+  if (depth == 0) {
+    return quiescence(gs, ply, alpha, beta, info, stop_signal, max_nodes);
+  }
+  pv_length[ply] = 0;
+  if (stop_signal || out_of_time) {
+    return 0.0;
+  }
+  count_node(info, false);
+  if (over_node_limit(info, max_nodes)) {
+    return 0.0;
+  }
+  if (gs.repetitions() > 0) {
+    return 0.0;
+  }
+  if (ply >= MAX_PLY - 1) {
+    return evaluate(gs);
+  }
+  // Rounding means a null window may come out slightly wider than
+  // NULL_WINDOW, so we allow some slack. A window this narrow is effectively
+  // a null window anyway.
+  bool null_window = beta - alpha < 2 * NULL_WINDOW;
+  TTEntry entry;
+  std::optional<Move> hash_move;
+  if (probe(gs, ply, entry)) {
+    if (!entry.move.is_null()) {
+      hash_move = entry.move;
+    }
+    if (entry.depth >= (int) depth) {
+      if (entry.bound != TTEntry::UPPER && entry.score >= beta) {
+        return beta;
+      }
+      if (entry.bound != TTEntry::LOWER && entry.score <= alpha) {
+        return alpha;
+      }
+    }
+  }
+  double tb_score;
+  if (probe_tablebase(gs, ply, alpha, beta, info, tb_score)) {
+    return tb_score;
+  }
+  // Off the principle variation and out of check, the static evaluation can
+  // be trusted enough to prune with.
+  bool prune = null_window && !check;
+  double static_eval = prune ? evaluate(gs) : 0.0;
+  // Reverse futility pruning. This close to the leaves, the opponent is very
+  // unlikely to make up such a large deficit.
+  if (prune && (int) depth <= params.reverse_futility_depth &&
+      static_eval - params.reverse_futility_margin / 100.0 * depth >= beta) {
+    return beta;
+  }
+  // Null-move pruning. If the opponent can't bring the score below beta even
+  // with a free move, a real move is very likely to fail high as well.
+  if (prune && null_allowed && (int) depth >= params.null_move_depth &&
+      has_pieces(gs.pos(), gs.whites_move()) && static_eval >= beta) {
+    unsigned reduction = params.null_move_reduction +
+      (depth >= NULL_MOVE_DEEP);
+    gs.make_move(Move());
+    double score = -pvs(gs, depth > reduction + 1 ? depth - 1 - reduction : 0,
+        ply + 1, -beta, -alpha, false, false, info, stop_signal, max_nodes);
+    gs.undo_move();
+    if (interrupted(stop_signal, info, max_nodes)) {
+      return 0.0;
+    }
+    if (score >= beta) {
+      return beta;
+    }
+  }
+  // Futility pruning. Quiet moves are skipped if even a generous allowance
+  // for positional gains doesn't bring the score up to alpha.
+  bool futile = prune && (int) depth <= params.futility_depth &&
+    static_eval + params.futility_margin / 100.0 * depth <= alpha;
+  std::optional<Move> prev_pv_move;
+  if (on_pv && ply < this->principle_variation.size()) {
+    prev_pv_move = this->principle_variation[ply];
+  }
+  MovePicker picker(gs, prev_pv_move ? prev_pv_move : hash_move,
+      killers[ply], &history, false);
+  unsigned legal_moves = 0;
+  Move best_move;
+  Move m;
+  while (picker.next(m)) {
+    legal_moves++;
+    bool child_on_pv = prev_pv_move && m == *prev_pv_move;
+    bool quiet = !m.capture() && !m.promotion();
+    gs.make_move(m);
+    // Checking moves are forcing, so they are neither pruned nor reduced.
+    bool gives_check = in_check(gs.whites_move(), gs.pos());
+    if (futile && legal_moves > 1 && quiet && !gives_check) {
+      gs.undo_move();
+      continue;
+    }
+    unsigned reduction = 0;
+    if ((int) depth >= params.lmr_depth &&
+        (int) legal_moves > params.lmr_moves && quiet && !check &&
+        !gives_check) {
+      reduction = reductions[std::min(depth, REDUCTION_TABLE_SIZE - 1)]
+        [std::min(legal_moves, REDUCTION_TABLE_SIZE - 1)];
+      // Reduce less on the principle variation, where mistakes are costly.
+      if (!null_window && reduction > 0) {
+        reduction--;
+      }
+      reduction = std::min(reduction, depth - 2);
+    }
+    double score;
+    if (legal_moves == 1) {
+      score = -pvs(gs, depth - 1, ply + 1, -beta, -alpha, child_on_pv, true,
+          info, stop_signal, max_nodes);
+    } else {
+      // Check that this move is no better than the best so far, first at a
+      // reduced depth and then at full depth, and only find out how good it
+      // is if it is.
+      score = -pvs(gs, depth - 1 - reduction, ply + 1, -alpha - NULL_WINDOW,
+          -alpha, child_on_pv, true, info, stop_signal, max_nodes);
+      if (reduction > 0 && score > alpha) {
+        score = -pvs(gs, depth - 1, ply + 1, -alpha - NULL_WINDOW, -alpha,
+            child_on_pv, true, info, stop_signal, max_nodes);
+      }
+      if (score > alpha && score < beta) {
+        score = -pvs(gs, depth - 1, ply + 1, -beta, -alpha, child_on_pv,
+            true, info, stop_signal, max_nodes);
+      }
+    }
+    gs.undo_move();
+    if (interrupted(stop_signal, info, max_nodes)) {
+      return 0.0;
+    }
+    if (score >= beta) {
+      count_cutoff(legal_moves);
+      if (quiet) {
+        if (!(killers[ply][0] == m)) {
+          killers[ply][1] = killers[ply][0];
+          killers[ply][0] = m;
+        }
+        history.update(gs.whites_move(), m, depth);
+      }
+      store(gs, ply, m, beta, depth, TTEntry::LOWER);
+      return beta;
+    }
+    if (score > alpha) {
+      alpha = score;
+      best_move = m;
+      update_pv(ply, m);
+    }
+  }
+  if (legal_moves == 0) {
+    return check ? -1000.0 : 0.0;
+  }
+  uint8_t bound = best_move.is_null() ? TTEntry::UPPER : TTEntry::EXACT;
+  store(gs, ply, best_move, alpha, depth, bound);
+  return alpha;
+}
+
+void PVSSearcher::set_params(const SearchParams& p) {
+  params = p;
+  for (unsigned d = 0; d < REDUCTION_TABLE_SIZE; d++) {
+    for (unsigned n = 0; n < REDUCTION_TABLE_SIZE; n++) {
+      double r = 0.0;
+      if (d > 0 && n > 0) {
+        r = params.lmr_base / 100.0 +
+          std::log(d) * std::log(n) / (params.lmr_divisor / 100.0);
+      }
+      reductions[d][n] = std::clamp<int>(r, 0, d);
+    }
+  }
+}
+
+LazySMPSearcher::LazySMPSearcher(std::unique_ptr<Evaluator>&& e,
+    std::shared_ptr<TranspositionTable> t, unsigned threads, bool pvs):
+  Searcher(std::move(e)), workers{}, tt{t}, pvs{pvs}, params{},
+  tablebase{nullptr} {
+  set_threads(threads);
+}
+
+void LazySMPSearcher::set_threads(unsigned threads) {
+  threads = std::clamp<unsigned>(threads, 1, MAX_THREADS);
+  while (workers.size() > threads) {
+    workers.pop_back();
+  }
+  while (workers.size() < threads) {
+    if (pvs) {
+      workers.push_back(std::make_unique<PVSSearcher>(eval->clone(), tt));
+      workers.back()->set_params(params);
+    } else {
+      workers.push_back(std::make_unique<BasicAlphaBetaSearcher>(
+            eval->clone(), tt));
+    }
+    workers.back()->set_tablebase(tablebase);
+  }
+}
+
+void LazySMPSearcher::set_evaluator(std::unique_ptr<Evaluator>&& e) {
+  eval = std::move(e);
+  unsigned threads = workers.size();
+  workers.clear();
+  set_threads(threads);
+}
+
+void LazySMPSearcher::set_params(const SearchParams& p) {
+  params = p;
+  for (std::unique_ptr<BasicAlphaBetaSearcher>& w : workers) {
+    w->set_params(params);
+  }
+}
+
+void LazySMPSearcher::new_game() {
+  // The table is shared, so it is only cleared once.
+  tt->clear();
+  for (std::unique_ptr<BasicAlphaBetaSearcher>& w : workers) {
+    w->clear_tables();
+  }
+}
+
+void LazySMPSearcher::set_tablebase(std::shared_ptr<const Tablebase> tb) {
+  tablebase = tb;
+  for (std::unique_ptr<BasicAlphaBetaSearcher>& w : workers) {
+    w->set_tablebase(tablebase);
+  }
+}
+
+std::pair<double, Move> LazySMPSearcher::search(GameState& gs,
+    const SearchLimits& limits, SearchInfo& info,
+    std::atomic<bool>& stop_signal) {
+  info.nodes = 0;
+  info.qnodes = 0;
+  info.tbhits = 0;
+  info.depth = 0;
+  tt->new_search();
+  // The helpers are stopped once the main thread finishes, whether it ran out
+  // of resources or was told to stop.
+  std::atomic<bool> helper_stop{false};
+  std::vector<std::thread> helpers;
+  std::vector<GameState> states(workers.size() - 1, gs);
+  for (unsigned i = 1; i < workers.size(); i++) {
+    helpers.push_back(std::thread([&, i]() {
+          workers[i]->iterative_deepening(states[i - 1], limits, info,
+              helper_stop, i % 2, false, nullptr);
+        }));
+  }
+  // Only the main thread watches the clock. The helpers are stopped with it.
+  TimeManager timer(limits, gs.whites_move(), &info.pondering);
+  std::pair<double, Move> result = workers[0]->iterative_deepening(gs,
+      limits, info, stop_signal, 0, true, &timer);
+  helper_stop = true;
+  for (std::thread& t : helpers) {
+    t.join();
+  }
+  return result;
+}
\ No newline at end of file
@@ -1,32 +1,129 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <optional>
 #include <mutex>
+#include <vector>
 
 #include "boards.hpp"
 #include "evaluation.hpp"
 #include "movegen.hpp"
+#include "transposition.hpp"
+#include "movepicker.hpp"
+#include "tablebase.hpp"
+
+class TimeManager;
+
+// The deepest ply the search can reach.
+#define MAX_PLY 128
+// The largest number of search threads we allow.
+#define MAX_THREADS 256
+// The largest number of lines a MultiPV search may find.
+#define MAX_MULTIPV 256
+// Search threads add their node counts to the shared total in batches of this
+// size, so that they rarely write to the same cache line.
+#define NODE_BATCH 1024
+
+// Search statistics are only collected when SEARCH_STATS is defined.
+// Otherwise every SEARCH_STAT statement compiles to nothing and the counters
+// stay zero.
+#ifdef SEARCH_STATS
+#define SEARCH_STAT(...) do { __VA_ARGS__; } while (0)
+static constexpr bool SEARCH_STATS_ENABLED = true;
+#else
+#define SEARCH_STAT(...) do {} while (0)
+static constexpr bool SEARCH_STATS_ENABLED = false;
+#endif
+
+/**
+ * \brief Counters describing the tree searched by one thread.
+ *
+ * Each search thread has its own counters, which it updates without any
+ * synchronization. They are aligned to a cache line so that the counters of
+ * different threads never share one.
+ */
+struct alignas(64) SearchStats {
+  /** The nodes searched, including quiescence nodes. */
+  uint64_t nodes = 0;
+  /** The quiescence nodes searched. */
+  uint64_t qnodes = 0;
+  /** The nodes outside the quiescence search where a move failed high. */
+  uint64_t cutoffs = 0;
+  /** The cutoffs caused by the first move searched. */
+  uint64_t first_move_cutoffs = 0;
+  /** The calls to the evaluator. */
+  uint64_t evals = 0;
+  /** The transposition table lookups. */
+  uint64_t tt_probes = 0;
+  /** The lookups which found an entry. */
+  uint64_t tt_hits = 0;
+};
+
+/**
+ * \brief The statistics of one iteration of iterative deepening.
+ */
+struct IterationStats {
+  /** The depth of the iteration. */
+  unsigned depth;
+  /** The time from the start of the search to the end of the iteration in
+   * milliseconds. */
+  unsigned time;
+  /** The time the iteration took in milliseconds. */
+  unsigned duration;
+  /** False if the search was interrupted during the iteration. */
+  bool complete;
+  /** The counters of the main search thread during the iteration. */
+  SearchStats stats;
+};
+
+/**
+ * \brief One of the best lines found by a MultiPV search.
+ */
+struct PVLine {
+  /** The score of the line from white's perspective. */
+  double score;
+  /** The depth the line was searched to. */
+  unsigned depth;
+  /** The moves of the line. */
+  MoveList pv;
+};
 
 /**
  * \brief Information the engine shoudld send to the GUi.
  *
- * For the most part, this information can all be approximate so we don't
- * care about race conditions. The exception is the principle variation,
- * because we don't want to read half the list then have it update.
+ * This is written by the search threads while the reporting thread reads it.
+ * For the most part, this information can all be approximate, so the single
+ * values are atomics which need no particular ordering. The exception is the
+ * principle variation, because we don't want to read half the list then have
+ * it update.
  */
 struct SearchInfo {
   /** The current best score estimate of the position. */
-  double score;
+  std::atomic<double> score{0.0};
   /** The current search depth */
-  unsigned depth;
-  /** The total number of nodes searched so far. */
-  unsigned nodes;
+  std::atomic<unsigned> depth{0};
+  /** The total number of nodes searched so far by all search threads. */
+  std::atomic<uint64_t> nodes{0};
+  /** The number of those nodes which were in a quiescence search. */
+  std::atomic<uint64_t> qnodes{0};
+  /** The number of positions found in the tablebases. */
+  std::atomic<uint64_t> tbhits{0};
   /** The amount of time spent searching */
-  unsigned time;
+  std::atomic<unsigned> time{0};
+  /** Set by the interface before a search which starts by pondering, and
+   * cleared on ponderhit. Until then the search ignores the clock. */
+  std::atomic<bool> pondering{false};
   /** The current principle variation */
   MoveList pv;
-  /** A lock for interacting with the principle variation. */
+  /** In a MultiPV search, the best lines so far, best first. The first is
+   * the principle variation. Empty when only one line is searched for. */
+  std::vector<PVLine> lines;
+  /** Statistics of each iteration of the main search thread so far. These
+   * are only filled in when SEARCH_STATS is defined. */
+  std::vector<IterationStats> iterations;
+  /** A lock for interacting with the principle variation, the lines and the
+   * iteration statistics. */
   std::mutex pv_lock;
 };
 
@@ -36,14 +133,82 @@ struct SearchInfo {
 struct SearchLimits {
   /** A maximum allowed amount of time. */
   std::optional<unsigned> timeout;
+  /** White's time left on the clock in milliseconds. */
+  std::optional<int> wtime;
+  /** Black's time left on the clock in milliseconds. */
+  std::optional<int> btime;
+  /** White's increment per move in milliseconds. */
+  std::optional<unsigned> winc;
+  /** Black's increment per move in milliseconds. */
+  std::optional<unsigned> binc;
+  /** The number of moves until the next time control. */
+  std::optional<unsigned> movestogo;
   /** The maximum number of nodes to search. */
-  std::optional<unsigned> node_limit;
+  std::optional<uint64_t> node_limit;
   /** The maximum depth to search to. */
   std::optional<unsigned> depth_limit;
   /** Look for mate in N moves. */
   std::optional<unsigned> mate_in;
   /** A set of first moves to restrict the search to. */
   std::optional<MoveList> moves;
+  /** The number of best lines to find, each with a different first move.
+   * Only the first is found if this is not given. */
+  std::optional<unsigned> multipv;
+};
+
+/**
+ * \brief Tunable parameters of the selective search.
+ *
+ * These are all integers so that they can be exposed as UCI spin options and
+ * tuned by playing matches. Scores are in centipawns and fractional plies in
+ * hundredths of a ply.
+ */
+struct SearchParams {
+  /** The half-width of the first aspiration window. */
+  int aspiration_window = 50;
+  /** Null moves are only tried with at least this much depth left. */
+  int null_move_depth = 3;
+  /** The depth reduction of a null move search. */
+  int null_move_reduction = 2;
+  /** Late moves are only reduced with at least this much depth left. */
+  int lmr_depth = 3;
+  /** The number of moves searched at full depth before reducing. */
+  int lmr_moves = 3;
+  /** The reduction of a late move is `lmr_base + ln(depth) * ln(moves) /
+   * lmr_divisor`, in hundredths of a ply before rounding down. */
+  int lmr_base = 75;
+  int lmr_divisor = 225;
+  /** Quiet moves are pruned at nodes with at most this much depth left if
+   * the static evaluation is far enough below alpha. */
+  int futility_depth = 2;
+  /** The futility margin per ply of depth left. */
+  int futility_margin = 150;
+  /** Nodes with at most this much depth left fail high immediately if the
+   * static evaluation is far enough above beta. */
+  int reverse_futility_depth = 3;
+  /** The reverse futility margin per ply of depth left. */
+  int reverse_futility_margin = 100;
+  /** If nonzero, positions in check are searched one ply deeper. */
+  int check_extension = 1;
+
+  /**
+   * \brief A parameter which can be set as a UCI option.
+   */
+  struct Option {
+    /** The name of the UCI option. */
+    const char* name;
+    /** The parameter the option sets. */
+    int SearchParams::* value;
+    /** The smallest allowed value. */
+    int min;
+    /** The largest allowed value. */
+    int max;
+  };
+
+  /**
+   * \brief Get a description of every parameter.
+   */
+  static const std::vector<Option>& options();
 };
 
 /**
@@ -65,10 +230,31 @@ class Searcher {
     Searcher(std::unique_ptr<Evaluator>&& e);
 
     /**
-     * \brief Initialize the internal state of the searcher.
+     * \brief Forget everything learned in previous searches.
+     *
+     * Between the moves of one game a searcher keeps what it learned, such
+     * as its transposition table and move ordering tables, since most of it
+     * is still useful after two more plies. This is called when a new game
+     * starts, and should not be called during a search.
+     */
+    virtual void new_game() {};
+
+    /**
+     * \brief Change the parameters of the selective search.
+     *
+     * Searchers without a selective search ignore this. It should not be
+     * called during a search.
+     */
+    virtual void set_params(const SearchParams& p) {};
+
+    /**
+     * \brief Use a tablebase to play endgames perfectly.
+     *
+     * Searchers which can't use a tablebase ignore this. A null tablebase
+     * turns probing off. It should not be called during a search.
      */
+    virtual void set_tablebase(std::shared_ptr<const Tablebase> tb) {};
 
-    virtual void initialize(const GameState& gs) {};
     /**
      * \brief Find the best move and the score of that move.
      *
@@ -78,40 +264,462 @@ class Searcher {
      * \param stop_signal Another thread sets this to true to end the search.
      */
     virtual std::pair<double, Move> search(GameState& gs,
-        const SearchLimits& limits, SearchInfo& info, bool& stop_signal) = 0;
-};
-
-struct SearchResult {
-  double score;
-  MoveList pv;
-
-  SearchResult(double s, MoveList ml):
-    score{s}, pv{ml} {}
+        const SearchLimits& limits, SearchInfo& info,
+        std::atomic<bool>& stop_signal) = 0;
 };
 
 /**
  * \brief A basic minimax search with alpha-beta pruning.
  *
  * This is a very basic search algorithm including alpha-beta pruning and a
- * quiescence search. We also use a very simple move ordering to improve
- * pruning: for captures we will order moves by the difference between the
- * value of the captured piece and the value of the capturing piece. All other
- * moves are currently not ordered in any particular way.
+ * quiescence search. Moves are ordered by a MovePicker, using killer moves
+ * and a history table kept by the searcher. Results are cached in a
+ * transposition table, which may be shared with other searchers. Given a
+ * tablebase, the searcher filters the root moves with it once the root is in
+ * the tables, and before that scores positions which reach them without
+ * searching further.
  */
 class BasicAlphaBetaSearcher: public Searcher {
-  private:
+  protected:
+    /** The principle variation from the previous iteration. Between
+     * searches it is kept for the next one, see `next_root`. */
     MoveList principle_variation;
+    /** The hash of the position after the first two moves of the principle
+     * variation of the last search. If the next search starts there, the
+     * opponent played the reply we expected and the rest of the principle
+     * variation still applies. */
+    std::optional<uint64_t> next_root;
+    std::shared_ptr<TranspositionTable> tt;
+    /** A triangular table of principle variations. Row `i` holds the best line
+     * found from the node at ply `i` of the current search. */
+    Move pv_table[MAX_PLY][MAX_PLY];
+    /** The length of each principle variation in `pv_table`. */
+    unsigned pv_length[MAX_PLY];
+    /** Two quiet moves at each ply which recently caused a cutoff. */
+    Move killers[MAX_PLY][2];
+    /** Scores for ordering quiet moves. */
+    HistoryTable history;
+    /** Nodes searched which have not yet been added to `SearchInfo::nodes`. */
+    unsigned pending_nodes;
+    /** Quiescence nodes which have not yet been added to
+     * `SearchInfo::qnodes`. */
+    unsigned pending_qnodes;
+    /** The time limits of the current search, or null if this searcher
+     * ignores the clock. */
+    const TimeManager* timer;
+    /** Set once the hard time limit of the current search has passed. */
+    bool out_of_time;
+    /** Counters for the current iteration of iterative deepening. */
+    SearchStats stats;
+    /** The tablebase, or null if there is none. */
+    std::shared_ptr<const Tablebase> tablebase;
+    /** Positions with at most this many pieces are probed in the tablebase
+     * during the current search. Zero if none are. */
+    unsigned tb_pieces;
 
-    SearchResult alpha_beta(GameState& gs, unsigned depth,
-        double alpha, double beta, bool quiescence_search, SearchInfo& info,
-        bool& stop_signal, MoveList::const_iterator pv_iter,
-        unsigned max_nodes);
+    /** Captures which can't bring the score within this many pawns of alpha,
+     * even winning the captured piece for free, are skipped in the quiescence
+     * search. */
+    static constexpr double DELTA_MARGIN = 2.0;
+
+    double alpha_beta(GameState& gs, unsigned depth, unsigned ply,
+        double alpha, double beta, bool on_pv, SearchInfo& info,
+        std::atomic<bool>& stop_signal, uint64_t max_nodes);
+
+    double quiescence(GameState& gs, unsigned ply, double alpha, double beta,
+        SearchInfo& info, std::atomic<bool>& stop_signal, uint64_t max_nodes);
+
+    /**
+     * \brief Evaluate a position from the perspective of the side to move.
+     */
+    double evaluate(GameState& gs);
+
+    /**
+     * \brief Forget the history, killer moves and principle variation.
+     */
+    void clear_tables();
+
+    /**
+     * \brief Carry what was learned in the last search over to a search of
+     * the given game state.
+     *
+     * The principle variation is shifted by two plies if the game followed
+     * it, and cleared otherwise. The killer moves are shifted by two plies
+     * too, since the game has usually moved on by our move and the reply,
+     * and the history is aged.
+     */
+    void start_search(const GameState& gs);
+
+    /**
+     * \brief Record where the game is expected to be at the next search.
+     */
+    void finish_search(GameState& gs);
+
+    /**
+     * \brief Look up a node of the search in the tablebase.
+     *
+     * The parameters are as for alpha_beta.
+     *
+     * \param score Set to the score of the node if the tablebase decides it.
+     * \return True if the node needs no search.
+     */
+    bool probe_tablebase(GameState& gs, unsigned ply, double alpha,
+        double beta, SearchInfo& info, double& score);
+
+    /**
+     * \brief Record a new best move at the given ply.
+     *
+     * The principle variation at the given ply becomes the move followed by
+     * the principle variation of the next ply.
+     */
+    void update_pv(unsigned ply, const Move& m);
+
+    /**
+     * \brief Get the principle variation of a root move which was just
+     * searched.
+     */
+    MoveList root_pv(const Move& m) const;
+
+    /**
+     * \brief Search every root move to the given depth.
+     *
+     * This is one iteration of iterative deepening. Subclasses may override
+     * it to search the root differently.
+     *
+     * \param gs The current state of the game.
+     * \param ml The root moves, in the order to search them.
+     * \param depth The depth to search each root move to.
+     * \param previous_score The score of the previous iteration, if there
+     * was one.
+     * \param best_move Set to the best move found. If the search is
+     * interrupted, this is either the best move among those searched or left
+     * null, and any move given is worth at least the returned score.
+     * \param best_pv Set to the principle variation of the best move.
+     * \return The score of the best move, from the side to move's
+     * perspective.
+     */
+    virtual double search_iteration(GameState& gs, const MoveList& ml,
+        unsigned depth, std::optional<double> previous_score, Move& best_move,
+        MoveList& best_pv, SearchInfo& info, std::atomic<bool>& stop_signal,
+        uint64_t max_nodes);
+
+    /**
+     * \brief Find the best lines after those already found in an iteration
+     * of a MultiPV search.
+     *
+     * Each line is found by searching the root moves which don't start a
+     * line yet with search_iteration, so the later lines share the
+     * transposition table with the first.
+     *
+     * \param ml The root moves.
+     * \param count The number of lines to find.
+     * \param previous The lines of the previous iteration, best first, as
+     * pairs of the score and the principle variation.
+     * \param lines The lines found so far in this iteration, best first. New
+     * lines are added until there are `count` or no root moves are left, or
+     * the search is interrupted.
+     */
+    void search_lines(GameState& gs, const MoveList& ml, unsigned depth,
+        unsigned count,
+        const std::vector<std::pair<double, MoveList>>& previous,
+        std::vector<std::pair<double, MoveList>>& lines, SearchInfo& info,
+        std::atomic<bool>& stop_signal, uint64_t max_nodes);
+
+    /**
+     * \brief Add any pending nodes to the shared node count.
+     */
+    inline void flush_nodes(SearchInfo& info) {
+      info.nodes.fetch_add(pending_nodes, std::memory_order_relaxed);
+      info.qnodes.fetch_add(pending_qnodes, std::memory_order_relaxed);
+      pending_nodes = 0;
+      pending_qnodes = 0;
+    }
+
+    /**
+     * \brief Set `out_of_time` if the hard time limit has passed.
+     *
+     * Reading the clock is relatively slow, so this is only called once per
+     * batch of nodes.
+     */
+    void check_time();
+
+    /**
+     * \brief Count a searched node.
+     *
+     * \param quiescence True if the node is in a quiescence search.
+     */
+    inline void count_node(SearchInfo& info, bool quiescence) {
+      pending_nodes++;
+      pending_qnodes += quiescence;
+      SEARCH_STAT(stats.nodes++);
+      SEARCH_STAT(stats.qnodes += quiescence);
+      if (pending_nodes >= NODE_BATCH) {
+        flush_nodes(info);
+        check_time();
+      }
+    }
+
+    /**
+     * \brief Look up a position in the transposition table.
+     *
+     * This is TranspositionTable::probe, counting the lookup in `stats` and
+     * converting a tablebase score to one at the current ply.
+     */
+    inline bool probe(const GameState& gs, unsigned ply, TTEntry& entry) {
+      bool hit = tt->probe(gs.hash(), entry);
+      SEARCH_STAT(stats.tt_probes++);
+      SEARCH_STAT(stats.tt_hits += hit);
+      if (hit) {
+        entry.score = tablebase_score_from_tt(entry.score, ply);
+      }
+      return hit;
+    }
+
+    /**
+     * \brief Store a position in the transposition table.
+     *
+     * This is TranspositionTable::store, with a tablebase score made
+     * independent of the current ply.
+     */
+    inline void store(const GameState& gs, unsigned ply, const Move& move,
+        double score, int depth, uint8_t bound) {
+      tt->store(gs.hash(), move, tablebase_score_to_tt(score, ply), depth,
+          bound);
+    }
+
+    /**
+     * \brief Count a node outside the quiescence search failing high.
+     *
+     * \param moves The number of moves searched at the node.
+     */
+    inline void count_cutoff(unsigned moves) {
+      SEARCH_STAT(stats.cutoffs++);
+      SEARCH_STAT(stats.first_move_cutoffs += moves == 1);
+    }
+
+    /**
+     * \brief Determine whether the search has used up its node limit.
+     */
+    inline bool over_node_limit(const SearchInfo& info, uint64_t max_nodes)
+        const {
+      return info.nodes.load(std::memory_order_relaxed) + pending_nodes >
+        max_nodes;
+    }
+
+    /**
+     * \brief Determine whether the search must stop, for any reason.
+     *
+     * Everything searched since the first time this is true is meaningless.
+     */
+    inline bool interrupted(const std::atomic<bool>& stop_signal,
+        const SearchInfo& info, uint64_t max_nodes) const {
+      return stop_signal || out_of_time || over_node_limit(info, max_nodes);
+    }
+
+    /**
+     * \brief Run iterative deepening from the given game state.
+     *
+     * \param gs The current state of the game.
+     * \param limits Limits placed on the search procedure.
+     * \param info Node counts are added to this. If `report` is true, the
+     * depth, score and principle variation are also written here.
+     * \param stop_signal Another thread sets this to true to end the search.
+     * \param start_depth The depth of the first iteration.
+     * \param report If false, only node counts are written to `info`.
+     * \param timer The time limits of the search, or null to ignore the
+     * clock.
+     * \return The score and best move of the deepest completed iteration.
+     */
+    std::pair<double, Move> iterative_deepening(GameState& gs,
+        const SearchLimits& limits, SearchInfo& info,
+        std::atomic<bool>& stop_signal, unsigned start_depth, bool report,
+        TimeManager* timer);
+
+    friend class LazySMPSearcher;
 
   public:
+    /**
+     * \brief Construct a searcher with its own transposition table.
+     */
     BasicAlphaBetaSearcher(std::unique_ptr<Evaluator>&& e);
 
+    /**
+     * \brief Construct a searcher using the given transposition table.
+     */
+    BasicAlphaBetaSearcher(std::unique_ptr<Evaluator>&& e,
+        std::shared_ptr<TranspositionTable> t);
+
+    void new_game() override;
+
+    void set_tablebase(std::shared_ptr<const Tablebase> tb) override;
+
     std::pair<double, Move> search(GameState& gs,
         const SearchLimits& limits, SearchInfo& info,
-        bool& stop_signal) override;
+        std::atomic<bool>& stop_signal) override;
+};
+
+/**
+ * \brief An alpha-beta search using principle variation search, aspiration
+ * windows and null-move pruning.
+ *
+ * With good move ordering the first move searched at a node is usually the
+ * best one. Principle variation search (PVS) searches it with the full
+ * window, then only checks that each later move is no better by searching it
+ * with a null window around alpha. Only a move which turns out to be better
+ * is searched again with the full window.
+ *
+ * Each iteration of iterative deepening starts with a narrow aspiration
+ * window around the previous iteration's score, which is widened and the root
+ * searched again whenever the score falls outside it.
+ *
+ * At nodes off the principle variation, the side to move is first allowed to
+ * pass. If a reduced-depth search still fails high, the position is assumed
+ * to fail high with a real move too. This is wrong in zugzwang, so the null
+ * move is not tried in check or when the side to move has only pawns left.
+ *
+ * The rest of the search is selective too, controlled by SearchParams:
+ *
+ * - Late move reductions: quiet moves ordered late by the move picker are
+ *   searched to a reduced depth first, and only searched fully if they turn
+ *   out better than alpha.
+ * - Reverse futility pruning: near the leaves, a node off the principle
+ *   variation whose static evaluation is far above beta fails high without
+ *   a search.
+ * - Futility pruning: near the leaves, quiet moves are skipped if the static
+ *   evaluation is so far below alpha that they are very unlikely to reach it.
+ * - Check extensions: positions in check are searched one ply deeper, so
+ *   that forcing lines are not cut short.
+ */
+class PVSSearcher: public BasicAlphaBetaSearcher {
+  private:
+    /** The width of a null window, in pawns. Moves which improve on alpha
+     * by less than this are not noticed. */
+    static constexpr double NULL_WINDOW = 0.001;
+    /** Once an aspiration window would be wider than this on one side, that
+     * side is left unbounded. */
+    static constexpr double ASPIRATION_LIMIT = 4.0;
+    /** Aspiration windows are only used from this iteration on, since the
+     * scores of shallow searches are unstable. */
+    static const unsigned ASPIRATION_DEPTH = 3;
+    /** Null move searches are reduced by one more ply with at least this
+     * much depth left. */
+    static const unsigned NULL_MOVE_DEEP = 7;
+    /** The reductions table covers depths and move counts below this. */
+    static const unsigned REDUCTION_TABLE_SIZE = 64;
+
+    /** The parameters of the selective search. */
+    SearchParams params;
+    /** The reduction of a late move, indexed by the depth left and the
+     * number of moves searched so far, computed from `params`. */
+    uint8_t reductions[REDUCTION_TABLE_SIZE][REDUCTION_TABLE_SIZE];
+
+    /**
+     * \brief Search the root moves within a window.
+     *
+     * \param best_move Set to the best move if any scores above alpha.
+     * \return The best score, or alpha if every move failed low.
+     */
+    double search_root(GameState& gs, const MoveList& ml, unsigned depth,
+        double alpha, double beta, Move& best_move, MoveList& best_pv,
+        SearchInfo& info, std::atomic<bool>& stop_signal, uint64_t max_nodes);
+
+    /**
+     * \brief Perform a principle variation search and get the score.
+     *
+     * The parameters are as for BasicAlphaBetaSearcher::alpha_beta.
+     *
+     * \param null_allowed False directly after a null move, so that the
+     * search never passes twice in a row.
+     */
+    double pvs(GameState& gs, unsigned depth, unsigned ply, double alpha,
+        double beta, bool on_pv, bool null_allowed, SearchInfo& info,
+        std::atomic<bool>& stop_signal, uint64_t max_nodes);
+
+  protected:
+    double search_iteration(GameState& gs, const MoveList& ml,
+        unsigned depth, std::optional<double> previous_score, Move& best_move,
+        MoveList& best_pv, SearchInfo& info, std::atomic<bool>& stop_signal,
+        uint64_t max_nodes) override;
+
+  public:
+    /**
+     * \brief Construct a searcher with its own transposition table.
+     */
+    PVSSearcher(std::unique_ptr<Evaluator>&& e);
+
+    /**
+     * \brief Construct a searcher using the given transposition table.
+     */
+    PVSSearcher(std::unique_ptr<Evaluator>&& e,
+        std::shared_ptr<TranspositionTable> t);
+
+    void set_params(const SearchParams& p) override;
 };
 
+/**
+ * \brief A multi-threaded search using the Lazy SMP approach.
+ *
+ * Each thread runs its own alpha-beta search on a private copy of the game
+ * state, and all of them share one transposition table. The threads don't
+ * coordinate beyond that: results written to the table by one thread speed up
+ * the others. Half of the helper threads search one ply deeper than the main
+ * thread so that the threads don't all explore the same tree in lockstep.
+ * Only the main thread reports its progress and result.
+ */
+class LazySMPSearcher: public Searcher {
+  private:
+    /** One searcher per thread. The first is run by the calling thread. */
+    std::vector<std::unique_ptr<BasicAlphaBetaSearcher>> workers;
+    std::shared_ptr<TranspositionTable> tt;
+    /** If true, each thread runs a PVSSearcher. */
+    bool pvs;
+    /** The parameters given to each thread. */
+    SearchParams params;
+    /** The tablebase given to each thread. */
+    std::shared_ptr<const Tablebase> tablebase;
+
+  public:
+    /**
+     * \brief Construct a searcher using the given transposition table.
+     *
+     * \param e The evaluator. Each thread uses its own clone of it.
+     * \param t The transposition table shared by all threads.
+     * \param threads The number of threads to search with.
+     * \param pvs If true, each thread runs a PVSSearcher rather than a
+     * BasicAlphaBetaSearcher.
+     */
+    LazySMPSearcher(std::unique_ptr<Evaluator>&& e,
+        std::shared_ptr<TranspositionTable> t, unsigned threads,
+        bool pvs = false);
+
+    /**
+     * \brief Change the number of search threads.
+     *
+     * This should not be called during a search.
+     */
+    void set_threads(unsigned threads);
+
+    /**
+     * \brief Replace the evaluator used by every thread.
+     *
+     * This should not be called during a search.
+     */
+    void set_evaluator(std::unique_ptr<Evaluator>&& e);
+
+    void set_params(const SearchParams& p) override;
+
+    void set_tablebase(std::shared_ptr<const Tablebase> tb) override;
+
+    void new_game() override;
+
+    /**
+     * \brief Get the number of search threads.
+     */
+    inline unsigned threads() const {
+      return workers.size();
+    }
+
+    std::pair<double, Move> search(GameState& gs,
+        const SearchLimits& limits, SearchInfo& info,
+        std::atomic<bool>& stop_signal) override;
+};
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "bits.hpp"
+#include "movegen.hpp"
+#include "selfplay.hpp"
+
+// Neither side can mate with at most one minor piece on the board.
+static bool insufficient_material(const Position& p) {
+  uint64_t heavy = p.get_board(Position::W_PAWN) |
+    p.get_board(Position::B_PAWN) | p.get_board(Position::W_ROOK) |
+    p.get_board(Position::B_ROOK) | p.get_board(Position::W_QUEEN) |
+    p.get_board(Position::B_QUEEN);
+  return heavy == 0 && popcount(p.get_board(Position::BOTH_ALL)) <= 3;
+}
+
+std::optional<int> game_result(const GameState& gs) {
+  MoveList ml;
+  generate_moves(gs, ml);
+  if (ml.empty()) {
+    if (!in_check(gs.whites_move(), gs.pos())) {
+      return 0;
+    }
+    return gs.whites_move() ? -1 : 1;
+  }
+  if (gs.repetitions() >= 2 || gs.half_move_clock() >= 100 ||
+      insufficient_material(gs.pos())) {
+    return 0;
+  }
+  return std::nullopt;
+}
+
+// Convert a score in pawns from the search into the centipawns of a record.
+static int16_t record_score(double score) {
+  double cp = std::round(score * 100);
+  return std::clamp(cp, (double) -TRAINING_MAX_SCORE,
+      (double) TRAINING_MAX_SCORE);
+}
+
+// Play one game and return its records, with the result filled in.
+static std::vector<TrainingRecord> play_game(PVSSearcher& searcher,
+    const SelfPlayOptions& options, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::atomic<bool> stop_signal{false};
+  std::vector<TrainingRecord> records;
+  GameState gs;
+  searcher.new_game();
+  std::optional<int> result;
+  for (unsigned ply = 0; !(result = game_result(gs)); ply++) {
+    if (ply >= options.max_plies) {
+      result = 0;
+      break;
+    }
+    if (ply < options.random_plies) {
+      MoveList ml;
+      generate_moves(gs, ml);
+      gs.make_move(ml[std::uniform_int_distribution<unsigned>(0,
+            ml.size() - 1)(rng)]);
+      continue;
+    }
+    SearchInfo info;
+    auto [score, best] = searcher.search(gs, options.limits, info,
+        stop_signal);
+    records.emplace_back(gs, record_score(score), 0, best);
+    gs.make_move(best);
+  }
+  for (TrainingRecord& r : records) {
+    r.result = *result;
+  }
+  return records;
+}
+
+uint64_t run_selfplay(TrainingWriter& out, const Evaluator& eval,
+    const SelfPlayOptions& options) {
+  std::atomic<unsigned> next_game{0};
+  std::mutex out_lock;
+  uint64_t written = 0;
+  auto worker = [&]() {
+    std::shared_ptr<TranspositionTable> tt =
+      std::make_shared<TranspositionTable>(options.hash);
+    PVSSearcher searcher(eval.clone(), tt);
+    searcher.set_params(options.params);
+    for (unsigned game = next_game++; game < options.games;
+        game = next_game++) {
+      std::vector<TrainingRecord> records = play_game(searcher, options,
+          options.seed + game);
+      std::lock_guard<std::mutex> guard(out_lock);
+      for (const TrainingRecord& r : records) {
+        out.write(r);
+      }
+      written += records.size();
+    }
+  };
+  unsigned threads = std::clamp(options.threads, 1u,
+      std::max(1u, options.games));
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < threads; i++) {
+    workers.emplace_back(worker);
+  }
+  for (std::thread& t : workers) {
+    t.join();
+  }
+  out.flush();
+  return written;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "boards.hpp"
+#include "evaluation.hpp"
+#include "search.hpp"
+#include "training.hpp"
+#include "transposition.hpp"
+
+// The number of random moves played at the start of each game by default.
+#define SELFPLAY_RANDOM_PLIES 8
+// Games which last this many half moves by default are adjudicated as draws.
+#define SELFPLAY_MAX_PLIES 400
+
+/**
+ * \brief Options for generating training data from self-play.
+ */
+struct SelfPlayOptions {
+  /** The limits of the search for each move, normally a depth or a node
+   * count. */
+  SearchLimits limits;
+  /** The number of games to play. */
+  unsigned games = 1;
+  /** The number of worker threads, each playing one game at a time. */
+  unsigned threads = 1;
+  /** The size of each worker's transposition table in megabytes. */
+  size_t hash = DEFAULT_HASH_SIZE;
+  /** The parameters of the selective search. */
+  SearchParams params;
+  /** The number of random moves at the start of each game, which are not
+   * recorded. */
+  unsigned random_plies = SELFPLAY_RANDOM_PLIES;
+  /** The number of half moves after which a game is a draw. */
+  unsigned max_plies = SELFPLAY_MAX_PLIES;
+  /** The seed of the random moves. Game `i` uses the seed plus `i`. */
+  uint64_t seed = 0;
+};
+
+/**
+ * \brief Determine whether a game is over.
+ *
+ * A game is over on checkmate or stalemate, a threefold repetition, the
+ * fifty-move rule, or when neither side has enough material to mate.
+ *
+ * \return The result from white's perspective, or nothing if the game goes
+ * on.
+ */
+std::optional<int> game_result(const GameState& gs);
+
+/**
+ * \brief Play games between two copies of the engine and record them.
+ *
+ * Each game starts with a few random moves so that the games differ. After
+ * that every position is searched, written with the score and best move of
+ * its search, and the best move is played. The records of a game are written
+ * together once the game is over and its result is known, so games appear in
+ * the order they finish.
+ *
+ * Each worker has its own searcher, evaluator and transposition table, which
+ * are reset at the start of each game, so a game depends only on its seed and
+ * the options and not on the number of threads.
+ *
+ * \param out Where to write the records.
+ * \param eval The evaluator. Each worker uses its own clone of it.
+ * \param options How to play the games.
+ * \return The number of positions written.
+ */
+uint64_t run_selfplay(TrainingWriter& out, const Evaluator& eval,
+    const SelfPlayOptions& options);
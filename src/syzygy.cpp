@@ -0,0 +1,695 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#include "bits.hpp"
+#include "syzygy.hpp"
+
+// The flag in the first byte after the magic bytes which is set if a table
+// has pawns.
+#define SYZYGY_HAS_PAWNS 2
+// The number of ways to place the leading group of a pawnless table with at
+// least three unique pieces, and with only the two kings leading.
+#define SYZYGY_UNIQUE_POSITIONS 31332
+#define SYZYGY_KING_POSITIONS 462
+// A right child of this marks a symbol which stands for a single value.
+#define SYZYGY_LEAF 0xfff
+
+// The tables used to number positions, set up by initialize_encoding.
+//
+// map_b1h1h7 numbers the squares below the a1-h8 diagonal from 0 to 27.
+static int map_b1h1h7[64];
+// map_a1d1d4 numbers the squares of the a1-d1-d4 triangle, first those below
+// the diagonal and then those on it.
+static int map_a1d1d4[64];
+// map_kk numbers the legal placements of two kings with the first in the
+// triangle, by the number of the first king's square and the second king's
+// square. If the first king is on the diagonal, the second is not above it.
+static int map_kk[10][64];
+// binomial[k][n] is the number of ways to choose k of n things.
+static uint64_t binomial[SYZYGY_MAX_PIECES - 1][64];
+// map_pawns numbers the squares a pawn may stand on so that the pawn with
+// the largest number is the leading pawn: the one nearest the edge, and the
+// lowest of those.
+static int map_pawns[64];
+// lead_pawn_index[n][s] is where the positions of n leading pawns with the
+// leading pawn on s start, and lead_pawns_size[n][f] is the number of them
+// with the leading pawn on file f.
+static uint64_t lead_pawn_index[SYZYGY_MAX_PIECES - 1][64];
+static uint64_t lead_pawns_size[SYZYGY_MAX_PIECES - 1][4];
+
+// How far a square is above the a1-h8 diagonal, negative if it is below.
+static int off_diagonal(int square) {
+  return square / 8 - square % 8;
+}
+
+static int flip_file(int square) {
+  return square ^ 7;
+}
+
+static int flip_rank(int square) {
+  return square ^ 56;
+}
+
+static void initialize_encoding() {
+  int code = 0;
+  for (int s = 0; s < 64; s++) {
+    if (off_diagonal(s) < 0) {
+      map_b1h1h7[s] = code++;
+    }
+  }
+
+  std::vector<int> diagonal;
+  code = 0;
+  for (int s = 0; s < 32; s++) {
+    if (s % 8 > 3) {
+      continue;
+    }
+    if (off_diagonal(s) < 0) {
+      map_a1d1d4[s] = code++;
+    } else if (off_diagonal(s) == 0) {
+      diagonal.push_back(s);
+    }
+  }
+  for (int s : diagonal) {
+    map_a1d1d4[s] = code++;
+  }
+
+  std::vector<std::pair<int, int>> both_on_diagonal;
+  code = 0;
+  for (int i = 0; i < 10; i++) {
+    for (int s1 = 0; s1 < 32; s1++) {
+      // b1 is the only square numbered 0 which counts, since the other
+      // entries are never set.
+      if (s1 % 8 > 3 || map_a1d1d4[s1] != i || (i == 0 && s1 != 1)) {
+        continue;
+      }
+      for (int s2 = 0; s2 < 64; s2++) {
+        if (std::abs(s1 % 8 - s2 % 8) <= 1 && std::abs(s1 / 8 - s2 / 8) <= 1) {
+          // The kings touch.
+          continue;
+        } else if (off_diagonal(s1) == 0 && off_diagonal(s2) > 0) {
+          continue;
+        } else if (off_diagonal(s1) == 0 && off_diagonal(s2) == 0) {
+          both_on_diagonal.emplace_back(i, s2);
+        } else {
+          map_kk[i][s2] = code++;
+        }
+      }
+    }
+  }
+  for (auto [i, s2] : both_on_diagonal) {
+    map_kk[i][s2] = code++;
+  }
+
+  binomial[0][0] = 1;
+  for (int n = 1; n < 64; n++) {
+    for (int k = 0; k < SYZYGY_MAX_PIECES - 1 && k <= n; k++) {
+      binomial[k][n] = (k > 0 ? binomial[k - 1][n - 1] : 0) +
+        (k < n ? binomial[k][n - 1] : 0);
+    }
+  }
+
+  // A leading pawn on a2 leaves 47 squares for the others, and each rank up
+  // takes away two more, the square itself and its mirror image.
+  int available = 47;
+  for (int leading = 1; leading < SYZYGY_MAX_PIECES - 1; leading++) {
+    for (int file = 0; file < 4; file++) {
+      uint64_t index = 0;
+      for (int rank = 1; rank < 7; rank++) {
+        int s = 8 * rank + file;
+        if (leading == 1) {
+          map_pawns[s] = available--;
+          map_pawns[flip_file(s)] = available--;
+        }
+        lead_pawn_index[leading][s] = index;
+        index += binomial[leading - 1][map_pawns[s]];
+      }
+      lead_pawns_size[leading][file] = index;
+    }
+  }
+}
+
+// Throw unless a table of the given size has the given number of bytes at
+// an offset.
+static void check_size(size_t offset, size_t bytes, size_t size) {
+  if (offset > size || bytes > size - offset) {
+    throw std::runtime_error("Syzygy table is truncated");
+  }
+}
+
+static uint64_t get_le(const unsigned char* in, unsigned bytes) {
+  uint64_t value = 0;
+  for (unsigned i = 0; i < bytes; i++) {
+    value |= static_cast<uint64_t>(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+static uint64_t get_be(const unsigned char* in, unsigned bytes) {
+  uint64_t value = 0;
+  for (unsigned i = 0; i < bytes; i++) {
+    value = value << 8 | in[i];
+  }
+  return value;
+}
+
+// Get Syzygy's code of a piece: 1 to 6 for the white pawn to king and 9 to
+// 14 for black.
+static unsigned piece_code(int piece) {
+  return piece < Position::W_ALL ? piece + 1 : piece - Position::B_PAWN + 9;
+}
+
+SyzygyTable::SyzygyTable(const unsigned char* data, size_t size,
+    const std::string& signature, bool dtz): bytes{data}, length{size},
+  dtz{dtz}, counts{}, piece_count{0}, pawn_counts{0, 0}, subtables{},
+  dtz_map{0} {
+  static std::once_flag initialized;
+  std::call_once(initialized, initialize_encoding);
+
+  // The side named first is white in the table.
+  size_t v = signature.find('v');
+  if (v == std::string::npos) {
+    throw std::runtime_error("Invalid Syzygy signature " + signature);
+  }
+  static const char codes[] = " PNBRQK";
+  for (size_t i = 0; i < signature.size(); i++) {
+    const char* c = signature[i] ? std::strchr(codes + 1, signature[i]) :
+      nullptr;
+    if (i == v) {
+      continue;
+    } else if (c == nullptr) {
+      throw std::runtime_error("Invalid Syzygy signature " + signature);
+    }
+    counts[(c - codes) + (i > v ? 8 : 0)]++;
+    piece_count++;
+  }
+  if (piece_count > SYZYGY_MAX_PIECES) {
+    throw std::runtime_error("Too many pieces in Syzygy table " + signature);
+  }
+  symmetric = signature.substr(0, v) == signature.substr(v + 1);
+  has_pawns = counts[1] + counts[9] > 0;
+  unique_pieces = false;
+  for (unsigned c = 1; c < 14; c++) {
+    if (c % 8 != 0 && c % 8 != 6 && c % 8 != 7 && counts[c] == 1) {
+      unique_pieces = true;
+    }
+  }
+  // The side with fewer pawns leads, since that compresses better, or white
+  // if both have the same number.
+  bool white_leads = counts[9] == 0 ||
+    (counts[1] > 0 && counts[9] >= counts[1]);
+  pawn_counts[0] = white_leads ? counts[1] : counts[9];
+  pawn_counts[1] = white_leads ? counts[9] : counts[1];
+
+  check_size(0, 5, length);
+  if (((bytes[4] & SYZYGY_HAS_PAWNS) != 0) != has_pawns) {
+    throw std::runtime_error("Syzygy table doesn't match its name " +
+        signature);
+  }
+  sides = !dtz && !symmetric ? 2 : 1;
+  unsigned files = has_pawns ? 4 : 1;
+  subtables.resize(sides * files);
+  bool both_pawns = has_pawns && pawn_counts[1] > 0;
+  size_t offset = 5;
+  for (unsigned f = 0; f < files; f++) {
+    check_size(offset, 1 + both_pawns + piece_count, length);
+    unsigned first = bytes[offset];
+    unsigned second = both_pawns ? bytes[offset + 1] : 0xff;
+    unsigned order[2][2] = {{first & 0xf, second & 0xf},
+      {first >> 4, second >> 4}};
+    offset += 1 + both_pawns;
+    for (unsigned k = 0; k < piece_count; k++, offset++) {
+      for (unsigned i = 0; i < sides; i++) {
+        subtables[f * sides + i].pieces[k] = i ? bytes[offset] >> 4 :
+          bytes[offset] & 0xf;
+      }
+    }
+    for (unsigned i = 0; i < sides; i++) {
+      Subtable& s = subtables[f * sides + i];
+      // The pieces must be those of the table, in some order.
+      unsigned seen[16] = {};
+      for (unsigned k = 0; k < piece_count; k++) {
+        seen[s.pieces[k]]++;
+      }
+      for (unsigned c = 0; c < 16; c++) {
+        if (seen[c] != counts[c]) {
+          throw std::runtime_error("Syzygy table doesn't match its name " +
+              signature);
+        }
+      }
+      set_groups(s, order[i], f);
+    }
+  }
+  offset += offset & 1;
+
+  for (Subtable& s : subtables) {
+    offset = set_sizes(s, offset);
+  }
+
+  if (dtz) {
+    dtz_map = offset;
+    for (unsigned f = 0; f < files; f++) {
+      Subtable& s = subtables[f];
+      if (!(s.flags & FLAG_MAPPED)) {
+        continue;
+      }
+      if (s.flags & FLAG_WIDE) {
+        offset += offset & 1;
+        for (unsigned i = 0; i < 4; i++) {
+          check_size(offset, 2, length);
+          s.map_index[i] = (offset - dtz_map) / 2 + 1;
+          offset += 2 * get_le(bytes + offset, 2) + 2;
+        }
+      } else {
+        for (unsigned i = 0; i < 4; i++) {
+          check_size(offset, 1, length);
+          s.map_index[i] = offset - dtz_map + 1;
+          offset += bytes[offset] + 1;
+        }
+      }
+    }
+    offset += offset & 1;
+  }
+
+  for (Subtable& s : subtables) {
+    s.sparse_index = offset;
+    uint64_t entries = s.span ? (positions(&s - &subtables[0]) + s.span - 1) /
+      s.span : 0;
+    offset += 6 * entries;
+  }
+  for (Subtable& s : subtables) {
+    s.block_length = offset;
+    offset += 2 * s.block_lengths;
+  }
+  for (Subtable& s : subtables) {
+    offset = (offset + 0x3f) & ~static_cast<size_t>(0x3f);
+    s.data = offset;
+    offset += s.blocks * s.block_size;
+  }
+  check_size(0, offset, length);
+}
+
+void SyzygyTable::set_groups(Subtable& s, const unsigned order[2],
+    unsigned file) {
+  // The leading group is the pawns of the leading side, or without pawns
+  // the first three unique pieces or the two kings. After it each group is
+  // a run of the same piece.
+  unsigned n = 0;
+  int first_length = has_pawns ? 0 : unique_pieces ? 3 : 2;
+  s.group_length[0] = 1;
+  for (unsigned i = 1; i < piece_count; i++) {
+    if (--first_length > 0 || s.pieces[i] == s.pieces[i - 1]) {
+      s.group_length[n]++;
+    } else {
+      s.group_length[++n] = 1;
+    }
+  }
+  s.group_length[++n] = 0;
+
+  // The groups are placed in the index in the given order. The leading
+  // group goes at order[0], the remaining pawns at order[1] and the rest
+  // follow in turn.
+  bool both_pawns = has_pawns && pawn_counts[1] > 0;
+  unsigned next = both_pawns ? 2 : 1;
+  unsigned free_squares = 64 - s.group_length[0] -
+    (both_pawns ? s.group_length[1] : 0);
+  uint64_t factor = 1;
+  std::fill(s.group_factor, s.group_factor + n, 0);
+  for (unsigned k = 0; next < n || k == order[0] || k == order[1]; k++) {
+    if (k == order[0]) {
+      s.group_factor[0] = factor;
+      factor *= has_pawns ? lead_pawns_size[s.group_length[0]][file] :
+        unique_pieces ? SYZYGY_UNIQUE_POSITIONS : SYZYGY_KING_POSITIONS;
+    } else if (k == order[1]) {
+      s.group_factor[1] = factor;
+      factor *= binomial[s.group_length[1]][48 - s.group_length[0]];
+    } else {
+      s.group_factor[next] = factor;
+      factor *= binomial[s.group_length[next]][free_squares];
+      free_squares -= s.group_length[next++];
+    }
+    if (k > SYZYGY_MAX_PIECES) {
+      throw std::runtime_error("Invalid group order in Syzygy table");
+    }
+  }
+  s.group_factor[n] = factor;
+  if (std::find(s.group_factor, s.group_factor + n, 0) != s.group_factor + n) {
+    throw std::runtime_error("Invalid group order in Syzygy table");
+  }
+}
+
+size_t SyzygyTable::set_sizes(Subtable& s, size_t offset) {
+  check_size(offset, 1, length);
+  s.flags = bytes[offset++];
+  if (s.flags & FLAG_SINGLE_VALUE) {
+    s.blocks = 0;
+    s.block_lengths = 0;
+    s.block_size = 0;
+    s.span = 0;
+    check_size(offset, 1, length);
+    s.min_length = bytes[offset++];
+    return offset;
+  }
+  check_size(offset, 9, length);
+  s.block_size = 1ull << bytes[offset];
+  s.span = 1ull << bytes[offset + 1];
+  unsigned padding = bytes[offset + 2];
+  s.blocks = get_le(bytes + offset + 3, 4);
+  // The list of block lengths is padded so that the sparse index never
+  // points past its end.
+  s.block_lengths = s.blocks + padding;
+  s.max_length = bytes[offset + 7];
+  s.min_length = bytes[offset + 8];
+  offset += 9;
+  if (bytes[offset - 9] > 32 || bytes[offset - 8] > 32 || s.min_length == 0 ||
+      s.max_length < s.min_length || s.max_length > 32) {
+    throw std::runtime_error("Invalid code lengths in Syzygy table");
+  }
+  s.lowest_symbol = offset;
+  unsigned lengths = s.max_length - s.min_length + 1;
+  check_size(offset, 2 * lengths + 2, length);
+
+  // The codes are canonical, with longer codes numerically lower. The
+  // symbols of each length are numbered consecutively, so from the lowest
+  // symbol of each length we get the number of codes of each length, and
+  // from those the first code of each length. Left aligning them makes any
+  // code of a given length compare between the first code of its length
+  // and that of the next shorter length.
+  s.base.assign(lengths, 0);
+  for (int i = lengths - 2; i >= 0; i--) {
+    s.base[i] = (s.base[i + 1] + get_le(bytes + offset + 2 * i, 2) -
+        get_le(bytes + offset + 2 * (i + 1), 2)) / 2;
+  }
+  for (unsigned i = 0; i < lengths; i++) {
+    s.base[i] <<= 64 - i - s.min_length;
+  }
+  offset += 2 * lengths;
+
+  // Each symbol is a leaf standing for one value or a pair of symbols.
+  unsigned symbols = get_le(bytes + offset, 2);
+  offset += 2;
+  s.tree = offset;
+  check_size(offset, 3 * symbols, length);
+  s.symbol_length.assign(symbols, 0);
+  std::vector<bool> visited(symbols);
+  for (unsigned i = 0; i < symbols; i++) {
+    if (!visited[i]) {
+      s.symbol_length[i] = set_symbol_length(s, i, visited);
+    }
+  }
+  return offset + 3 * symbols + (symbols & 1);
+}
+
+unsigned SyzygyTable::left_child(const Subtable& s, unsigned symbol) const {
+  const unsigned char* lr = bytes + s.tree + 3 * symbol;
+  return (lr[1] & 0xf) << 8 | lr[0];
+}
+
+unsigned SyzygyTable::right_child(const Subtable& s, unsigned symbol) const {
+  const unsigned char* lr = bytes + s.tree + 3 * symbol;
+  return lr[2] << 4 | lr[1] >> 4;
+}
+
+uint16_t SyzygyTable::set_symbol_length(Subtable& s, unsigned symbol,
+    std::vector<bool>& visited) const {
+  // The pairs form a tree, so each symbol is visited once.
+  visited[symbol] = true;
+  unsigned right = right_child(s, symbol);
+  if (right == SYZYGY_LEAF) {
+    return 0;
+  }
+  unsigned left = left_child(s, symbol);
+  if (left >= s.symbol_length.size() || right >= s.symbol_length.size()) {
+    throw std::runtime_error("Invalid symbol in Syzygy table");
+  }
+  for (unsigned child : {left, right}) {
+    if (!visited[child]) {
+      s.symbol_length[child] = set_symbol_length(s, child, visited);
+    }
+  }
+  return s.symbol_length[left] + s.symbol_length[right] + 1;
+}
+
+bool SyzygyTable::locate(const Position& p, bool white_to_move,
+    unsigned& subtable, uint64_t& index) const {
+  // The table has the side named first as white. If the position has the
+  // colors the other way around, or it is symmetric and black is to move,
+  // we swap the colors and flip the board.
+  bool flip = symmetric && !white_to_move;
+  for (int piece = Position::W_PAWN; piece <= Position::B_KING; piece++) {
+    if (piece != Position::W_ALL && !symmetric &&
+        (unsigned) popcount(p.get_board(piece)) != counts[piece_code(piece)]) {
+      flip = true;
+    }
+  }
+  unsigned flip_color = flip ? 8 : 0;
+  int flip_squares = flip ? 56 : 0;
+  unsigned side = flip != !white_to_move;
+
+  int squares[SYZYGY_MAX_PIECES] = {};
+  unsigned pieces[SYZYGY_MAX_PIECES];
+  unsigned size = 0;
+  unsigned leading = 0;
+  uint64_t lead_pawns = 0;
+  unsigned file = 0;
+  auto pawns_less = [](int a, int b) {
+    return map_pawns[a] < map_pawns[b];
+  };
+  if (has_pawns) {
+    // The pawns of the leading side come first in every subtable.
+    unsigned lead_code = subtables[0].pieces[0] ^ flip_color;
+    lead_pawns = p.get_board(lead_code < 8 ? Position::W_PAWN :
+        Position::B_PAWN);
+    for (int s : SquareSet(lead_pawns)) {
+      squares[size++] = s ^ flip_squares;
+    }
+    leading = size;
+    std::swap(squares[0], *std::max_element(squares, squares + leading,
+          pawns_less));
+    file = std::min(squares[0] % 8, 7 - squares[0] % 8);
+  }
+
+  // A DTZ table only holds one side to move, except when both sides have
+  // the same pieces and no pawns, so either side to move is the same.
+  const Subtable& d = find_subtable(side, file);
+  if (dtz && (d.flags & FLAG_STM) != side && !(symmetric && !has_pawns)) {
+    return false;
+  }
+  subtable = file * sides + side % sides;
+
+  for (int s : SquareSet(p.get_board(Position::BOTH_ALL) & ~lead_pawns)) {
+    squares[size] = s ^ flip_squares;
+    pieces[size++] = piece_code(p.get_piece(s)) ^ flip_color;
+  }
+
+  // Put the pieces in the order of the subtable.
+  for (unsigned i = leading; i + 1 < size; i++) {
+    for (unsigned j = i + 1; j < size; j++) {
+      if (d.pieces[i] == pieces[j]) {
+        std::swap(pieces[i], pieces[j]);
+        std::swap(squares[i], squares[j]);
+        break;
+      }
+    }
+  }
+
+  // Mirror the board so that the leading piece is on files a to d.
+  if (squares[0] % 8 > 3) {
+    for (unsigned i = 0; i < size; i++) {
+      squares[i] = flip_file(squares[i]);
+    }
+  }
+
+  uint64_t idx;
+  if (has_pawns) {
+    idx = lead_pawn_index[leading][squares[0]];
+    std::stable_sort(squares + 1, squares + leading, pawns_less);
+    for (unsigned i = 1; i < leading; i++) {
+      idx += binomial[i][map_pawns[squares[i]]];
+    }
+  } else {
+    // Without pawns the board can also be flipped top to bottom and about
+    // the diagonal, so the leading piece is in the a1-d1-d4 triangle, and
+    // the first leading piece off the diagonal is below it.
+    if (squares[0] / 8 > 3) {
+      for (unsigned i = 0; i < size; i++) {
+        squares[i] = flip_rank(squares[i]);
+      }
+    }
+    for (unsigned i = 0; i < d.group_length[0]; i++) {
+      if (off_diagonal(squares[i]) == 0) {
+        continue;
+      }
+      if (off_diagonal(squares[i]) > 0) {
+        for (unsigned j = i; j < size; j++) {
+          squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+        }
+      }
+      break;
+    }
+
+    if (unique_pieces) {
+      // The first three pieces are placed together, with the later pieces
+      // numbered among the squares the earlier ones leave free.
+      int adjust1 = squares[1] > squares[0];
+      int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+      if (off_diagonal(squares[0])) {
+        idx = (map_a1d1d4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 +
+          squares[2] - adjust2;
+      } else if (off_diagonal(squares[1])) {
+        idx = (6 * 63 + (squares[0] / 8) * 28 + map_b1h1h7[squares[1]]) * 62 +
+          squares[2] - adjust2;
+      } else if (off_diagonal(squares[2])) {
+        idx = 6 * 63 * 62 + 4 * 28 * 62 + (squares[0] / 8) * 7 * 28 +
+          (squares[1] / 8 - adjust1) * 28 + map_b1h1h7[squares[2]];
+      } else {
+        idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 +
+          (squares[0] / 8) * 7 * 6 + (squares[1] / 8 - adjust1) * 6 +
+          (squares[2] / 8 - adjust2);
+      }
+    } else {
+      idx = map_kk[map_a1d1d4[squares[0]]][squares[1]];
+    }
+  }
+  idx *= d.group_factor[0];
+
+  // Each later group is numbered as a combination of the squares left by
+  // the groups before it, with the other side's pawns among the 48 squares
+  // a pawn can stand on.
+  int* group = squares + d.group_length[0];
+  bool remaining_pawns = has_pawns && pawn_counts[1] > 0;
+  for (unsigned g = 1; d.group_length[g]; g++) {
+    std::stable_sort(group, group + d.group_length[g]);
+    uint64_t n = 0;
+    for (unsigned i = 0; i < d.group_length[g]; i++) {
+      int adjust = std::count_if(squares, group,
+          [&](int s) { return group[i] > s; });
+      n += binomial[i + 1][group[i] - adjust - 8 * remaining_pawns];
+    }
+    remaining_pawns = false;
+    idx += n * d.group_factor[g];
+    group += d.group_length[g];
+  }
+  index = idx;
+  return true;
+}
+
+unsigned SyzygyTable::value(unsigned subtable, uint64_t index) const {
+  const Subtable& d = subtables[subtable];
+  if (d.flags & FLAG_SINGLE_VALUE) {
+    return d.min_length;
+  }
+
+  // Block n holds one more than block_length[n] values. The sparse index
+  // entry k gives the block and the offset in it of the position
+  // k * span + span / 2, from which we walk to the block holding ours.
+  uint64_t k = index / d.span;
+  const unsigned char* entry = bytes + d.sparse_index + 6 * k;
+  int64_t block = get_le(entry, 4);
+  int64_t offset = get_le(entry + 4, 2);
+  offset += static_cast<int64_t>(index % d.span) -
+    static_cast<int64_t>(d.span / 2);
+  auto block_length = [&](int64_t b) -> int64_t {
+    if (b < 0 || (uint64_t) b >= d.block_lengths) {
+      throw std::runtime_error("Invalid sparse index in Syzygy table");
+    }
+    return get_le(bytes + d.block_length + 2 * b, 2);
+  };
+  while (offset < 0) {
+    offset += block_length(--block) + 1;
+  }
+  while (offset > block_length(block)) {
+    offset -= block_length(block++) + 1;
+  }
+  if ((uint64_t) block >= d.blocks) {
+    throw std::runtime_error("Invalid sparse index in Syzygy table");
+  }
+
+  // Decode symbols from the start of the block until we reach the one
+  // which covers our offset. The buffer holds the next 64 bits, and is
+  // refilled 32 bits at a time.
+  const unsigned char* ptr = bytes + d.data + block * d.block_size;
+  const unsigned char* end = bytes + d.data + d.blocks * d.block_size;
+  auto next_word = [&]() -> uint64_t {
+    uint64_t word = ptr + 4 <= end ? get_be(ptr, 4) : 0;
+    ptr += 4;
+    return word;
+  };
+  uint64_t buffer = next_word() << 32;
+  buffer |= next_word();
+  int buffer_bits = 64;
+  unsigned symbol;
+  while (true) {
+    unsigned len = 0;
+    while (buffer < d.base[len]) {
+      len++;
+    }
+    symbol = ((buffer - d.base[len]) >> (64 - len - d.min_length)) +
+      get_le(bytes + d.lowest_symbol + 2 * len, 2);
+    if (symbol >= d.symbol_length.size()) {
+      throw std::runtime_error("Invalid symbol in Syzygy table");
+    }
+    if (offset < d.symbol_length[symbol] + 1) {
+      break;
+    }
+    offset -= d.symbol_length[symbol] + 1;
+    len += d.min_length;
+    buffer <<= len;
+    buffer_bits -= len;
+    if (buffer_bits <= 32) {
+      buffer_bits += 32;
+      buffer |= next_word() << (64 - buffer_bits);
+    }
+  }
+
+  // The symbol stands for a run of values. Its pairs are adjacent, so we
+  // go down the tree to the leaf holding our offset.
+  while (d.symbol_length[symbol]) {
+    unsigned left = left_child(d, symbol);
+    if (offset < d.symbol_length[left] + 1) {
+      symbol = left;
+    } else {
+      offset -= d.symbol_length[left] + 1;
+      symbol = right_child(d, symbol);
+    }
+  }
+  return left_child(d, symbol);
+}
+
+std::optional<int> SyzygyTable::probe(const Position& p, bool white_to_move,
+    int wdl) const {
+  unsigned index;
+  uint64_t position;
+  if (!locate(p, white_to_move, index, position)) {
+    return std::nullopt;
+  }
+  int v = value(index, position);
+  if (!dtz) {
+    return v - 2;
+  }
+
+  // DTZ values may be mapped, with a separate map for wins, losses, cursed
+  // wins and blessed losses.
+  static const unsigned wdl_map[] = {1, 3, 0, 2, 0};
+  const Subtable& d = subtables[index];
+  if (d.flags & FLAG_MAPPED) {
+    size_t at = d.map_index[wdl_map[wdl + 2]] + v;
+    if (d.flags & FLAG_WIDE) {
+      check_size(dtz_map + 2 * at, 2, length);
+      v = get_le(bytes + dtz_map + 2 * at, 2);
+    } else {
+      check_size(dtz_map + at, 1, length);
+      v = bytes[dtz_map + at];
+    }
+  }
+  // Values are stored in moves unless the flags say plies, and those of
+  // cursed wins and blessed losses always are.
+  if ((wdl == 2 && !(d.flags & FLAG_WIN_PLIES)) ||
+      (wdl == -2 && !(d.flags & FLAG_LOSS_PLIES)) || wdl == 1 || wdl == -1) {
+    v *= 2;
+  }
+  return v + 1;
+}
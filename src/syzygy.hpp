@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "boards.hpp"
+
+// The most pieces, kings included, in a Syzygy table.
+#define SYZYGY_MAX_PIECES 7
+
+/**
+ * \brief One Syzygy WDL or DTZ file, decoded in place.
+ *
+ * A file holds one table for each side to move, or just one if both sides
+ * have the same material or it is a DTZ file, and with pawns each of those
+ * is split into four by the file of the leading pawn. Each of these
+ * subtables numbers the positions of its material, folding away the
+ * symmetries of the board, and stores the value of every position in
+ * blocks of Huffman-coded symbols. A symbol may stand for a pair of symbols,
+ * which may in turn stand for pairs, so long runs of equal values take a
+ * few bits.
+ *
+ * Only the headers are read on construction. The blocks are decoded when a
+ * position is looked up, so only the pages of the file holding them are
+ * read.
+ */
+class SyzygyTable {
+  private:
+    /**
+     * \brief One subtable: how its positions are numbered and where its
+     * values are stored.
+     */
+    struct Subtable {
+      /** The pieces in the order they are numbered, with Syzygy's codes:
+       * 1 to 6 for the white pawn to king and 9 to 14 for black. */
+      uint8_t pieces[SYZYGY_MAX_PIECES];
+      /** The number of pieces in each group numbered together, ending with
+       * a zero. */
+      uint8_t group_length[SYZYGY_MAX_PIECES + 1];
+      /** The factor of each group in the index. The entry after the last
+       * group is the number of positions. */
+      uint64_t group_factor[SYZYGY_MAX_PIECES + 1];
+      /** The properties of the subtable, see SyzygyTable::FLAG_STM onwards. */
+      uint8_t flags;
+      /** The size of a block of symbols in bytes. */
+      uint64_t block_size;
+      /** The number of positions between entries of the sparse index. */
+      uint64_t span;
+      /** The number of blocks and of entries in their list of lengths,
+       * which may be padded. */
+      uint32_t blocks;
+      uint64_t block_lengths;
+      /** The shortest and longest codes in bits. The shortest is the value
+       * of every position if the subtable has a single value. */
+      uint8_t min_length;
+      uint8_t max_length;
+      /** The offset in the file of the lowest symbol of each code length,
+       * from the shortest code. */
+      size_t lowest_symbol;
+      /** The first code of each length, left aligned in 64 bits. */
+      std::vector<uint64_t> base;
+      /** The offset in the file of the pairs each symbol stands for. */
+      size_t tree;
+      /** The number of values, less one, each symbol stands for. */
+      std::vector<uint16_t> symbol_length;
+      /** The offsets in the file of the sparse index, the block lengths and
+       * the blocks. */
+      size_t sparse_index;
+      size_t block_length;
+      size_t data;
+      /** For DTZ tables, the offset in the DTZ map of the values for wins,
+       * losses, cursed wins and blessed losses. */
+      uint16_t map_index[4];
+    };
+
+    const unsigned char* bytes;
+    size_t length;
+    bool dtz;
+    /** True if both sides have the same material, so only white to move is
+     * stored. */
+    bool symmetric;
+    bool has_pawns;
+    /** True if any piece other than a king is the only one of its kind. */
+    bool unique_pieces;
+    /** The number of pieces of each code of the side which comes first in
+     * the name of the table. */
+    unsigned counts[16];
+    unsigned piece_count;
+    /** The number of pawns of the side whose pawns lead, and of the other
+     * side. */
+    unsigned pawn_counts[2];
+    /** The number of sides to move stored. */
+    unsigned sides;
+    std::vector<Subtable> subtables;
+    /** The offset in the file of the DTZ map. */
+    size_t dtz_map;
+
+    /**
+     * \brief Get the subtable for a side to move and leading pawn file.
+     */
+    inline const Subtable& find_subtable(unsigned side, unsigned file) const {
+      return subtables[file * sides + side % sides];
+    }
+
+    void set_groups(Subtable& s, const unsigned order[2], unsigned file);
+    size_t set_sizes(Subtable& s, size_t offset);
+    uint16_t set_symbol_length(Subtable& s, unsigned symbol,
+        std::vector<bool>& visited) const;
+    unsigned left_child(const Subtable& s, unsigned symbol) const;
+    unsigned right_child(const Subtable& s, unsigned symbol) const;
+
+  public:
+    /** The subtable holds black to move. */
+    static const uint8_t FLAG_STM = 1;
+    /** The DTZ values are mapped through the DTZ map. */
+    static const uint8_t FLAG_MAPPED = 2;
+    /** The DTZ values of wins and losses are in plies rather than moves. */
+    static const uint8_t FLAG_WIN_PLIES = 4;
+    static const uint8_t FLAG_LOSS_PLIES = 8;
+    /** The DTZ map has 16-bit entries. */
+    static const uint8_t FLAG_WIDE = 16;
+    /** Every position has the same value, and there are no blocks. */
+    static const uint8_t FLAG_SINGLE_VALUE = 128;
+
+    /**
+     * \brief Read the headers of a table.
+     *
+     * The data must outlive the table. A std::runtime_error is thrown if
+     * the data is not a table of the given material.
+     *
+     * \param data The whole file, magic bytes included.
+     * \param size The size of the file.
+     * \param signature The material of the table, such as KRPvKR.
+     * \param dtz True for a DTZ file, false for a WDL file.
+     */
+    SyzygyTable(const unsigned char* data, size_t size,
+        const std::string& signature, bool dtz);
+
+    /**
+     * \brief Get the number of subtables.
+     */
+    inline unsigned size() const {
+      return subtables.size();
+    }
+
+    /**
+     * \brief Get the number of positions numbered by a subtable, including
+     * some which are not legal.
+     */
+    inline uint64_t positions(unsigned index) const {
+      const Subtable& s = subtables[index];
+      unsigned groups = 0;
+      while (s.group_length[groups]) {
+        groups++;
+      }
+      return s.group_factor[groups];
+    }
+
+    /**
+     * \brief Get the properties of a subtable, see FLAG_STM and onwards.
+     */
+    inline uint8_t flags(unsigned index) const {
+      return subtables[index].flags;
+    }
+
+    /**
+     * \brief Find where a position with the material of this table is
+     * stored.
+     *
+     * \param subtable Set to the index of the subtable.
+     * \param index Set to the index of the position in the subtable.
+     * \return False if this is a DTZ table which only holds the other side
+     * to move.
+     */
+    bool locate(const Position& p, bool white_to_move, unsigned& subtable,
+        uint64_t& index) const;
+
+    /**
+     * \brief Get the value stored for a position in a subtable.
+     *
+     * A std::runtime_error is thrown if the blocks are damaged.
+     */
+    unsigned value(unsigned subtable, uint64_t index) const;
+
+    /**
+     * \brief Look up a position with the material of this table.
+     *
+     * A std::runtime_error is thrown if the table is damaged.
+     *
+     * \param wdl The result of the position from -2 to 2, as in the WDL
+     * enumeration. DTZ tables need it to decode their values.
+     * \return The result from -2 to 2 in a WDL table. In a DTZ table, the
+     * number of plies to the next capture or pawn move, not counting the
+     * 100 plies by which a cursed win or blessed loss is over the fifty-move
+     * limit, or nothing if the table only holds the other side to move.
+     */
+    std::optional<int> probe(const Position& p, bool white_to_move,
+        int wdl = 0) const;
+};
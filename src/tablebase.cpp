@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+
+#include "bits.hpp"
+#include "tablebase.hpp"
+#include "utils.hpp"
+
+const unsigned char SyzygyTablebase::WDL_MAGIC[4] = {0x71, 0xe8, 0x23, 0x5d};
+const unsigned char SyzygyTablebase::DTZ_MAGIC[4] = {0xd7, 0x66, 0x0c, 0xa5};
+
+// Pieces appear in signatures in this order, strongest first.
+static const char SIGNATURE_PIECES[] = "KQRBNP";
+
+// Count the pieces of a Syzygy file name such as KRPvKR, or return zero if
+// it isn't one. Each side has exactly one king, which comes first.
+static unsigned signature_pieces(const std::string& name) {
+  size_t v = name.find('v');
+  if (v == std::string::npos || v == 0 || v + 1 >= name.size() ||
+      name[0] != 'K' || name[v + 1] != 'K') {
+    return 0;
+  }
+  for (size_t i = 0; i < name.size(); i++) {
+    if (i != v && (name[i] == 'v' ||
+          std::strchr(SIGNATURE_PIECES, name[i]) == nullptr ||
+          (name[i] == 'K' && i != 0 && i != v + 1))) {
+      return 0;
+    }
+  }
+  return name.size() - 1;
+}
+
+// Map a file if it starts with the given magic bytes, returning null if it
+// doesn't or it can't be mapped.
+static std::unique_ptr<MappedFile> map_table(const std::string& path,
+    const unsigned char* magic) {
+  std::unique_ptr<MappedFile> file;
+  try {
+    file = std::make_unique<MappedFile>(path);
+  } catch (const std::runtime_error&) {
+    return nullptr;
+  }
+  if (file->size() < 4 || std::memcmp(file->data(), magic, 4) != 0) {
+    return nullptr;
+  }
+  return file;
+}
+
+SyzygyTablebase::SyzygyTablebase(const std::string& path): tables{},
+  largest{0}, wdl_count{0}, dtz_count{0} {
+  for (const std::string& dir : split(path, ':')) {
+    if (dir.empty()) {
+      continue;
+    }
+    std::error_code ec;
+    for (const auto& f : std::filesystem::directory_iterator(dir, ec)) {
+      std::string extension = f.path().extension().string();
+      std::string name = f.path().stem().string();
+      bool wdl = extension == ".rtbw";
+      if ((!wdl && extension != ".rtbz") || !f.is_regular_file(ec)) {
+        continue;
+      }
+      unsigned pieces = signature_pieces(name);
+      if (pieces == 0) {
+        continue;
+      }
+      std::unique_ptr<Table>& table = tables[name];
+      if (!table) {
+        table = std::make_unique<Table>();
+        table->name = name;
+      }
+      // The first directory in the list with a file wins.
+      std::string& table_path = wdl ? table->wdl_path : table->dtz_path;
+      if (table_path.empty()) {
+        table_path = f.path().string();
+        (wdl ? wdl_count : dtz_count)++;
+        largest = std::max(largest, pieces);
+      }
+    }
+  }
+}
+
+unsigned SyzygyTablebase::max_pieces() const {
+  return largest;
+}
+
+SyzygyTablebase::Table* SyzygyTablebase::find(const GameState& gs) const {
+  // Only one of a signature and its mirror image is generated, so we look
+  // for both.
+  for (bool mirror : {false, true}) {
+    auto it = tables.find(material_signature(gs.pos(), mirror));
+    if (it != tables.end()) {
+      return it->second.get();
+    }
+  }
+  return nullptr;
+}
+
+void SyzygyTablebase::map(Table& table, bool dtz) const {
+  std::call_once(dtz ? table.dtz_once : table.wdl_once, [&table, dtz]() {
+      std::unique_ptr<MappedFile>& file = dtz ? table.dtz : table.wdl;
+      file = map_table(dtz ? table.dtz_path : table.wdl_path,
+          dtz ? DTZ_MAGIC : WDL_MAGIC);
+      if (!file) {
+        return;
+      }
+      // A damaged file stays mapped, but is never probed.
+      try {
+        (dtz ? table.dtz_table : table.wdl_table) =
+          std::make_unique<SyzygyTable>(file->data(), file->size(),
+              table.name, dtz);
+      } catch (const std::runtime_error&) {}
+    });
+}
+
+const MappedFile* SyzygyTablebase::wdl_file(const GameState& gs) const {
+  Table* table = find(gs);
+  if (!table || table->wdl_path.empty()) {
+    return nullptr;
+  }
+  map(*table, false);
+  return table->wdl.get();
+}
+
+const MappedFile* SyzygyTablebase::dtz_file(const GameState& gs) const {
+  Table* table = find(gs);
+  if (!table || table->dtz_path.empty()) {
+    return nullptr;
+  }
+  map(*table, true);
+  return table->dtz.get();
+}
+
+SyzygyTablebase::Lookup SyzygyTablebase::lookup(const GameState& gs,
+    bool dtz, int wdl, int& value) const {
+  // Two bare kings are a draw, and there is no table for them.
+  if (popcount(gs.pos().get_board(Position::BOTH_ALL)) == 2) {
+    value = 0;
+    return Lookup::FOUND;
+  }
+  Table* table = find(gs);
+  if (!table || (dtz ? table->dtz_path : table->wdl_path).empty()) {
+    return Lookup::FAILED;
+  }
+  map(*table, dtz);
+  const SyzygyTable* t = (dtz ? table->dtz_table : table->wdl_table).get();
+  if (!t) {
+    return Lookup::FAILED;
+  }
+  try {
+    std::optional<int> v = t->probe(gs.pos(), gs.whites_move(), wdl);
+    if (!v) {
+      return Lookup::OTHER_SIDE;
+    }
+    value = *v;
+  } catch (const std::runtime_error&) {
+    return Lookup::FAILED;
+  }
+  return Lookup::FOUND;
+}
+
+// Determine whether a move is made by a pawn.
+static bool pawn_move(const GameState& gs, const Move& m) {
+  return gs.pos().get_board(Position::color_piece(Position::PAWN,
+        gs.whites_move())) & (1ull << m.from_square());
+}
+
+std::optional<int> SyzygyTablebase::search(GameState& gs, bool pawn_moves,
+    bool& zeroing) const {
+  MoveList ml;
+  generate_moves(gs, ml);
+  int best = static_cast<int>(WDL::LOSS);
+  unsigned searched = 0;
+  for (const Move& m : ml) {
+    if (!m.capture() && !(pawn_moves && pawn_move(gs, m))) {
+      continue;
+    }
+    searched++;
+    gs.make_move(m);
+    bool child_zeroing;
+    std::optional<int> child = search(gs, false, child_zeroing);
+    gs.undo_move();
+    if (!child) {
+      return std::nullopt;
+    }
+    if (-*child > best) {
+      best = -*child;
+      if (best >= static_cast<int>(WDL::WIN)) {
+        zeroing = true;
+        return best;
+      }
+    }
+  }
+  // If every move was tried the table isn't needed, and it may even be
+  // wrong, since it doesn't know about en passant.
+  bool all_moves = searched > 0 && searched == ml.size();
+  int value = best;
+  if (!all_moves && lookup(gs, false, 0, value) != Lookup::FOUND) {
+    return std::nullopt;
+  }
+  // The table may store any value no better than the best capture.
+  if (best >= value) {
+    zeroing = best > static_cast<int>(WDL::DRAW) || all_moves;
+    return best;
+  }
+  zeroing = false;
+  return value;
+}
+
+std::optional<WDL> SyzygyTablebase::probe_wdl(GameState& gs) const {
+  if (!tablebase_probeable(*this, gs)) {
+    return std::nullopt;
+  }
+  bool zeroing;
+  std::optional<int> wdl = search(gs, false, zeroing);
+  if (!wdl) {
+    return std::nullopt;
+  }
+  return static_cast<WDL>(*wdl);
+}
+
+// The distance to zeroing of a position whose best move is a capture or a
+// pawn move.
+static int zeroing_distance(int wdl) {
+  switch (static_cast<WDL>(wdl)) {
+    case WDL::WIN:
+      return 1;
+    case WDL::CURSED_WIN:
+      return 101;
+    case WDL::BLESSED_LOSS:
+      return -101;
+    case WDL::LOSS:
+      return -1;
+    default:
+      return 0;
+  }
+}
+
+static int sign(int x) {
+  return (x > 0) - (x < 0);
+}
+
+std::optional<int> SyzygyTablebase::distance(GameState& gs) const {
+  bool zeroing;
+  std::optional<int> wdl = search(gs, true, zeroing);
+  if (!wdl) {
+    return std::nullopt;
+  }
+  if (*wdl == 0) {
+    return 0;
+  }
+  // The DTZ file doesn't store positions where zeroing is best.
+  if (zeroing) {
+    return zeroing_distance(*wdl);
+  }
+  int dtz;
+  Lookup found = lookup(gs, true, *wdl, dtz);
+  if (found == Lookup::FAILED) {
+    return std::nullopt;
+  } else if (found == Lookup::FOUND) {
+    return (dtz + (std::abs(*wdl) == 1 ? 100 : 0)) * sign(*wdl);
+  }
+
+  // The file holds the other side to move, so we search one ply and take
+  // the move which best keeps the result.
+  MoveList ml;
+  generate_moves(gs, ml);
+  std::optional<int> best;
+  for (const Move& m : ml) {
+    bool zeroing_move = m.capture() || pawn_move(gs, m);
+    gs.make_move(m);
+    std::optional<int> child;
+    if (zeroing_move) {
+      // The distance after a zeroing move counts from the move after it,
+      // so we want the distance of the move itself, and we only need the
+      // result to know that.
+      bool child_zeroing;
+      child = search(gs, false, child_zeroing);
+      if (child) {
+        *child = zeroing_distance(*child);
+      }
+    } else {
+      child = distance(gs);
+    }
+    bool mate = false;
+    if (child && *child == -1 && in_check(gs.whites_move(), gs.pos())) {
+      MoveList replies;
+      generate_moves(gs, replies);
+      mate = replies.empty();
+    }
+    gs.undo_move();
+    if (!child) {
+      return std::nullopt;
+    }
+    int d = -*child;
+    if (mate) {
+      best = 1;
+    }
+    if (!zeroing_move) {
+      d += sign(d);
+    }
+    if (sign(d) == sign(*wdl) && (!best || d < *best)) {
+      best = d;
+    }
+  }
+  // Without legal moves the side to move is mated.
+  return best ? *best : -1;
+}
+
+std::optional<int> SyzygyTablebase::probe_dtz(GameState& gs) const {
+  if (!tablebase_probeable(*this, gs)) {
+    return std::nullopt;
+  }
+  return distance(gs);
+}
+
+std::string material_signature(const Position& p, bool mirror) {
+  std::string sides[2];
+  for (bool white : {true, false}) {
+    std::string& s = sides[white != mirror ? 0 : 1];
+    // Position numbers the pieces from the pawn up to the king.
+    for (int piece = Position::KING; piece >= Position::PAWN; piece--) {
+      int n = popcount(p.get_board(Position::color_piece(piece, white)));
+      s.append(n, SIGNATURE_PIECES[Position::KING - piece]);
+    }
+  }
+  return sides[0] + "v" + sides[1];
+}
+
+bool tablebase_probeable(const Tablebase& tb, const GameState& gs) {
+  return !gs.can_castle() &&
+    (unsigned) popcount(gs.pos().get_board(Position::BOTH_ALL)) <=
+    tb.max_pieces();
+}
+
+double tablebase_score(WDL wdl, unsigned ply) {
+  switch (wdl) {
+    case WDL::WIN:
+      return TB_WIN_SCORE - ply * 0.01;
+    case WDL::LOSS:
+      return -TB_WIN_SCORE + ply * 0.01;
+    default:
+      return 0.0;
+  }
+}
+
+// Determine whether a score was won or lost through the tables.
+static bool tablebase_score_band(double score) {
+  return std::abs(score) <= TB_WIN_SCORE &&
+    std::abs(score) >= TB_WIN_SCORE - TB_SCORE_RANGE;
+}
+
+double tablebase_score_to_tt(double score, unsigned ply) {
+  if (!tablebase_score_band(score)) {
+    return score;
+  }
+  return score > 0 ? score + ply * 0.01 : score - ply * 0.01;
+}
+
+double tablebase_score_from_tt(double score, unsigned ply) {
+  if (!tablebase_score_band(score)) {
+    return score;
+  }
+  return score > 0 ? score - ply * 0.01 : score + ply * 0.01;
+}
+
+bool tablebase_root_filter(const Tablebase& tb, GameState& gs, MoveList& ml) {
+  if (ml.empty() || !tablebase_probeable(tb, gs)) {
+    return false;
+  }
+  std::vector<WDL> results;
+  // The number of half moves until the next capture or pawn move, or a
+  // negative value if the DTZ tables are missing.
+  std::vector<int> distances;
+  for (const Move& m : ml) {
+    gs.make_move(m);
+    std::optional<WDL> wdl = tb.probe_wdl(gs);
+    int distance = -1;
+    if (gs.half_move_clock() == 0) {
+      distance = 1;
+    } else if (std::optional<int> dtz = tb.probe_dtz(gs)) {
+      distance = 1 + std::abs(*dtz);
+    }
+    gs.undo_move();
+    if (!wdl) {
+      return false;
+    }
+    // The child is probed from the opponent's perspective.
+    results.push_back(static_cast<WDL>(-static_cast<int>(*wdl)));
+    distances.push_back(distance);
+  }
+  WDL best = *std::max_element(results.begin(), results.end());
+  bool use_dtz = best != WDL::DRAW;
+  std::optional<int> best_distance;
+  for (unsigned i = 0; i < ml.size(); i++) {
+    if (results[i] != best) {
+      continue;
+    }
+    if (distances[i] < 0) {
+      use_dtz = false;
+    } else if (!best_distance || (best > WDL::DRAW ?
+          distances[i] < *best_distance : distances[i] > *best_distance)) {
+      best_distance = distances[i];
+    }
+  }
+  MoveList kept;
+  for (unsigned i = 0; i < ml.size(); i++) {
+    if (results[i] == best && (!use_dtz || distances[i] == *best_distance)) {
+      kept.push_back(ml[i]);
+    }
+  }
+  ml = kept;
+  return true;
+}
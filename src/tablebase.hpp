@@ -0,0 +1,282 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "boards.hpp"
+#include "mapped_file.hpp"
+#include "movegen.hpp"
+#include "syzygy.hpp"
+
+// The score of a position the tablebases say is won, from the winner's
+// perspective. It is above any evaluation but below a mate found by the
+// search.
+#define TB_WIN_SCORE 900.0
+// Scores within this much of TB_WIN_SCORE were won or lost through the
+// tables. They lose a hundredth of a pawn for each ply from the root, and
+// this covers more plies than the search goes.
+#define TB_SCORE_RANGE 2.0
+
+/**
+ * \brief The result of a position with perfect play, from the perspective of
+ * the side to move.
+ *
+ * A cursed win is a win which takes more than 50 moves without a capture or
+ * pawn move, so it is a draw under the fifty-move rule. A blessed loss is the
+ * opposite.
+ */
+enum class WDL {
+  LOSS = -2,
+  BLESSED_LOSS = -1,
+  DRAW = 0,
+  CURSED_WIN = 1,
+  WIN = 2,
+};
+
+/**
+ * \brief A source of perfect results for positions with few pieces.
+ *
+ * Probes may be made from several search threads at once.
+ */
+class Tablebase {
+  public:
+    virtual ~Tablebase() {}
+
+    /**
+     * \brief Get the largest number of pieces, kings included, in a position
+     * this tablebase may know.
+     */
+    virtual unsigned max_pieces() const = 0;
+
+    /**
+     * \brief Find the result of a game state.
+     *
+     * The result assumes that no moves have been made since the last capture
+     * or pawn move. Positions where either side can castle are never in a
+     * tablebase. A probe may make and undo moves, so the game state is only
+     * unchanged once it returns.
+     *
+     * \return The result, or nothing if it isn't known.
+     */
+    virtual std::optional<WDL> probe_wdl(GameState& gs) const = 0;
+
+    /**
+     * \brief Find the distance to zeroing of a game state.
+     *
+     * \return The number of half moves until the next capture or pawn move
+     * with perfect play, negative if the side to move is losing and zero in
+     * a draw, or nothing if it isn't known. Cursed wins and blessed losses
+     * are 100 further from zero than their distance.
+     */
+    virtual std::optional<int> probe_dtz(GameState& gs) const = 0;
+};
+
+/**
+ * \brief The Syzygy tablebase files found in some directories.
+ *
+ * Each material signature, such as KRPvKR, has a WDL file with the extension
+ * .rtbw and a DTZ file with the extension .rtbz. The directories are scanned
+ * once on construction, but a file is only mapped the first time a position
+ * with its material is probed. That way a large set of tables costs nothing
+ * until the game reaches an endgame, and then only the pages which are read.
+ *
+ * The tables leave out positions where a capture or pawn move is best, or
+ * store a value which is no better than that move, since those positions
+ * are solved by the tables with fewer pieces or of the next pawn move. So
+ * a probe first tries every capture, and a DTZ probe every pawn move, and
+ * takes the best of those and the table. A DTZ file also only holds one
+ * side to move, and the other side is found by searching one ply.
+ */
+class SyzygyTablebase: public Tablebase {
+  private:
+    /**
+     * \brief The files of one material signature.
+     */
+    struct Table {
+      /** The material, such as KRPvKR, as in the name of the files. */
+      std::string name;
+      /** The path of the WDL file, or empty if there is none. */
+      std::string wdl_path;
+      /** The path of the DTZ file, or empty if there is none. */
+      std::string dtz_path;
+      /** Guards mapping the files, which happens on the first probe. */
+      std::once_flag wdl_once;
+      std::once_flag dtz_once;
+      /** The mapped files, which are null until they are needed or if they
+       * are not valid. */
+      std::unique_ptr<MappedFile> wdl;
+      std::unique_ptr<MappedFile> dtz;
+      /** The decoded headers of the files, which are null if a file is
+       * missing or damaged. */
+      std::unique_ptr<SyzygyTable> wdl_table;
+      std::unique_ptr<SyzygyTable> dtz_table;
+    };
+
+    /**
+     * \brief The outcome of looking up a position in one file.
+     */
+    enum class Lookup {
+      /** The value was found. */
+      FOUND,
+      /** The DTZ file only holds the other side to move. */
+      OTHER_SIDE,
+      /** The file is missing or damaged. */
+      FAILED,
+    };
+
+    /** The tables by material signature. */
+    std::map<std::string, std::unique_ptr<Table>> tables;
+    /** The number of pieces in the largest table. */
+    unsigned largest;
+    /** The number of WDL and DTZ files found. */
+    unsigned wdl_count;
+    unsigned dtz_count;
+
+    /**
+     * \brief Find the table for the material of a game state.
+     *
+     * \return The table, or null if there is none.
+     */
+    Table* find(const GameState& gs) const;
+
+    /**
+     * \brief Map a file of a table and decode its headers, the first time
+     * it is needed.
+     */
+    void map(Table& table, bool dtz) const;
+
+    /**
+     * \brief Look up a game state in its WDL or DTZ file, without trying
+     * any moves.
+     *
+     * \param wdl The result of the game state, needed for a DTZ lookup.
+     * \param value Set to the value found, as given by SyzygyTable::probe.
+     */
+    Lookup lookup(const GameState& gs, bool dtz, int wdl, int& value) const;
+
+    /**
+     * \brief Find the result of a game state by trying its captures, and
+     * optionally its pawn moves, before looking it up.
+     *
+     * \param zeroing Set to true if a capture or pawn move is best, or the
+     * only moves are captures, in which case the DTZ file can't be used.
+     * \return The result from -2 to 2, or nothing if a table is missing.
+     */
+    std::optional<int> search(GameState& gs, bool pawn_moves,
+        bool& zeroing) const;
+
+    /**
+     * \brief Find the distance to zeroing of a game state, as probe_dtz.
+     */
+    std::optional<int> distance(GameState& gs) const;
+
+  public:
+    /** The first bytes of a WDL file. */
+    static const unsigned char WDL_MAGIC[4];
+    /** The first bytes of a DTZ file. */
+    static const unsigned char DTZ_MAGIC[4];
+
+    /**
+     * \brief Find the tables in a list of directories.
+     *
+     * \param path The directories, separated by colons. Directories which
+     * don't exist are ignored.
+     */
+    SyzygyTablebase(const std::string& path);
+
+    /**
+     * \brief Get the number of WDL files found.
+     */
+    inline unsigned wdl_tables() const {
+      return wdl_count;
+    }
+
+    /**
+     * \brief Get the number of DTZ files found.
+     */
+    inline unsigned dtz_tables() const {
+      return dtz_count;
+    }
+
+    unsigned max_pieces() const override;
+
+    /**
+     * \brief Get the WDL file for the material of a game state, mapping it
+     * the first time it is needed.
+     *
+     * \return The file, or null if there is none or it is not a WDL file.
+     */
+    const MappedFile* wdl_file(const GameState& gs) const;
+
+    /**
+     * \brief Get the DTZ file for the material of a game state, mapping it
+     * the first time it is needed.
+     *
+     * \return The file, or null if there is none or it is not a DTZ file.
+     */
+    const MappedFile* dtz_file(const GameState& gs) const;
+
+    std::optional<WDL> probe_wdl(GameState& gs) const override;
+
+    std::optional<int> probe_dtz(GameState& gs) const override;
+};
+
+/**
+ * \brief Get the Syzygy name of the material in a position, such as KRPvKR.
+ *
+ * \param mirror If false white's pieces come first, otherwise black's.
+ */
+std::string material_signature(const Position& p, bool mirror = false);
+
+/**
+ * \brief Determine whether a game state may be probed in a tablebase.
+ *
+ * This is true if it has few enough pieces and neither side can castle.
+ */
+bool tablebase_probeable(const Tablebase& tb, const GameState& gs);
+
+/**
+ * \brief Get the score of a tablebase result for the side to move.
+ *
+ * Wins are worth TB_WIN_SCORE, less a little for each ply from the root so
+ * that the search prefers reaching a won ending sooner. Cursed wins and
+ * blessed losses are draws under the fifty-move rule.
+ */
+double tablebase_score(WDL wdl, unsigned ply);
+
+/**
+ * \brief Convert a score at some ply into the score stored in the
+ * transposition table.
+ *
+ * A tablebase score depends on the ply at which it was found, but the same
+ * position may be reached at any ply. Scores won or lost through the tables
+ * are stored counting plies from the position itself rather than from the
+ * root, and every other score is unchanged.
+ */
+double tablebase_score_to_tt(double score, unsigned ply);
+
+/**
+ * \brief Convert a score from the transposition table into the score at some
+ * ply.
+ *
+ * This undoes tablebase_score_to_tt.
+ */
+double tablebase_score_from_tt(double score, unsigned ply);
+
+/**
+ * \brief Keep only the root moves which preserve the best result.
+ *
+ * Every move is probed. The moves with the best result are kept and, if the
+ * DTZ tables are available, only those of them which make the most
+ * progress: a winning side keeps the moves which reach the next capture or
+ * pawn move soonest and a losing side those which put it off longest.
+ * Without that the search would see the same score after every winning move
+ * and could shuffle forever.
+ *
+ * \return True if the moves were filtered, or false and the moves are left
+ * unchanged if any probe failed.
+ */
+bool tablebase_root_filter(const Tablebase& tb, GameState& gs, MoveList& ml);
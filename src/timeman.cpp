@@ -0,0 +1,62 @@
+#include <algorithm>
+
+#include "timeman.hpp"
+
+TimeManager::TimeManager(const SearchLimits& limits, bool white_to_move,
+    const std::atomic<bool>* pondering):
+  start{std::chrono::steady_clock::now()}, soft{}, hard{},
+  best_move_changes{0.0}, pondering{pondering} {
+  std::optional<int> time = white_to_move ? limits.wtime : limits.btime;
+  if (time) {
+    unsigned inc = (white_to_move ? limits.winc : limits.binc).value_or(0);
+    unsigned moves = std::max<unsigned>(1,
+        limits.movestogo.value_or(DEFAULT_MOVES_TO_GO));
+    // The clock may be slightly negative if we have already overrun it.
+    unsigned left = std::max(*time, 0);
+    unsigned available = left > MOVE_OVERHEAD ? left - MOVE_OVERHEAD : 0;
+    // Even on the last move before the time control we leave some time in
+    // reserve, in case the GUI is slow to respond.
+    unsigned most = available * 4 / 5;
+    unsigned target = std::min(available / moves + inc * 3 / 4, most);
+    soft = std::max<unsigned>(target, 1);
+    hard = std::max<unsigned>(std::min(target * HARD_RATIO, most), 1);
+  }
+  if (limits.timeout) {
+    // A fixed move time overrides the clock if it is shorter.
+    soft = std::min(soft.value_or(*limits.timeout), *limits.timeout);
+    hard = std::min(hard.value_or(*limits.timeout), *limits.timeout);
+  }
+}
+
+unsigned TimeManager::elapsed() const {
+  auto now = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      now - start).count();
+}
+
+void TimeManager::iteration_finished(bool best_move_changed) {
+  // Halving the old count each iteration means only the last few iterations
+  // matter, and the count never exceeds two.
+  best_move_changes = best_move_changes / 2 + (best_move_changed ? 1.0 : 0.0);
+}
+
+std::optional<unsigned> TimeManager::adjusted_soft_limit() const {
+  if (!soft) {
+    return std::nullopt;
+  }
+  double scale = 1.0 + INSTABILITY_WEIGHT * best_move_changes;
+  return std::min<unsigned>(*soft * scale, *hard);
+}
+
+bool TimeManager::start_iteration(unsigned elapsed,
+    unsigned last_iteration) const {
+  if (!soft || is_pondering()) {
+    return true;
+  }
+  if (elapsed >= *adjusted_soft_limit()) {
+    return false;
+  }
+  // Only the root moves searched before the hard limit count, so starting an
+  // iteration we can't finish mostly wastes the time.
+  return elapsed + last_iteration * BRANCHING_FACTOR < *hard;
+}
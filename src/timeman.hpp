@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+
+#include "search.hpp"
+
+/**
+ * \brief Decide how long to spend on a move.
+ *
+ * Two limits are computed when the search starts, both in milliseconds since
+ * that point:
+ *
+ * - The soft limit is the time we aim to spend. Once it has passed, no new
+ *   iteration of iterative deepening is started. It is stretched while the
+ *   best move keeps changing between iterations, since the search has not yet
+ *   settled on a move.
+ * - The hard limit is checked by the search itself every few nodes and ends
+ *   it immediately, even in the middle of an iteration.
+ *
+ * With a clock (`wtime`/`btime`) the time left is shared evenly among the
+ * moves to the next time control, plus most of the increment. With
+ * `movetime` both limits are the given time. Without either, the search is
+ * not limited by time at all.
+ *
+ * While the engine ponders, the limits are computed as usual but ignored.
+ * After a ponderhit they apply from the time the search started, so the time
+ * spent pondering counts towards them and a search which has already pondered
+ * long enough stops soon.
+ */
+class TimeManager {
+  private:
+    /** When the search started. */
+    std::chrono::steady_clock::time_point start;
+    /** The time we aim to spend, if the search is timed. */
+    std::optional<unsigned> soft;
+    /** The time after which the search must stop, if it is timed. */
+    std::optional<unsigned> hard;
+    /** A decaying count of how often the best move changed recently. */
+    double best_move_changes;
+    /** Set by the interface while the engine ponders, or null if the search
+     * never ponders. */
+    const std::atomic<bool>* pondering;
+
+  public:
+    /** Time kept in reserve for communicating with the GUI, in ms. */
+    static constexpr unsigned MOVE_OVERHEAD = 30;
+    /** The number of moves assumed to be left when the GUI doesn't say. */
+    static constexpr unsigned DEFAULT_MOVES_TO_GO = 30;
+    /** The hard limit is at most this many times the soft limit. */
+    static constexpr unsigned HARD_RATIO = 4;
+    /** An iteration is expected to take this many times as long as the one
+     * before it. */
+    static constexpr double BRANCHING_FACTOR = 2.0;
+    /** Each recent change of best move stretches the soft limit by this
+     * fraction. */
+    static constexpr double INSTABILITY_WEIGHT = 0.5;
+
+    /**
+     * \brief Compute the limits for a search starting now.
+     *
+     * \param limits The limits given by the GUI.
+     * \param white_to_move True if we are playing white.
+     * \param pondering True while the engine ponders. It may be cleared
+     * during the search but never set again.
+     */
+    TimeManager(const SearchLimits& limits, bool white_to_move,
+        const std::atomic<bool>* pondering = nullptr);
+
+    /**
+     * \brief Get the time since the search started in milliseconds.
+     */
+    unsigned elapsed() const;
+
+    /**
+     * \brief Get the soft limit, if the search is timed.
+     */
+    inline std::optional<unsigned> soft_limit() const {
+      return soft;
+    }
+
+    /**
+     * \brief Get the hard limit, if the search is timed.
+     */
+    inline std::optional<unsigned> hard_limit() const {
+      return hard;
+    }
+
+    /**
+     * \brief Determine whether the engine is pondering, so that the limits
+     * don't apply yet.
+     */
+    inline bool is_pondering() const {
+      return pondering && pondering->load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Determine whether the search must stop now.
+     */
+    inline bool hard_limit_reached() const {
+      return !is_pondering() && hard && elapsed() >= *hard;
+    }
+
+    /**
+     * \brief Record the result of a completed iteration.
+     *
+     * \param best_move_changed True if the iteration found a different best
+     * move than the one before it.
+     */
+    void iteration_finished(bool best_move_changed);
+
+    /**
+     * \brief Get the soft limit, stretched by the instability of the best
+     * move but never beyond the hard limit.
+     */
+    std::optional<unsigned> adjusted_soft_limit() const;
+
+    /**
+     * \brief Determine whether to start another iteration.
+     *
+     * We stop if the adjusted soft limit has passed, or if the next iteration
+     * is not expected to finish before the hard limit.
+     *
+     * \param elapsed The time since the search started.
+     * \param last_iteration The time the last iteration took.
+     */
+    bool start_iteration(unsigned elapsed, unsigned last_iteration) const;
+};
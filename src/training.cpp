@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "bits.hpp"
+#include "training.hpp"
+
+// Pieces are coded in four bits by skipping W_ALL, which sits between the
+// white king and the black pawn.
+static int piece_code(int piece) {
+  return piece < Position::W_ALL ? piece : piece - 1;
+}
+
+static int code_piece(int code) {
+  return code < Position::W_ALL ? code : code + 1;
+}
+
+static void put_le(unsigned char* out, uint64_t value, unsigned bytes) {
+  for (unsigned i = 0; i < bytes; i++) {
+    out[i] = (value >> (8 * i)) & 0xff;
+  }
+}
+
+static uint64_t get_le(const unsigned char* in, unsigned bytes) {
+  uint64_t value = 0;
+  for (unsigned i = 0; i < bytes; i++) {
+    value |= static_cast<uint64_t>(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+TrainingRecord::TrainingRecord(): position{}, white_to_move{true},
+  castling{0xf}, en_passant{-1}, half_moves{0}, score{0}, result{0}, move{} {}
+
+TrainingRecord::TrainingRecord(const GameState& gs, int16_t score,
+    int8_t result, const Move& move): position{gs.pos()},
+  white_to_move{gs.whites_move()}, castling{gs.castling_rights()},
+  en_passant{gs.en_passant() ? gs.en_passant_target() : -1},
+  half_moves{static_cast<unsigned>(gs.half_move_clock())}, score{score},
+  result{result}, move{move} {}
+
+GameState TrainingRecord::game_state() const {
+  return GameState(position, white_to_move, castling & 1, castling & 2,
+      castling & 4, castling & 8, en_passant < 0 ? 0 : en_passant,
+      en_passant >= 0, half_moves, 1);
+}
+
+void pack_record(const TrainingRecord& record, unsigned char* out) {
+  uint64_t occupied = record.position.get_board(Position::BOTH_ALL);
+  if (popcount(occupied) > 32) {
+    throw std::runtime_error("Too many pieces for a training record");
+  }
+  std::fill(out, out + TRAINING_RECORD_SIZE, 0);
+  put_le(out, occupied, 8);
+  unsigned i = 0;
+  for (int square : SquareSet(occupied)) {
+    int code = piece_code(record.position.get_piece(square));
+    out[8 + i / 2] |= code << (4 * (i % 2));
+    i++;
+  }
+  out[24] = (record.white_to_move ? 1 : 0) | (record.castling & 0xf) << 1;
+  out[25] = record.en_passant < 0 ? 0xff : record.en_passant;
+  out[26] = std::min(record.half_moves, 255u);
+  out[27] = static_cast<uint8_t>(record.result);
+  put_le(out + 28, static_cast<uint16_t>(record.score), 2);
+  const Move& m = record.move;
+  put_le(out + 30, m.from_square() | m.to_square() << 6 | m.get_flags() << 12,
+      2);
+}
+
+TrainingRecord unpack_record(const unsigned char* in) {
+  // Parsing an empty board once is cheaper than clearing a position for
+  // every record.
+  static const Position empty("8/8/8/8/8/8/8/8");
+  TrainingRecord record;
+  record.position = empty;
+  unsigned i = 0;
+  for (int square : SquareSet(get_le(in, 8))) {
+    int code = (in[8 + i / 2] >> (4 * (i % 2))) & 0xf;
+    record.position.place_piece(square, code_piece(code));
+    i++;
+  }
+  record.white_to_move = in[24] & 1;
+  record.castling = (in[24] >> 1) & 0xf;
+  record.en_passant = in[25] == 0xff ? -1 : in[25];
+  record.half_moves = in[26];
+  record.result = static_cast<int8_t>(in[27]);
+  record.score = static_cast<int16_t>(get_le(in + 28, 2));
+  uint16_t m = get_le(in + 30, 2);
+  record.move = Move(m & 0x3f, (m >> 6) & 0x3f, m >> 12);
+  return record;
+}
+
+TrainingWriter::TrainingWriter(const std::string& path, bool append):
+  out(path, std::ios::binary | (append ? std::ios::app : std::ios::trunc)),
+  buffer{}, count{0} {
+  if (!out) {
+    throw std::runtime_error("Could not open " + path);
+  }
+  buffer.reserve(TRAINING_WRITER_BUFFER * TRAINING_RECORD_SIZE);
+}
+
+TrainingWriter::~TrainingWriter() {
+  // Errors can't be reported from a destructor, so a caller which needs to
+  // know that every record was written should flush first.
+  try {
+    flush();
+  } catch (const std::runtime_error&) {}
+}
+
+void TrainingWriter::write(const TrainingRecord& record) {
+  unsigned char packed[TRAINING_RECORD_SIZE];
+  pack_record(record, packed);
+  buffer.insert(buffer.end(), packed, packed + TRAINING_RECORD_SIZE);
+  count++;
+  if (buffer.size() >= TRAINING_WRITER_BUFFER * TRAINING_RECORD_SIZE) {
+    flush();
+  }
+}
+
+void TrainingWriter::flush() {
+  out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+  out.flush();
+  buffer.clear();
+  if (!out) {
+    throw std::runtime_error("Could not write training records");
+  }
+}
+
+TrainingReader::TrainingReader(const std::string& path):
+  file(path, false), position{0} {
+  if (file.size() % TRAINING_RECORD_SIZE != 0) {
+    throw std::runtime_error(path + " is not a file of training records");
+  }
+}
+
+bool TrainingReader::next(TrainingRecord& record) {
+  if (position >= size()) {
+    return false;
+  }
+  record = (*this)[position++];
+  return true;
+}
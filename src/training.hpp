@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "boards.hpp"
+#include "mapped_file.hpp"
+
+// The size of a packed training record in bytes.
+#define TRAINING_RECORD_SIZE 32
+// The number of records a TrainingWriter collects before writing them.
+#define TRAINING_WRITER_BUFFER 4096
+// The score of a record is clamped to this many centipawns, so that mate
+// scores fit in 16 bits.
+#define TRAINING_MAX_SCORE 32000
+
+/**
+ * \brief One position of a game, labelled for training an evaluator.
+ */
+struct TrainingRecord {
+  /** The position before the move was made. */
+  Position position;
+  bool white_to_move;
+  /** The castling rights, as given by GameState::castling_rights. */
+  uint8_t castling;
+  /** The en passant square, or -1 if en passant is impossible. */
+  int en_passant;
+  /** The number of half moves since the last pawn move or capture. */
+  unsigned half_moves;
+  /** The score from the search in centipawns, from white's perspective. */
+  int16_t score;
+  /** The result of the game from white's perspective: 1 for a win, 0 for a
+   * draw and -1 for a loss. */
+  int8_t result;
+  /** The best move found by the search. */
+  Move move;
+
+  /**
+   * \brief Construct a record of the starting position.
+   */
+  TrainingRecord();
+
+  /**
+   * \brief Construct a record of the current position of a game.
+   */
+  TrainingRecord(const GameState& gs, int16_t score, int8_t result,
+      const Move& move);
+
+  /**
+   * \brief Get the position as a game state with no history and move
+   * number 1.
+   */
+  GameState game_state() const;
+};
+
+/**
+ * \brief Pack a record into TRAINING_RECORD_SIZE bytes.
+ *
+ * The layout, with every field little-endian, is
+ * - bytes 0-7: a bitboard of the occupied squares,
+ * - bytes 8-23: a four bit code for each occupied piece in order of square,
+ *   low half of each byte first, numbered from the white pawn to the white
+ *   king and then the black pawn to the black king,
+ * - byte 24: bit 0 set if white is to move and bits 1 to 4 the castling
+ *   rights K, Q, k and q,
+ * - byte 25: the en passant square, or 0xff if en passant is impossible,
+ * - byte 26: the halfmove clock, which stops at 255,
+ * - byte 27: the result,
+ * - bytes 28-29: the score,
+ * - bytes 30-31: the move as the from square, the to square shifted by 6 and
+ *   the flags shifted by 12.
+ *
+ * The move number is not stored. A std::runtime_error is thrown if the
+ * position has more than 32 pieces.
+ */
+void pack_record(const TrainingRecord& record, unsigned char* out);
+
+/**
+ * \brief Unpack a record written by pack_record.
+ */
+TrainingRecord unpack_record(const unsigned char* in);
+
+/**
+ * \brief Write packed records to a file.
+ *
+ * Records are packed into a buffer which is written to the file in one call
+ * when it is full, when the writer is flushed and when it is destroyed.
+ * A writer may only be used by one thread at a time.
+ */
+class TrainingWriter {
+  private:
+    std::ofstream out;
+    /** The packed records not yet written. */
+    std::vector<unsigned char> buffer;
+    /** The number of records given to the writer. */
+    uint64_t count;
+
+  public:
+    /**
+     * \brief Open a file for writing.
+     *
+     * A std::runtime_error is thrown if the file can't be opened.
+     *
+     * \param append True to add to the end of an existing file rather than
+     * replacing it.
+     */
+    TrainingWriter(const std::string& path, bool append = false);
+
+    ~TrainingWriter();
+
+    /**
+     * \brief Add a record to the file.
+     */
+    void write(const TrainingRecord& record);
+
+    /**
+     * \brief Write every buffered record to the file.
+     *
+     * A std::runtime_error is thrown if the file can't be written.
+     */
+    void flush();
+
+    /**
+     * \brief Get the number of records given to this writer.
+     */
+    inline uint64_t records() const {
+      return count;
+    }
+};
+
+/**
+ * \brief Read packed records from a memory-mapped file.
+ *
+ * The file is mapped for reading in order, so the kernel reads ahead of a
+ * sequential scan, and records are unpacked straight from the mapping.
+ */
+class TrainingReader {
+  private:
+    MappedFile file;
+    /** The index of the next record returned by next. */
+    uint64_t position;
+
+  public:
+    /**
+     * \brief Open a file of records.
+     *
+     * A std::runtime_error is thrown if the file can't be mapped or its size
+     * is not a whole number of records.
+     */
+    TrainingReader(const std::string& path);
+
+    /**
+     * \brief Get the number of records in the file.
+     */
+    inline uint64_t size() const {
+      return file.size() / TRAINING_RECORD_SIZE;
+    }
+
+    /**
+     * \brief Get the record with a given index.
+     */
+    inline TrainingRecord operator[](uint64_t index) const {
+      return unpack_record(file.data() + index * TRAINING_RECORD_SIZE);
+    }
+
+    /**
+     * \brief Read the next record.
+     *
+     * \return True if a record was read, or false at the end of the file.
+     */
+    bool next(TrainingRecord& record);
+};
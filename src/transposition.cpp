@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "transposition.hpp"
+
+TranspositionTable::TranspositionTable(size_t mb): table{}, mask{0}, age{0} {
+  resize(mb);
+}
+
+// Pack an entry into a single word: the move in the low 16 bits, then the
+// bits of the score, the depth, the bound and the age.
+static uint64_t pack_entry(const Move& m, float score, int depth,
+    uint8_t bound, uint8_t age) {
+  uint32_t score_bits;
+  std::memcpy(&score_bits, &score, sizeof(score_bits));
+  uint64_t move_bits = m.from_square() | m.to_square() << 6 |
+    m.get_flags() << 12;
+  return move_bits | (uint64_t) score_bits << 16 |
+    (uint64_t) std::clamp(depth, 0, 255) << 48 | (uint64_t) (bound & 3) << 56 |
+    (uint64_t) (age & 63) << 58;
+}
+
+static TTEntry unpack_entry(uint64_t data) {
+  TTEntry e;
+  e.move = Move(data & 0x3f, (data >> 6) & 0x3f, (data >> 12) & 0xf);
+  uint32_t score_bits = data >> 16;
+  std::memcpy(&e.score, &score_bits, sizeof(score_bits));
+  e.depth = (data >> 48) & 0xff;
+  e.bound = (data >> 56) & 3;
+  e.age = data >> 58;
+  return e;
+}
+
+// Read a slot, returning true if it holds an entry for the hash.
+static bool read_slot(const TTSlot& slot, uint64_t hash, TTEntry& entry) {
+  uint64_t check = slot.check.load(std::memory_order_relaxed);
+  uint64_t data = slot.data.load(std::memory_order_relaxed);
+  if ((check ^ data) != hash) {
+    return false;
+  }
+  entry = unpack_entry(data);
+  return entry.bound != TTEntry::NONE;
+}
+
+static void write_slot(TTSlot& slot, uint64_t hash, uint64_t data) {
+  slot.check.store(hash ^ data, std::memory_order_relaxed);
+  slot.data.store(data, std::memory_order_relaxed);
+}
+
+void TranspositionTable::resize(size_t mb) {
+  mb = std::clamp<size_t>(mb, 1, MAX_HASH_SIZE);
+  // Use the largest power of two number of buckets that fits in the requested
+  // size so that we can find buckets with a mask rather than a division.
+  size_t buckets = (mb << 20) / sizeof(TTBucket);
+  size_t size = 1;
+  while (2 * size <= buckets) {
+    size *= 2;
+  }
+  table = std::vector<TTBucket>(size);
+  mask = size - 1;
+  clear();
+}
+
+void TranspositionTable::clear() {
+  // An empty slot has a bound of NONE, so it never matches any hash.
+  for (TTBucket& b : table) {
+    for (TTSlot& slot : b.entries) {
+      write_slot(slot, 0, 0);
+    }
+  }
+  age = 0;
+}
+
+void TranspositionTable::new_search() {
+  age++;
+}
+
+bool TranspositionTable::probe(uint64_t hash, TTEntry& entry) const {
+  for (const TTSlot& slot : bucket(hash).entries) {
+    if (read_slot(slot, hash, entry)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TranspositionTable::store(uint64_t hash, const Move& m, double score,
+    int depth, uint8_t bound) {
+  TTBucket& b = bucket(hash);
+  uint8_t current = age & 63;
+
+  // If this position is already in the table we update it in place.
+  for (TTSlot& slot : b.entries) {
+    TTEntry e;
+    if (read_slot(slot, hash, e)) {
+      // Don't overwrite a deeper result from this search with a shallower
+      // bound, since the deeper result is more useful.
+      if (e.age == current && bound != TTEntry::EXACT && depth < e.depth) {
+        return;
+      }
+      // Keep the old best move if we didn't find a new one.
+      Move best = m.is_null() ? e.move : m;
+      write_slot(slot, hash, pack_entry(best, score, depth, bound, age));
+      return;
+    }
+  }
+
+  // Otherwise we replace the least valuable entry in the bucket. Empty entries
+  // are always replaced first. Entries from older searches are much less
+  // likely to be useful, so age counts for more than depth.
+  TTSlot* replace = &b.entries[0];
+  int replace_value = std::numeric_limits<int>::max();
+  for (TTSlot& slot : b.entries) {
+    TTEntry e = unpack_entry(slot.data.load(std::memory_order_relaxed));
+    if (e.bound == TTEntry::NONE) {
+      replace = &slot;
+      break;
+    }
+    int value = e.depth - 8 * ((current - e.age) & 63);
+    if (value < replace_value) {
+      replace = &slot;
+      replace_value = value;
+    }
+  }
+  write_slot(*replace, hash, pack_entry(m, score, depth, bound, age));
+}
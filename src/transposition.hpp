@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "boards.hpp"
+
+// The default size of the transposition table in megabytes.
+#define DEFAULT_HASH_SIZE 16
+// The largest transposition table we allow in megabytes.
+#define MAX_HASH_SIZE 65536
+
+/**
+ * \brief A single transposition table entry.
+ *
+ * Each entry records the result of searching some position to a given depth.
+ * Since alpha-beta search does not always find the exact score of a position,
+ * the entry also records whether the score is exact or only a bound.
+ */
+struct TTEntry {
+  /** The entry holds no data. */
+  static constexpr uint8_t NONE = 0;
+  /** The score is the exact value of the position. */
+  static constexpr uint8_t EXACT = 1;
+  /** The position is worth at least the score (the search failed high). */
+  static constexpr uint8_t LOWER = 2;
+  /** The position is worth at most the score (the search failed low). */
+  static constexpr uint8_t UPPER = 3;
+
+  /** The best move found, or a null move if none was found. */
+  Move move;
+  /** The score found by the search, from the side to move's perspective. */
+  float score;
+  /** The depth the position was searched to, at most 255. */
+  int16_t depth;
+  /** The type of bound described by the score. */
+  uint8_t bound;
+  /** The search generation in which the entry was written, modulo 64. */
+  uint8_t age;
+};
+
+/**
+ * \brief A transposition table entry as it is stored in the table.
+ *
+ * Search threads share a table without locking, so one thread may read an
+ * entry while another is writing it. The entry is packed into a data word,
+ * and the check word is the full hash of the position XORed with the data.
+ * Each word is read and written atomically, but a reader may see the check
+ * of one write with the data of another. Then the check doesn't match the
+ * hash and the entry is a miss, rather than one position's key paired with
+ * another position's score.
+ */
+struct TTSlot {
+  std::atomic<uint64_t> check;
+  std::atomic<uint64_t> data;
+};
+
+/**
+ * \brief A group of entries sharing a single cache line.
+ *
+ * A position may be stored in any entry of the bucket its hash maps to, so a
+ * probe only ever touches one cache line.
+ */
+struct alignas(64) TTBucket {
+  static constexpr int SIZE = 64 / sizeof(TTSlot);
+  TTSlot entries[SIZE];
+};
+
+/**
+ * \brief A fixed-size hash table of search results.
+ *
+ * The table is keyed by the Zobrist hash of the game state. When a bucket is
+ * full, new results replace the entry which is the least useful, preferring
+ * to keep deep searches from the current search generation.
+ *
+ * Any number of threads may probe and store at once. A probe only returns an
+ * entry which was stored whole for the same hash, see TTSlot.
+ */
+class TranspositionTable {
+  private:
+    /** The buckets of the table. The number of buckets is a power of two. */
+    std::vector<TTBucket> table;
+    /** A mask to get a bucket index from a hash. */
+    uint64_t mask;
+    /** The current search generation. */
+    uint8_t age;
+
+    /**
+     * \brief Get the bucket a hash maps to.
+     */
+    inline TTBucket& bucket(uint64_t hash) {
+      return table[hash & mask];
+    }
+
+    inline const TTBucket& bucket(uint64_t hash) const {
+      return table[hash & mask];
+    }
+
+  public:
+    /**
+     * \brief Construct a table using at most the given number of megabytes.
+     */
+    TranspositionTable(size_t mb);
+
+    /**
+     * \brief Change the size of the table.
+     *
+     * This clears all entries. It should not be called during a search.
+     */
+    void resize(size_t mb);
+
+    /**
+     * \brief Remove all entries from the table.
+     */
+    void clear();
+
+    /**
+     * \brief Start a new search generation.
+     *
+     * Entries from older generations are preferred for replacement.
+     */
+    void new_search();
+
+    /**
+     * \brief Look up a game state.
+     *
+     * \param hash The Zobrist hash of the game state.
+     * \param entry Filled with the stored entry if one is found.
+     * \return True if an entry for the game state was found.
+     */
+    bool probe(uint64_t hash, TTEntry& entry) const;
+
+    /**
+     * \brief Store a search result.
+     *
+     * \param hash The Zobrist hash of the game state.
+     * \param m The best move found, or a null move.
+     * \param score The score of the position from the side to move's
+     * perspective.
+     * \param depth The depth of the search.
+     * \param bound The type of bound (TTEntry::EXACT, LOWER or UPPER).
+     */
+    void store(uint64_t hash, const Move& m, double score, int depth,
+        uint8_t bound);
+
+    /**
+     * \brief Get the number of entries the table can hold.
+     */
+    inline size_t capacity() const {
+      return table.size() * TTBucket::SIZE;
+    }
+};
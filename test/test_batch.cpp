@@ -0,0 +1,206 @@
+#include "catch.hpp"
+
+#include <limits>
+#include <map>
+#include <sstream>
+
+#include "batch.hpp"
+#include "movegen.hpp"
+
+SCENARIO("batch input lines are parsed as FEN or EPD") {
+  GIVEN("a FEN line") {
+    auto bp = parse_batch_line(
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 3 17",
+        5);
+    REQUIRE(bp);
+    CHECK(bp->index == 5);
+    CHECK(bp->fen ==
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 3 17");
+    CHECK(bp->id.empty());
+  }
+
+  GIVEN("an EPD line with operations") {
+    auto bp = parse_batch_line("1k1r4/pp1b1R2/3q2pp/4p3/2B5/4Q3/PPP2B2/2K5 "
+        "b - - bm Qd1+; id \"BK.01; mate\"; hmvc 4;", 0);
+    REQUIRE(bp);
+    THEN("the id is read and the clocks come from the operations") {
+      CHECK(bp->fen == "1k1r4/pp1b1R2/3q2pp/4p3/2B5/4Q3/PPP2B2/2K5 b - - 4 1");
+      CHECK(bp->id == "BK.01; mate");
+    }
+  }
+
+  GIVEN("blank lines and comments") {
+    CHECK(!parse_batch_line("", 0));
+    CHECK(!parse_batch_line("   \r", 0));
+    CHECK(!parse_batch_line("# a comment", 0));
+  }
+
+  GIVEN("malformed lines") {
+    CHECK_THROWS(parse_batch_line("8/8/8 w - -", 0));
+    CHECK_THROWS(parse_batch_line("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP w KQkq -",
+          0));
+    CHECK_THROWS(parse_batch_line("8/8/8/8/8/8/8/8 w - - 0 1", 0));
+    CHECK_THROWS(parse_batch_line(
+          "rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 0));
+    CHECK_THROWS(parse_batch_line(
+          "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq - 0 1", 0));
+    CHECK_THROWS(parse_batch_line("4k3/8/8/8/8/8/8/4K3 w - - id \"open", 0));
+  }
+
+  GIVEN("illegal positions") {
+    CHECK_THROWS(parse_batch_line("K6k/8/8/8/8/8/8/7R w - -", 0));
+    CHECK_THROWS(parse_batch_line("k7/8/8/8/8/8/8/K6r b - -", 0));
+    CHECK_THROWS(parse_batch_line("P6k/8/8/8/8/8/8/K7 w - -", 0));
+    CHECK_THROWS(parse_batch_line("k7/8/8/8/8/8/8/K6p b - -", 0));
+  }
+}
+
+SCENARIO("batch results are formatted as JSON or CSV") {
+  BatchResult r{};
+  r.index = 3;
+  r.id = "a \"quoted\", id";
+  r.fen = "4k3/8/8/8/8/8/8/4K2R w K - 0 1";
+  GameState gs(r.fen);
+  r.best = gs.convert_move("e1g1");
+  r.pv = {r.best};
+  r.score = 5.25;
+  r.depth = 4;
+  r.nodes = 1234;
+  r.time = 7;
+
+  THEN("JSON strings are escaped") {
+    CHECK(format_batch_result(r, BatchOptions::Format::JSON) ==
+        "{\"index\":3,\"id\":\"a \\\"quoted\\\", id\","
+        "\"fen\":\"4k3/8/8/8/8/8/8/4K2R w K - 0 1\",\"bestmove\":\"e1g1\","
+        "\"score\":525,\"depth\":4,\"nodes\":1234,\"time\":7,\"pv\":\"e1g1\"}");
+  }
+
+  THEN("CSV fields are quoted where needed") {
+    CHECK(format_batch_result(r, BatchOptions::Format::CSV) ==
+        "3,\"a \"\"quoted\"\", id\",4k3/8/8/8/8/8/8/4K2R w K - 0 1,e1g1,525,4,"
+        "1234,7,e1g1,");
+  }
+
+  THEN("scores which aren't a number of pawns are kept within a mate") {
+    r.score = -std::numeric_limits<double>::max();
+    CHECK(format_batch_result(r, BatchOptions::Format::CSV) ==
+        "3,\"a \"\"quoted\"\", id\",4k3/8/8/8/8/8/8/4K2R w K - 0 1,e1g1,-100000,"
+        "4,1234,7,e1g1,");
+  }
+
+  THEN("errors replace the search results") {
+    r.error = "bad";
+    CHECK(format_batch_result(r, BatchOptions::Format::JSON) ==
+        "{\"index\":3,\"id\":\"a \\\"quoted\\\", id\","
+        "\"fen\":\"4k3/8/8/8/8/8/8/4K2R w K - 0 1\",\"error\":\"bad\"}");
+    CHECK(format_batch_result(r, BatchOptions::Format::CSV) ==
+        "3,\"a \"\"quoted\"\", id\",4k3/8/8/8/8/8/8/4K2R w K - 0 1,,,,,,,bad");
+  }
+}
+
+// Get the result lines of a batch keyed by the number of the input line.
+static std::map<uint64_t, std::string> run_lines(const std::string& input,
+    BatchOptions options) {
+  std::istringstream in(input);
+  std::ostringstream out;
+  BasicEvaluator eval;
+  run_batch(in, out, eval, options);
+  std::map<uint64_t, std::string> lines;
+  std::istringstream results(out.str());
+  for (std::string line; std::getline(results, line);) {
+    auto start = line.find(':') + 1;
+    uint64_t index = std::stoull(line.substr(start, line.find(',') - start));
+    CHECK(lines.count(index) == 0);
+    lines[index] = line;
+  }
+  return lines;
+}
+
+SCENARIO("a batch analyzes each position independently") {
+  std::string input =
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1\n"
+    "\n"
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1\n"
+    "not a position\n"
+    "6k1/5ppp/8/8/8/8/8/R5K1 w - - bm Ra8#; id \"mate\";\n"
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1\n"
+    "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3\n";
+  BatchOptions options;
+  options.limits.depth_limit = 3;
+  options.hash = 1;
+
+  GIVEN("one worker") {
+    options.threads = 1;
+    auto lines = run_lines(input, options);
+
+    THEN("every position gets a result with its line number") {
+      CHECK(lines.size() == 6);
+      CHECK(lines.count(1) == 0);
+      CHECK(lines[3].find("\"error\"") != std::string::npos);
+      CHECK(lines[4].find("\"id\":\"mate\"") != std::string::npos);
+      CHECK(lines[4].find("\"bestmove\":\"a1a8\"") != std::string::npos);
+    }
+
+    THEN("several workers give exactly the same results") {
+      options.threads = 3;
+      auto parallel = run_lines(input, options);
+      REQUIRE(parallel.size() == lines.size());
+      for (const auto& [index, line] : lines) {
+        // The time taken is the only thing that may differ.
+        auto strip = [](const std::string& s) {
+          auto t = s.find("\"time\":");
+          return t == std::string::npos ? s :
+            s.substr(0, t) + s.substr(s.find(',', t));
+        };
+        CHECK(strip(parallel[index]) == strip(line));
+      }
+    }
+  }
+
+  GIVEN("a CSV batch") {
+    options.format = BatchOptions::Format::CSV;
+    std::istringstream in(input);
+    std::ostringstream out;
+    BasicEvaluator eval;
+    CHECK(run_batch(in, out, eval, options) == 5);
+    THEN("a header comes first") {
+      CHECK(out.str().substr(0, out.str().find('\n')) == batch_csv_header());
+    }
+  }
+}
+
+SCENARIO("batch results are from the point of view of the side to move") {
+  std::string input =
+    "k7/8/8/8/8/8/7r/K7 b - -\n"
+    "k7/8/8/8/8/8/7r/K7 w - -\n"
+    "7k/5Q2/6K1/8/8/8/8/8 b - -\n"
+    "7k/6Q1/6K1/8/8/8/8/8 b - -\n"
+    "K6k/8/8/8/8/8/8/7R w - -\n"
+    "P6k/8/8/8/8/8/8/K7 w - -\n";
+  BatchOptions options;
+  options.limits.depth_limit = 4;
+  options.hash = 1;
+  auto lines = run_lines(input, options);
+  REQUIRE(lines.size() == 6);
+
+  auto score = [&lines](uint64_t index) {
+    auto start = lines[index].find("\"score\":") + 8;
+    return std::stoi(lines[index].substr(start));
+  };
+  THEN("the side with the rook is ahead whichever side moves") {
+    CHECK(score(0) > 300);
+    CHECK(score(1) < -300);
+  }
+
+  THEN("positions without moves are scored without a search") {
+    CHECK(lines[2].find("\"bestmove\":\"0000\",\"score\":0,") !=
+        std::string::npos);
+    CHECK(lines[3].find("\"bestmove\":\"0000\",\"score\":-100000,") !=
+        std::string::npos);
+  }
+
+  THEN("illegal positions give errors") {
+    CHECK(lines[4].find("\"error\"") != std::string::npos);
+    CHECK(lines[5].find("\"error\"") != std::string::npos);
+  }
+}
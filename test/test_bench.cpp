@@ -0,0 +1,35 @@
+#include "catch.hpp"
+
+#include "bench.hpp"
+#include "movegen.hpp"
+
+SCENARIO("the bench command gives a deterministic node count") {
+  GIVEN("the bench positions") {
+    THEN("each one is a position with legal moves") {
+      for (const std::string& fen : bench_positions()) {
+        GameState gs(fen);
+        MoveList ml;
+        generate_moves(gs, ml);
+        CHECK(ml.size() > 0);
+        CHECK(gs.fen_string() == fen);
+      }
+    }
+  }
+
+  GIVEN("a fixed depth") {
+    IncrementalEvaluator eval;
+    SearchParams params;
+    BenchResult first = run_bench(eval, params, 4);
+    CHECK(first.nodes > 0);
+
+    THEN("running it again searches the same number of nodes") {
+      CHECK(run_bench(eval, params, 4).nodes == first.nodes);
+    }
+
+    THEN("changing the search changes the node count") {
+      CHECK(run_bench(eval, params, 4, false).nodes != first.nodes);
+      params.lmr_depth = 100;
+      CHECK(run_bench(eval, params, 4).nodes != first.nodes);
+    }
+  }
+}
@@ -0,0 +1,48 @@
+#include "catch.hpp"
+
+#include "bits.hpp"
+
+TEST_CASE("bits are counted correctly") {
+  CHECK(popcount(0) == 0);
+  CHECK(popcount(1) == 1);
+  CHECK(popcount(~0ull) == 64);
+  CHECK(popcount(0x8000000000000001ull) == 2);
+  CHECK(popcount(0x0123456789abcdefull) == 32);
+
+  CHECK(portable_popcount(0) == 0);
+  CHECK(portable_popcount(~0ull) == 64);
+  CHECK(portable_popcount(0x0123456789abcdefull) == 32);
+}
+
+TEST_CASE("the least significant bit is found correctly") {
+  CHECK(lsb(1) == 0);
+  CHECK(lsb(0x8000000000000000ull) == 63);
+  CHECK(lsb(0x0000000000f00000ull) == 20);
+  for (int i = 0; i < 64; i++) {
+    uint64_t x = (~0ull) << i;
+    CHECK(lsb(x) == i);
+    CHECK(portable_lsb(x) == i);
+  }
+
+  uint64_t x = 0x0000000100000201ull;
+  CHECK(pop_lsb(x) == 0);
+  CHECK(pop_lsb(x) == 9);
+  CHECK(pop_lsb(x) == 32);
+  CHECK(x == 0);
+}
+
+TEST_CASE("the fast and portable versions agree") {
+  uint64_t state = 0x2545f4914f6cdd1dull;
+  bool all_match = true;
+  for (int i = 0; i < 10000; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    uint64_t x = i % 3 == 0 ? state & (state >> 23) : state;
+    all_match = all_match && popcount(x) == portable_popcount(x);
+    if (x != 0) {
+      all_match = all_match && lsb(x) == portable_lsb(x);
+    }
+  }
+  CHECK(all_match);
+}
@@ -1,6 +1,10 @@
 #include "catch.hpp"
 
+#include <string>
+#include <vector>
+
 #include "boards.hpp"
+#include "utils.hpp"
 
 SCENARIO("pieces can be placed on and removed from positions") {
   GIVEN("a board with some pieces on it") {
@@ -71,6 +75,38 @@ TEST_CASE("a position can be tested for piece occupation") {
   CHECK(!p.piece_at(0, Position::W_PAWN));
 }
 
+TEST_CASE("moves are packed into 16 bits") {
+  Move m(algebraic_to_int("h7"), algebraic_to_int("g8"),
+      Move::PROMOTE_QUEEN_CAPTURE);
+  CHECK(sizeof(Move) == 2);
+  CHECK(m.from_square() == 55);
+  CHECK(m.to_square() == 62);
+  CHECK(m.get_flags() == (uint16_t) Move::PROMOTE_QUEEN_CAPTURE);
+  CHECK(m.capture());
+  CHECK(m.promote_queen());
+  CHECK(!m.is_null());
+  CHECK(Move().is_null());
+  CHECK(m != Move(55, 62, Move::PROMOTE_QUEEN));
+}
+
+TEST_CASE("the locations of pieces can be found") {
+  Position p("4k3/8/8/8/8/8/PP5P/4K3");
+  std::vector<int> pawns;
+  for (int sq : p.find_piece(Position::W_PAWN)) {
+    pawns.push_back(sq);
+  }
+  CHECK(pawns == std::vector<int>{8, 9, 15});
+  CHECK(p.find_piece(Position::W_PAWN).size() == 3);
+  CHECK(*p.find_piece(Position::B_KING).begin() == 60);
+  CHECK(p.find_piece(Position::B_PAWN).empty());
+
+  // Copies of a position are independent of the original.
+  Position q = p;
+  q.remove_piece(8, Position::W_PAWN);
+  CHECK(p.find_piece(Position::W_PAWN).size() == 3);
+  CHECK(q.find_piece(Position::W_PAWN).size() == 2);
+}
+
 SCENARIO("moves can be made on positions") {
   GIVEN("a board in some starting position") {
     // Initial position:
@@ -87,8 +123,8 @@ SCENARIO("moves can be made on positions") {
     CHECK(p.fen_board() == "4rnbq/PPPPPPP1/8/6Pp/r2Qb3/3R4/8/R3K2R");
 
     WHEN("we make some moves") {
-      Move m1 = Move(27, 26, Position::W_QUEEN, Move::QUIET);
-      Move m2 = Move(39, 31, Position::B_PAWN, Move::QUIET);
+      Move m1 = Move(27, 26, Move::QUIET);
+      Move m2 = Move(39, 31, Move::QUIET);
       p.make_move(m1);
       p.make_move(m2);
 
@@ -98,8 +134,8 @@ SCENARIO("moves can be made on positions") {
     }
 
     WHEN("we capture a piece") {
-      Move m1 = Move(27, 24, Position::W_QUEEN, Move::CAPTURE);
-      Move m2 = Move(28, 19, Position::B_BISHOP, Move::CAPTURE);
+      Move m1 = Move(27, 24, Move::CAPTURE);
+      Move m2 = Move(28, 19, Move::CAPTURE);
       p.make_move(m1);
       p.make_move(m2);
 
@@ -109,7 +145,7 @@ SCENARIO("moves can be made on positions") {
     }
 
     WHEN("we castle queenside") {
-      Move m1 = Move(4, 2, Position::W_KING, Move::QUEEN_CASTLE);
+      Move m1 = Move(4, 2, Move::QUEEN_CASTLE);
       p.make_move(m1);
 
       THEN("the rook moves") {
@@ -118,7 +154,7 @@ SCENARIO("moves can be made on positions") {
     }
 
     WHEN("we castle kingside") {
-      Move m1 = Move(4, 6, Position::W_KING, Move::KING_CASTLE);
+      Move m1 = Move(4, 6, Move::KING_CASTLE);
       p.make_move(m1);
 
       THEN("the rook moves") {
@@ -127,7 +163,7 @@ SCENARIO("moves can be made on positions") {
     }
 
     WHEN("we capture en passant") {
-      Move m1 = Move(38, 47, Position::W_PAWN, Move::CAPTURE_EP);
+      Move m1 = Move(38, 47, Move::CAPTURE_EP);
       p.make_move(m1);
 
       THEN("the captured pawn is removed") {
@@ -136,10 +172,10 @@ SCENARIO("moves can be made on positions") {
     }
 
     WHEN("we promote a pawn") {
-      Move m1 = Move(48, 56, Position::W_PAWN, Move::PROMOTE_KNIGHT);
-      Move m2 = Move(49, 57, Position::W_PAWN, Move::PROMOTE_BISHOP);
-      Move m3 = Move(50, 58, Position::W_PAWN, Move::PROMOTE_ROOK);
-      Move m4 = Move(51, 59, Position::W_PAWN, Move::PROMOTE_QUEEN);
+      Move m1 = Move(48, 56, Move::PROMOTE_KNIGHT);
+      Move m2 = Move(49, 57, Move::PROMOTE_BISHOP);
+      Move m3 = Move(50, 58, Move::PROMOTE_ROOK);
+      Move m4 = Move(51, 59, Move::PROMOTE_QUEEN);
       p.make_move(m1);
       p.make_move(m2);
       p.make_move(m3);
@@ -151,10 +187,10 @@ SCENARIO("moves can be made on positions") {
     }
 
     WHEN("we promote with capture") {
-      Move m1 = Move(51, 60, Position::W_PAWN, Move::PROMOTE_KNIGHT_CAPTURE);
-      Move m2 = Move(52, 61, Position::W_PAWN, Move::PROMOTE_BISHOP_CAPTURE);
-      Move m3 = Move(53, 62, Position::W_PAWN, Move::PROMOTE_ROOK_CAPTURE);
-      Move m4 = Move(54, 63, Position::W_PAWN, Move::PROMOTE_QUEEN_CAPTURE);
+      Move m1 = Move(51, 60, Move::PROMOTE_KNIGHT_CAPTURE);
+      Move m2 = Move(52, 61, Move::PROMOTE_BISHOP_CAPTURE);
+      Move m3 = Move(53, 62, Move::PROMOTE_ROOK_CAPTURE);
+      Move m4 = Move(54, 63, Move::PROMOTE_QUEEN_CAPTURE);
       p.make_move(m1);
       p.make_move(m2);
       p.make_move(m3);
@@ -171,15 +207,15 @@ TEST_CASE("a fen string can be generated from a game state") {
   GameState gs;
   CHECK(gs.fen_string() == "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
 
-  Move m1(12, 28, Position::W_PAWN, Move::PAWN_DOUBLE);
+  Move m1(12, 28, Move::PAWN_DOUBLE);
   gs.make_move(m1);
   CHECK(gs.fen_string() == "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1");
 
-  Move m2(50, 34, Position::B_PAWN, Move::PAWN_DOUBLE);
+  Move m2(50, 34, Move::PAWN_DOUBLE);
   gs.make_move(m2);
   CHECK(gs.fen_string() == "rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq c6 0 2");
 
-  Move m3(6, 21, Position::W_KNIGHT, Move::QUIET);
+  Move m3(6, 21, Move::QUIET);
   gs.make_move(m3);
   CHECK(gs.fen_string() == "rnbqkbnr/pp1ppppp/8/2p5/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2");
 }
@@ -191,14 +227,13 @@ SCENARIO("we can make moves on a game state") {
 
   GIVEN("a game state") {
     Position p("r3k2r/pppppppp/8/8/8/8/PPPPPPPP/R3K2R");
-    GameState gs(p, true, true, true, true, true, 0, false, 0, 1,
-        std::map<Position, int>(), std::deque<Node>());
+    GameState gs(p, true, true, true, true, true, 0, false, 0, 1);
 
     CHECK(gs.fen_string() == "r3k2r/pppppppp/8/8/8/8/PPPPPPPP/R3K2R w KQkq - 0 1");
 
     WHEN("we castle kingside") {
-      Move m1(4, 2, Position::W_KING, Move::QUEEN_CASTLE);
-      Move m2(60, 58, Position::B_KING, Move::QUEEN_CASTLE);
+      Move m1(4, 2, Move::QUEEN_CASTLE);
+      Move m2(60, 58, Move::QUEEN_CASTLE);
       gs.make_move(m1);
       gs.make_move(m2);
 
@@ -208,8 +243,8 @@ SCENARIO("we can make moves on a game state") {
     }
 
     WHEN("we castle queenside") {
-      Move m1(4, 6, Position::W_KING, Move::KING_CASTLE);
-      Move m2(60, 62, Position::B_KING, Move::KING_CASTLE);
+      Move m1(4, 6, Move::KING_CASTLE);
+      Move m2(60, 62, Move::KING_CASTLE);
       gs.make_move(m1);
       gs.make_move(m2);
 
@@ -219,8 +254,8 @@ SCENARIO("we can make moves on a game state") {
     }
 
     WHEN("we move a rook") {
-      Move m1(0, 1, Position::W_ROOK, Move::QUIET);
-      Move m2(63, 62, Position::B_ROOK, Move::QUIET);
+      Move m1(0, 1, Move::QUIET);
+      Move m2(63, 62, Move::QUIET);
       gs.make_move(m1);
       gs.make_move(m2);
 
@@ -230,11 +265,11 @@ SCENARIO("we can make moves on a game state") {
     }
 
     WHEN("en passant becomes possible") {
-      Move m1(8, 24, Position::W_PAWN, Move::PAWN_DOUBLE);
-      Move m2(55, 39, Position::B_PAWN, Move::PAWN_DOUBLE);
-      Move m3(24, 32, Position::W_PAWN, Move::QUIET);
-      Move m4(39, 31, Position::B_PAWN, Move::QUIET);
-      Move m5(14, 30, Position::W_PAWN, Move::PAWN_DOUBLE);
+      Move m1(8, 24, Move::PAWN_DOUBLE);
+      Move m2(55, 39, Move::PAWN_DOUBLE);
+      Move m3(24, 32, Move::QUIET);
+      Move m4(39, 31, Move::QUIET);
+      Move m5(14, 30, Move::PAWN_DOUBLE);
       gs.make_move(m1);
       gs.make_move(m2);
       gs.make_move(m3);
@@ -247,12 +282,12 @@ SCENARIO("we can make moves on a game state") {
     }
 
     WHEN("the en passant capture isn't taken immediately") {
-      Move m1(8, 24, Position::W_PAWN, Move::PAWN_DOUBLE);
-      Move m2(55, 39, Position::B_PAWN, Move::PAWN_DOUBLE);
-      Move m3(24, 32, Position::W_PAWN, Move::QUIET);
-      Move m4(49, 33, Position::B_PAWN, Move::PAWN_DOUBLE);
-      Move m5(0, 1, Position::W_ROOK, Move::QUIET);
-      Move m6(39, 31, Position::B_PAWN, Move::QUIET);
+      Move m1(8, 24, Move::PAWN_DOUBLE);
+      Move m2(55, 39, Move::PAWN_DOUBLE);
+      Move m3(24, 32, Move::QUIET);
+      Move m4(49, 33, Move::PAWN_DOUBLE);
+      Move m5(0, 1, Move::QUIET);
+      Move m6(39, 31, Move::QUIET);
       gs.make_move(m1);
       gs.make_move(m2);
       gs.make_move(m3);
@@ -266,3 +301,92 @@ SCENARIO("we can make moves on a game state") {
     }
   }
 }
+
+SCENARIO("game state hashes are maintained incrementally") {
+  GIVEN("a game state") {
+    GameState gs("r3k2r/pPpp1ppp/8/4p3/8/8/PPPPPPPP/R3K2R w KQkq - 0 1");
+    uint64_t start = gs.hash();
+
+    CHECK(start == GameState(gs.fen_string()).hash());
+
+    WHEN("we make a sequence of moves") {
+      std::vector<std::string> moves = {"d2d4", "e5d4", "e2e4", "d4e3",
+        "b7a8q", "e8g8", "e1c1", "f8e8"};
+      std::vector<uint64_t> hashes;
+      std::vector<std::string> fens;
+      for (const std::string& m : moves) {
+        hashes.push_back(gs.hash());
+        fens.push_back(gs.fen_string());
+        gs.make_move(gs.convert_move(m));
+        // The incremental hash agrees with one computed from scratch.
+        CHECK(gs.hash() == GameState(gs.fen_string()).hash());
+      }
+
+      THEN("undoing the moves restores each state") {
+        for (int i = moves.size() - 1; i >= 0; i--) {
+          gs.undo_move();
+          CHECK(gs.hash() == hashes[i]);
+          CHECK(gs.fen_string() == fens[i]);
+        }
+        CHECK(gs.hash() == start);
+        CHECK(gs.history_size() == 0);
+      }
+    }
+
+    WHEN("we reach the same position with the other side to move") {
+      GameState other("r3k2r/pPpp1ppp/8/4p3/8/8/PPPPPPPP/R3K2R b KQkq - 0 1");
+
+      THEN("the hashes differ") {
+        CHECK(other.hash() != start);
+      }
+    }
+  }
+}
+
+TEST_CASE("repetitions are detected") {
+  GameState gs;
+  CHECK(gs.repetitions() == 0);
+  std::vector<std::string> moves = {"g1f3", "g8f6", "f3g1", "f6g8"};
+  for (const std::string& m : moves) {
+    gs.make_move(gs.convert_move(m));
+  }
+  CHECK(gs.repetitions() == 1);
+  for (const std::string& m : moves) {
+    gs.make_move(gs.convert_move(m));
+  }
+  CHECK(gs.repetitions() == 2);
+
+  // A pawn move means no earlier position can be repeated.
+  gs.make_move(gs.convert_move("e2e4"));
+  CHECK(gs.repetitions() == 0);
+}
+
+TEST_CASE("the null move passes the turn") {
+  GameState gs("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1");
+  std::string fen = gs.fen_string();
+  uint64_t hash = gs.hash();
+  gs.make_move(Move());
+  // Passing gives up the chance to capture en passant.
+  GameState passed(
+      "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2");
+  CHECK(gs.whites_move());
+  CHECK(!gs.en_passant());
+  CHECK(gs.hash() == passed.hash());
+  // Repetitions are not detected across a null move.
+  gs.make_move(gs.convert_move("g1f3"));
+  gs.make_move(gs.convert_move("g8f6"));
+  gs.make_move(gs.convert_move("f3g1"));
+  gs.make_move(gs.convert_move("f6g8"));
+  CHECK(gs.repetitions() == 1);
+  gs.make_move(Move());
+  gs.make_move(Move());
+  CHECK(gs.repetitions() == 0);
+  // Passing is not a capture or a pawn move, so the fifty-move clock keeps
+  // counting.
+  CHECK(gs.half_move_clock() == 7);
+  for (int i = 0; i < 7; i++) {
+    gs.undo_move();
+  }
+  CHECK(gs.fen_string() == fen);
+  CHECK(gs.hash() == hash);
+}
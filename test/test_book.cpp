@@ -0,0 +1,163 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <map>
+
+#include "book.hpp"
+#include "movegen.hpp"
+
+SCENARIO("book moves use Polyglot's encoding") {
+  GIVEN("a position where both sides can castle") {
+    GameState gs("r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1");
+
+    THEN("castling is encoded as the king taking its rook") {
+      Move kingside = gs.convert_move("e1g1");
+      Move queenside = gs.convert_move("e1c1");
+      CHECK(OpeningBook::encode_move(kingside) == (7 | (4 << 6)));
+      CHECK(OpeningBook::encode_move(queenside) == (0 | (4 << 6)));
+      CHECK(OpeningBook::decode_move(gs, 7 | (4 << 6)) == kingside);
+      CHECK(OpeningBook::decode_move(gs, 0 | (4 << 6)) == queenside);
+    }
+
+    THEN("moves which aren't legal decode to a null move") {
+      // e1 to e8
+      CHECK(OpeningBook::decode_move(gs, 60 | (4 << 6)).is_null());
+    }
+  }
+
+  GIVEN("a position with promotions") {
+    GameState gs("8/1P6/8/8/8/8/6k1/4K3 w - - 0 1");
+    Move q = gs.convert_move("b7b8q");
+    Move n = gs.convert_move("b7b8n");
+    CHECK(OpeningBook::encode_move(q) == (57 | (49 << 6) | (4 << 12)));
+    CHECK(OpeningBook::encode_move(n) == (57 | (49 << 6) | (1 << 12)));
+
+    THEN("every legal move decodes to itself") {
+      MoveList ml;
+      generate_moves(gs, ml);
+      for (const Move& m : ml) {
+        CHECK(OpeningBook::decode_move(gs, OpeningBook::encode_move(m)) == m);
+      }
+    }
+  }
+}
+
+SCENARIO("book keys are Polyglot's") {
+  GIVEN("the test positions from the Polyglot book format") {
+    GameState gs;
+    CHECK(OpeningBook::key(gs) == 0x463b96181691fc9cull);
+    const std::vector<std::pair<std::string, uint64_t>> line = {
+      {"e2e4", 0x823c9b50fd114196ull},
+      {"d7d5", 0x0756b94461c50fb0ull},
+      {"e4e5", 0x662fafb965db29d4ull},
+      {"f7f5", 0x22a48b5a8e47ff78ull},
+      {"e1e2", 0x652a607ca3f242c1ull},
+      {"e8f7", 0x00fdd303c946bdd9ull},
+    };
+    for (const auto& [move, key] : line) {
+      gs.make_move(gs.convert_move(move));
+      CHECK(OpeningBook::key(gs) == key);
+    }
+  }
+
+  GIVEN("a line where an en passant capture becomes possible") {
+    GameState gs;
+    for (const char* move : {"a2a4", "b7b5", "h2h4", "b5b4", "c2c4"}) {
+      gs.make_move(gs.convert_move(move));
+    }
+    CHECK(OpeningBook::key(gs) == 0x3c8123ea7b067637ull);
+    gs.make_move(gs.convert_move("b4c3"));
+    gs.make_move(gs.convert_move("a1a3"));
+    CHECK(OpeningBook::key(gs) == 0x5c3f9b829b279560ull);
+  }
+
+  GIVEN("a double pawn push with no pawn beside it") {
+    GameState with_ep("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq "
+        "e3 0 1");
+    GameState without_ep("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b "
+        "KQkq - 0 1");
+    CHECK(OpeningBook::key(with_ep) == OpeningBook::key(without_ep));
+  }
+}
+
+SCENARIO("an opening book is read from a mapped file") {
+  std::string path = "test_book.bin";
+  GameState start;
+  Move e4 = start.convert_move("e2e4");
+  Move d4 = start.convert_move("d2d4");
+  Move c4 = start.convert_move("c2c4");
+  GameState after_e4;
+  after_e4.make_move(after_e4.convert_move("e2e4"));
+  Move c5 = after_e4.convert_move("c7c5");
+
+  GIVEN("a book with a few positions") {
+    std::vector<BookEntry> entries = {
+      {OpeningBook::key(after_e4), OpeningBook::encode_move(c5), 1, 0},
+      {OpeningBook::key(start), OpeningBook::encode_move(d4), 1, 0},
+      {OpeningBook::key(start), OpeningBook::encode_move(e4), 3, 0},
+      {OpeningBook::key(start), OpeningBook::encode_move(c4), 0, 0},
+    };
+    // Some unrelated keys on either side of the ones we look up.
+    for (uint64_t k = 0; k < 50; k++) {
+      entries.push_back({k * 0x0123456789abcdefull, 1, 1, 0});
+    }
+    OpeningBook::write(path, entries);
+    OpeningBook book(path);
+    CHECK(book.size() == entries.size());
+
+    THEN("the moves of each position are found, heaviest first") {
+      auto ms = book.moves(start);
+      REQUIRE(ms.size() == 3);
+      CHECK(ms[0] == std::make_pair(e4, (uint16_t) 3));
+      CHECK(ms[1] == std::make_pair(d4, (uint16_t) 1));
+      CHECK(ms[2] == std::make_pair(c4, (uint16_t) 0));
+      REQUIRE(book.moves(after_e4).size() == 1);
+      CHECK(book.moves(after_e4)[0].first == c5);
+    }
+
+    THEN("a position which isn't in the book has no moves") {
+      GameState gs("r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1");
+      CHECK(book.moves(gs).empty());
+      std::mt19937_64 rng(1);
+      CHECK(!book.probe(gs, rng));
+    }
+
+    THEN("moves are chosen in proportion to their weights") {
+      std::mt19937_64 rng(1);
+      std::map<uint16_t, unsigned> chosen;
+      unsigned found = 0;
+      for (unsigned i = 0; i < 4000; i++) {
+        std::optional<Move> m = book.probe(start, rng);
+        if (m) {
+          chosen[OpeningBook::encode_move(*m)]++;
+          found++;
+        }
+      }
+      CHECK(found == 4000);
+      CHECK(chosen.count(OpeningBook::encode_move(c4)) == 0);
+      unsigned n_e4 = chosen[OpeningBook::encode_move(e4)];
+      CHECK(n_e4 > 2800);
+      CHECK(n_e4 < 3200);
+    }
+  }
+
+  GIVEN("an empty book") {
+    OpeningBook::write(path, {});
+    OpeningBook book(path);
+    CHECK(book.size() == 0);
+    CHECK(book.moves(start).empty());
+  }
+
+  GIVEN("a file which is not a whole number of entries") {
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    std::fputs("not a book", f);
+    std::fclose(f);
+    CHECK_THROWS_AS(OpeningBook(path), std::runtime_error);
+  }
+
+  GIVEN("a file which doesn't exist") {
+    CHECK_THROWS_AS(OpeningBook("no_such_book.bin"), std::runtime_error);
+  }
+
+  std::remove(path.c_str());
+}
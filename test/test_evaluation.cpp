@@ -68,3 +68,118 @@ SCENARIO("evaluation is correct on some known positions") {
     }
   }
 }
+
+SCENARIO("the incremental evaluator agrees with a position's contents") {
+  GIVEN("a symmetrical position") {
+    GameState gs("r2qk2r/ppp2ppp/2np1n2/2b1p1B1/2B1P1b1/2NP1N2/PPP2PPP/R2QK2R w KQkq - 0 1");
+    IncrementalEvaluator e;
+    THEN("the evaluation is 0") {
+      CHECK(std::abs(e.evaluate_position(gs)) <= 0.001);
+      CHECK(gs.pos().material_score() == 0);
+      CHECK(gs.pos().placement_score() == 0);
+    }
+  }
+
+  GIVEN("a position and the same position with colors flipped") {
+    GameState gs1("rnbq1rk1/pp1n1pbp/3p2p1/1BpP4/P3PP2/2N5/1P4PP/R1BQK1NR w KQkq - 0 1");
+    GameState gs2("r1bqk1nr/1p4pp/2n5/p3pp2/1bPp4/3P2P1/PP1N1PBP/RNBQ1RK1 b KQkq - 0 1");
+    IncrementalEvaluator e;
+    THEN("the evaluations are opposite") {
+      CHECK(std::abs(e.evaluate_position(gs1) + e.evaluate_position(gs2)) <=
+          0.001);
+    }
+  }
+
+  GIVEN("a position where black is up a pawn") {
+    GameState gs("r1bq1rk1/pp3ppp/2n1pn2/2p5/2pP4/P1PBPN2/5PPP/R1BQ1RK1 w KQkq - 0 1");
+    THEN("the material balance is one pawn for black") {
+      CHECK(gs.pos().material_score() == -100);
+    }
+  }
+
+  GIVEN("a game with captures, castling, en passant and promotion") {
+    GameState gs("r3k2r/1P3ppp/8/3pP3/8/8/5PPP/R3K2R w KQkq d6 0 1");
+    int32_t material = gs.pos().material_score();
+    int32_t placement = gs.pos().placement_score();
+    IncrementalEvaluator e;
+    double before = e.evaluate_position(gs);
+
+    WHEN("we make the moves") {
+      gs.make_move(gs.convert_move("e5d6"));
+      gs.make_move(gs.convert_move("e8g8"));
+      gs.make_move(gs.convert_move("b7a8q"));
+
+      THEN("the sums match a position built from scratch") {
+        Position fresh(gs.pos().fen_board());
+        CHECK(gs.pos().material_score() == fresh.material_score());
+        CHECK(gs.pos().placement_score() == fresh.placement_score());
+        CHECK(gs.pos().material_score() == material + 100 + 500 + 800);
+      }
+
+      THEN("undoing them restores the sums and the evaluation") {
+        gs.undo_move();
+        gs.undo_move();
+        gs.undo_move();
+        CHECK(gs.pos().material_score() == material);
+        CHECK(gs.pos().placement_score() == placement);
+        CHECK(e.evaluate_position(gs) == before);
+      }
+    }
+  }
+}
+
+SCENARIO("pawn structure is scored and cached by pawn hash") {
+  GIVEN("a lone passed pawn") {
+    GameState gs("4k3/8/8/3P4/8/8/8/4K3 w - - 0 1");
+    IncrementalEvaluator e;
+    THEN("it is isolated but passed") {
+      CHECK(e.pawn_score(gs.pos()) == -10);
+    }
+  }
+
+  GIVEN("a backward pawn") {
+    // d3 can't be defended and e5 stops it advancing. c4 is passed and
+    // defended, and e5 is isolated.
+    GameState gs("4k3/8/8/4p3/2P5/3P4/8/4K3 w - - 0 1");
+    IncrementalEvaluator e;
+    THEN("the score combines every term") {
+      CHECK(e.pawn_score(gs.pos()) == 70);
+    }
+  }
+
+  GIVEN("a game state") {
+    GameState gs;
+    uint64_t pawn_hash = gs.pos().get_pawn_hash();
+
+    WHEN("only pieces move") {
+      gs.make_move(gs.convert_move("g1f3"));
+      gs.make_move(gs.convert_move("b8c6"));
+      THEN("the pawn hash is unchanged") {
+        CHECK(gs.pos().get_pawn_hash() == pawn_hash);
+      }
+    }
+
+    WHEN("a pawn moves") {
+      gs.make_move(gs.convert_move("e2e4"));
+      THEN("the pawn hash changes and matches a fresh position") {
+        CHECK(gs.pos().get_pawn_hash() != pawn_hash);
+        Position fresh(gs.pos().fen_board());
+        CHECK(gs.pos().get_pawn_hash() == fresh.get_pawn_hash());
+      }
+    }
+  }
+
+  GIVEN("an evaluator with a pawn table") {
+    IncrementalEvaluator cached;
+    IncrementalEvaluator uncached;
+    GameState gs("r1bq1rk1/pp3ppp/2n1pn2/2p5/2pP4/P1PBPN2/5PPP/R1BQ1RK1 w - - 0 1");
+    cached.initialize(gs);
+    THEN("the evaluation is the same with or without the cache") {
+      double first = cached.evaluate_position(gs);
+      CHECK(first == uncached.evaluate_position(gs));
+      CHECK(cached.evaluate_position(gs) == first);
+      gs.make_move(gs.convert_move("d4c5"));
+      CHECK(cached.evaluate_position(gs) == uncached.evaluate_position(gs));
+    }
+  }
+}
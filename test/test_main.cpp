@@ -10,8 +10,6 @@ int main(int argc, char* argv[]) {
   //int result = Catch::Session().run(argc, argv);
   Catch::Session().run(argc, argv);
 
-  movegen_free_magics();
-
   //return result;
   return 0;
 }
@@ -3,6 +3,7 @@
 #include <algorithm>
 
 #include "movegen.hpp"
+#include "perft.hpp"
 #include "boards.hpp"
 #include "utils.hpp"
 
@@ -12,31 +13,10 @@
 
 void debug_move_list(const MoveList& l) {
   for (const Move& m : l) {
-    std::cout << m.piece() << " " << int_to_algebraic(m.from_square()) << "-" << int_to_algebraic(m.to_square()) << " (" << m.get_flags() << ")" << std::endl;
+    std::cout << int_to_algebraic(m.from_square()) << "-" << int_to_algebraic(m.to_square()) << " (" << m.get_flags() << ")" << std::endl;
   }
 }
 
-uint64_t perft(int depth, GameState start) {
-  if (depth == 0) {
-    return 1;
-  }
-  uint64_t n = 0;
-  MoveList moves = generate_moves(start);
-  //debug_move_list(moves);
-  for (const Move& m : moves) {
-    start.make_move(m);
-    uint64_t p = perft(depth - 1, start);
-    //if (depth == 2) {
-    //  std::cout << m.piece() << " " << int_to_algebraic(m.from_square()) << "-" << int_to_algebraic(m.to_square()) << " (" << m.get_flags() << ")" << std::endl;
-    //  std::cout << p << std::endl;
-    //}
-    n += p;
-    start.undo_move();
-  }
-
-  return n;
-}
-
 bool contains_move(const MoveList& l, const Move& m) {
   return std::find(l.begin(), l.end(), m) != l.end();
 }
@@ -46,14 +26,14 @@ SCENARIO("king moves are generated correctly") {
   GIVEN("a board with just a king") {
     GameState gs("8/8/8/4K3/8/8/8/3k4 w - - 0 1");
     MoveList l = generate_moves(gs);
-    Move kd4(algebraic_to_int("e5"), algebraic_to_int("d4"), Position::W_KING, Move::QUIET);
-    Move kd5(algebraic_to_int("e5"), algebraic_to_int("d5"), Position::W_KING, Move::QUIET);
-    Move kd6(algebraic_to_int("e5"), algebraic_to_int("d6"), Position::W_KING, Move::QUIET);
-    Move ke4(algebraic_to_int("e5"), algebraic_to_int("e4"), Position::W_KING, Move::QUIET);
-    Move ke6(algebraic_to_int("e5"), algebraic_to_int("e6"), Position::W_KING, Move::QUIET);
-    Move kf4(algebraic_to_int("e5"), algebraic_to_int("f4"), Position::W_KING, Move::QUIET);
-    Move kf5(algebraic_to_int("e5"), algebraic_to_int("f5"), Position::W_KING, Move::QUIET);
-    Move kf6(algebraic_to_int("e5"), algebraic_to_int("f6"), Position::W_KING, Move::QUIET);
+    Move kd4(algebraic_to_int("e5"), algebraic_to_int("d4"), Move::QUIET);
+    Move kd5(algebraic_to_int("e5"), algebraic_to_int("d5"), Move::QUIET);
+    Move kd6(algebraic_to_int("e5"), algebraic_to_int("d6"), Move::QUIET);
+    Move ke4(algebraic_to_int("e5"), algebraic_to_int("e4"), Move::QUIET);
+    Move ke6(algebraic_to_int("e5"), algebraic_to_int("e6"), Move::QUIET);
+    Move kf4(algebraic_to_int("e5"), algebraic_to_int("f4"), Move::QUIET);
+    Move kf5(algebraic_to_int("e5"), algebraic_to_int("f5"), Move::QUIET);
+    Move kf6(algebraic_to_int("e5"), algebraic_to_int("f6"), Move::QUIET);
 
     CHECK(l.size() == 8);
     CHECK(contains_move(l, kd4));
@@ -77,11 +57,11 @@ SCENARIO("king moves are generated correctly") {
     // . . . . . . . .
     // . . . . . . . .
     MoveList l = generate_moves(gs);
-    Move kd4(algebraic_to_int("e4"), algebraic_to_int("d4"), Position::B_KING, Move::QUIET);
-    Move kf4(algebraic_to_int("e4"), algebraic_to_int("f4"), Position::B_KING, Move::QUIET);
-    Move kd3(algebraic_to_int("e4"), algebraic_to_int("d3"), Position::B_KING, Move::QUIET);
-    Move ke3(algebraic_to_int("e4"), algebraic_to_int("e3"), Position::B_KING, Move::QUIET);
-    Move kf3(algebraic_to_int("e4"), algebraic_to_int("f3"), Position::B_KING, Move::QUIET);
+    Move kd4(algebraic_to_int("e4"), algebraic_to_int("d4"), Move::QUIET);
+    Move kf4(algebraic_to_int("e4"), algebraic_to_int("f4"), Move::QUIET);
+    Move kd3(algebraic_to_int("e4"), algebraic_to_int("d3"), Move::QUIET);
+    Move ke3(algebraic_to_int("e4"), algebraic_to_int("e3"), Move::QUIET);
+    Move kf3(algebraic_to_int("e4"), algebraic_to_int("f3"), Move::QUIET);
 
     CHECK(l.size() == 5);
     CHECK(contains_move(l, kd4));
@@ -94,8 +74,8 @@ SCENARIO("king moves are generated correctly") {
   GIVEN("castling opportunities") {
     GameState gs("k7/p7/8/8/8/8/8/R3K2R w KQkq - 0 1");
     MoveList l = generate_moves(gs);
-    Move oo(algebraic_to_int("e1"), algebraic_to_int("g1"), Position::W_KING, Move::KING_CASTLE);
-    Move ooo(algebraic_to_int("e1"), algebraic_to_int("c1"), Position::W_KING, Move::QUEEN_CASTLE);
+    Move oo(algebraic_to_int("e1"), algebraic_to_int("g1"), Move::KING_CASTLE);
+    Move ooo(algebraic_to_int("e1"), algebraic_to_int("c1"), Move::QUEEN_CASTLE);
 
     CHECK(l.size() == 25);
     CHECK(contains_move(l, oo));
@@ -109,13 +89,13 @@ SCENARIO("pawn moves are generated correctly") {
   GIVEN("a board with just pawns") {
     GameState gs("k7/4p3/3p4/8/8/8/1p6/7K b - - 0 1");
     MoveList l = generate_moves(gs);
-    Move e6(algebraic_to_int("e7"), algebraic_to_int("e6"), Position::B_PAWN, Move::QUIET);
-    Move e5(algebraic_to_int("e7"), algebraic_to_int("e5"), Position::B_PAWN, Move::PAWN_DOUBLE);
-    Move d5(algebraic_to_int("d6"), algebraic_to_int("d5"), Position::B_PAWN, Move::QUIET);
-    Move b1Q(algebraic_to_int("b2"), algebraic_to_int("b1"), Position::B_PAWN, Move::PROMOTE_QUEEN);
-    Move b1R(algebraic_to_int("b2"), algebraic_to_int("b1"), Position::B_PAWN, Move::PROMOTE_ROOK);
-    Move b1B(algebraic_to_int("b2"), algebraic_to_int("b1"), Position::B_PAWN, Move::PROMOTE_BISHOP);
-    Move b1N(algebraic_to_int("b2"), algebraic_to_int("b1"), Position::B_PAWN, Move::PROMOTE_KNIGHT);
+    Move e6(algebraic_to_int("e7"), algebraic_to_int("e6"), Move::QUIET);
+    Move e5(algebraic_to_int("e7"), algebraic_to_int("e5"), Move::PAWN_DOUBLE);
+    Move d5(algebraic_to_int("d6"), algebraic_to_int("d5"), Move::QUIET);
+    Move b1Q(algebraic_to_int("b2"), algebraic_to_int("b1"), Move::PROMOTE_QUEEN);
+    Move b1R(algebraic_to_int("b2"), algebraic_to_int("b1"), Move::PROMOTE_ROOK);
+    Move b1B(algebraic_to_int("b2"), algebraic_to_int("b1"), Move::PROMOTE_BISHOP);
+    Move b1N(algebraic_to_int("b2"), algebraic_to_int("b1"), Move::PROMOTE_KNIGHT);
 
     CHECK(l.size() == 10);
     CHECK(contains_move(l, e6));
@@ -130,9 +110,9 @@ SCENARIO("pawn moves are generated correctly") {
   GIVEN("capturing options including en passant") {
     GameState gs("k7/8/2p5/3Pp3/8/8/8/7K w - e6 0 1");
     MoveList l = generate_moves(gs);
-    Move c6(algebraic_to_int("d5"), algebraic_to_int("c6"), Position::W_PAWN, Move::CAPTURE);
-    Move d6(algebraic_to_int("d5"), algebraic_to_int("d6"), Position::W_PAWN, Move::QUIET);
-    Move e6(algebraic_to_int("d5"), algebraic_to_int("e6"), Position::W_PAWN, Move::CAPTURE_EP);
+    Move c6(algebraic_to_int("d5"), algebraic_to_int("c6"), Move::CAPTURE);
+    Move d6(algebraic_to_int("d5"), algebraic_to_int("d6"), Move::QUIET);
+    Move e6(algebraic_to_int("d5"), algebraic_to_int("e6"), Move::CAPTURE_EP);
 
     CHECK(l.size() == 6);
     CHECK(contains_move(l, c6));
@@ -147,10 +127,10 @@ SCENARIO("rook moves are generated correctly") {
   GIVEN("a board with just rooks") {
     GameState gs("k7/8/8/8/8/3R4/8/7K w - - 0 1");
     MoveList l = generate_moves(gs);
-    Move rd2(algebraic_to_int("d3"), algebraic_to_int("d2"), Position::W_ROOK, Move::QUIET);
-    Move rf3(algebraic_to_int("d3"), algebraic_to_int("f3"), Position::W_ROOK, Move::QUIET);
-    Move rd8(algebraic_to_int("d3"), algebraic_to_int("d8"), Position::W_ROOK, Move::QUIET);
-    Move ra3(algebraic_to_int("d3"), algebraic_to_int("a3"), Position::W_ROOK, Move::QUIET);
+    Move rd2(algebraic_to_int("d3"), algebraic_to_int("d2"), Move::QUIET);
+    Move rf3(algebraic_to_int("d3"), algebraic_to_int("f3"), Move::QUIET);
+    Move rd8(algebraic_to_int("d3"), algebraic_to_int("d8"), Move::QUIET);
+    Move ra3(algebraic_to_int("d3"), algebraic_to_int("a3"), Move::QUIET);
 
     CHECK(l.size() == 17);
     CHECK(contains_move(l, rd2));
@@ -170,10 +150,10 @@ SCENARIO("rook moves are generated correctly") {
     // . . x . . . . .
     // . . x . . . . K
     MoveList l = generate_moves(gs);
-    Move rg4(algebraic_to_int("c4"), algebraic_to_int("g4"), Position::B_ROOK, Move::CAPTURE);
-    Move rc8(algebraic_to_int("c4"), algebraic_to_int("c8"), Position::B_ROOK, Move::QUIET);
-    Move rc6(algebraic_to_int("c4"), algebraic_to_int("c6"), Position::B_ROOK, Move::CAPTURE);
-    Move rh4(algebraic_to_int("c4"), algebraic_to_int("c8"), Position::B_ROOK, Move::QUIET);
+    Move rg4(algebraic_to_int("c4"), algebraic_to_int("g4"), Move::CAPTURE);
+    Move rc8(algebraic_to_int("c4"), algebraic_to_int("c8"), Move::QUIET);
+    Move rc6(algebraic_to_int("c4"), algebraic_to_int("c6"), Move::CAPTURE);
+    Move rh4(algebraic_to_int("c4"), algebraic_to_int("c8"), Move::QUIET);
 
     CHECK(l.size() == 14);
     CHECK(contains_move(l, rg4));
@@ -197,10 +177,10 @@ SCENARIO("bishop moves are generated correctly") {
     // . . x . . . . .
     // . x . . . . . K
     MoveList l = generate_moves(gs);
-    Move bh7(algebraic_to_int("f5"), algebraic_to_int("h7"), Position::B_BISHOP, Move::QUIET);
-    Move bd3(algebraic_to_int("f5"), algebraic_to_int("d3"), Position::B_BISHOP, Move::QUIET);
-    Move bc8(algebraic_to_int("f5"), algebraic_to_int("c8"), Position::B_BISHOP, Move::QUIET);
-    Move bg4(algebraic_to_int("f5"), algebraic_to_int("g4"), Position::B_BISHOP, Move::QUIET);
+    Move bh7(algebraic_to_int("f5"), algebraic_to_int("h7"), Move::QUIET);
+    Move bd3(algebraic_to_int("f5"), algebraic_to_int("d3"), Move::QUIET);
+    Move bc8(algebraic_to_int("f5"), algebraic_to_int("c8"), Move::QUIET);
+    Move bg4(algebraic_to_int("f5"), algebraic_to_int("g4"), Move::QUIET);
 
     CHECK(l.size() == 14);
     CHECK(contains_move(l, bh7));
@@ -224,8 +204,8 @@ SCENARIO("queen moves are generated correctly") {
     // . x . . . x . .
     // x . . . . x . K
     MoveList l = generate_moves(gs);
-    Move qb6(algebraic_to_int("f6"), algebraic_to_int("b6"), Position::W_QUEEN, Move::QUIET);
-    Move qh4(algebraic_to_int("f6"), algebraic_to_int("h4"), Position::W_QUEEN, Move::QUIET);
+    Move qb6(algebraic_to_int("f6"), algebraic_to_int("b6"), Move::QUIET);
+    Move qh4(algebraic_to_int("f6"), algebraic_to_int("h4"), Move::QUIET);
 
     CHECK(l.size() == 28);
     CHECK(contains_move(l, qb6));
@@ -239,14 +219,14 @@ SCENARIO("knight moves are generated correctly") {
   GIVEN("a board with only knights") {
     GameState gs("k7/8/8/4n3/8/8/8/7K b - - 0 1");
     MoveList l = generate_moves(gs);
-    Move nf7(algebraic_to_int("e5"), algebraic_to_int("f7"), Position::B_KNIGHT, Move::QUIET);
-    Move ng6(algebraic_to_int("e5"), algebraic_to_int("g6"), Position::B_KNIGHT, Move::QUIET);
-    Move ng4(algebraic_to_int("e5"), algebraic_to_int("g4"), Position::B_KNIGHT, Move::QUIET);
-    Move nf3(algebraic_to_int("e5"), algebraic_to_int("f3"), Position::B_KNIGHT, Move::QUIET);
-    Move nd3(algebraic_to_int("e5"), algebraic_to_int("d3"), Position::B_KNIGHT, Move::QUIET);
-    Move nc4(algebraic_to_int("e5"), algebraic_to_int("c4"), Position::B_KNIGHT, Move::QUIET);
-    Move nc6(algebraic_to_int("e5"), algebraic_to_int("c6"), Position::B_KNIGHT, Move::QUIET);
-    Move nd7(algebraic_to_int("e5"), algebraic_to_int("d7"), Position::B_KNIGHT, Move::QUIET);
+    Move nf7(algebraic_to_int("e5"), algebraic_to_int("f7"), Move::QUIET);
+    Move ng6(algebraic_to_int("e5"), algebraic_to_int("g6"), Move::QUIET);
+    Move ng4(algebraic_to_int("e5"), algebraic_to_int("g4"), Move::QUIET);
+    Move nf3(algebraic_to_int("e5"), algebraic_to_int("f3"), Move::QUIET);
+    Move nd3(algebraic_to_int("e5"), algebraic_to_int("d3"), Move::QUIET);
+    Move nc4(algebraic_to_int("e5"), algebraic_to_int("c4"), Move::QUIET);
+    Move nc6(algebraic_to_int("e5"), algebraic_to_int("c6"), Move::QUIET);
+    Move nd7(algebraic_to_int("e5"), algebraic_to_int("d7"), Move::QUIET);
 
     CHECK(l.size() == 11);
     CHECK(contains_move(l, nf7));
@@ -262,14 +242,14 @@ SCENARIO("knight moves are generated correctly") {
   GIVEN("a board where a knight can capture") {
     GameState gs("k7/8/8/4n3/8/5P2/8/7K b - - 0 1");
     MoveList l = generate_moves(gs);
-    Move nf7(algebraic_to_int("e5"), algebraic_to_int("f7"), Position::B_KNIGHT, Move::QUIET);
-    Move ng6(algebraic_to_int("e5"), algebraic_to_int("g6"), Position::B_KNIGHT, Move::QUIET);
-    Move ng4(algebraic_to_int("e5"), algebraic_to_int("g4"), Position::B_KNIGHT, Move::QUIET);
-    Move nf3(algebraic_to_int("e5"), algebraic_to_int("f3"), Position::B_KNIGHT, Move::CAPTURE);
-    Move nd3(algebraic_to_int("e5"), algebraic_to_int("d3"), Position::B_KNIGHT, Move::QUIET);
-    Move nc4(algebraic_to_int("e5"), algebraic_to_int("c4"), Position::B_KNIGHT, Move::QUIET);
-    Move nc6(algebraic_to_int("e5"), algebraic_to_int("c6"), Position::B_KNIGHT, Move::QUIET);
-    Move nd7(algebraic_to_int("e5"), algebraic_to_int("d7"), Position::B_KNIGHT, Move::QUIET);
+    Move nf7(algebraic_to_int("e5"), algebraic_to_int("f7"), Move::QUIET);
+    Move ng6(algebraic_to_int("e5"), algebraic_to_int("g6"), Move::QUIET);
+    Move ng4(algebraic_to_int("e5"), algebraic_to_int("g4"), Move::QUIET);
+    Move nf3(algebraic_to_int("e5"), algebraic_to_int("f3"), Move::CAPTURE);
+    Move nd3(algebraic_to_int("e5"), algebraic_to_int("d3"), Move::QUIET);
+    Move nc4(algebraic_to_int("e5"), algebraic_to_int("c4"), Move::QUIET);
+    Move nc6(algebraic_to_int("e5"), algebraic_to_int("c6"), Move::QUIET);
+    Move nd7(algebraic_to_int("e5"), algebraic_to_int("d7"), Move::QUIET);
 
     CHECK(l.size() == 11);
     CHECK(contains_move(l, nf7));
@@ -290,6 +270,154 @@ TEST_CASE("We can tell when the king is in check") {
   CHECK(!in_check(false, p));
 }
 
+SCENARIO("moves which leave the king in check are not generated") {
+
+  GIVEN("a rook pinned to the king") {
+    GameState gs("4r1k1/8/8/8/8/8/4R3/4K3 w - - 0 1");
+    MoveList l = generate_moves(gs);
+    Move re7(algebraic_to_int("e2"), algebraic_to_int("e7"), Move::QUIET);
+    Move rxe8(algebraic_to_int("e2"), algebraic_to_int("e8"), Move::CAPTURE);
+    Move rd2(algebraic_to_int("e2"), algebraic_to_int("d2"), Move::QUIET);
+
+    // The rook can only move along the pin, and the king has four moves.
+    CHECK(l.size() == 10);
+    CHECK(contains_move(l, re7));
+    CHECK(contains_move(l, rxe8));
+    CHECK(!contains_move(l, rd2));
+  }
+
+  GIVEN("a king in check from a bishop") {
+    GameState gs("4k3/8/8/8/1b6/8/8/1N2K3 w - - 0 1");
+    MoveList l = generate_moves(gs);
+    Move nc3(algebraic_to_int("b1"), algebraic_to_int("c3"), Move::QUIET);
+    Move nd2(algebraic_to_int("b1"), algebraic_to_int("d2"), Move::QUIET);
+    Move na3(algebraic_to_int("b1"), algebraic_to_int("a3"), Move::QUIET);
+    Move kd2(algebraic_to_int("e1"), algebraic_to_int("d2"), Move::QUIET);
+
+    // The knight can block and the king can step off the diagonal.
+    CHECK(l.size() == 6);
+    CHECK(contains_move(l, nc3));
+    CHECK(contains_move(l, nd2));
+    CHECK(!contains_move(l, na3));
+    CHECK(!contains_move(l, kd2));
+  }
+
+  GIVEN("a king in double check") {
+    GameState gs("4k3/8/8/8/1b6/8/8/1N2K2r w - - 0 1");
+    MoveList l = generate_moves(gs);
+    Move ke2(algebraic_to_int("e1"), algebraic_to_int("e2"), Move::QUIET);
+    Move kf2(algebraic_to_int("e1"), algebraic_to_int("f2"), Move::QUIET);
+
+    // Only the king can move, and not along the rook's line away from it.
+    CHECK(l.size() == 2);
+    CHECK(contains_move(l, ke2));
+    CHECK(contains_move(l, kf2));
+  }
+
+  GIVEN("a white king on the back rank near a black pawn") {
+    GameState gs("5K2/3p4/8/8/8/8/8/k7 w - - 0 1");
+    MoveList l = generate_moves(gs);
+    Move ke8(algebraic_to_int("f8"), algebraic_to_int("e8"), Move::QUIET);
+
+    // Black pawns only attack toward the first rank.
+    CHECK(l.size() == 5);
+    CHECK(contains_move(l, ke8));
+  }
+}
+
+SCENARIO("moves can be generated by kind") {
+  GIVEN("a position with castling, en passant and promotions") {
+    GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    gs.make_move(gs.convert_move("a1b1"));
+    gs.make_move(gs.convert_move("b4b3"));
+    gs.make_move(gs.convert_move("a2a4"));
+    MoveList all = generate_moves(gs);
+    MoveList captures;
+    MoveList quiets;
+    generate_moves(gs, captures, GenMode::CAPTURES);
+    generate_moves(gs, quiets, GenMode::QUIETS);
+
+    THEN("captures and quiet moves split the legal moves") {
+      CHECK(captures.size() + quiets.size() == all.size());
+      for (const Move& m : all) {
+        CHECK(contains_move(m.capture() || m.promotion() ? captures : quiets, m));
+      }
+    }
+
+    THEN("each legal move is recognized as legal") {
+      for (const Move& m : all) {
+        CHECK(is_legal_move(gs, m));
+      }
+      CHECK(!is_legal_move(gs, Move()));
+      CHECK(!is_legal_move(gs, gs.convert_move("e1h1")));
+    }
+  }
+}
+
+SCENARIO("static exchange evaluation") {
+  GIVEN("an undefended piece") {
+    Position p("4k3/8/8/3n4/8/8/8/3RK3");
+    CHECK(see(p, Move(algebraic_to_int("d1"), algebraic_to_int("d5"), Move::CAPTURE)) == 3);
+  }
+
+  GIVEN("a pawn defended by a pawn") {
+    Position p("4k3/8/2p5/3p4/8/3Q4/8/4K3");
+    CHECK(see(p, Move(algebraic_to_int("d3"), algebraic_to_int("d5"), Move::CAPTURE)) == -8);
+  }
+
+  GIVEN("a defended piece with more attackers lined up behind") {
+    // Rxd5 Rxd5 Rxd5 wins a knight for nothing once the queen behind the
+    // first rook joins in.
+    Position p("3rk3/8/8/3n4/8/8/3R4/3QK3");
+    CHECK(see(p, Move(algebraic_to_int("d2"), algebraic_to_int("d5"), Move::CAPTURE)) == 3);
+  }
+}
+
+// Compute sliding attacks one square at a time, for checking the magic
+// bitboards.
+uint64_t ray_attacks(int square, uint64_t occupancy, bool rook) {
+  const int rook_dirs[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+  const int bishop_dirs[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+  uint64_t attacks = 0;
+  for (int d = 0; d < 4; d++) {
+    int dr = rook ? rook_dirs[d][0] : bishop_dirs[d][0];
+    int df = rook ? rook_dirs[d][1] : bishop_dirs[d][1];
+    int r = square / 8 + dr;
+    int f = square % 8 + df;
+    while (r >= 0 && r < 8 && f >= 0 && f < 8) {
+      attacks |= 1ull << (8 * r + f);
+      if (occupancy & (1ull << (8 * r + f))) {
+        break;
+      }
+      r += dr;
+      f += df;
+    }
+  }
+  return attacks;
+}
+
+TEST_CASE("magic bitboards give the same attacks as tracing rays") {
+  // Initializing again must not change anything.
+  movegen_initialize_attack_boards();
+  uint64_t state = 0x123456789abcdefull;
+  bool all_match = true;
+  for (int i = 0; i < 20000; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    // Sparse and dense boards both come up.
+    uint64_t occupancy = i % 2 ? state : state & (state >> 17) & (state >> 31);
+    int square = i % 64;
+    all_match = all_match &&
+      rook_attacks(square, occupancy) == ray_attacks(square, occupancy, true) &&
+      bishop_attacks(square, occupancy) ==
+        ray_attacks(square, occupancy, false);
+  }
+  CHECK(all_match);
+  CHECK(rook_attacks(0, 0) == ray_attacks(0, 0, true));
+  CHECK(bishop_attacks(63, ~0ull) == (1ull << 54));
+}
+
 #ifdef ENABLE_PERFT
 
 SCENARIO("perft testing gives correct results") {
@@ -297,36 +425,36 @@ SCENARIO("perft testing gives correct results") {
   GIVEN("the starting position") {
     GameState gs("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
 
-    CHECK(perft(1, gs) == 20);
-    CHECK(perft(2, gs) == 400);
-    CHECK(perft(3, gs) == 8902);
-    CHECK(perft(4, gs) == 197281);
+    CHECK(perft(gs, 1) == 20);
+    CHECK(perft(gs, 2) == 400);
+    CHECK(perft(gs, 3) == 8902);
+    CHECK(perft(gs, 4) == 197281);
   }
 
   GIVEN("a 2nd position") {
     GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
 
-    CHECK(perft(1, gs) == 48);
-    CHECK(perft(2, gs) == 2039);
-    CHECK(perft(3, gs) == 97862);
+    CHECK(perft(gs, 1) == 48);
+    CHECK(perft(gs, 2) == 2039);
+    CHECK(perft(gs, 3) == 97862);
   }
 
   GIVEN("a 3rd position") {
     GameState gs("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1");
 
-    CHECK(perft(1, gs) == 14);
-    CHECK(perft(2, gs) == 191);
-    CHECK(perft(3, gs) == 2812);
-    CHECK(perft(4, gs) == 43238);
+    CHECK(perft(gs, 1) == 14);
+    CHECK(perft(gs, 2) == 191);
+    CHECK(perft(gs, 3) == 2812);
+    CHECK(perft(gs, 4) == 43238);
   }
 
   GIVEN("a 4th position") {
     GameState gs("rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8");
 
-    CHECK(perft(1, gs) == 44);
-    CHECK(perft(2, gs) == 1486);
-    CHECK(perft(3, gs) == 62379);
-    CHECK(perft(4, gs) == 2103487);
+    CHECK(perft(gs, 1) == 44);
+    CHECK(perft(gs, 2) == 1486);
+    CHECK(perft(gs, 3) == 62379);
+    CHECK(perft(gs, 4) == 2103487);
   }
 
 }
@@ -0,0 +1,101 @@
+#include "catch.hpp"
+
+#include <algorithm>
+
+#include "movepicker.hpp"
+
+namespace {
+
+// Collect every move a picker produces.
+MoveList pick_all(MovePicker& picker) {
+  MoveList l;
+  Move m;
+  while (picker.next(m)) {
+    l.push_back(m);
+  }
+  return l;
+}
+
+bool same_moves(const MoveList& a, const MoveList& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (const Move& m : a) {
+    if (std::count(b.begin(), b.end(), m) != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}
+
+SCENARIO("a move picker produces every legal move once") {
+  GIVEN("a position with castling, en passant and promotions") {
+    GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    MoveList all = generate_moves(gs);
+    Move hash = gs.convert_move("e1g1");
+    Move killers[2] = {gs.convert_move("a2a3"), gs.convert_move("d5d6")};
+    HistoryTable history;
+    history.update(true, gs.convert_move("b2b3"), 10);
+
+    WHEN("we pick every move") {
+      MovePicker picker(gs, hash, killers, &history, false);
+      MoveList picked = pick_all(picker);
+
+      THEN("the moves are the legal moves") {
+        CHECK(same_moves(picked, all));
+      }
+
+      THEN("the hash move comes first") {
+        CHECK(picked[0] == hash);
+      }
+
+      THEN("winning captures come before killers, which come before other "
+          "quiet moves") {
+        Move bxh3 = gs.convert_move("g2h3");
+        Move b3 = gs.convert_move("b2b3");
+        auto pos = [&](const Move& m) {
+          return std::find(picked.begin(), picked.end(), m) - picked.begin();
+        };
+        CHECK(pos(bxh3) < pos(killers[0]));
+        CHECK(pos(killers[0]) < pos(killers[1]));
+        CHECK(pos(killers[1]) < pos(b3));
+        // The history score puts b3 ahead of every other quiet move.
+        CHECK(pos(b3) == pos(killers[1]) + 1);
+      }
+    }
+
+    WHEN("the hash move and killers are illegal") {
+      Move bogus[2] = {gs.convert_move("a1a8"), gs.convert_move("h1h8")};
+      MovePicker picker(gs, gs.convert_move("e2e8"), bogus, nullptr, false);
+      THEN("they are not produced") {
+        CHECK(same_moves(pick_all(picker), all));
+      }
+    }
+
+    WHEN("we only pick captures") {
+      MovePicker picker(gs, std::nullopt, nullptr, nullptr, true);
+      MoveList captures;
+      generate_moves(gs, captures, GenMode::CAPTURES);
+      THEN("only captures and promotions are produced") {
+        CHECK(same_moves(pick_all(picker), captures));
+      }
+    }
+  }
+
+  GIVEN("a capture which loses material") {
+    // The queen can take a pawn defended by a pawn, or the rook can take an
+    // undefended knight.
+    GameState gs("4k3/8/2p5/3p4/8/3Q4/8/1n2K2R w - - 0 1");
+    MovePicker picker(gs, std::nullopt, nullptr, nullptr, false);
+    MoveList picked = pick_all(picker);
+
+    THEN("it is tried after the quiet moves") {
+      Move qxd5 = gs.convert_move("d3d5");
+      Move qxb1 = gs.convert_move("d3b1");
+      CHECK(picked[0] == qxb1);
+      CHECK(picked.back() == qxd5);
+    }
+  }
+}
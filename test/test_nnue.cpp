@@ -0,0 +1,103 @@
+#include <cstdio>
+
+#include "catch.hpp"
+
+#include "nnue.hpp"
+#include "movegen.hpp"
+
+SCENARIO("networks can be saved and loaded") {
+  GIVEN("a random network") {
+    std::shared_ptr<NNUENetwork> net = NNUENetwork::random(32, 1);
+    std::string path = "test_nnue_network.nnue";
+    net->save(path);
+
+    WHEN("we load it back") {
+      std::shared_ptr<NNUENetwork> loaded = NNUENetwork::load(path);
+      THEN("the weights are the same") {
+        CHECK(loaded->hidden == net->hidden);
+        CHECK(loaded->ft_bias == net->ft_bias);
+        CHECK(loaded->ft_weights == net->ft_weights);
+        CHECK(loaded->l1_bias == net->l1_bias);
+        CHECK(loaded->l1_weights == net->l1_weights);
+        CHECK(loaded->out_bias == net->out_bias);
+        CHECK(loaded->out_weights == net->out_weights);
+      }
+    }
+
+    WHEN("the file is truncated") {
+      std::FILE* f = std::fopen(path.c_str(), "wb");
+      uint32_t header[3] = {NNUENetwork::MAGIC, NNUENetwork::VERSION, 32};
+      std::fwrite(header, sizeof(uint32_t), 3, f);
+      std::fclose(f);
+      THEN("loading it fails") {
+        CHECK_THROWS_AS(NNUENetwork::load(path), std::runtime_error);
+      }
+    }
+
+    std::remove(path.c_str());
+  }
+
+  GIVEN("a file which does not exist") {
+    THEN("loading it fails") {
+      CHECK_THROWS_AS(NNUENetwork::load("no_such_network.nnue"),
+          std::runtime_error);
+    }
+  }
+}
+
+SCENARIO("the NNUE evaluator matches evaluation from scratch") {
+  GIVEN("a random network") {
+    std::shared_ptr<NNUENetwork> net = NNUENetwork::random(64, 7);
+
+    THEN("the SIMD kernels agree with the portable ones") {
+      GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+      CHECK(net->evaluate(gs.pos(), true) ==
+          net->evaluate(gs.pos(), true, true));
+      CHECK(net->evaluate(gs.pos(), false) ==
+          net->evaluate(gs.pos(), false, true));
+    }
+
+    THEN("a position and its mirror image are evaluated the same") {
+      GameState gs1("r1bq1rk1/pp3ppp/2n1pn2/2p5/2pP4/P1PBPN2/5PPP/R1BQ1RK1 w - - 0 1");
+      GameState gs2("r1bq1rk1/5ppp/p1pbpn2/2Pp4/2P5/2N1PN2/PP3PPP/R1BQ1RK1 b - - 0 1");
+      NNUEEvaluator e(net);
+      CHECK(e.evaluate_position(gs1) == -e.evaluate_position(gs2));
+    }
+
+    WHEN("we evaluate every position along a line of play") {
+      GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+      NNUEEvaluator e(net);
+      e.initialize(gs);
+      bool all_match = true;
+      // Walk down the tree and back up again, evaluating each node and every
+      // child of it, so accumulators come from siblings, parents and stale
+      // entries alike.
+      for (int ply = 0; ply < 8; ply++) {
+        MoveList ml;
+        generate_moves(gs, ml);
+        for (const Move& m : ml) {
+          gs.make_move(m);
+          int32_t expected = net->evaluate(gs.pos(), gs.whites_move(), true);
+          double sign = gs.whites_move() ? 1.0 : -1.0;
+          if (e.evaluate_position(gs) !=
+              sign * expected / NNUENetwork::OUTPUT_SCALE) {
+            all_match = false;
+          }
+          gs.undo_move();
+        }
+        // Play a king move when one is available so the refresh path runs.
+        Move next = ml[ply * 7 % ml.size()];
+        for (const Move& m : ml) {
+          if (gs.pos().piece_at(m.from_square(), gs.whites_move() ?
+                Position::W_KING : Position::B_KING)) {
+            next = ply % 3 == 0 ? m : next;
+          }
+        }
+        gs.make_move(next);
+      }
+      THEN("the incremental evaluation is always exact") {
+        CHECK(all_match);
+      }
+    }
+  }
+}
@@ -0,0 +1,51 @@
+#include "catch.hpp"
+
+#include "perft.hpp"
+
+SCENARIO("perft counts the leaves of the move tree") {
+  GIVEN("the starting position") {
+    GameState gs;
+    CHECK(perft(gs, 0) == 1);
+    CHECK(perft(gs, 1) == 20);
+    CHECK(perft(gs, 3) == 8902);
+
+    THEN("the game state is restored afterwards") {
+      uint64_t hash = gs.hash();
+      perft(gs, 2);
+      CHECK(gs.hash() == hash);
+      CHECK(gs.history_size() == 0);
+    }
+  }
+
+  GIVEN("a position with castling, en passant and promotions") {
+    GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    CHECK(perft(gs, 2) == 2039);
+  }
+}
+
+SCENARIO("divide splits perft by root move") {
+  GIVEN("a position with castling, en passant and promotions") {
+    GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+
+    THEN("the counts sum to the perft result with any number of threads") {
+      for (unsigned threads : {1, 2, 4}) {
+        auto results = divide(gs, 3, threads);
+        CHECK(results.size() == 48);
+        uint64_t total = 0;
+        for (const auto& r : results) {
+          total += r.second;
+        }
+        CHECK(total == 97862);
+      }
+    }
+
+    THEN("each count matches perft from the child position") {
+      auto results = divide(gs, 2, 2);
+      for (const auto& [m, n] : results) {
+        gs.make_move(m);
+        CHECK(n == perft(gs, 1));
+        gs.undo_move();
+      }
+    }
+  }
+}
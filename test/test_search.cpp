@@ -1,8 +1,12 @@
 #include "catch.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
+#include <thread>
 
 #include "search.hpp"
+#include "movegen.hpp"
 
 SCENARIO("search is correct on some known positions") {
   GIVEN("The starting position") {
@@ -10,7 +14,7 @@ SCENARIO("search is correct on some known positions") {
     BasicAlphaBetaSearcher searcher(std::make_unique<BasicEvaluator>());
     SearchLimits limits;
     SearchInfo info;
-    bool stop_signal = false;
+    std::atomic<bool> stop_signal{false};
     WHEN("We evaluate the position to depth 2") {
       Move e4 = gs.convert_move("e2e4");
       Move e3 = gs.convert_move("e2e3");
@@ -60,7 +64,7 @@ SCENARIO("search is correct on some known positions") {
       Move e6 = gs.convert_move("e7e6");
       SearchLimits limits;
       SearchInfo info;
-      bool stop_signal = false;
+      std::atomic<bool> stop_signal{false};
       limits.depth_limit = 1;
       auto res = searcher.search(gs, limits, info, stop_signal);
       THEN("The best move is e5 or e6.") {
@@ -73,30 +77,553 @@ SCENARIO("search is correct on some known positions") {
   }
 
   GIVEN("A position with mate in 2 for black") {
+    // There are two mates: Qd7+ Kb8 Qb7# and Kb6 Kb8 Qd8#.
     GameState gs("2K5/8/2k5/8/8/8/8/3q4 b - - 0 1");
-    Move qd7 = gs.convert_move("d1d7");
-    gs.make_move(qd7);
-    Move kb8 = gs.convert_move("c8b8");
-    gs.make_move(kb8);
-    Move qb7 = gs.convert_move("d7b7");
-    gs.undo_move();
-    gs.undo_move();
     BasicAlphaBetaSearcher searcher(std::make_unique<BasicEvaluator>());
     WHEN("We evaluate withd epth 3") {
       SearchLimits limits;
       SearchInfo info;
       limits.mate_in = 2;
-      bool stop_signal = false;
+      std::atomic<bool> stop_signal{false};
       auto res = searcher.search(gs, limits, info, stop_signal);
       THEN("The evaluation is largely negative") {
         CHECK(res.first < -100.0);
       }
       THEN("The principle variation is the mate") {
-        CHECK(info.pv.size() == 3);
-        CHECK(info.pv[0] == qd7);
-        CHECK(info.pv[1] == kb8);
-        CHECK(info.pv[2] == qb7);
+        REQUIRE(info.pv.size() == 3);
+        for (const Move& m : info.pv) {
+          gs.make_move(m);
+        }
+        CHECK(generate_moves(gs).empty());
+        CHECK(in_check(gs.whites_move(), gs.pos()));
       }
     }
   }
 }
+
+SCENARIO("quiescence search resolves captures at the horizon") {
+  GIVEN("A queen which can take a pawn defended by a pawn") {
+    GameState gs("4k3/8/2p5/3p4/8/3Q4/8/4K3 w - - 0 1");
+    Move qxd5 = gs.convert_move("d3d5");
+    BasicAlphaBetaSearcher searcher(std::make_unique<BasicEvaluator>());
+    WHEN("We search to depth 1") {
+      SearchLimits limits;
+      SearchInfo info;
+      limits.depth_limit = 1;
+      std::atomic<bool> stop_signal{false};
+      auto res = searcher.search(gs, limits, info, stop_signal);
+      THEN("The recapture is seen and the pawn is left alone") {
+        CHECK(!(res.second == qxd5));
+        CHECK(res.first > 5.0);
+      }
+      THEN("Quiescence nodes are counted") {
+        CHECK(info.qnodes > 0);
+        CHECK(info.qnodes <= info.nodes);
+      }
+    }
+  }
+
+  GIVEN("A back rank mate in one") {
+    GameState gs("6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1");
+    Move ra8 = gs.convert_move("a1a8");
+    BasicAlphaBetaSearcher searcher(std::make_unique<BasicEvaluator>());
+    SearchLimits limits;
+    SearchInfo info;
+    limits.depth_limit = 1;
+    std::atomic<bool> stop_signal{false};
+    auto res = searcher.search(gs, limits, info, stop_signal);
+    THEN("The mate is found by searching evasions at the horizon") {
+      CHECK(res.second == ra8);
+      CHECK(res.first > 100.0);
+    }
+  }
+}
+
+SCENARIO("lazy SMP search works with several threads") {
+  GIVEN("A position with mate in 2 for black") {
+    GameState gs("2K5/8/2k5/8/8/8/8/3q4 b - - 0 1");
+    std::string fen = gs.fen_string();
+    auto tt = std::make_shared<TranspositionTable>(1);
+    LazySMPSearcher searcher(std::make_unique<BasicEvaluator>(), tt, 3);
+    CHECK(searcher.threads() == 3);
+    WHEN("We search for the mate") {
+      SearchLimits limits;
+      SearchInfo info;
+      limits.mate_in = 2;
+      std::atomic<bool> stop_signal{false};
+      auto res = searcher.search(gs, limits, info, stop_signal);
+      THEN("The mate is found") {
+        CHECK(res.first < -100.0);
+        REQUIRE(info.pv.size() == 3);
+        CHECK(info.depth == 4);
+      }
+      THEN("The game state is unchanged") {
+        CHECK(gs.fen_string() == fen);
+      }
+    }
+    WHEN("We search with a node limit") {
+      SearchLimits limits;
+      SearchInfo info;
+      limits.node_limit = 5000;
+      std::atomic<bool> stop_signal{false};
+      searcher.search(gs, limits, info, stop_signal);
+      THEN("Nodes from every thread count toward the limit") {
+        // Each thread may overrun the limit by up to one batch.
+        CHECK(info.nodes > 0);
+        CHECK(info.nodes <= 5000 + 3 * NODE_BATCH);
+      }
+    }
+  }
+
+  GIVEN("A searcher with too many threads") {
+    auto tt = std::make_shared<TranspositionTable>(1);
+    LazySMPSearcher searcher(std::make_unique<BasicEvaluator>(), tt, 1);
+    searcher.set_threads(0);
+    CHECK(searcher.threads() == 1);
+    searcher.set_threads(100000);
+    CHECK(searcher.threads() == MAX_THREADS);
+    searcher.set_threads(2);
+    CHECK(searcher.threads() == 2);
+  }
+}
+
+SCENARIO("search stops on its own when given a clock") {
+  GIVEN("The starting position and a few seconds on the clock") {
+    GameState gs;
+    auto tt = std::make_shared<TranspositionTable>(1);
+    LazySMPSearcher searcher(std::make_unique<IncrementalEvaluator>(), tt, 2);
+    SearchLimits limits;
+    limits.wtime = 3000;
+    limits.btime = 3000;
+    SearchInfo info;
+    std::atomic<bool> stop_signal{false};
+    WHEN("We search") {
+      auto start = std::chrono::steady_clock::now();
+      auto res = searcher.search(gs, limits, info, stop_signal);
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      THEN("A move is found well within the time left") {
+        CHECK(!res.second.is_null());
+        CHECK(info.depth > 0);
+        CHECK(elapsed < std::chrono::milliseconds(1000));
+      }
+    }
+  }
+
+  GIVEN("A move time too short to finish the first iteration") {
+    GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w "
+        "KQkq - 0 1");
+    BasicAlphaBetaSearcher searcher(std::make_unique<IncrementalEvaluator>());
+    SearchLimits limits;
+    limits.timeout = 0;
+    SearchInfo info;
+    std::atomic<bool> stop_signal{false};
+    WHEN("We search") {
+      auto res = searcher.search(gs, limits, info, stop_signal);
+      THEN("We still get a legal move") {
+        MoveList ml;
+        generate_moves(gs, ml);
+        CHECK(std::find(ml.begin(), ml.end(), res.second) != ml.end());
+      }
+    }
+  }
+}
+
+SCENARIO("search responds quickly to being stopped") {
+  GIVEN("An unlimited search running on another thread") {
+    GameState gs;
+    auto tt = std::make_shared<TranspositionTable>(1);
+    LazySMPSearcher searcher(std::make_unique<IncrementalEvaluator>(), tt, 2);
+    SearchLimits limits;
+    SearchInfo info;
+    std::atomic<bool> stop_signal{false};
+    std::pair<double, Move> res;
+    std::thread worker([&]() {
+        res = searcher.search(gs, limits, info, stop_signal);
+      });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    WHEN("We stop it") {
+      auto start = std::chrono::steady_clock::now();
+      stop_signal = true;
+      worker.join();
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      THEN("It returns a move almost immediately") {
+        CHECK(elapsed < std::chrono::milliseconds(20));
+        CHECK(!res.second.is_null());
+        CHECK(info.nodes > 0);
+      }
+    }
+  }
+
+  GIVEN("A fixed move time") {
+    GameState gs;
+    BasicAlphaBetaSearcher searcher(std::make_unique<IncrementalEvaluator>());
+    SearchLimits limits;
+    limits.timeout = 50;
+    SearchInfo info;
+    std::atomic<bool> stop_signal{false};
+    WHEN("We search") {
+      auto start = std::chrono::steady_clock::now();
+      searcher.search(gs, limits, info, stop_signal);
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      THEN("The search ends shortly after the move time") {
+        CHECK(elapsed < std::chrono::milliseconds(70));
+      }
+    }
+  }
+}
+
+SCENARIO("a pondering search keeps going until ponderhit") {
+  GameState gs;
+  auto tt = std::make_shared<TranspositionTable>(1);
+  LazySMPSearcher searcher(std::make_unique<IncrementalEvaluator>(), tt, 2,
+      true);
+  SearchLimits limits;
+  limits.wtime = 300;
+  limits.btime = 300;
+  SearchInfo info;
+  info.pondering = true;
+  std::atomic<bool> stop_signal{false};
+  std::atomic<bool> done{false};
+  std::pair<double, Move> res;
+  std::thread worker([&]() {
+      res = searcher.search(gs, limits, info, stop_signal);
+      done = true;
+    });
+  // Well past the hard limit of the clock.
+  std::this_thread::sleep_for(std::chrono::milliseconds(400));
+  CHECK(!done);
+  unsigned depth = info.depth;
+  CHECK(depth > 0);
+  WHEN("The opponent plays the expected move") {
+    auto start = std::chrono::steady_clock::now();
+    info.pondering = false;
+    worker.join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    THEN("The search stops soon, as deep as it got while pondering") {
+      CHECK(elapsed < std::chrono::milliseconds(50));
+      CHECK(!res.second.is_null());
+      CHECK(info.depth >= depth);
+    }
+  }
+}
+
+SCENARIO("searches of one game build on each other") {
+  GIVEN("A search of the starting position") {
+    GameState gs;
+    PVSSearcher searcher(std::make_unique<IncrementalEvaluator>());
+    SearchLimits limits;
+    limits.depth_limit = 6;
+    SearchInfo info;
+    std::atomic<bool> stop_signal{false};
+    searcher.search(gs, limits, info, stop_signal);
+    REQUIRE(info.pv.size() > 2);
+    gs.make_move(info.pv[0]);
+    gs.make_move(info.pv[1]);
+    limits.depth_limit = 5;
+
+    // The same search from scratch.
+    PVSSearcher fresh(std::make_unique<IncrementalEvaluator>());
+    SearchInfo fresh_info;
+    fresh.search(gs, limits, fresh_info, stop_signal);
+
+    WHEN("The game follows the principle variation") {
+      searcher.search(gs, limits, info, stop_signal);
+      THEN("The next search is cheaper than starting from scratch") {
+        CHECK(info.nodes < fresh_info.nodes);
+      }
+    }
+
+    WHEN("A new game starts") {
+      searcher.new_game();
+      searcher.search(gs, limits, info, stop_signal);
+      THEN("Nothing is left over from the old one") {
+        CHECK(info.nodes == fresh_info.nodes);
+      }
+    }
+  }
+}
+
+SCENARIO("a MultiPV search finds several lines") {
+  GIVEN("A position with a few reasonable moves") {
+    GameState gs("r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - "
+        "2 3");
+    BasicAlphaBetaSearcher searcher(std::make_unique<BasicEvaluator>());
+    SearchLimits limits;
+    limits.depth_limit = 3;
+    limits.multipv = 3;
+    SearchInfo info;
+    std::atomic<bool> stop_signal{false};
+    auto res = searcher.search(gs, limits, info, stop_signal);
+
+    THEN("The lines have different first moves, best first") {
+      REQUIRE(info.lines.size() == 3);
+      CHECK(info.lines[0].pv[0] == res.second);
+      CHECK(std::equal(info.pv.begin(), info.pv.end(),
+            info.lines[0].pv.begin(), info.lines[0].pv.end()));
+      CHECK(info.lines[0].score == res.first);
+      for (unsigned i = 0; i < 3; i++) {
+        CHECK(info.lines[i].depth == 3);
+        for (unsigned j = 0; j < i; j++) {
+          CHECK(!(info.lines[i].pv[0] == info.lines[j].pv[0]));
+          CHECK(info.lines[j].score >= info.lines[i].score);
+        }
+      }
+    }
+
+    THEN("Each line is scored as if its first move were searched alone") {
+      for (const PVLine& line : info.lines) {
+        BasicAlphaBetaSearcher single(std::make_unique<BasicEvaluator>());
+        SearchLimits only;
+        only.depth_limit = 3;
+        only.moves = MoveList{line.pv[0]};
+        SearchInfo single_info;
+        auto r = single.search(gs, only, single_info, stop_signal);
+        CHECK(std::abs(r.first - line.score) < 0.001);
+      }
+    }
+  }
+
+  GIVEN("More lines than there are moves") {
+    GameState gs;
+    PVSSearcher searcher(std::make_unique<IncrementalEvaluator>());
+    SearchLimits limits;
+    limits.depth_limit = 2;
+    limits.multipv = 50;
+    SearchInfo info;
+    std::atomic<bool> stop_signal{false};
+    searcher.search(gs, limits, info, stop_signal);
+    THEN("Every move gets a line") {
+      CHECK(info.lines.size() == 20);
+    }
+  }
+
+  GIVEN("A single line") {
+    GameState gs;
+    PVSSearcher searcher(std::make_unique<IncrementalEvaluator>());
+    SearchLimits limits;
+    limits.depth_limit = 2;
+    SearchInfo info;
+    std::atomic<bool> stop_signal{false};
+    searcher.search(gs, limits, info, stop_signal);
+    THEN("No lines are kept besides the principle variation") {
+      CHECK(info.lines.empty());
+      CHECK(info.pv.size() == 2);
+    }
+  }
+}
+
+/**
+ * \brief Get search parameters which turn off everything but null-move
+ * pruning.
+ */
+static SearchParams exhaustive_params() {
+  SearchParams params;
+  params.lmr_depth = 100;
+  params.futility_depth = 0;
+  params.reverse_futility_depth = 0;
+  params.check_extension = 0;
+  return params;
+}
+
+SCENARIO("principle variation search agrees with plain alpha-beta") {
+  GIVEN("Some positions searched to a fixed depth without selectivity") {
+    std::vector<std::string> fens = {
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+      "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+      "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    };
+    SearchLimits limits;
+    limits.depth_limit = 6;
+    std::atomic<bool> stop_signal{false};
+    uint64_t basic_nodes = 0;
+    uint64_t pvs_nodes = 0;
+    for (const std::string& fen : fens) {
+      GameState gs(fen);
+      BasicAlphaBetaSearcher basic(std::make_unique<IncrementalEvaluator>());
+      PVSSearcher pvs(std::make_unique<IncrementalEvaluator>());
+      pvs.set_params(exhaustive_params());
+      SearchInfo basic_info, pvs_info;
+      auto expected = basic.search(gs, limits, basic_info, stop_signal);
+      auto res = pvs.search(gs, limits, pvs_info, stop_signal);
+      INFO(fen);
+      CHECK(res.second == expected.second);
+      CHECK(res.first == Approx(expected.first));
+      CHECK(gs.fen_string() == fen);
+      basic_nodes += basic_info.nodes;
+      pvs_nodes += pvs_info.nodes;
+    }
+    THEN("Fewer nodes are searched in total") {
+      CHECK(pvs_nodes < basic_nodes);
+    }
+  }
+
+  GIVEN("A position with mate in 2 for black") {
+    GameState gs("2K5/8/2k5/8/8/8/8/3q4 b - - 0 1");
+    PVSSearcher searcher(std::make_unique<BasicEvaluator>());
+    SearchLimits limits;
+    SearchInfo info;
+    limits.mate_in = 2;
+    std::atomic<bool> stop_signal{false};
+    auto res = searcher.search(gs, limits, info, stop_signal);
+    THEN("The mate is found") {
+      CHECK(res.first < -100.0);
+      REQUIRE(info.pv.size() == 3);
+      for (const Move& m : info.pv) {
+        gs.make_move(m);
+      }
+      CHECK(generate_moves(gs).empty());
+    }
+  }
+
+  GIVEN("Lazy SMP running principle variation searches") {
+    GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w "
+        "KQkq - 0 1");
+    auto tt = std::make_shared<TranspositionTable>(1);
+    LazySMPSearcher searcher(std::make_unique<IncrementalEvaluator>(), tt, 3,
+        true);
+    SearchLimits limits;
+    SearchInfo info;
+    limits.depth_limit = 5;
+    std::atomic<bool> stop_signal{false};
+    auto res = searcher.search(gs, limits, info, stop_signal);
+    THEN("A legal move is found") {
+      MoveList ml;
+      generate_moves(gs, ml);
+      CHECK(std::find(ml.begin(), ml.end(), res.second) != ml.end());
+      CHECK(info.depth == 5);
+    }
+  }
+}
+
+SCENARIO("the selective search finds the same tactics with fewer nodes") {
+  GIVEN("Positions with a clear best move") {
+    // A free queen, a back rank mate, and a knight fork of king and queen.
+    std::vector<std::pair<std::string, std::string>> tests = {
+      {"4k3/8/8/3q4/8/8/3R4/3RK3 w - - 0 1", "d2d5"},
+      {"6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1", "a1a8"},
+      {"4k3/1q6/8/8/2N5/8/8/4K3 w - - 0 1", "c4d6"},
+    };
+    for (const auto& [fen, best] : tests) {
+      GameState gs(fen);
+      PVSSearcher searcher(std::make_unique<IncrementalEvaluator>());
+      SearchLimits limits;
+      limits.depth_limit = 5;
+      SearchInfo info;
+      std::atomic<bool> stop_signal{false};
+      auto res = searcher.search(gs, limits, info, stop_signal);
+      INFO(fen);
+      CHECK(res.second == gs.convert_move(best));
+    }
+  }
+
+  GIVEN("A middlegame position") {
+    GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w "
+        "KQkq - 0 1");
+    SearchLimits limits;
+    limits.depth_limit = 6;
+    std::atomic<bool> stop_signal{false};
+    PVSSearcher selective(std::make_unique<IncrementalEvaluator>());
+    PVSSearcher exhaustive(std::make_unique<IncrementalEvaluator>());
+    exhaustive.set_params(exhaustive_params());
+    SearchInfo selective_info, exhaustive_info;
+    selective.search(gs, limits, selective_info, stop_signal);
+    exhaustive.search(gs, limits, exhaustive_info, stop_signal);
+    THEN("Far fewer nodes are searched") {
+      CHECK(2 * selective_info.nodes < exhaustive_info.nodes);
+    }
+  }
+
+  GIVEN("A mate in two which needs a check evasion") {
+    // After Kb6 Kb8 the mate is Qh1-h8, a quiet move which the quiescence
+    // search won't try unless the checks are extended.
+    GameState gs("k7/8/2K5/8/8/8/8/7Q w - - 0 1");
+    SearchLimits limits;
+    limits.depth_limit = 2;
+    std::atomic<bool> stop_signal{false};
+    WHEN("Checks are extended") {
+      PVSSearcher searcher(std::make_unique<BasicEvaluator>());
+      SearchInfo info;
+      auto res = searcher.search(gs, limits, info, stop_signal);
+      THEN("The mate is seen at depth two") {
+        CHECK(res.first > 100.0);
+      }
+    }
+    WHEN("Checks are not extended") {
+      PVSSearcher searcher(std::make_unique<BasicEvaluator>());
+      SearchParams params;
+      params.check_extension = 0;
+      searcher.set_params(params);
+      SearchInfo info;
+      auto res = searcher.search(gs, limits, info, stop_signal);
+      THEN("The mate is too deep to see") {
+        CHECK(res.first < 100.0);
+      }
+    }
+  }
+}
+
+#ifdef SEARCH_STATS
+SCENARIO("search statistics are collected for each iteration") {
+  GIVEN("a search to a fixed depth") {
+    GameState gs("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    SearchLimits limits;
+    limits.depth_limit = 5;
+    std::atomic<bool> stop_signal{false};
+    SearchInfo info;
+    PVSSearcher searcher(std::make_unique<IncrementalEvaluator>());
+    searcher.search(gs, limits, info, stop_signal);
+
+    THEN("each iteration has consistent counters") {
+      REQUIRE(info.iterations.size() == 5);
+      uint64_t nodes = 0;
+      uint64_t qnodes = 0;
+      for (unsigned i = 0; i < info.iterations.size(); i++) {
+        const IterationStats& it = info.iterations[i];
+        const SearchStats& s = it.stats;
+        CHECK(it.depth == i + 1);
+        CHECK(it.complete);
+        CHECK(s.qnodes <= s.nodes);
+        CHECK(s.first_move_cutoffs <= s.cutoffs);
+        CHECK(s.tt_hits <= s.tt_probes);
+        CHECK(s.evals > 0);
+        nodes += s.nodes;
+        qnodes += s.qnodes;
+      }
+      const SearchStats& last = info.iterations.back().stats;
+      CHECK(last.cutoffs > 0);
+      CHECK(last.tt_hits > 0);
+      // With good move ordering most cutoffs come from the first move.
+      CHECK(last.first_move_cutoffs * 2 > last.cutoffs);
+
+      AND_THEN("the iterations add up to the whole search") {
+        CHECK(nodes == info.nodes);
+        CHECK(qnodes == info.qnodes);
+      }
+    }
+
+    THEN("a search interrupted by its node limit ends with an incomplete "
+        "iteration") {
+      limits.depth_limit = {};
+      limits.node_limit = 20000;
+      SearchInfo limited;
+      searcher.search(gs, limits, limited, stop_signal);
+      REQUIRE(!limited.iterations.empty());
+      CHECK(!limited.iterations.back().complete);
+    }
+  }
+}
+#endif
+
+TEST_CASE("search parameters can be set as UCI options") {
+  SearchParams params;
+  std::vector<std::string> names;
+  for (const SearchParams::Option& opt : SearchParams::options()) {
+    INFO(opt.name);
+    CHECK(opt.min <= params.*opt.value);
+    CHECK(params.*opt.value <= opt.max);
+    CHECK(std::find(names.begin(), names.end(), opt.name) == names.end());
+    names.push_back(opt.name);
+  }
+  CHECK(names.size() == 12);
+}
@@ -0,0 +1,648 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <queue>
+#include <random>
+#include <unordered_map>
+
+#include "movegen.hpp"
+#include "syzygy.hpp"
+#include "tablebase.hpp"
+
+static void put_le(std::vector<unsigned char>& out, uint64_t value,
+    unsigned bytes) {
+  for (unsigned i = 0; i < bytes; i++) {
+    out.push_back((value >> (8 * i)) & 0xff);
+  }
+}
+
+// The values of one subtable to write, with negative values for indices
+// which hold no legal position.
+struct SubtableValues {
+  uint8_t flags;
+  std::vector<int> values;
+};
+
+// The parts of a compressed subtable, which are spread through the file.
+struct Compressed {
+  std::vector<unsigned char> sizes;
+  std::vector<unsigned char> sparse_index;
+  std::vector<unsigned char> block_lengths;
+  std::vector<unsigned char> blocks;
+  unsigned block_count;
+};
+
+// Compress the values of a subtable as the Syzygy generator does, with
+// blocks of canonical Huffman codes. As well as a symbol for each value
+// there is a symbol for a pair of the most common value and one for a pair
+// of those pairs.
+static Compressed compress(const SubtableValues& table,
+    unsigned block_bits, unsigned span_bits) {
+  Compressed c;
+  std::vector<int> values = table.values;
+  std::map<int, unsigned> frequency;
+  for (int v : values) {
+    if (v >= 0) {
+      frequency[v]++;
+    }
+  }
+  int common = frequency.empty() ? 0 : std::max_element(frequency.begin(),
+      frequency.end(), [](auto a, auto b) { return a.second < b.second; })
+    ->first;
+  for (int& v : values) {
+    if (v < 0) {
+      v = common;
+    }
+  }
+  if (std::all_of(values.begin(), values.end(),
+        [&](int v) { return v == common; })) {
+    c.sizes = {static_cast<unsigned char>(table.flags |
+        SyzygyTable::FLAG_SINGLE_VALUE), static_cast<unsigned char>(common)};
+    c.block_count = 0;
+    return c;
+  }
+
+  // Symbol v < leaves stands for the value v, then come the pair and the
+  // pair of pairs.
+  int leaves = *std::max_element(values.begin(), values.end()) + 1;
+  int pair = leaves;
+  int quad = leaves + 1;
+  int symbols = leaves + 2;
+  std::vector<std::pair<int, int>> children(symbols, {0, 0xfff});
+  std::vector<unsigned> expansion(symbols, 1);
+  for (int v = 0; v < leaves; v++) {
+    children[v].first = v;
+  }
+  children[pair] = {common, common};
+  children[quad] = {pair, pair};
+  expansion[pair] = 2;
+  expansion[quad] = 4;
+  std::vector<int> tokens;
+  for (size_t i = 0; i < values.size(); i += expansion[tokens.back()]) {
+    auto run = [&](size_t n) {
+      return i + n <= values.size() && std::all_of(values.begin() + i,
+          values.begin() + i + n, [&](int v) { return v == common; });
+    };
+    tokens.push_back(run(4) ? quad : run(2) ? pair : values[i]);
+  }
+
+  // Huffman code lengths, with every symbol given a code.
+  std::vector<unsigned> count(symbols, 1);
+  for (int t : tokens) {
+    count[t]++;
+  }
+  std::vector<int> parent(2 * symbols, -1);
+  std::priority_queue<std::pair<uint64_t, int>,
+    std::vector<std::pair<uint64_t, int>>, std::greater<>> queue;
+  for (int s = 0; s < symbols; s++) {
+    queue.push({count[s], s});
+  }
+  int nodes = symbols;
+  while (queue.size() > 1) {
+    auto [fa, a] = queue.top();
+    queue.pop();
+    auto [fb, b] = queue.top();
+    queue.pop();
+    parent[a] = parent[b] = nodes;
+    queue.push({fa + fb, nodes++});
+  }
+  std::vector<unsigned> length(symbols, 0);
+  for (int s = 0; s < symbols; s++) {
+    for (int n = s; parent[n] >= 0; n = parent[n]) {
+      length[s]++;
+    }
+  }
+
+  // Number the symbols from the longest code to the shortest, and give
+  // each length consecutive codes, with longer codes numerically lower.
+  std::vector<int> order(symbols);
+  for (int s = 0; s < symbols; s++) {
+    order[s] = s;
+  }
+  std::stable_sort(order.begin(), order.end(),
+      [&](int a, int b) { return length[a] > length[b]; });
+  std::vector<int> number(symbols);
+  for (int i = 0; i < symbols; i++) {
+    number[order[i]] = i;
+  }
+  unsigned min_length = length[order.back()];
+  unsigned max_length = length[order.front()];
+  std::vector<uint64_t> codes(symbols);
+  std::vector<unsigned> lowest(max_length - min_length + 1);
+  uint64_t next_code = 0;
+  int next_symbol = 0;
+  for (unsigned len = max_length; len >= min_length; len--) {
+    lowest[len - min_length] = next_symbol;
+    unsigned n = 0;
+    while (next_symbol < symbols && length[order[next_symbol]] == len) {
+      codes[order[next_symbol++]] = next_code + n++;
+    }
+    if (len > min_length) {
+      REQUIRE((next_code + n) % 2 == 0);
+      next_code = (next_code + n) / 2;
+    } else {
+      REQUIRE(next_code + n == 1ull << len);
+    }
+  }
+
+  // Fill blocks with whole codes.
+  unsigned block_size = 1u << block_bits;
+  std::vector<unsigned> block_values;
+  std::vector<uint64_t> block_start;
+  unsigned bits = 8 * block_size;
+  uint64_t start = 0;
+  for (int t : tokens) {
+    if (bits + length[t] > 8 * block_size) {
+      c.blocks.resize(c.blocks.size() + block_size);
+      block_values.push_back(0);
+      block_start.push_back(start);
+      bits = 0;
+    }
+    unsigned char* block = &c.blocks[c.blocks.size() - block_size];
+    for (unsigned i = 0; i < length[t]; i++) {
+      if (codes[t] >> (length[t] - 1 - i) & 1) {
+        block[(bits + i) / 8] |= 0x80 >> ((bits + i) % 8);
+      }
+    }
+    bits += length[t];
+    block_values.back() += expansion[t];
+    start += expansion[t];
+  }
+  c.block_count = block_values.size();
+  for (unsigned n : block_values) {
+    REQUIRE(n <= 65536);
+    put_le(c.block_lengths, n - 1, 2);
+  }
+
+  // Each sparse index entry locates the middle of its span.
+  uint64_t span = 1ull << span_bits;
+  for (uint64_t k = 0; k * span < values.size(); k++) {
+    uint64_t middle = k * span + span / 2;
+    unsigned b = std::upper_bound(block_start.begin(), block_start.end(),
+        middle) - block_start.begin() - 1;
+    REQUIRE(middle - block_start[b] < 65536);
+    put_le(c.sparse_index, b, 4);
+    put_le(c.sparse_index, middle - block_start[b], 2);
+  }
+
+  c.sizes = {table.flags, static_cast<unsigned char>(block_bits),
+    static_cast<unsigned char>(span_bits), 0};
+  put_le(c.sizes, c.block_count, 4);
+  c.sizes.push_back(max_length);
+  c.sizes.push_back(min_length);
+  for (unsigned l : lowest) {
+    put_le(c.sizes, l, 2);
+  }
+  put_le(c.sizes, symbols, 2);
+  for (int i = 0; i < symbols; i++) {
+    auto [left, right] = children[order[i]];
+    if (right != 0xfff) {
+      left = number[left];
+      right = number[right];
+    }
+    c.sizes.push_back(left & 0xff);
+    c.sizes.push_back((left >> 8) | (right & 0xf) << 4);
+    c.sizes.push_back(right >> 4);
+  }
+  if (symbols & 1) {
+    c.sizes.push_back(0);
+  }
+  return c;
+}
+
+// Build a Syzygy file. Every subtable has its pieces in the given order and
+// its groups in their natural order. Without any values, each subtable
+// holds a single zero, which is enough to find where positions go.
+static std::vector<unsigned char> syzygy_file(const std::string& signature,
+    bool dtz, const std::vector<unsigned>& pieces,
+    const std::vector<SubtableValues>& subtables = {},
+    const std::vector<unsigned char>& dtz_map = {}, unsigned block_bits = 5,
+    unsigned span_bits = 6) {
+  size_t v = signature.find('v');
+  std::string left = signature.substr(0, v);
+  std::string right = signature.substr(v + 1);
+  bool symmetric = left == right;
+  bool pawns = signature.find('P') != std::string::npos;
+  bool both_pawns = left.find('P') != std::string::npos &&
+    right.find('P') != std::string::npos;
+  unsigned files = pawns ? 4 : 1;
+  unsigned count = files * (!dtz && !symmetric ? 2 : 1);
+
+  const unsigned char* magic = dtz ? SyzygyTablebase::DTZ_MAGIC :
+    SyzygyTablebase::WDL_MAGIC;
+  std::vector<unsigned char> out(magic, magic + 4);
+  out.push_back((symmetric ? 0 : 1) | (pawns ? 2 : 0));
+  for (unsigned f = 0; f < files; f++) {
+    out.push_back(0);
+    if (both_pawns) {
+      out.push_back(0x11);
+    }
+    for (unsigned p : pieces) {
+      out.push_back(p | p << 4);
+    }
+  }
+  if (out.size() & 1) {
+    out.push_back(0);
+  }
+
+  std::vector<Compressed> parts;
+  for (unsigned i = 0; i < count; i++) {
+    parts.push_back(subtables.empty() ?
+        Compressed{{SyzygyTable::FLAG_SINGLE_VALUE, 0}, {}, {}, {}, 0} :
+        compress(subtables[i], block_bits, span_bits));
+  }
+  for (const Compressed& c : parts) {
+    out.insert(out.end(), c.sizes.begin(), c.sizes.end());
+  }
+  if (dtz) {
+    out.insert(out.end(), dtz_map.begin(), dtz_map.end());
+    if (out.size() & 1) {
+      out.push_back(0);
+    }
+  }
+  for (const Compressed& c : parts) {
+    out.insert(out.end(), c.sparse_index.begin(), c.sparse_index.end());
+  }
+  for (const Compressed& c : parts) {
+    out.insert(out.end(), c.block_lengths.begin(), c.block_lengths.end());
+  }
+  for (const Compressed& c : parts) {
+    out.resize((out.size() + 63) / 64 * 64);
+    out.insert(out.end(), c.blocks.begin(), c.blocks.end());
+  }
+  return out;
+}
+
+static void save(const std::filesystem::path& path,
+    const std::vector<unsigned char>& data) {
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+// A placement of pieces, as pieces of Position and their squares.
+typedef std::vector<std::pair<int, int>> Placement;
+
+static Position place(const Placement& pieces) {
+  static const Position empty("8/8/8/8/8/8/8/8");
+  Position p = empty;
+  for (auto [piece, square] : pieces) {
+    p.place_piece(square, piece);
+  }
+  return p;
+}
+
+static GameState game_state(const Position& p, bool white_to_move) {
+  return GameState(p, white_to_move, false, false, false, false, 0, false, 0,
+      1);
+}
+
+static bool is_king(int piece) {
+  return piece == Position::W_KING || piece == Position::B_KING;
+}
+
+// Determine whether a piece may go on a square after some others: squares
+// are distinct, pawns are on ranks 2 to 7 and the kings are apart.
+static bool allowed(const Placement& so_far, int piece, int square) {
+  if ((piece == Position::W_PAWN || piece == Position::B_PAWN) &&
+      (square < 8 || square >= 56)) {
+    return false;
+  }
+  return std::none_of(so_far.begin(), so_far.end(), [&](auto ps) {
+      return ps.second == square || (is_king(piece) && is_king(ps.first) &&
+          std::abs(ps.second % 8 - square % 8) <= 1 &&
+          std::abs(ps.second / 8 - square / 8) <= 1);
+    });
+}
+
+// Call f with every allowed placement of the given pieces.
+template <typename F>
+static void each_placement(const std::vector<int>& pieces, Placement& so_far,
+    F f) {
+  if (so_far.size() == pieces.size()) {
+    f(so_far);
+    return;
+  }
+  int piece = pieces[so_far.size()];
+  for (int s = 0; s < 64; s++) {
+    if (allowed(so_far, piece, s)) {
+      so_far.emplace_back(piece, s);
+      each_placement(pieces, so_far, f);
+      so_far.pop_back();
+    }
+  }
+}
+
+// Get a random allowed placement of the given pieces.
+static Placement random_placement(const std::vector<int>& pieces,
+    std::mt19937& rng) {
+  std::uniform_int_distribution<int> square(0, 63);
+  Placement placement;
+  for (int piece : pieces) {
+    int s;
+    do {
+      s = square(rng);
+    } while (!allowed(placement, piece, s));
+    placement.emplace_back(piece, s);
+  }
+  return placement;
+}
+
+static int swap_color(int piece) {
+  return piece < Position::W_ALL ? piece + Position::B_PAWN :
+    piece - Position::B_PAWN;
+}
+
+// Turn the board and swap the colors, which gives the same position with
+// the other side to move.
+static Placement swap_colors(const Placement& pieces) {
+  Placement swapped;
+  for (auto [piece, square] : pieces) {
+    swapped.emplace_back(swap_color(piece), square ^ 56);
+  }
+  return swapped;
+}
+
+// Apply one of the symmetries of the board to a square. Without pawns
+// there are eight, and with pawns only the first two keep them on their
+// ranks.
+static int transform(int square, unsigned symmetry) {
+  if (symmetry & 4) {
+    square = ((square >> 3) | (square << 3)) & 63;
+  }
+  return square ^ (symmetry & 1 ? 7 : 0) ^ (symmetry & 2 ? 56 : 0);
+}
+
+static Placement transform(const Placement& pieces, unsigned symmetry) {
+  Placement t;
+  for (auto [piece, square] : pieces) {
+    t.emplace_back(piece, transform(square, symmetry));
+  }
+  return t;
+}
+
+// A key which is the same for positions which are the same up to symmetry.
+static uint64_t canonical(const Placement& pieces, bool white_to_move,
+    bool pawns) {
+  uint64_t best = ~0ull;
+  for (bool swap : {false, true}) {
+    for (unsigned symmetry = 0; symmetry < (pawns ? 2u : 8u); symmetry++) {
+      unsigned keys[SYZYGY_MAX_PIECES];
+      unsigned n = 0;
+      for (auto [piece, square] : pieces) {
+        keys[n++] = (swap ? swap_color(piece) : piece) << 6 |
+          transform(swap ? square ^ 56 : square, symmetry);
+      }
+      std::sort(keys, keys + n);
+      uint64_t key = white_to_move != swap;
+      for (unsigned i = 0; i < n; i++) {
+        key = key << 10 | keys[i];
+      }
+      best = std::min(best, key);
+    }
+  }
+  return best;
+}
+
+SCENARIO("Syzygy tables number positions without collisions") {
+  struct Case {
+    std::string signature;
+    std::vector<int> pieces;
+    // The order of the pieces in the file.
+    std::vector<unsigned> order;
+    // Every placement is tried if this is zero, otherwise this many random
+    // ones.
+    unsigned samples;
+  };
+  const int K = Position::W_KING, Q = Position::W_QUEEN,
+        R = Position::W_ROOK, B = Position::W_BISHOP, N = Position::W_KNIGHT,
+        P = Position::W_PAWN, k = Position::B_KING, r = Position::B_ROOK,
+        p = Position::B_PAWN;
+  std::vector<Case> cases = {
+    {"KRvK", {K, R, k}, {6, 4, 14}, 0},
+    {"KPvK", {K, P, k}, {1, 6, 14}, 0},
+    {"KRRvK", {K, R, R, k}, {6, 14, 4, 4}, 20000},
+    {"KQvKR", {K, Q, k, r}, {6, 5, 14, 12}, 20000},
+    {"KBNvK", {K, B, N, k}, {6, 3, 2, 14}, 20000},
+    {"KPvKP", {K, P, k, p}, {1, 9, 6, 14}, 20000},
+    {"KRPvKR", {K, R, P, k, r}, {1, 6, 4, 14, 12}, 20000},
+  };
+  for (const Case& c : cases) {
+    GIVEN("the table " + c.signature) {
+      std::vector<unsigned char> file = syzygy_file(c.signature, false,
+          c.order);
+      SyzygyTable table(file.data(), file.size(), c.signature, false);
+      bool pawns = c.signature.find('P') != std::string::npos;
+      std::unordered_map<uint64_t, uint64_t> seen;
+      unsigned out_of_range = 0;
+      unsigned collisions = 0;
+      unsigned mismatches = 0;
+      auto check = [&](const Placement& pieces) {
+        for (bool white : {true, false}) {
+          unsigned subtable;
+          uint64_t index;
+          table.locate(place(pieces), white, subtable, index);
+          out_of_range += index >= table.positions(subtable);
+          uint64_t key = canonical(pieces, white, pawns);
+          auto [it, added] = seen.emplace(index * table.size() + subtable,
+              key);
+          collisions += !added && it->second != key;
+          // The mirror image and the position with the colors swapped are
+          // stored in the same place.
+          unsigned s;
+          uint64_t i;
+          table.locate(place(transform(pieces, 1)), white, s, i);
+          mismatches += s != subtable || i != index;
+          table.locate(place(swap_colors(pieces)), !white, s, i);
+          mismatches += s != subtable || i != index;
+        }
+      };
+      if (c.samples == 0) {
+        Placement so_far;
+        each_placement(c.pieces, so_far, check);
+      } else {
+        std::mt19937 rng(1);
+        for (unsigned n = 0; n < c.samples; n++) {
+          check(random_placement(c.pieces, rng));
+        }
+      }
+      THEN("every position has its own index in range") {
+        CHECK(!seen.empty());
+        CHECK(out_of_range == 0);
+        CHECK(collisions == 0);
+        CHECK(mismatches == 0);
+      }
+    }
+  }
+}
+
+// The distance between the kings, which is the same in every symmetry of
+// the board.
+static int king_distance(const Position& p) {
+  int w = *SquareSet(p.get_board(Position::W_KING)).begin();
+  int b = *SquareSet(p.get_board(Position::B_KING)).begin();
+  return std::max(std::abs(w % 8 - b % 8), std::abs(w / 8 - b / 8));
+}
+
+SCENARIO("Syzygy tables are decoded") {
+  // A KRvK table built from the rules: the side with the rook wins unless
+  // the other side is stalemated or can take it. Positions where the rook
+  // can be taken are stored as losses, as the generator may, since a probe
+  // tries the captures first. The DTZ table only holds the side with the
+  // rook to move, and is twice the distance between the kings.
+  std::vector<unsigned> order = {6, 4, 14};
+  std::vector<unsigned char> empty = syzygy_file("KRvK", false, order);
+  SyzygyTable layout(empty.data(), empty.size(), "KRvK", false);
+  std::vector<SubtableValues> wdl(2);
+  std::vector<SubtableValues> dtz = {{SyzygyTable::FLAG_MAPPED |
+    SyzygyTable::FLAG_WIN_PLIES, {}}};
+  for (unsigned i = 0; i < 2; i++) {
+    wdl[i].values.assign(layout.positions(i), -1);
+  }
+  dtz[0].values.assign(layout.positions(0), -1);
+  // Wins map the stored value v to 3 + 2v plies, and nothing else is
+  // stored.
+  std::vector<unsigned char> dtz_map = {6, 3, 5, 7, 9, 11, 13, 0, 0, 0};
+  unsigned conflicts = 0;
+  Placement so_far;
+  each_placement({Position::W_KING, Position::W_ROOK, Position::B_KING},
+      so_far, [&](const Placement& pieces) {
+      Position p = place(pieces);
+      for (bool white : {true, false}) {
+        if (in_check(!white, p)) {
+          continue;
+        }
+        MoveList ml;
+        generate_moves(game_state(p, white), ml);
+        int value = white ? 4 : ml.empty() && !in_check(false, p) ? 2 : 0;
+        unsigned subtable;
+        uint64_t index;
+        layout.locate(p, white, subtable, index);
+        int& stored = wdl[subtable].values[index];
+        conflicts += stored >= 0 && stored != value;
+        stored = value;
+        if (white) {
+          int& d = dtz[0].values[index];
+          conflicts += d >= 0 && d != king_distance(p) - 2;
+          d = king_distance(p) - 2;
+        }
+      }
+    });
+  REQUIRE(conflicts == 0);
+  std::vector<unsigned char> wdl_file = syzygy_file("KRvK", false, order, wdl);
+  std::vector<unsigned char> dtz_file = syzygy_file("KRvK", true, order, dtz,
+      dtz_map);
+
+  THEN("every stored value is read back") {
+    SyzygyTable table(wdl_file.data(), wdl_file.size(), "KRvK", false);
+    REQUIRE(table.size() == 2);
+    unsigned wrong = 0;
+    for (unsigned i = 0; i < 2; i++) {
+      for (uint64_t j = 0; j < table.positions(i); j++) {
+        int v = wdl[i].values[j];
+        wrong += v >= 0 && table.value(i, j) != (unsigned) v;
+      }
+    }
+    CHECK(wrong == 0);
+  }
+
+  THEN("a damaged table is rejected") {
+    std::vector<unsigned char> truncated(wdl_file.begin(),
+        wdl_file.end() - 1);
+    CHECK_THROWS_AS(SyzygyTable(truncated.data(), truncated.size(), "KRvK",
+          false), std::runtime_error);
+    CHECK_THROWS_AS(SyzygyTable(wdl_file.data(), wdl_file.size(), "KPvK",
+          false), std::runtime_error);
+  }
+
+  THEN("the tablebase probes positions with either side stronger") {
+    std::filesystem::path dir = "test_syzygy_tables";
+    std::filesystem::create_directory(dir);
+    save(dir / "KRvK.rtbw", wdl_file);
+    save(dir / "KRvK.rtbz", dtz_file);
+    SyzygyTablebase tb(dir.string());
+    std::mt19937 rng(2);
+    unsigned wrong_wdl = 0;
+    unsigned wrong_dtz = 0;
+    for (unsigned n = 0; n < 2000; n++) {
+      Placement pieces = random_placement({Position::W_KING,
+          Position::W_ROOK, Position::B_KING}, rng);
+      for (bool swap : {false, true}) {
+        Position p = place(swap ? swap_colors(pieces) : pieces);
+        for (bool white : {true, false}) {
+          if (in_check(!white, p)) {
+            continue;
+          }
+          bool rook_to_move = white != swap;
+          GameState gs = game_state(p, white);
+          MoveList ml;
+          generate_moves(gs, ml);
+          bool capture = std::any_of(ml.begin(), ml.end(),
+              [](const Move& m) { return m.capture(); });
+          WDL expected = WDL::LOSS;
+          int distance = -1;
+          if (rook_to_move) {
+            expected = WDL::WIN;
+            distance = 2 * king_distance(p);
+          } else if (capture || (ml.empty() && !in_check(white, p))) {
+            expected = WDL::DRAW;
+            distance = 0;
+          } else if (!ml.empty()) {
+            // The lone king goes where the rook's side is furthest from
+            // zeroing.
+            int furthest = 0;
+            for (const Move& m : ml) {
+              gs.make_move(m);
+              furthest = std::max(furthest, 2 * king_distance(gs.pos()));
+              gs.undo_move();
+            }
+            distance = -(furthest + 1);
+          }
+          wrong_wdl += tb.probe_wdl(gs) != expected;
+          wrong_dtz += tb.probe_dtz(gs) != distance;
+        }
+      }
+    }
+    CHECK(wrong_wdl == 0);
+    CHECK(wrong_dtz == 0);
+
+    GameState missing("8/8/8/8/8/8/1n6/K6k w - - 0 1");
+    CHECK(!tb.probe_wdl(missing));
+    std::filesystem::remove_all(dir);
+  }
+}
+
+SCENARIO("real Syzygy tables are read") {
+  // The tables are too large to ship with the tests, so these only run if
+  // SYZYGY_PATH names a directory holding at least KQvK and KRvK.
+  const char* path = std::getenv("SYZYGY_PATH");
+  if (path == nullptr) {
+    return;
+  }
+  SyzygyTablebase tb(path);
+  REQUIRE(tb.max_pieces() >= 3);
+
+  GameState won("8/8/8/4k3/8/8/8/R3K3 w - - 0 1");
+  CHECK(tb.probe_wdl(won) == WDL::WIN);
+  REQUIRE(tb.probe_dtz(won));
+  CHECK(*tb.probe_dtz(won) > 0);
+
+  GameState lost("8/8/8/4k3/8/8/8/R3K3 b - - 0 1");
+  CHECK(tb.probe_wdl(lost) == WDL::LOSS);
+  REQUIRE(tb.probe_dtz(lost));
+  CHECK(*tb.probe_dtz(lost) < 0);
+
+  GameState capture("8/8/8/8/8/8/1r6/K6k w - - 0 1");
+  CHECK(tb.probe_wdl(capture) == WDL::DRAW);
+  CHECK(tb.probe_dtz(capture) == 0);
+
+  GameState stalemate("k7/2Q5/1K6/8/8/8/8/8 b - - 0 1");
+  CHECK(tb.probe_wdl(stalemate) == WDL::DRAW);
+
+  GameState mate_in_one("k7/8/1K6/8/8/8/8/7Q w - - 0 1");
+  CHECK(tb.probe_wdl(mate_in_one) == WDL::WIN);
+  CHECK(tb.probe_dtz(mate_in_one) == 1);
+}
@@ -0,0 +1,259 @@
+#include "catch.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+#include "search.hpp"
+#include "tablebase.hpp"
+
+// A tablebase which only knows that a rook wins against a bare king, and
+// calls everything else a draw. The distance to zeroing of a won position is
+// one more than the file of the rook.
+class RookTablebase: public Tablebase {
+  private:
+    unsigned pieces;
+    bool dtz;
+
+  public:
+    RookTablebase(unsigned pieces, bool dtz): pieces{pieces}, dtz{dtz} {}
+
+    unsigned max_pieces() const override {
+      return pieces;
+    }
+
+    std::optional<WDL> probe_wdl(GameState& gs) const override {
+      if (!tablebase_probeable(*this, gs)) {
+        return std::nullopt;
+      }
+      std::string sig = material_signature(gs.pos());
+      if (sig == "KRvK") {
+        return gs.whites_move() ? WDL::WIN : WDL::LOSS;
+      } else if (sig == "KvKR") {
+        return gs.whites_move() ? WDL::LOSS : WDL::WIN;
+      }
+      return WDL::DRAW;
+    }
+
+    std::optional<int> probe_dtz(GameState& gs) const override {
+      std::optional<WDL> wdl = probe_wdl(gs);
+      if (!dtz || !wdl) {
+        return std::nullopt;
+      }
+      if (*wdl == WDL::DRAW) {
+        return 0;
+      }
+      uint64_t rooks = gs.pos().get_board(Position::W_ROOK) |
+        gs.pos().get_board(Position::B_ROOK);
+      int distance = 1 + *SquareSet(rooks).begin() % 8;
+      return *wdl == WDL::WIN ? distance : -distance;
+    }
+};
+
+// Write a file with the given first bytes, padded to the given size.
+static void write_table(const std::filesystem::path& path,
+    const unsigned char* magic, size_t size) {
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char*>(magic), 4);
+  for (size_t i = 4; i < size; i++) {
+    out.put(0);
+  }
+}
+
+SCENARIO("material signatures use Syzygy's names") {
+  Position p("8/8/3k4/3r4/8/2R5/3P4/3K4");
+  CHECK(material_signature(p) == "KRPvKR");
+  CHECK(material_signature(p, true) == "KRvKRP");
+  Position q("8/8/3k4/8/8/2Q5/3N4/2BK4");
+  CHECK(material_signature(q) == "KQBNvK");
+  CHECK(material_signature(q, true) == "KvKQBN");
+}
+
+SCENARIO("positions are only probed when they can be in the tables") {
+  RookTablebase tb(3, false);
+  CHECK(tablebase_probeable(tb, GameState("k7/8/8/8/8/8/8/3R2K1 w - - 0 1")));
+  CHECK(!tablebase_probeable(tb,
+        GameState("k7/8/8/3n4/8/8/8/3R2K1 w - - 0 1")));
+  CHECK(!tablebase_probeable(tb, GameState("k7/8/8/8/8/8/8/R3K3 w Q - 0 1")));
+}
+
+SCENARIO("Syzygy files are found and mapped when needed") {
+  std::filesystem::path first = "test_syzygy_1";
+  std::filesystem::path second = "test_syzygy_2";
+  std::filesystem::create_directory(first);
+  std::filesystem::create_directory(second);
+  const unsigned char* wdl = SyzygyTablebase::WDL_MAGIC;
+  const unsigned char* dtz = SyzygyTablebase::DTZ_MAGIC;
+  write_table(first / "KQvK.rtbw", wdl, 16);
+  // A DTZ file with the wrong magic bytes.
+  write_table(first / "KQvK.rtbz", wdl, 16);
+  write_table(first / "KRPvKR.rtbw", wdl, 16);
+  // Files which aren't tables.
+  write_table(first / "kqvk.rtbw", wdl, 16);
+  write_table(first / "KQKvK.rtbw", wdl, 16);
+  write_table(first / "KQvK.txt", wdl, 16);
+  // The same table in a later directory is ignored.
+  write_table(second / "KQvK.rtbw", wdl, 32);
+  write_table(second / "KBvK.rtbz", dtz, 32);
+
+  SyzygyTablebase tb(first.string() + ":no_such_directory:" +
+      second.string());
+  CHECK(tb.wdl_tables() == 2);
+  CHECK(tb.dtz_tables() == 2);
+  CHECK(tb.max_pieces() == 5);
+
+  GameState kqk("k7/8/8/8/8/8/8/3Q2K1 w - - 0 1");
+  GameState kkq("K7/8/8/8/8/8/8/3q2k1 w - - 0 1");
+  GameState kbk("k7/8/8/8/8/8/8/3B2K1 w - - 0 1");
+
+  THEN("a table is found from either side") {
+    REQUIRE(tb.wdl_file(kqk));
+    CHECK(tb.wdl_file(kqk)->size() == 16);
+    CHECK(tb.wdl_file(kkq) == tb.wdl_file(kqk));
+    REQUIRE(tb.dtz_file(kbk));
+    CHECK(tb.dtz_file(kbk)->size() == 32);
+  }
+
+  THEN("missing and invalid files are not mapped") {
+    CHECK(!tb.dtz_file(kqk));
+    CHECK(!tb.wdl_file(kbk));
+    CHECK(!tb.wdl_file(GameState("k7/8/8/8/8/8/8/3R2K1 w - - 0 1")));
+  }
+
+  THEN("files which are not tables give no result") {
+    CHECK(!tb.probe_wdl(kqk));
+    CHECK(!tb.probe_dtz(kbk));
+  }
+
+  std::filesystem::remove_all(first);
+  std::filesystem::remove_all(second);
+}
+
+SCENARIO("tablebase scores are stored without the ply") {
+  GIVEN("a result found at one ply") {
+    double win = tablebase_score_to_tt(tablebase_score(WDL::WIN, 7), 7);
+    double loss = tablebase_score_to_tt(tablebase_score(WDL::LOSS, 7), 7);
+
+    THEN("it is counted from the position itself") {
+      CHECK(win == Approx(TB_WIN_SCORE));
+      CHECK(loss == Approx(-TB_WIN_SCORE));
+    }
+
+    THEN("it is read back as the same result at another ply") {
+      CHECK(tablebase_score_from_tt(win, 3) ==
+          Approx(tablebase_score(WDL::WIN, 3)));
+      CHECK(tablebase_score_from_tt(loss, 20) ==
+          Approx(tablebase_score(WDL::LOSS, 20)));
+    }
+  }
+
+  GIVEN("a result a few plies below the position which is stored") {
+    double score = tablebase_score(WDL::WIN, 12);
+    double stored = tablebase_score_to_tt(score, 9);
+    THEN("the distance to it is kept") {
+      CHECK(tablebase_score_from_tt(stored, 30) ==
+          Approx(tablebase_score(WDL::WIN, 33)));
+    }
+  }
+
+  THEN("other scores are unchanged") {
+    for (double score : {0.0, 3.5, -12.25, 1000.0, -1000.0}) {
+      CHECK(tablebase_score_to_tt(score, 10) == score);
+      CHECK(tablebase_score_from_tt(score, 10) == score);
+    }
+  }
+}
+
+SCENARIO("the root moves are filtered with the tablebase") {
+  GIVEN("a rook which can capture the last enemy piece") {
+    GameState gs("k7/8/8/3n4/8/8/8/3R2K1 w - - 0 1");
+    MoveList ml;
+    generate_moves(gs, ml);
+    REQUIRE(tablebase_root_filter(RookTablebase(4, false), gs, ml));
+    REQUIRE(ml.size() == 1);
+    CHECK(ml[0] == gs.convert_move("d1d5"));
+  }
+
+  GIVEN("a won position") {
+    GameState gs("k7/8/8/8/8/8/8/3R2K1 w - - 0 1");
+    MoveList all;
+    generate_moves(gs, all);
+
+    THEN("without DTZ tables every winning move is kept") {
+      MoveList ml = all;
+      REQUIRE(tablebase_root_filter(RookTablebase(3, false), gs, ml));
+      CHECK(ml.size() == all.size());
+    }
+
+    THEN("with DTZ tables only the moves which make most progress are kept") {
+      MoveList ml = all;
+      REQUIRE(tablebase_root_filter(RookTablebase(3, true), gs, ml));
+      REQUIRE(ml.size() == 1);
+      CHECK(ml[0] == gs.convert_move("d1a1"));
+    }
+
+    THEN("nothing is filtered if the position isn't in the tables") {
+      MoveList ml = all;
+      CHECK(!tablebase_root_filter(RookTablebase(2, true), gs, ml));
+      CHECK(ml.size() == all.size());
+    }
+  }
+}
+
+SCENARIO("the search uses the tablebase") {
+  std::shared_ptr<const Tablebase> tb =
+    std::make_shared<RookTablebase>(3, true);
+  SearchLimits limits;
+  limits.depth_limit = 3;
+  SearchInfo info;
+  std::atomic<bool> stop_signal{false};
+
+  GIVEN("a capture which reaches a won ending") {
+    GameState gs("k7/8/8/3n4/8/8/8/3R2K1 w - - 0 1");
+    Move capture = gs.convert_move("d1d5");
+
+    THEN("a single thread scores it as won") {
+      PVSSearcher searcher(std::make_unique<BasicEvaluator>());
+      searcher.set_tablebase(tb);
+      auto res = searcher.search(gs, limits, info, stop_signal);
+      CHECK(res.second == capture);
+      CHECK(res.first > 800.0);
+      CHECK(info.tbhits > 0);
+    }
+
+    THEN("plain alpha-beta scores it as won") {
+      BasicAlphaBetaSearcher searcher(std::make_unique<BasicEvaluator>());
+      searcher.set_tablebase(tb);
+      auto res = searcher.search(gs, limits, info, stop_signal);
+      CHECK(res.second == capture);
+      CHECK(res.first > 800.0);
+    }
+
+    THEN("every thread of a parallel search is given the tablebase") {
+      LazySMPSearcher searcher(std::make_unique<BasicEvaluator>(),
+          std::make_shared<TranspositionTable>(DEFAULT_HASH_SIZE), 1, true);
+      searcher.set_tablebase(tb);
+      searcher.set_threads(2);
+      auto res = searcher.search(gs, limits, info, stop_signal);
+      CHECK(res.second == capture);
+      CHECK(res.first > 800.0);
+    }
+
+    THEN("without the tablebase it is only a piece up") {
+      PVSSearcher searcher(std::make_unique<BasicEvaluator>());
+      auto res = searcher.search(gs, limits, info, stop_signal);
+      CHECK(res.second == capture);
+      CHECK(res.first < 800.0);
+      CHECK(info.tbhits == 0);
+    }
+  }
+
+  GIVEN("a root position in the tables") {
+    GameState gs("k7/8/8/8/8/8/8/3R2K1 w - - 0 1");
+    PVSSearcher searcher(std::make_unique<BasicEvaluator>());
+    searcher.set_tablebase(tb);
+    auto res = searcher.search(gs, limits, info, stop_signal);
+    CHECK(res.second == gs.convert_move("d1a1"));
+    CHECK(info.tbhits > 0);
+  }
+}
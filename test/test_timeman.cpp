@@ -0,0 +1,147 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <thread>
+
+#include "timeman.hpp"
+
+SCENARIO("the time manager divides the clock between moves") {
+  GIVEN("No time limits") {
+    SearchLimits limits;
+    limits.depth_limit = 5;
+    TimeManager tm(limits, true);
+    THEN("The search is not timed") {
+      CHECK(!tm.soft_limit());
+      CHECK(!tm.hard_limit());
+      CHECK(!tm.hard_limit_reached());
+      CHECK(tm.start_iteration(1000000, 1000000));
+    }
+  }
+
+  GIVEN("A fixed move time") {
+    SearchLimits limits;
+    limits.timeout = 500;
+    TimeManager tm(limits, true);
+    THEN("Both limits are the move time") {
+      CHECK(tm.soft_limit() == 500u);
+      CHECK(tm.hard_limit() == 500u);
+    }
+  }
+
+  GIVEN("A clock with increments") {
+    SearchLimits limits;
+    limits.wtime = 60000;
+    limits.btime = 30030;
+    limits.winc = 1000;
+    limits.binc = 0;
+    WHEN("We are white") {
+      TimeManager tm(limits, true);
+      THEN("The time is shared among the remaining moves plus the increment") {
+        unsigned expected = (60000 - TimeManager::MOVE_OVERHEAD) /
+          TimeManager::DEFAULT_MOVES_TO_GO + 750;
+        CHECK(tm.soft_limit() == expected);
+        CHECK(tm.hard_limit() == expected * TimeManager::HARD_RATIO);
+      }
+    }
+    WHEN("We are black") {
+      TimeManager tm(limits, false);
+      THEN("Black's clock is used") {
+        CHECK(tm.soft_limit() == 30000 / TimeManager::DEFAULT_MOVES_TO_GO);
+      }
+    }
+    WHEN("The move time is shorter than the clock allows") {
+      limits.timeout = 100;
+      TimeManager tm(limits, true);
+      THEN("The move time wins") {
+        CHECK(tm.soft_limit() == 100u);
+        CHECK(tm.hard_limit() == 100u);
+      }
+    }
+  }
+
+  GIVEN("The last move before the time control") {
+    SearchLimits limits;
+    limits.wtime = 10030;
+    limits.movestogo = 1;
+    TimeManager tm(limits, true);
+    THEN("Some time is still kept in reserve") {
+      CHECK(tm.soft_limit() == 8000u);
+      CHECK(tm.hard_limit() == 8000u);
+    }
+  }
+
+  GIVEN("A clock which has run out") {
+    SearchLimits limits;
+    limits.wtime = -50;
+    TimeManager tm(limits, true);
+    THEN("The limits are tiny but positive") {
+      CHECK(tm.soft_limit() == 1u);
+      CHECK(tm.hard_limit() == 1u);
+    }
+  }
+}
+
+SCENARIO("the time manager decides when to stop iterating") {
+  GIVEN("A soft limit of one second") {
+    SearchLimits limits;
+    limits.wtime = 30000 + TimeManager::MOVE_OVERHEAD;
+    TimeManager tm(limits, true);
+    REQUIRE(tm.soft_limit() == 1000u);
+    THEN("Iterations start until the soft limit passes") {
+      CHECK(tm.start_iteration(500, 100));
+      CHECK(!tm.start_iteration(1000, 100));
+    }
+    THEN("Iterations which would overrun the hard limit are not started") {
+      CHECK(tm.start_iteration(900, 1000));
+      CHECK(!tm.start_iteration(900, 2000));
+    }
+    WHEN("The best move keeps changing") {
+      tm.iteration_finished(true);
+      tm.iteration_finished(true);
+      THEN("The soft limit is extended") {
+        CHECK(*tm.adjusted_soft_limit() > 1000u);
+        CHECK(*tm.adjusted_soft_limit() <= *tm.hard_limit());
+        CHECK(tm.start_iteration(1100, 100));
+      }
+      AND_WHEN("It settles down again") {
+        for (int i = 0; i < 10; i++) {
+          tm.iteration_finished(false);
+        }
+        THEN("The extension wears off") {
+          CHECK(*tm.adjusted_soft_limit() < 1010u);
+        }
+      }
+    }
+  }
+
+  GIVEN("A short move time") {
+    SearchLimits limits;
+    limits.timeout = 5;
+    TimeManager tm(limits, true);
+    THEN("The hard limit is reached once the time passes") {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      CHECK(tm.hard_limit_reached());
+    }
+  }
+}
+
+SCENARIO("the time manager ignores its limits while pondering") {
+  SearchLimits limits;
+  limits.timeout = 5;
+  std::atomic<bool> pondering{true};
+  TimeManager tm(limits, true, &pondering);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  THEN("The search carries on past the limits") {
+    CHECK(tm.is_pondering());
+    CHECK(!tm.hard_limit_reached());
+    CHECK(tm.start_iteration(1000, 1000));
+  }
+  WHEN("The opponent plays the expected move") {
+    pondering = false;
+    THEN("The time spent pondering counts towards the limits") {
+      CHECK(!tm.is_pondering());
+      CHECK(tm.hard_limit_reached());
+      CHECK(!tm.start_iteration(tm.elapsed(), 1));
+    }
+  }
+}
@@ -0,0 +1,128 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+#include "bench.hpp"
+#include "movegen.hpp"
+#include "selfplay.hpp"
+#include "training.hpp"
+
+// Drop the move number from a FEN string, since records don't store it.
+static std::string without_move_number(const std::string& fen) {
+  return fen.substr(0, fen.find_last_of(' '));
+}
+
+SCENARIO("training records are packed without losing anything") {
+  for (const std::string& fen : bench_positions()) {
+    GameState gs(fen);
+    MoveList ml;
+    generate_moves(gs, ml);
+    TrainingRecord record(gs, -1234, -1, ml[ml.size() - 1]);
+    unsigned char packed[TRAINING_RECORD_SIZE];
+    pack_record(record, packed);
+    TrainingRecord r = unpack_record(packed);
+    GameState unpacked = r.game_state();
+    CHECK(without_move_number(unpacked.fen_string()) ==
+        without_move_number(gs.fen_string()));
+    CHECK(unpacked.hash() == gs.hash());
+    CHECK(r.score == -1234);
+    CHECK(r.result == -1);
+    CHECK(r.move == ml[ml.size() - 1]);
+  }
+
+  GIVEN("a position where en passant is possible") {
+    GameState gs("4k3/8/8/3pP3/8/8/8/4K3 w - d6 0 1");
+    TrainingRecord record(gs, 0, 0, gs.convert_move("e5d6"));
+    unsigned char packed[TRAINING_RECORD_SIZE];
+    pack_record(record, packed);
+    CHECK(packed[25] == 43);
+    TrainingRecord r = unpack_record(packed);
+    CHECK(r.en_passant == 43);
+    CHECK(r.move.capture());
+    CHECK(r.game_state().fen_string() == gs.fen_string());
+  }
+}
+
+SCENARIO("training records are written and read back") {
+  const char* path = "test_training.bin";
+  std::vector<GameState> states = {GameState(),
+    GameState("8/8/3k4/3r4/8/2R5/3P4/3K4 b - - 12 40")};
+  {
+    TrainingWriter writer(path);
+    for (unsigned i = 0; i < 3 * TRAINING_WRITER_BUFFER / 2; i++) {
+      writer.write(TrainingRecord(states[i % 2], i, 1, Move()));
+    }
+    CHECK(writer.records() == 3 * TRAINING_WRITER_BUFFER / 2);
+  }
+
+  THEN("the reader sees every record in order") {
+    TrainingReader reader(path);
+    REQUIRE(reader.size() == 3 * TRAINING_WRITER_BUFFER / 2);
+    TrainingRecord r;
+    unsigned i = 0;
+    while (reader.next(r)) {
+      REQUIRE(r.score == (int) i);
+      REQUIRE(r.game_state().hash() == states[i % 2].hash());
+      i++;
+    }
+    CHECK(i == reader.size());
+    CHECK(reader[1].half_moves == 12);
+  }
+
+  THEN("records can be appended") {
+    {
+      TrainingWriter writer(path, true);
+      writer.write(TrainingRecord(states[1], 7, 0, Move()));
+    }
+    TrainingReader reader(path);
+    REQUIRE(reader.size() == 3 * TRAINING_WRITER_BUFFER / 2 + 1);
+    CHECK(reader[reader.size() - 1].score == 7);
+  }
+
+  THEN("a file which isn't records is rejected") {
+    {
+      std::ofstream out(path, std::ios::binary | std::ios::app);
+      out.put(0);
+    }
+    CHECK_THROWS_AS(TrainingReader(path), std::runtime_error);
+  }
+
+  std::remove(path);
+}
+
+SCENARIO("games are recognized as over") {
+  CHECK(game_result(GameState("k7/1Q6/1K6/8/8/8/8/8 b - - 0 1")) == 1);
+  CHECK(game_result(GameState("k7/8/1QK5/8/8/8/8/8 b - - 0 1")) == 0);
+  CHECK(game_result(GameState("k7/8/1NK5/8/8/8/8/8 b - - 0 1")) == 0);
+  CHECK(game_result(GameState("k7/8/1RK5/8/8/8/8/8 b - - 100 80")) == 0);
+  CHECK(!game_result(GameState("k7/8/1RK5/8/8/8/8/8 b - - 10 80")));
+  CHECK(!game_result(GameState()));
+}
+
+SCENARIO("self-play writes every searched position") {
+  const char* path = "test_selfplay.bin";
+  SelfPlayOptions options;
+  options.limits.depth_limit = 1;
+  options.games = 2;
+  options.threads = 2;
+  options.hash = 1;
+  options.max_plies = 40;
+  uint64_t written;
+  {
+    TrainingWriter writer(path);
+    written = run_selfplay(writer, BasicEvaluator(), options);
+  }
+  TrainingReader reader(path);
+  REQUIRE(reader.size() == written);
+  CHECK(written > 0);
+  CHECK(written <= 2 * (options.max_plies - options.random_plies));
+  TrainingRecord r;
+  while (reader.next(r)) {
+    GameState gs = r.game_state();
+    REQUIRE(is_legal_move(gs, r.move));
+    REQUIRE(-1 <= r.result);
+    REQUIRE(r.result <= 1);
+  }
+  std::remove(path);
+}
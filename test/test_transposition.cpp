@@ -0,0 +1,140 @@
+#include "catch.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "transposition.hpp"
+
+SCENARIO("search results can be stored in a transposition table") {
+  GIVEN("an empty table") {
+    TranspositionTable tt(1);
+    GameState gs;
+    Move e4 = gs.convert_move("e2e4");
+    TTEntry entry;
+
+    CHECK(!tt.probe(gs.hash(), entry));
+
+    WHEN("we store a result") {
+      tt.store(gs.hash(), e4, 0.5, 3, TTEntry::EXACT);
+
+      THEN("we can read it back") {
+        REQUIRE(tt.probe(gs.hash(), entry));
+        CHECK(entry.move == e4);
+        CHECK(entry.score == 0.5);
+        CHECK(entry.depth == 3);
+        CHECK(entry.bound == TTEntry::EXACT);
+      }
+
+      THEN("other positions are not found") {
+        gs.make_move(e4);
+        CHECK(!tt.probe(gs.hash(), entry));
+      }
+    }
+
+    WHEN("we store a shallower bound for the same position") {
+      tt.store(gs.hash(), e4, 0.5, 3, TTEntry::EXACT);
+      tt.store(gs.hash(), Move(), 1.0, 1, TTEntry::LOWER);
+
+      THEN("the deeper result is kept") {
+        REQUIRE(tt.probe(gs.hash(), entry));
+        CHECK(entry.depth == 3);
+        CHECK(entry.bound == TTEntry::EXACT);
+      }
+    }
+
+    WHEN("we store a deeper result without a move") {
+      tt.store(gs.hash(), e4, 0.5, 3, TTEntry::EXACT);
+      tt.store(gs.hash(), Move(), -1.0, 5, TTEntry::UPPER);
+
+      THEN("the new result replaces the old one but keeps the move") {
+        REQUIRE(tt.probe(gs.hash(), entry));
+        CHECK(entry.depth == 5);
+        CHECK(entry.bound == TTEntry::UPPER);
+        CHECK(entry.move == e4);
+      }
+    }
+
+    WHEN("the table is cleared") {
+      tt.store(gs.hash(), e4, 0.5, 3, TTEntry::EXACT);
+      tt.clear();
+
+      THEN("the result is gone") {
+        CHECK(!tt.probe(gs.hash(), entry));
+      }
+    }
+  }
+
+  GIVEN("a full bucket") {
+    TranspositionTable tt(1);
+    // These hashes all map to the same bucket but have different keys.
+    const uint64_t base = 0x1234;
+    for (int i = 0; i < TTBucket::SIZE; i++) {
+      tt.store(base + ((uint64_t) (i + 1) << 32), Move(), 0.0, 10 + i,
+          TTEntry::EXACT);
+    }
+
+    WHEN("we store a new result in the same search") {
+      uint64_t hash = base + ((uint64_t) 100 << 32);
+      tt.store(hash, Move(), 0.0, 1, TTEntry::EXACT);
+
+      THEN("the shallowest entry is replaced") {
+        TTEntry entry;
+        CHECK(tt.probe(hash, entry));
+        CHECK(!tt.probe(base + (1ull << 32), entry));
+        CHECK(tt.probe(base + (2ull << 32), entry));
+      }
+    }
+
+    WHEN("we store a new result in a later search") {
+      tt.new_search();
+      tt.store(base + (1ull << 32), Move(), 0.0, 10, TTEntry::EXACT);
+      tt.new_search();
+      uint64_t hash = base + ((uint64_t) 100 << 32);
+      tt.store(hash, Move(), 0.0, 1, TTEntry::EXACT);
+
+      THEN("an old entry is replaced before a recent one") {
+        TTEntry entry;
+        CHECK(tt.probe(hash, entry));
+        CHECK(tt.probe(base + (1ull << 32), entry));
+        CHECK(!tt.probe(base + (2ull << 32), entry));
+      }
+    }
+  }
+}
+
+TEST_CASE("transposition tables fit in the requested size") {
+  TranspositionTable tt(3);
+  CHECK(tt.capacity() * sizeof(TTSlot) <= 3u << 20);
+  CHECK(tt.capacity() * sizeof(TTSlot) > 1u << 20);
+  CHECK(sizeof(TTBucket) == 64);
+}
+
+TEST_CASE("threads sharing a table never see each other's torn entries") {
+  TranspositionTable tt(1);
+  // Each thread writes positions which all map to the same bucket, with a
+  // score and depth which identify the position, so a probe which mixed two
+  // writes would find the wrong ones.
+  const uint64_t base = 0x4321;
+  std::atomic<bool> mismatch{false};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t]() {
+        TTEntry entry;
+        for (int i = 0; i < 20000; i++) {
+          int n = 1 + (i * 7 + t) % 16;
+          uint64_t hash = base + ((uint64_t) n << 32);
+          tt.store(hash, Move(), n, n, TTEntry::EXACT);
+          int m = 1 + (i * 5 + 3 * t) % 16;
+          if (tt.probe(base + ((uint64_t) m << 32), entry) &&
+              (entry.score != m || entry.depth != m)) {
+            mismatch = true;
+          }
+        }
+      });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  CHECK(!mismatch);
+}